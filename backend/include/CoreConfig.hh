@@ -46,6 +46,7 @@ public:
   static const std::string CFG_KEY_MONITOR_IDLE;
   static const std::string CFG_KEY_MONITOR_SENSITIVITY;
   static const std::string CFG_KEY_GENERAL_DATADIR;
+  static const std::string CFG_KEY_GENERAL_SYNC_STATE;
   static const std::string CFG_KEY_OPERATION_MODE;
   static const std::string CFG_KEY_USAGE_MODE;
 
@@ -59,6 +60,9 @@ public:
   static const std::string CFG_KEY_DISTRIBUTION_TCP_PASSWORD;
   static const std::string CFG_KEY_DISTRIBUTION_TCP_ATTEMPTS;
   static const std::string CFG_KEY_DISTRIBUTION_TCP_INTERVAL;
+  static const std::string CFG_KEY_DISTRIBUTION_TCP_REPLICATION_WINDOW;
+  static const std::string CFG_KEY_DISTRIBUTION_TCP_WRITE_HIGH_WATER;
+  static const std::string CFG_KEY_DISTRIBUTION_TCP_WRITE_LIMIT;
 
   static bool match(const std::string &str, const std::string &key, workrave::BreakId &id);
 };
@@ -81,6 +81,12 @@ namespace workrave {
     virtual bool remove_listener(IConfiguratorListener *listener) = 0;
     virtual bool remove_listener(const std::string &key_prefix, IConfiguratorListener *listener) = 0;
     virtual bool find_listener(IConfiguratorListener *listener, std::string &key) const = 0;
+
+    //! Defers change notifications until the matching commit_transaction().
+    virtual void begin_transaction() = 0;
+
+    //! Notifies each listener once of all keys changed since begin_transaction().
+    virtual void commit_transaction() = 0;
   };
 }
 
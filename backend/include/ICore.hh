@@ -85,9 +85,23 @@ namespace workrave {
     //! Initialize the Core. Must be called first.
     virtual void init(int argc, char **argv, IApp *app, const char *display) = 0;
 
-    //! Periodic heartbeat. The GUI *MUST* call this method every second.
+    //! Periodic heartbeat.
+    /*!
+     *  The GUI *MUST* call this method again after at most
+     *  get_heartbeat_delay() milliseconds, and whenever the core
+     *  requests a wakeup (see ICoreEventListener::core_event_wakeup).
+     */
     virtual void heartbeat() = 0;
 
+    //! Returns the number of milliseconds until the next heartbeat is needed.
+    virtual int get_heartbeat_delay() const = 0;
+
+    //! Are all timers stopped and fully reset?
+    virtual bool are_timers_settled() = 0;
+
+    //! Requests an early heartbeat from the GUI.
+    virtual void wakeup() = 0;
+
     //! Force a break of the specified type.
     virtual void force_break(BreakId id, BreakHint break_hint) = 0;
 
@@ -54,6 +54,9 @@ namespace workrave
 
     // Notification that the usage mode has changed..
     virtual void core_event_usage_mode_changed(const UsageMode m) = 0;
+
+    // Request to call ICore::heartbeat() as soon as possible.
+    virtual void core_event_wakeup() = 0;
   };
 }
 
@@ -84,6 +84,14 @@ namespace workrave {
     virtual DailyStats *get_current_day() const = 0;
     virtual DailyStats *get_day(int day) const = 0;
     virtual void get_day_index_by_date(int y, int m, int d, int &idx, int &next, int &prev) const = 0;
+
+    //! Sums the statistics of all days between two dates (inclusive).
+    /*!
+     *  Returns the number of days in the range. \a today is set if the
+     *  current day is one of them.
+     */
+    virtual int get_stats_by_date_range(int y1, int m1, int d1, int y2, int m2, int d2,
+                                        DailyStats &total, bool &today) const = 0;
     virtual int get_history_size() const = 0;
     virtual void dump() = 0;
   };
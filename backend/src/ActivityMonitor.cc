@@ -45,6 +45,7 @@
 
 #include "IInputMonitor.hh"
 #include "InputMonitorFactory.hh"
+#include "TimeSource.hh"
 
 using namespace std;
 
@@ -55,7 +56,8 @@ ActivityMonitor::ActivityMonitor() :
   prev_y(-10),
   button_is_pressed(false),
   sensitivity(3),
-  listener(NULL)
+  listener(NULL),
+  state_listener(NULL)
 {
   TRACE_ENTER("ActivityMonitor::ActivityMonitor");
 
@@ -146,12 +148,19 @@ ActivityState
 ActivityMonitor::get_current_state()
 {
   TRACE_ENTER_MSG("ActivityMonitor::get_current_state", activity_state);
+
+  // Process input that was not delivered yet.
+  if (input_monitor != NULL)
+    {
+      input_monitor->flush();
+    }
+
   lock.lock();
 
   // First update the state...
   if (activity_state == ACTIVITY_ACTIVE)
     {
-      gint64 now = g_get_real_time();
+      gint64 now = TimeSource::get_clock()->get_real_time();
       gint64 tv = now - last_action_time;
 
       TRACE_MSG("Active: "
@@ -170,6 +179,28 @@ ActivityMonitor::get_current_state()
 }
 
 
+//! Returns the time at which the current state changes without user input.
+/*!
+ *  The monitor only leaves the active state when no activity is reported
+ *  for the idle threshold. This returns the (wall clock) second at which
+ *  that happens, or 0 if the monitor is not active.
+ */
+time_t
+ActivityMonitor::get_next_deadline()
+{
+  time_t ret = 0;
+
+  lock.lock();
+  if (activity_state == ACTIVITY_ACTIVE)
+    {
+      ret = (time_t)((last_action_time + idle_threshold) / G_USEC_PER_SEC) + 1;
+    }
+  lock.unlock();
+
+  return ret;
+}
+
+
 
 //! Sets the operation parameters.
 void
@@ -226,13 +257,74 @@ ActivityMonitor::set_listener(ActivityMonitorListener *l)
 }
 
 
-//! Activity is reported by the input monitor.
+//! Sets the listener that is notified when the user becomes active.
+void
+ActivityMonitor::set_state_listener(ActivityMonitorListener *l)
+{
+  lock.lock();
+  state_listener = l;
+  lock.unlock();
+}
+
+
+//! Input activity is reported by the input monitor.
+void
+ActivityMonitor::input_notify(const InputEvent *events, int count, gint64 time)
+{
+  bool active = false;
+
+  lock.lock();
+  for (int i = 0; i < count; i++)
+    {
+      const InputEvent &event = events[i];
+
+      switch (event.type)
+        {
+        case InputEvent::INPUT_EVENT_MOUSE:
+          {
+            const int delta_x = event.x - prev_x;
+            const int delta_y = event.y - prev_y;
+            prev_x = event.x;
+            prev_y = event.y;
+
+            if (abs(delta_x) >= sensitivity || abs(delta_y) >= sensitivity
+                || event.wheel != 0 || button_is_pressed)
+              {
+                active = true;
+              }
+          }
+          break;
+
+        case InputEvent::INPUT_EVENT_BUTTON:
+          button_is_pressed = event.flag;
+          if (button_is_pressed)
+            {
+              active = true;
+            }
+          break;
+
+        default:
+          active = true;
+          break;
+        }
+    }
+
+  lock.unlock();
+
+  if (active)
+    {
+      action_notify(time);
+    }
+}
+
+
+//! Updates the state after activity was detected at the specified time.
 void
-ActivityMonitor::action_notify()
+ActivityMonitor::action_notify(gint64 now)
 {
   lock.lock();
 
-  gint64 now = g_get_real_time();
+  ActivityState prev_state = activity_state;
 
   switch (activity_state)
     {
@@ -275,56 +367,18 @@ ActivityMonitor::action_notify()
     }
 
   last_action_time = now;
-  lock.unlock();
-  call_listener();
-}
-
-
-//! Mouse activity is reported by the input monitor.
-void
-ActivityMonitor::mouse_notify(int x, int y, int wheel_delta)
-{
-  lock.lock();
-  const int delta_x = x - prev_x;
-  const int delta_y = y - prev_y;
-  prev_x = x;
-  prev_y = y;
-
-  if (abs(delta_x) >= sensitivity || abs(delta_y) >= sensitivity
-      || wheel_delta != 0 || button_is_pressed)
+  ActivityMonitorListener *sl = NULL;
+  if (activity_state == ACTIVITY_ACTIVE && prev_state != ACTIVITY_ACTIVE)
     {
-      action_notify();
+      sl = state_listener;
     }
   lock.unlock();
-}
-
 
-//! Mouse button activity is reported by the input monitor.
-void
-ActivityMonitor::button_notify(bool is_press)
-{
-  lock.lock();
-
-  button_is_pressed = is_press;
-
-  if (is_press)
+  if (sl != NULL)
     {
-      action_notify();
+      sl->action_notify();
     }
-
-  lock.unlock();
-}
-
-
-//! Keyboard activity is reported by the input monitor.
-void
-ActivityMonitor::keyboard_notify(bool repeat)
-{
-  (void)repeat;
-
-  lock.lock();
-  action_notify();
-  lock.unlock();
+  call_listener();
 }
 
 
@@ -53,18 +53,18 @@ public:
   void shift_time(int delta);
 
   ActivityState get_current_state();
+  time_t get_next_deadline();
 
   void set_parameters(int noise, int activity, int idle, int sensitivity);
   void get_parameters(int &noise, int &activity, int &idle, int &sensitivity);
 
   void set_listener(ActivityMonitorListener *l);
+  void set_state_listener(ActivityMonitorListener *l);
 
-  void action_notify();
-  void mouse_notify(int x, int y, int wheel = 0);
-  void button_notify(bool is_press);
-  void keyboard_notify(bool repeat);
+  void input_notify(const InputEvent *events, int count, gint64 time);
 
 private:
+  void action_notify(gint64 now);
   void call_listener();
 
 private:
@@ -106,6 +106,9 @@ private:
 
   //! Activity listener.
   ActivityMonitorListener *listener;
+
+  //! Listener that is notified when the user becomes active.
+  ActivityMonitorListener *state_listener;
 };
 
 #endif // ACTIVITYMONITOR_HH
@@ -166,6 +166,9 @@ Break::init_defaults()
   config->set_delay(CoreConfig::CFG_KEY_TIMER_LIMIT % break_id, 2);
   config->set_delay(CoreConfig::CFG_KEY_TIMER_AUTO_RESET % break_id, 2);
 
+  // Reload the settings once, after all defaults are set.
+  config->begin_transaction();
+
   // Convert old settings.
 
   config->rename_key(string("gui/breaks/%b/max_preludes") % break_id,
@@ -209,6 +212,8 @@ Break::init_defaults()
   config->set_value(CoreConfig::CFG_KEY_BREAK_ENABLED % break_id,
                     true,
                     CONFIG_FLAG_DEFAULT);
+
+  config->commit_transaction();
 }
 
 //! Returns the id of the break
@@ -499,3 +504,37 @@ Break::config_changed_notify(const string &key)
     }
   TRACE_EXIT();
 }
+
+
+//! Notification that several configuration items have changed.
+void
+Break::config_keys_changed_notify(const std::set<std::string> &keys)
+{
+  TRACE_ENTER("Break::config_keys_changed_notify");
+  bool break_changed = false;
+  bool timer_changed = false;
+  string name;
+
+  for (std::set<std::string>::const_iterator i = keys.begin(); i != keys.end(); i++)
+    {
+      if (starts_with(*i, CoreConfig::CFG_KEY_BREAKS, name))
+        {
+          break_changed = true;
+        }
+      else if (starts_with(*i, CoreConfig::CFG_KEY_TIMERS, name))
+        {
+          timer_changed = true;
+        }
+    }
+
+  // Reload each part of the configuration only once.
+  if (break_changed)
+    {
+      load_break_control_config();
+    }
+  if (timer_changed)
+    {
+      load_timer_config();
+    }
+  TRACE_EXIT();
+}
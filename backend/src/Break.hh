@@ -104,6 +104,7 @@ public:
 
 private:
   void config_changed_notify(const std::string &key);
+  void config_keys_changed_notify(const std::set<std::string> &keys);
 
 private:
   void init_defaults();
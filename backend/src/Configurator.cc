@@ -35,15 +35,22 @@
 #include "ICore.hh"
 #include "CoreFactory.hh"
 #include "IConfiguratorListener.hh"
+#include "Metrics.hh"
 
 using namespace std;
 using namespace workrave;
 
+static Metrics::Counter cache_hits_metric("workrave_config_cache_hits_total",
+                                          "Number of configuration lookups answered from the cache");
+static Metrics::Counter cache_misses_metric("workrave_config_cache_misses_total",
+                                            "Number of configuration lookups that went to the backend");
+
 
 // Constructs a new configurator.
 Configurator::Configurator(IConfigBackend *backend)
 {
   this->auto_save_time = 0;
+  this->transaction_depth = 0;
   this->backend = backend;
   if (dynamic_cast<IConfigBackendMonitoring *>(backend) != NULL)
     {
@@ -62,6 +69,7 @@ Configurator::~Configurator()
 bool
 Configurator::load(std::string filename)
 {
+  value_cache.clear();
   return backend->load(filename);
 }
 
@@ -92,6 +100,12 @@ Configurator::heartbeat()
   ICore *core = CoreFactory::get_core();
   time_t now = core->get_time();
 
+  bool transaction = !delayed_config.empty();
+  if (transaction)
+    {
+      begin_transaction();
+    }
+
   DelayedListIter it = delayed_config.begin();
   while (it != delayed_config.end())
     {
@@ -105,6 +119,7 @@ Configurator::heartbeat()
           bool old_value_valid = backend->get_value(delayed.key, delayed.value.type, old_value);
 
           bool b = backend->set_value(delayed.key, delayed.value);
+          invalidate_cached_value(delayed.key);
 
           if (b && dynamic_cast<IConfigBackendMonitoring *>(backend) == NULL)
             {
@@ -126,6 +141,11 @@ Configurator::heartbeat()
       it = next;
     }
 
+  if (transaction)
+    {
+      commit_transaction();
+    }
+
   if (auto_save_time != 0 && now >= auto_save_time)
     {
       save();
@@ -134,6 +154,25 @@ Configurator::heartbeat()
 }
 
 
+//! Returns the time at which heartbeat() has work to do, or 0 if none.
+time_t
+Configurator::get_next_deadline() const
+{
+  time_t ret = auto_save_time;
+
+  for (DelayedListCIter it = delayed_config.begin(); it != delayed_config.end(); it++)
+    {
+      const DelayedConfig &delayed = it->second;
+      if (ret == 0 || delayed.until < ret)
+        {
+          ret = delayed.until;
+        }
+    }
+
+  return ret;
+}
+
+
 void
 Configurator::set_delay(const std::string &key, int delay)
 {
@@ -156,6 +195,7 @@ Configurator::set_delay(const std::string &key, int delay)
 bool
 Configurator::remove_key(const std::string &key) const
 {
+  invalidate_cached_value(key);
   return backend->remove_key(key);
 }
 
@@ -222,6 +262,7 @@ Configurator::set_value(const std::string &key, Variant &value, ConfigFlags flag
               d.key = (string)key;
               d.value = value;
               d.until = core->get_time() + setting.delay;
+              core->wakeup();
 
               skip = true;
             }
@@ -234,6 +275,7 @@ Configurator::set_value(const std::string &key, Variant &value, ConfigFlags flag
       bool old_value_valid = backend->get_value(newkey, value.type, old_value);
 
       ret = backend->set_value(newkey, value);
+      invalidate_cached_value(newkey);
 
       if (ret && dynamic_cast<IConfigBackendMonitoring *>(backend) == NULL)
         {
@@ -263,6 +305,16 @@ Configurator::get_value(const std::string &key, VariantType type, Variant &out)
 
   TRACE_ENTER_MSG("Configurator::get_value", key);
 
+  bool normalized = !key.empty() && key[0] != '/' && key[key.length() - 1] != '/';
+
+  if (normalized && delayed_config.find(key) == delayed_config.end())
+    {
+      // Fast path: no string copies.
+      ret = get_cached_value(key, type, out);
+      TRACE_RETURN(ret);
+      return ret;
+    }
+
   string newkey = key;
   strip_trailing_slash(newkey);
   strip_leading_slash(newkey);
@@ -291,6 +343,88 @@ Configurator::get_value(const std::string &key, VariantType type, Variant &out)
 }
 
 
+//! Returns the value of a key from the cache, or from the backend on a miss.
+bool
+Configurator::get_cached_value(const std::string &key, VariantType type, Variant &out) const
+{
+  GQuark quark = g_quark_try_string(key.c_str());
+
+  if (quark != 0)
+    {
+      ValueCacheIter it = value_cache.find(quark);
+      if (it != value_cache.end() && it->second.type == type)
+        {
+          const CachedValue &cached = it->second;
+
+          cache_hits_metric.inc();
+          if (cached.found)
+            {
+              out = cached.value;
+            }
+          return cached.found;
+        }
+    }
+
+  cache_misses_metric.inc();
+
+  bool ret = backend->get_value(key, type, out);
+
+  if (ret && type != VARIANT_TYPE_NONE && out.type != type)
+    {
+      ret = false;
+      out.type = VARIANT_TYPE_NONE;
+    }
+
+  if (is_cacheable(key))
+    {
+      if (quark == 0)
+        {
+          quark = g_quark_from_string(key.c_str());
+        }
+
+      CachedValue &cached = value_cache[quark];
+      cached.type = type;
+      cached.found = ret;
+      if (ret)
+        {
+          cached.value = out;
+        }
+    }
+
+  return ret;
+}
+
+
+//! Returns whether changes of the specified key are noticed by the configurator.
+/*!
+ *  Backends that are not monitored are only changed through the
+ *  configurator. Monitored backends only report changes of keys that
+ *  have a listener.
+ */
+bool
+Configurator::is_cacheable(const std::string &key) const
+{
+  return (dynamic_cast<IConfigBackendMonitoring *>(backend) == NULL ||
+          has_trie_listener(key));
+}
+
+
+//! Removes a key from the cache.
+void
+Configurator::invalidate_cached_value(const std::string &key) const
+{
+  string k = key;
+  strip_leading_slash(k);
+  strip_trailing_slash(k);
+
+  GQuark quark = g_quark_try_string(k.c_str());
+  if (quark != 0)
+    {
+      value_cache.erase(quark);
+    }
+}
+
+
 
 bool
 Configurator::get_value(const std::string &key, std::string &out) const
@@ -605,6 +739,7 @@ Configurator::add_listener(const std::string &key_prefix, IConfiguratorListener
     {
       // not found -> add
       listeners.push_back(make_pair(key, listener));
+      add_trie_listener(key, listener);
     }
 
   return ret;
@@ -616,12 +751,16 @@ Configurator::remove_listener(IConfiguratorListener *listener)
 {
   bool ret = false;
 
+  // Keys may no longer be monitored.
+  value_cache.clear();
+
   ListenerIter i = listeners.begin();
   while (i != listeners.end())
     {
       if (listener == i->second)
         {
           // Found. Remove
+          remove_trie_listener(i->first, i->second);
           i = listeners.erase(i);
           ret = true;
         }
@@ -640,6 +779,9 @@ Configurator::remove_listener(const std::string &key_prefix, IConfiguratorListen
 {
   bool ret = false;
 
+  // Keys may no longer be monitored.
+  value_cache.clear();
+
   if (dynamic_cast<IConfigBackendMonitoring *>(backend) != NULL)
     {
       dynamic_cast<IConfigBackendMonitoring *>(backend)->remove_listener(key_prefix);
@@ -651,6 +793,7 @@ Configurator::remove_listener(const std::string &key_prefix, IConfiguratorListen
       if (i->first == key_prefix && i->second == listener)
         {
           // Found. Remove
+          remove_trie_listener(i->first, i->second);
           i = listeners.erase(i);
           ret = true;
         }
@@ -694,26 +837,209 @@ Configurator::fire_configurator_event(const string &key)
   strip_leading_slash(k);
   strip_trailing_slash(k);
 
-  ListenerIter i = listeners.begin();
-  while (i != listeners.end())
+  if (transaction_depth > 0)
     {
-      string prefix = i->first;
+      transaction_keys.insert(k);
+      TRACE_RETURN("Deferred until commit");
+      return;
+    }
+
+  vector<IConfiguratorListener *> matches;
+  find_trie_listeners(k, matches);
 
-      if (k.substr(0, prefix.length()) == prefix)
+  for (vector<IConfiguratorListener *>::iterator i = matches.begin(); i != matches.end(); i++)
+    {
+      IConfiguratorListener *l = *i;
+      if (l != NULL)
         {
-          IConfiguratorListener *l = i->second;
-          if (l != NULL)
+          l->config_changed_notify(k);
+        }
+    }
+
+  // Timer limits and the like may have changed.
+  ICore *core = CoreFactory::get_core();
+  core->wakeup();
+
+  TRACE_EXIT();
+}
+
+
+//! Starts a configuration transaction.
+/*!
+ *  Change notifications are collected until the outermost transaction is
+ *  committed. Transactions may be nested.
+ */
+void
+Configurator::begin_transaction()
+{
+  transaction_depth++;
+}
+
+
+//! Commits a configuration transaction.
+void
+Configurator::commit_transaction()
+{
+  TRACE_ENTER_MSG("Configurator::commit_transaction", transaction_depth);
+
+  if (transaction_depth > 0)
+    {
+      transaction_depth--;
+    }
+
+  if (transaction_depth == 0 && !transaction_keys.empty())
+    {
+      fire_transaction_events();
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Notifies each listener once of the keys changed during a transaction.
+void
+Configurator::fire_transaction_events()
+{
+  TRACE_ENTER("Configurator::fire_transaction_events");
+
+  set<string> keys;
+  keys.swap(transaction_keys);
+
+  // Group the changed keys by listener, in order of first notification.
+  vector<IConfiguratorListener *> order;
+  map<IConfiguratorListener *, set<string> > changes;
+
+  for (set<string>::iterator k = keys.begin(); k != keys.end(); k++)
+    {
+      vector<IConfiguratorListener *> matches;
+      find_trie_listeners(*k, matches);
+
+      for (vector<IConfiguratorListener *>::iterator i = matches.begin(); i != matches.end(); i++)
+        {
+          if (*i != NULL)
             {
-              l->config_changed_notify(k);
+              set<string> &listener_keys = changes[*i];
+              if (listener_keys.empty())
+                {
+                  order.push_back(*i);
+                }
+              listener_keys.insert(*k);
             }
         }
-      i++;
     }
 
+  TRACE_MSG(keys.size() << " keys, " << order.size() << " listeners");
+
+  for (vector<IConfiguratorListener *>::iterator i = order.begin(); i != order.end(); i++)
+    {
+      (*i)->config_keys_changed_notify(changes[*i]);
+    }
+
+  // Timer limits and the like may have changed.
+  ICore *core = CoreFactory::get_core();
+  core->wakeup();
+
   TRACE_EXIT();
 }
 
 
+//! Destructs a node of the listener trie.
+Configurator::ListenerNode::~ListenerNode()
+{
+  for (map<char, ListenerNode *>::iterator i = children.begin(); i != children.end(); i++)
+    {
+      delete i->second;
+    }
+}
+
+
+//! Adds a listener to the trie of key prefixes.
+void
+Configurator::add_trie_listener(const string &key_prefix, IConfiguratorListener *listener)
+{
+  ListenerNode *node = &listener_trie;
+
+  for (string::const_iterator c = key_prefix.begin(); c != key_prefix.end(); c++)
+    {
+      ListenerNode *&child = node->children[*c];
+      if (child == NULL)
+        {
+          child = new ListenerNode;
+        }
+      node = child;
+    }
+
+  node->listeners.push_back(listener);
+}
+
+
+//! Removes a listener from the trie of key prefixes.
+/*!
+ *  Empty nodes are kept, as the same prefixes are usually registered again.
+ */
+void
+Configurator::remove_trie_listener(const string &key_prefix, IConfiguratorListener *listener)
+{
+  ListenerNode *node = &listener_trie;
+
+  for (string::const_iterator c = key_prefix.begin(); node != NULL && c != key_prefix.end(); c++)
+    {
+      map<char, ListenerNode *>::iterator i = node->children.find(*c);
+      node = (i != node->children.end()) ? i->second : NULL;
+    }
+
+  if (node != NULL)
+    {
+      node->listeners.remove(listener);
+    }
+}
+
+
+//! Returns whether a listener has a key prefix that is a prefix of the specified key.
+bool
+Configurator::has_trie_listener(const string &key) const
+{
+  const ListenerNode *node = &listener_trie;
+  string::const_iterator c = key.begin();
+
+  while (node != NULL && node->listeners.empty() && c != key.end())
+    {
+      map<char, ListenerNode *>::const_iterator i = node->children.find(*c);
+      node = (i != node->children.end()) ? i->second : NULL;
+      c++;
+    }
+
+  return node != NULL && !node->listeners.empty();
+}
+
+
+//! Finds all listeners whose key prefix is a prefix of the specified key.
+/*!
+ *  Listeners of shorter prefixes come first, followed by listeners of
+ *  longer prefixes. Listeners of the same prefix are in order of registration.
+ */
+void
+Configurator::find_trie_listeners(const string &key, vector<IConfiguratorListener *> &result) const
+{
+  const ListenerNode *node = &listener_trie;
+  string::const_iterator c = key.begin();
+
+  while (node != NULL)
+    {
+      result.insert(result.end(), node->listeners.begin(), node->listeners.end());
+
+      if (c == key.end())
+        {
+          break;
+        }
+
+      map<char, ListenerNode *>::const_iterator i = node->children.find(*c);
+      node = (i != node->children.end()) ? i->second : NULL;
+      c++;
+    }
+}
+
+
 //! Removes the leading '/'.
 void
 Configurator::strip_leading_slash(string &key) const
@@ -777,6 +1103,7 @@ Configurator::find_setting(const string &key, Setting &setting) const
 void
 Configurator::config_changed_notify(const std::string &key)
 {
+  invalidate_cached_value(key);
   fire_configurator_event(key);
 }
 
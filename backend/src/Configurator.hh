@@ -25,6 +25,10 @@
 #include <string>
 #include <list>
 #include <map>
+#include <set>
+#include <vector>
+
+#include <glib.h>
 
 #include "Mutex.hh"
 #include "IConfigurator.hh"
@@ -49,6 +53,7 @@ public:
   virtual ~Configurator();
 
   void heartbeat();
+  time_t get_next_deadline() const;
 
   // IConfigurator
   virtual void set_delay(const std::string &name, int delay);
@@ -84,14 +89,38 @@ public:
   virtual bool remove_listener(const std::string &key_prefix, IConfiguratorListener *listener);
   virtual bool find_listener(IConfiguratorListener *listener, std::string &key) const;
 
+  virtual void begin_transaction();
+  virtual void commit_transaction();
+
 private:
   typedef std::list<std::pair<std::string, IConfiguratorListener *> > Listeners;
   typedef std::list<std::pair<std::string, IConfiguratorListener *> >::iterator ListenerIter;
   typedef std::list<std::pair<std::string, IConfiguratorListener *> >::const_iterator ListenerCIter;
 
-  //! Configuration change listeners.
+  //! Node in the trie of listener key prefixes.
+  struct ListenerNode
+  {
+    ~ListenerNode();
+
+    //! Child nodes, indexed by the next character of the prefix.
+    std::map<char, ListenerNode *> children;
+
+    //! Listeners of the prefix that ends at this node.
+    std::list<IConfiguratorListener *> listeners;
+  };
+
+  //! Configuration change listeners, in order of registration.
   Listeners listeners;
 
+  //! Configuration change listeners, indexed by key prefix.
+  ListenerNode listener_trie;
+
+  //! Nesting depth of configuration transactions.
+  int transaction_depth;
+
+  //! Keys that changed during the current transaction.
+  std::set<std::string> transaction_keys;
+
 private:
   struct DelayedConfig
   {
@@ -110,6 +139,22 @@ private:
   typedef DelayedList::iterator DelayedListIter;
   typedef DelayedList::const_iterator DelayedListCIter;
 
+  //! Cached result of a backend lookup.
+  struct CachedValue
+  {
+    //! Type that was requested from the backend.
+    VariantType type;
+
+    //! Whether the backend has a value of the requested type.
+    bool found;
+
+    //! The value, if found.
+    Variant value;
+  };
+
+  typedef std::map<GQuark, CachedValue> ValueCache;
+  typedef ValueCache::iterator ValueCacheIter;
+
   typedef std::map<std::string, Setting> Settings;
   typedef std::map<std::string, Setting>::iterator SettingIter;
   typedef std::map<std::string, Setting>::const_iterator SettingCIter;
@@ -120,8 +165,16 @@ private:
 
   bool set_value(const std::string &key, Variant &value, ConfigFlags flags = CONFIG_FLAG_NONE);
   bool get_value(const std::string &key, VariantType type, Variant &value) const;
+  bool get_cached_value(const std::string &key, VariantType type, Variant &value) const;
+  bool is_cacheable(const std::string &key) const;
+  void invalidate_cached_value(const std::string &key) const;
+  bool has_trie_listener(const std::string &key) const;
 
   void fire_configurator_event(const std::string &key);
+  void fire_transaction_events();
+  void add_trie_listener(const std::string &key_prefix, IConfiguratorListener *listener);
+  void remove_trie_listener(const std::string &key_prefix, IConfiguratorListener *listener);
+  void find_trie_listeners(const std::string &key, std::vector<IConfiguratorListener *> &result) const;
   void strip_leading_slash(std::string &key) const;
   void strip_trailing_slash(std::string &key) const;
   void add_trailing_slash(std::string &key) const;
@@ -140,6 +193,9 @@ private:
 
   //! Next auto save time.
   time_t auto_save_time;
+
+  //! Values read from the backend, indexed by interned key.
+  mutable ValueCache value_cache;
 };
 
 
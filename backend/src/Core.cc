@@ -28,6 +28,7 @@
 #include "debug.hh"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <iostream>
 #include <fstream>
@@ -45,12 +46,15 @@
 #include "Configurator.hh"
 #include "CoreConfig.hh"
 #include "Statistics.hh"
+#include "StateWriter.hh"
 #include "BreakControl.hh"
 #include "Timer.hh"
 #include "TimePredFactory.hh"
 #include "TimePred.hh"
 #include "TimeSource.hh"
+#include "InputMonitor.hh"
 #include "InputMonitorFactory.hh"
+#include "Metrics.hh"
 
 #ifdef HAVE_DISTRIBUTION
 #include "DistributionManager.hh"
@@ -80,8 +84,25 @@
 
 Core *Core::instance = NULL;
 
+static Metrics::Histogram heartbeat_metric("workrave_core_heartbeat_usec",
+                                           "Duration of Core::heartbeat");
+static Metrics::Histogram heartbeat_distribution_metric("workrave_core_heartbeat_distribution_usec",
+                                                        "Duration of the distribution phase of the heartbeat");
+static Metrics::Histogram heartbeat_state_metric("workrave_core_heartbeat_state_usec",
+                                                 "Duration of the activity state phase of the heartbeat");
+static Metrics::Histogram heartbeat_timers_metric("workrave_core_heartbeat_timers_usec",
+                                                  "Duration of the timer phase of the heartbeat");
+static Metrics::Histogram heartbeat_breaks_metric("workrave_core_heartbeat_breaks_usec",
+                                                  "Duration of the break phase of the heartbeat");
+static Metrics::Histogram heartbeat_save_metric("workrave_core_heartbeat_save_usec",
+                                                "Duration of saving the state in the heartbeat");
+static Metrics::Counter save_state_metric("workrave_core_state_saves_total",
+                                          "Number of times the timer state changed and was saved");
+
 const char *WORKRAVESTATE="WorkRaveState";
 const int SAVESTATETIME = 60;
+const int MAX_HEARTBEAT_DELAY = 300;
+const int HEARTBEAT_SLACK_MS = 20;
 
 #define DBUS_PATH_WORKRAVE         "/org/workrave/Workrave/Core"
 #define DBUS_SERVICE_WORKRAVE      "org.workrave.Workrave"
@@ -89,11 +110,17 @@ const int SAVESTATETIME = 60;
 //! Constructs a new Core.
 Core::Core() :
   last_process_time(0),
+  next_heartbeat_time(0),
+  next_save_time(0),
+  save_pending(false),
+  in_heartbeat(false),
+  wakeup_pending(0),
   master_node(true),
   configurator(NULL),
   monitor(NULL),
   application(NULL),
   statistics(NULL),
+  state_writer(NULL),
   operation_mode(OPERATION_MODE_NORMAL),
   operation_mode_regular(OPERATION_MODE_NORMAL),
   usage_mode(USAGE_MODE_NORMAL),
@@ -109,7 +136,10 @@ Core::Core() :
   ,
   dist_manager(NULL),
   remote_state(ACTIVITY_IDLE),
-  idlelog_manager(NULL)
+  idlelog_manager(NULL),
+  replicated_version(0),
+  replicate_complete_state(true),
+  received_version(0)
 #  ifndef NDEBUG
   ,
   fake_monitor(NULL)
@@ -117,11 +147,13 @@ Core::Core() :
 #endif
 {
   TRACE_ENTER("Core::Core");
-  current_time = time(NULL);
+  current_time = TimeSource::get_clock()->get_time();
 
   assert(! instance);
   instance = this;
 
+  state_writer = new StateWriter();
+
   TRACE_EXIT();
 }
 
@@ -155,6 +187,9 @@ Core::~Core()
 #endif
 #endif
 
+  state_writer->flush();
+  delete state_writer;
+
   TRACE_EXIT();
 }
 
@@ -240,6 +275,12 @@ Core::init_configurator()
     {
       Util::set_home_directory(home);
     }
+
+  bool sync;
+  if (configurator->get_value(CoreConfig::CFG_KEY_GENERAL_SYNC_STATE, sync))
+    {
+      state_writer->set_sync(sync);
+    }
 }
 
 //! Initializes the communication bus.
@@ -286,11 +327,18 @@ Core::init_monitor(const char *display_name)
 #endif
 #endif
 
+  const char *trace = getenv("WORKRAVE_RECORD_INPUT");
+  if (trace != NULL)
+    {
+      InputMonitor::record(trace);
+    }
+
   InputMonitorFactory::init(display_name);
 
   configurator->set_value(CoreConfig::CFG_KEY_MONITOR_SENSITIVITY, 3, CONFIG_FLAG_DEFAULT);
 
   monitor = new ActivityMonitor();
+  monitor->set_state_listener(this);
   load_monitor_config();
 
   configurator->add_listener(CoreConfig::CFG_KEY_MONITOR, this);
@@ -320,13 +368,14 @@ Core::init_distribution_manager()
   dist_manager->init(configurator);
   dist_manager->register_client_message(DCM_BREAKS, DCMT_MASTER, this);
   dist_manager->register_client_message(DCM_TIMERS, DCMT_MASTER, this);
+  dist_manager->register_client_message(DCM_TIMERS_DELTA, DCMT_PASSIVE, this);
   dist_manager->register_client_message(DCM_MONITOR, DCMT_MASTER, this);
-  dist_manager->register_client_message(DCM_IDLELOG, DCMT_SIGNON, this);
+  dist_manager->register_client_message(DCM_IDLELOG, (DistributionClientMessageType) (DCMT_SIGNON | DCMT_STREAM), this);
   dist_manager->register_client_message(DCM_BREAKCONTROL, DCMT_PASSIVE, this);
 
   dist_manager->add_listener(this);
 
-  idlelog_manager = new IdleLogManager(dist_manager->get_my_id(), this);
+  idlelog_manager = new IdleLogManager(dist_manager->get_my_id(), this, state_writer);
   idlelog_manager->init();
 }
 #endif
@@ -365,6 +414,8 @@ Core::load_monitor_config()
     sensitivity = 3;
 
   // Pre 1.0 compatibility...
+  configurator->begin_transaction();
+
   if (noise < 50)
     {
       noise *= 1000;
@@ -383,6 +434,7 @@ Core::load_monitor_config()
       configurator->set_value(CoreConfig::CFG_KEY_MONITOR_IDLE, idle);
     }
 
+  configurator->commit_transaction();
 
   TRACE_MSG("Monitor config = " << noise << " " << activity << " " << idle);
 
@@ -512,6 +564,14 @@ Core::get_statistics() const
 }
 
 
+//! Returns the writer of all state files.
+StateWriter *
+Core::get_state_writer() const
+{
+  return state_writer;
+}
+
+
 //! Returns the specified break controller.
 Break *
 Core::get_break(BreakId id)
@@ -548,6 +608,14 @@ Core::get_break_stage(BreakId id)
     }
 }
 
+//! Returns the performance metrics of the backend.
+std::string
+Core::get_metrics()
+{
+  return Metrics::dump();
+}
+
+
 #ifdef HAVE_DISTRIBUTION
 //! Returns the distribution manager.
 DistributionManager *
@@ -802,6 +870,7 @@ Core::set_operation_mode_internal(
       }
   }
 
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -832,6 +901,7 @@ Core::set_usage_mode_internal(UsageMode mode, bool persistent)
         {
           breaks[i].set_usage_mode(mode);
         }
+      wakeup();
 
       if (persistent)
         {
@@ -890,6 +960,7 @@ Core::do_force_break(BreakId id, BreakHint break_hint)
     }
 
   breaker->force_start_break(break_hint);
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -910,6 +981,7 @@ Core::time_changed()
       breaks[i].get_timer()->shift_time(0);
     }
 
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -933,6 +1005,7 @@ Core::set_powersave(bool down)
       
       save_state();
       statistics->update();
+      state_writer->flush();
     }
   else
     {
@@ -948,6 +1021,8 @@ Core::set_powersave(bool down)
       TRACE_MSG("resume time " << powersave_resume_time);
       remove_operation_mode_override( "powersave" );
     }
+
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -1017,6 +1092,8 @@ Core::force_idle(BreakId break_id)
       
       breaks[i].get_timer()->force_idle();
     }
+
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -1072,6 +1149,7 @@ Core::do_postpone_break(BreakId break_id)
     {
       BreakControl *bc = breaks[break_id].get_break_control();
       bc->postpone_break();
+      wakeup();
     }
 }
 
@@ -1084,6 +1162,7 @@ Core::do_skip_break(BreakId break_id)
     {
       BreakControl *bc = breaks[break_id].get_break_control();
       bc->skip_break();
+      wakeup();
     }
 }
 
@@ -1097,6 +1176,7 @@ Core::do_stop_prelude(BreakId break_id)
     {
       BreakControl *bc = breaks[break_id].get_break_control();
       bc->stop_prelude();
+      wakeup();
     }
   TRACE_EXIT();
 }
@@ -1113,8 +1193,11 @@ Core::heartbeat()
   TRACE_ENTER("Core::heartbeat");
   assert(application != NULL);
 
+  Metrics::Stopwatch stopwatch(heartbeat_metric);
+  in_heartbeat = true;
+
   // Set current time.
-  current_time = time(NULL);
+  current_time = TimeSource::get_clock()->get_time();
 
   // Performs timewarp checking.
   bool warped = process_timewarp();
@@ -1123,41 +1206,245 @@ Core::heartbeat()
   configurator->heartbeat();
 
   // Perform distribution processing.
-  process_distribution();
+  {
+    Metrics::Stopwatch phase(heartbeat_distribution_metric);
+    process_distribution();
+  }
 
   if (!warped)
     {
       // Perform state computation.
+      Metrics::Stopwatch phase(heartbeat_state_metric);
       process_state();
     }
 
   // Perform timer processing.
-  process_timers();
+  {
+    Metrics::Stopwatch phase(heartbeat_timers_metric);
+    process_timers();
+  }
 
-  // Send heartbeats to other components.
-  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+  // Send heartbeats to other components. These count seconds, so
+  // skip them when woken up more than once in the same second.
+  if (current_time != last_process_time)
     {
-      BreakControl *bc = breaks[i].get_break_control();
-      if (bc != NULL && bc->need_heartbeat())
+      Metrics::Stopwatch phase(heartbeat_breaks_metric);
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
         {
-          bc->heartbeat();
+          BreakControl *bc = breaks[i].get_break_control();
+          if (bc != NULL && bc->need_heartbeat())
+            {
+              bc->heartbeat();
+            }
         }
     }
 
-  // Make state persistent.
-  if (current_time % SAVESTATETIME == 0)
+  // Make state persistent. Once all timers are settled, the state is
+  // saved one last time and no more saves are scheduled. All state files
+  // are written in a single burst.
+  if (!are_timers_settled() || state_writer->is_pending())
+    {
+      save_pending = true;
+    }
+
+  if (next_save_time == 0)
+    {
+      next_save_time = current_time + SAVESTATETIME;
+    }
+  else if (save_pending && current_time >= next_save_time)
     {
+      Metrics::Stopwatch phase(heartbeat_save_metric);
       statistics->update();
       save_state();
+      state_writer->flush();
+
+      next_save_time = current_time + SAVESTATETIME;
+      save_pending = false;
     }
 
   // Done.
   last_process_time = current_time;
+  next_heartbeat_time = compute_next_heartbeat_time();
+  in_heartbeat = false;
 
+  TRACE_MSG("next heartbeat " << next_heartbeat_time - current_time);
   TRACE_EXIT();
 }
 
 
+//! Returns the number of milliseconds until the next heartbeat is needed.
+int
+Core::get_heartbeat_delay() const
+{
+  gint64 now = TimeSource::get_clock()->get_real_time();
+  gint64 delay = ((gint64)next_heartbeat_time * G_USEC_PER_SEC - now) / 1000 + HEARTBEAT_SLACK_MS;
+
+  if (delay < 0)
+    {
+      delay = 0;
+    }
+  else if (delay > MAX_HEARTBEAT_DELAY * 1000)
+    {
+      delay = MAX_HEARTBEAT_DELAY * 1000;
+    }
+
+  return (int)delay;
+}
+
+
+//! Are all timers stopped and fully reset?
+/*!
+ *  When settled, nothing changes until one of the deadlines computed by
+ *  compute_next_heartbeat_time() expires or the core requests a wakeup.
+ */
+bool
+Core::are_timers_settled()
+{
+  if (monitor_state == ACTIVITY_ACTIVE)
+    {
+      return false;
+    }
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      BreakControl *bc = breaks[i].get_break_control();
+      if (bc != NULL && bc->need_heartbeat())
+        {
+          return false;
+        }
+
+      Timer *timer = breaks[i].get_timer();
+      if (timer->get_state() == STATE_RUNNING || timer->get_next_reset_time() != 0)
+        {
+          return false;
+        }
+    }
+
+  return true;
+}
+
+
+//! Requests an early heartbeat from the GUI.
+void
+Core::wakeup()
+{
+  // The deadline is recomputed at the end of the heartbeat anyway.
+  if (!in_heartbeat)
+    {
+      request_wakeup();
+    }
+}
+
+
+//! Queues a wakeup request on the main loop.
+/*!
+ *  This may be called from the activity monitor thread.
+ */
+void
+Core::request_wakeup()
+{
+  if (g_atomic_int_compare_and_exchange(&wakeup_pending, 0, 1))
+    {
+      g_idle_add(static_on_wakeup, this);
+    }
+}
+
+
+//! Forwards a queued wakeup request to the GUI.
+gboolean
+Core::static_on_wakeup(gpointer data)
+{
+  Core *core = (Core *) data;
+
+  g_atomic_int_set(&core->wakeup_pending, 0);
+  if (core->core_event_listener != NULL)
+    {
+      core->core_event_listener->core_event_wakeup();
+    }
+  return FALSE;
+}
+
+
+//! Notification from the activity monitor that the user became active.
+bool
+Core::action_notify()
+{
+  request_wakeup();
+  return true;
+}
+
+
+//! Updates a deadline if the specified time is earlier.
+static inline void
+update_deadline(time_t &deadline, time_t t)
+{
+  if (t != 0 && t < deadline)
+    {
+      deadline = t;
+    }
+}
+
+
+//! Computes the time at which the next heartbeat is needed.
+time_t
+Core::compute_next_heartbeat_time()
+{
+  time_t next = current_time + MAX_HEARTBEAT_DELAY;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      Timer *timer = breaks[i].get_timer();
+      update_deadline(next, timer->get_next_limit_time());
+      update_deadline(next, timer->get_next_reset_time());
+      update_deadline(next, timer->get_next_pred_reset_time());
+
+      BreakControl *bc = breaks[i].get_break_control();
+      if (bc != NULL && bc->need_heartbeat())
+        {
+          update_deadline(next, current_time + 1);
+        }
+    }
+
+  update_deadline(next, monitor->get_next_deadline());
+  update_deadline(next, configurator->get_next_deadline());
+
+#ifdef HAVE_DISTRIBUTION
+  if (dist_manager != NULL)
+    {
+      update_deadline(next, dist_manager->get_next_deadline());
+    }
+#ifndef NDEBUG
+  if (fake_monitor != NULL)
+    {
+      update_deadline(next, current_time + 1);
+    }
+#endif
+#endif
+
+  for (map<std::string, time_t>::iterator i = external_activity.begin(); i != external_activity.end(); i++)
+    {
+      update_deadline(next, i->second + 1);
+    }
+
+  if (powersave && powersave_resume_time != 0)
+    {
+      update_deadline(next, powersave_resume_time + 31);
+    }
+
+  if (save_pending)
+    {
+      update_deadline(next, next_save_time);
+    }
+
+  if (next <= current_time)
+    {
+      next = current_time + 1;
+    }
+
+  return next;
+}
+
+
 //! Performs all distribution processing.
 void
 Core::process_distribution()
@@ -1184,23 +1471,17 @@ Core::process_distribution()
         }
     }
 
+  if (previous_master_mode != master_node)
+    {
+      replicate_complete_state = true;
+    }
+
   if ( (previous_master_mode != master_node) ||
        (master_node && local_state != state) )
     {
-      PacketBuffer buffer;
-      buffer.create();
-
-      buffer.pack_ushort(1);
-      buffer.pack_ushort(state);
-
-      dist_manager->broadcast_client_message(DCM_MONITOR, buffer);
-
-      buffer.clear();
-      bool ret = request_timer_state(buffer);
-      if (ret)
-        {
-          dist_manager->broadcast_client_message(DCM_TIMERS, buffer);
-        }
+      // Coalesced with other state changes within the replication window.
+      dist_manager->schedule_client_message(DCM_MONITOR);
+      dist_manager->schedule_client_message(DCM_TIMERS_DELTA);
     }
 
 #endif
@@ -1274,6 +1555,8 @@ Core::report_external_activity(std::string who, bool act)
     {
       external_activity.erase(who);
     }
+
+  wakeup();
   TRACE_EXIT();
 }
 
@@ -1398,6 +1681,29 @@ Core::process_timers()
   TRACE_EXIT();
 }
 
+//! Returns the number of seconds the current heartbeat is later than expected.
+/*!
+ *  The heartbeat is expected one second after the previous one, or at the
+ *  scheduled deadline if the core was allowed to sleep longer than that.
+ */
+time_t
+Core::get_timewarp_gap() const
+{
+  time_t gap = current_time - 1 - last_process_time;
+
+  if (gap > 0 && next_heartbeat_time > last_process_time + 1)
+    {
+      gap = current_time - next_heartbeat_time;
+      if (gap < 0)
+        {
+          gap = 0;
+        }
+    }
+
+  return gap;
+}
+
+
 #if defined(PLATFORM_OS_WIN32)
 
 //! Process a possible timewarp on Win32
@@ -1409,8 +1715,8 @@ Core::process_timewarp()
   TRACE_ENTER("Core::process_timewarp");
   if (last_process_time != 0)
     {
-      time_t gap = current_time - 1 - last_process_time;
-  
+      time_t gap = get_timewarp_gap();
+
       if (abs((int)gap) > 5)
         {
           TRACE_MSG("gap " << gap << " " << powersave << " " << operation_mode << " " << powersave_resume_time << " " << current_time);
@@ -1463,7 +1769,7 @@ Core::process_timewarp()
   TRACE_ENTER("Core::process_timewarp");
   if (last_process_time != 0)
     {
-      int gap = current_time - 1 - last_process_time;
+      int gap = (int) get_timewarp_gap();
 
       if (gap >= 30)
         {
@@ -1676,32 +1982,44 @@ Core::daily_reset()
 #endif
 
   save_state();
+  state_writer->flush();
 
   TRACE_EXIT();
 }
 
 
 //! Saves the current state.
+/*!
+ *  The state is only written if the state of a timer changed since the
+ *  last save.
+ */
 void
-Core::save_state() const
+Core::save_state()
 {
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "state" << ends;
+  // The serialized timers include the save time, so compare the values only.
+  string values;
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      values += breaks[i].get_timer()->serialize_state_values();
+      values += '\n';
+    }
 
-  ofstream stateFile(ss.str().c_str());
+  if (values != saved_state)
+    {
+      saved_state = values;
+      save_state_metric.inc();
 
-  stateFile << "WorkRaveState 3"  << endl
-            << get_time() << endl;
+      stringstream stateFile;
+      stateFile << "WorkRaveState 3"  << endl
+                << get_time() << endl;
 
-  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
-    {
-      string stateStr = breaks[i].get_timer()->serialize_state();
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          stateFile << breaks[i].get_timer()->serialize_state() << endl;
+        }
 
-      stateFile << stateStr << endl;
+      state_writer->write(Util::get_home_directory() + "state", stateFile.str());
     }
-
-  stateFile.close();
 }
 
 
@@ -1890,10 +2208,16 @@ Core::request_client_message(DistributionClientMessageID id, PacketBuffer &buffe
       ret = request_timer_state(buffer);
       break;
 
+    case DCM_TIMERS_DELTA:
+      ret = request_timer_delta(buffer);
+      break;
+
     case DCM_CONFIG:
       break;
 
     case DCM_MONITOR:
+      buffer.pack_ushort(1);
+      buffer.pack_ushort(monitor->get_current_state());
       ret = true;
       break;
 
@@ -1933,6 +2257,10 @@ Core::client_message(DistributionClientMessageID id, bool master, const char *cl
       ret = set_timer_state(buffer);
       break;
 
+    case DCM_TIMERS_DELTA:
+      ret = set_timer_delta(buffer);
+      break;
+
     case DCM_MONITOR:
       ret = set_monitor_state(master, buffer);
       break;
@@ -1954,6 +2282,7 @@ Core::client_message(DistributionClientMessageID id, bool master, const char *cl
       break;
     }
 
+  wakeup();
   return ret;
 }
 
@@ -2026,11 +2355,37 @@ Core::set_break_state(bool master, PacketBuffer &buffer)
   return true;
 }
 
+//! Encoding of the timer state in DCM_TIMERS_DELTA.
+/*!
+ *  Every field is a single zigzag varint, so that a receiver can skip
+ *  fields that were added in later versions.
+ */
+static const guint8 TIMER_DELTA_FORMAT = 2;
+
+//! Packs the complete timer state.
+/*!
+ *  The state is sent periodically and also serves as the new base of
+ *  DCM_TIMERS_DELTA. If all peers support version 4 packets, the state
+ *  is packed as a complete DCM_TIMERS_DELTA, which starts with its
+ *  (non-zero) format. Otherwise, the legacy format is used, which starts
+ *  with a 16 bit timer count below 256. Its version follows the timers,
+ *  so that older clients ignore it.
+ */
 bool
-Core::request_timer_state(PacketBuffer &buffer) const
+Core::request_timer_state(PacketBuffer &buffer)
 {
   TRACE_ENTER("Core::get_timer_state");
 
+  if (!dist_manager->has_legacy_peers())
+    {
+      replicate_complete_state = true;
+      bool ret = request_timer_delta(buffer);
+      TRACE_EXIT();
+      return ret;
+    }
+
+  next_replicated_version();
+
   buffer.pack_ushort(BREAK_ID_SIZEOF);
 
   for (int i = 0; i < BREAK_ID_SIZEOF; i++)
@@ -2056,8 +2411,13 @@ Core::request_timer_state(PacketBuffer &buffer) const
       buffer.pack_ushort((guint16)state_data.snooze_inhibited);
 
       buffer.poke_ushort(pos, buffer.bytes_written() - pos);
+
+      replicated_state[i] = state_data;
     }
 
+  buffer.pack_ulong(replicated_version);
+  replicate_complete_state = false;
+
   TRACE_EXIT();
   return true;
 }
@@ -2068,21 +2428,40 @@ Core::set_timer_state(PacketBuffer &buffer)
 {
   TRACE_ENTER("Core::set_timer_state");
 
+  if (buffer.bytes_available() > 0 && buffer.peek_byte(0) == TIMER_DELTA_FORMAT)
+    {
+      bool ret = set_timer_delta(buffer);
+      TRACE_EXIT();
+      return ret;
+    }
+
   int num_breaks = buffer.unpack_ushort();
+  Timer::TimerStateData states[BREAK_ID_SIZEOF];
+  bool received[BREAK_ID_SIZEOF] = { false };
 
   TRACE_MSG("numtimer = " << num_breaks);
   for (int i = 0; i < num_breaks; i++)
     {
-      gchar *id = buffer.unpack_string();
+      PacketString id = buffer.unpack_string();
       TRACE_MSG("id = " << id);
 
-      if (id == NULL)
+      if (id.is_null())
         {
           TRACE_EXIT();
           return false;
         }
 
-      Timer *t = (Timer *)get_timer(id);
+      // Resolve the timer without copying its id out of the packet.
+      Timer *t = NULL;
+      int break_id = -1;
+      for (int b = 0; b < BREAK_ID_SIZEOF; b++)
+        {
+          if (id.equals(breaks[b].get_timer()->get_id().c_str()))
+            {
+              t = breaks[b].get_timer();
+              break_id = b;
+            }
+        }
 
       Timer::TimerStateData state_data;
 
@@ -2109,9 +2488,223 @@ Core::set_timer_state(PacketBuffer &buffer)
       if (t != NULL)
         {
           t->set_state_data(state_data);
+
+          states[break_id] = state_data;
+          received[break_id] = true;
+        }
+    }
+
+  if (buffer.bytes_available() >= 4)
+    {
+      // The complete state is the new base of the timer deltas.
+      received_version = buffer.unpack_ulong();
+
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          if (received[i])
+            {
+              received_state[i] = states[i];
+            }
+        }
+
+      TRACE_MSG("version = " << received_version);
+    }
+
+  TRACE_EXIT();
+  return true;
+}
+
+
+//! Timer state field in DCM_TIMERS_DELTA.
+struct TimerStateField
+{
+  //! The field.
+  time_t Timer::TimerStateData::*field;
+
+  //! Is the field a time, encoded relative to the current time of the message?
+  bool relative;
+};
+
+//! Time fields of the timer state, in the order of the field mask of DCM_TIMERS_DELTA.
+static const TimerStateField timer_state_fields[] =
+  {
+    { &Timer::TimerStateData::current_time,         true },
+    { &Timer::TimerStateData::elapsed_time,         false },
+    { &Timer::TimerStateData::elapsed_idle_time,    false },
+    { &Timer::TimerStateData::last_pred_reset_time, true },
+    { &Timer::TimerStateData::total_overdue_time,   false },
+    { &Timer::TimerStateData::last_limit_time,      true },
+    { &Timer::TimerStateData::last_limit_elapsed,   false },
+  };
+
+static const int NUM_TIMER_STATE_FIELDS = sizeof(timer_state_fields) / sizeof(timer_state_fields[0]);
+
+//! Bit of the snooze inhibited flag in the field mask of DCM_TIMERS_DELTA.
+static const int TIMER_STATE_SNOOZE_INHIBITED = 1 << NUM_TIMER_STATE_FIELDS;
+
+
+//! Packs the timer state fields that changed since the last replicated state.
+/*!
+ *  The message contains the format, the version on which it is based (0
+ *  if the state is complete), the new version, the current time and, for
+ *  each timer that changed, its break id and a mask of the changed fields
+ *  followed by their values. Times are relative to the current time.
+ */
+bool
+Core::request_timer_delta(PacketBuffer &buffer)
+{
+  TRACE_ENTER("Core::request_timer_delta");
+
+  guint32 base_version = replicate_complete_state ? 0 : replicated_version;
+
+  next_replicated_version();
+
+  Timer::TimerStateData states[BREAK_ID_SIZEOF];
+  int masks[BREAK_ID_SIZEOF];
+  int count = 0;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      Timer::TimerStateData &old_data = replicated_state[i];
+      Timer::TimerStateData &state_data = states[i];
+      breaks[i].get_timer()->get_state_data(state_data);
+
+      int mask = 0;
+      for (int f = 0; f < NUM_TIMER_STATE_FIELDS; f++)
+        {
+          time_t Timer::TimerStateData::*field = timer_state_fields[f].field;
+          if (replicate_complete_state || state_data.*field != old_data.*field)
+            {
+              mask |= 1 << f;
+            }
+        }
+
+      if (replicate_complete_state || state_data.snooze_inhibited != old_data.snooze_inhibited)
+        {
+          mask |= TIMER_STATE_SNOOZE_INHIBITED;
+        }
+
+      masks[i] = mask;
+      count += mask != 0 ? 1 : 0;
+      old_data = state_data;
+    }
+
+  buffer.pack_byte(TIMER_DELTA_FORMAT);
+  buffer.pack_varint(base_version);
+  buffer.pack_varint(replicated_version);
+  buffer.pack_signed_varint(current_time);
+  buffer.pack_varint(count);
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      int mask = masks[i];
+      if (mask == 0)
+        {
+          continue;
+        }
+
+      buffer.pack_varint(i);
+      buffer.pack_varint(mask);
+
+      for (int f = 0; f < NUM_TIMER_STATE_FIELDS; f++)
+        {
+          if (mask & (1 << f))
+            {
+              time_t value = states[i].*timer_state_fields[f].field;
+              buffer.pack_signed_varint(timer_state_fields[f].relative ? value - current_time : value);
+            }
+        }
+
+      if (mask & TIMER_STATE_SNOOZE_INHIBITED)
+        {
+          buffer.pack_varint(states[i].snooze_inhibited ? 1 : 0);
+        }
+    }
+
+  replicate_complete_state = false;
+
+  TRACE_MSG("version = " << base_version << " -> " << replicated_version << ", timers = " << count);
+  TRACE_EXIT();
+  return true;
+}
+
+
+//! Advances the version of the replicated timer state.
+void
+Core::next_replicated_version()
+{
+  replicated_version++;
+  if (replicated_version == 0)
+    {
+      replicated_version = 1;
+    }
+}
+
+
+//! Applies the changed timer state fields to the last received state.
+bool
+Core::set_timer_delta(PacketBuffer &buffer)
+{
+  TRACE_ENTER("Core::set_timer_delta");
+
+  if (buffer.unpack_byte() != TIMER_DELTA_FORMAT)
+    {
+      TRACE_RETURN("Unknown format");
+      return false;
+    }
+
+  guint32 base_version = (guint32) buffer.unpack_varint();
+  guint32 version = (guint32) buffer.unpack_varint();
+  time_t ref_time = (time_t) buffer.unpack_signed_varint();
+  int count = (int) buffer.unpack_varint();
+
+  TRACE_MSG("version = " << base_version << " -> " << version << ", timers = " << count);
+
+  if (base_version != 0 && (received_version == 0 || base_version != received_version))
+    {
+      // Missed a change. Wait for the next complete state.
+      TRACE_RETURN("Unexpected version " << received_version);
+      return true;
+    }
+
+  for (int i = 0; i < count && buffer.bytes_available() > 0; i++)
+    {
+      guint64 id = buffer.unpack_varint();
+      guint64 mask = buffer.unpack_varint();
+
+      // State of unknown timers is decoded and discarded.
+      Timer::TimerStateData unknown;
+      Timer::TimerStateData *data = id < (guint64) BREAK_ID_SIZEOF ? &received_state[id] : &unknown;
+
+      for (int f = 0; f < NUM_TIMER_STATE_FIELDS; f++)
+        {
+          if (mask & (1 << f))
+            {
+              time_t value = (time_t) buffer.unpack_signed_varint();
+              data->*timer_state_fields[f].field = timer_state_fields[f].relative ? value + ref_time : value;
+            }
+        }
+
+      if (mask & TIMER_STATE_SNOOZE_INHIBITED)
+        {
+          data->snooze_inhibited = buffer.unpack_varint() != 0;
+        }
+
+      // Skip fields added in later versions.
+      for (mask >>= NUM_TIMER_STATE_FIELDS + 1; mask != 0; mask >>= 1)
+        {
+          if (mask & 1)
+            {
+              buffer.unpack_varint();
+            }
         }
+    }
 
-      g_free(id);
+  received_version = version;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      breaks[i].get_timer()->set_state_data(received_state[i]);
     }
 
   TRACE_EXIT();
@@ -2145,17 +2738,11 @@ Core::signon_remote_client(string client_id)
 
   if (master_node)
     {
-      PacketBuffer buffer;
-      buffer.create();
-
-      ActivityState state = monitor->get_current_state();
-
-      buffer.pack_ushort(1);
-      buffer.pack_ushort(state);
-
-      dist_manager->broadcast_client_message(DCM_MONITOR, buffer);
+      // The new client needs the complete timer state.
+      replicate_complete_state = true;
 
-      buffer.clear();
+      dist_manager->schedule_client_message(DCM_MONITOR);
+      dist_manager->schedule_client_message(DCM_TIMERS_DELTA);
     }
 }
 
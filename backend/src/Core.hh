@@ -43,6 +43,9 @@
 #include <string>
 #include <map>
 
+#include <glib.h>
+
+#include "ActivityMonitorListener.hh"
 #include "Break.hh"
 #include "IBreakResponse.hh"
 #include "IActivityMonitor.hh"
@@ -71,6 +74,7 @@ class Configurator;
 class Statistics;
 class FakeActivityMonitor;
 class IdleLogManager;
+class StateWriter;
 class BreakControl;
 
 #ifdef HAVE_DISTRIBUTION
@@ -87,7 +91,8 @@ class Core :
   public TimeSource,
   public ICore,
   public IConfiguratorListener,
-  public IBreakResponse
+  public IBreakResponse,
+  public ActivityMonitorListener
 {
 public:
   Core();
@@ -103,11 +108,13 @@ public:
   IActivityMonitor *get_activity_monitor() const;
   bool is_user_active() const;
   std::string get_break_stage(BreakId id);
+  std::string get_metrics();
 
 #ifdef HAVE_DISTRIBUTION
   DistributionManager *get_distribution_manager() const;
 #endif
   Statistics *get_statistics() const;
+  StateWriter *get_state_writer() const;
   void set_core_events_listener(ICoreEventListener *l);
   void force_break(BreakId id, BreakHint break_hint);
   void time_changed();
@@ -116,6 +123,10 @@ public:
   time_t get_time() const;
   void post_event(CoreEvent event);
 
+  int get_heartbeat_delay() const;
+  bool are_timers_settled();
+  void wakeup();
+
   OperationMode get_operation_mode();
   OperationMode get_operation_mode_regular();
   bool is_operation_mode_an_override();
@@ -188,13 +199,21 @@ private:
   void start_break(BreakId break_id, BreakId resume_this_break = BREAK_ID_NONE);
   void stop_all_breaks();
   void daily_reset();
-  void save_state() const;
+  void save_state();
   void load_state();
   void load_misc();
   void do_postpone_break(BreakId break_id);
   void do_skip_break(BreakId break_id);
   void do_stop_prelude(BreakId break_id);
 
+  time_t get_timewarp_gap() const;
+  time_t compute_next_heartbeat_time();
+  void request_wakeup();
+  static gboolean static_on_wakeup(gpointer data);
+
+  // ActivityMonitorListener
+  bool action_notify();
+
   void set_insist_policy(ICore::InsistPolicy p);
   ICore::InsistPolicy get_insist_policy() const;
 
@@ -209,9 +228,13 @@ private:
   bool request_break_state(PacketBuffer &buffer);
   bool set_break_state(bool master, PacketBuffer &buffer);
 
-  bool request_timer_state(PacketBuffer &buffer) const;
+  bool request_timer_state(PacketBuffer &buffer);
   bool set_timer_state(PacketBuffer &buffer);
 
+  bool request_timer_delta(PacketBuffer &buffer);
+  bool set_timer_delta(PacketBuffer &buffer);
+  void next_replicated_version();
+
   bool set_monitor_state(bool master, PacketBuffer &buffer);
 
   enum BreakControlMessage
@@ -249,6 +272,21 @@ private:
   //! The time we last processed the timers.
   time_t last_process_time;
 
+  //! The time at which the next heartbeat is needed.
+  time_t next_heartbeat_time;
+
+  //! The time at which the state is saved next.
+  time_t next_save_time;
+
+  //! Has the state changed since it was last saved?
+  bool save_pending;
+
+  //! Is the heartbeat currently being processed?
+  bool in_heartbeat;
+
+  //! Is a wakeup request queued on the main loop?
+  volatile gint wakeup_pending;
+
   //! Are we the master node??
   bool master_node;
 
@@ -267,6 +305,12 @@ private:
   //! The statistics collector.
   Statistics *statistics;
 
+  //! Writer of all state files.
+  StateWriter *state_writer;
+
+  //! Last saved timer state, without the save time.
+  std::string saved_state;
+
   //! Current operation mode.
   OperationMode operation_mode;
 
@@ -318,6 +362,21 @@ private:
   //! Manager that collects idle times of all clients.
   IdleLogManager *idlelog_manager;
 
+  //! Timer state that was last replicated to the remote clients.
+  Timer::TimerStateData replicated_state[BREAK_ID_SIZEOF];
+
+  //! Version of the replicated timer state.
+  guint32 replicated_version;
+
+  //! Whether the next replicated timer state must be complete.
+  bool replicate_complete_state;
+
+  //! Timer state that was last received from the master.
+  Timer::TimerStateData received_state[BREAK_ID_SIZEOF];
+
+  //! Version of the received timer state, or 0 if none was received.
+  guint32 received_version;
+
 #ifndef NDEBUG
   //! A fake activity monitor for testing puposes.
   FakeActivityMonitor *fake_monitor;
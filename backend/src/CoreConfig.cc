@@ -53,6 +53,7 @@ const string CoreConfig::CFG_KEY_MONITOR_IDLE              = "monitor/idle";
 const string CoreConfig::CFG_KEY_MONITOR_SENSITIVITY       = "monitor/sensitivity";
 
 const string CoreConfig::CFG_KEY_GENERAL_DATADIR           = "general/datadir";
+const string CoreConfig::CFG_KEY_GENERAL_SYNC_STATE        = "general/sync-state";
 const string CoreConfig::CFG_KEY_OPERATION_MODE            = "general/operation-mode";
 const string CoreConfig::CFG_KEY_USAGE_MODE                = "general/usage-mode";
 
@@ -66,6 +67,9 @@ const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_USERNAME = "distribution/usern
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_PASSWORD = "distribution/password";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_ATTEMPTS = "distribution/reconnect_attempts";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_INTERVAL = "distribution/reconnect_interval";
+const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_REPLICATION_WINDOW = "distribution/replication_window";
+const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_HIGH_WATER = "distribution/write_high_water";
+const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_LIMIT = "distribution/write_limit";
 
 
 bool
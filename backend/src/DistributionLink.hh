@@ -21,6 +21,7 @@
 #define DISTRIBUTIONLINK_HH
 
 #include <string>
+#include <time.h>
 
 class DistributionLinkListener;
 class IDistributionClientMessage;
@@ -39,6 +40,9 @@ public:
   //! Returns the number of remote peers.
   virtual int get_number_of_peers() = 0;
 
+  //! Returns whether a remote peer may only support version 3 packets.
+  virtual bool has_legacy_peers() = 0;
+
   //! Sets the callback interface to the distribution manager.
   // virtual void set_distribution_manager(DistributionLinkListener *dll) = 0;
 
@@ -49,6 +53,9 @@ public:
   //! Periodic heartbeat.
   virtual void heartbeat() = 0;
 
+  //! Returns the time at which the next heartbeat is needed, or 0 if none.
+  virtual time_t get_next_deadline() const = 0;
+
   //! Sets the username and password.
   virtual void set_user(string username, string password) = 0;
 
@@ -77,6 +84,9 @@ public:
   virtual bool broadcast_client_message(DistributionClientMessageID id,
                                         PacketBuffer &buffer) = 0;
 
+  //! Schedules a client message for the next batched broadcast.
+  virtual bool schedule_client_message(DistributionClientMessageID id) = 0;
+
   //! Disconnects from all remote clients.
   virtual bool disconnect_all() = 0;
 
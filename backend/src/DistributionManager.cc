@@ -93,6 +93,19 @@ DistributionManager::heartbeart()
 }
 
 
+//! Returns the time at which the next heartbeat is needed, or 0 if none.
+time_t
+DistributionManager::get_next_deadline() const
+{
+  time_t ret = 0;
+  if (link != NULL)
+    {
+      ret = link->get_next_deadline();
+    }
+  return ret;
+}
+
+
 //! Returns the current distribution state of this node.
 DistributionManager::NodeState
 DistributionManager::get_state() const
@@ -116,6 +129,21 @@ DistributionManager::get_number_of_peers()
 }
 
 
+//! Returns whether a peer may only support the version 3 protocol.
+bool
+DistributionManager::has_legacy_peers()
+{
+  bool ret = false;
+
+  if (link != NULL)
+    {
+      ret = link->has_legacy_peers();
+    }
+
+  return ret;
+}
+
+
 //! Returns true if this node is master.
 bool
 DistributionManager::is_master() const
@@ -353,6 +381,20 @@ DistributionManager::broadcast_client_message(DistributionClientMessageID id, Pa
 }
 
 
+//! Schedules a client message for the next batched broadcast to all.
+bool
+DistributionManager::schedule_client_message(DistributionClientMessageID id)
+{
+  bool ret = false;
+
+  if (link != NULL)
+    {
+      ret = link->schedule_client_message(id);
+    }
+  return ret;
+}
+
+
 //! Event from Link that our 'master' status changed.
 void
 DistributionManager::master_changed(bool new_master, string id)
@@ -886,4 +928,67 @@ DistributionManager::set_reconnect_interval(int v)
 }
 
 
+int
+DistributionManager::get_replication_window() const
+{
+  int ret;
+  bool is_set = configurator->get_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_REPLICATION_WINDOW, ret);
+  if (!is_set)
+    {
+      ret = DEFAULT_REPLICATION_WINDOW;
+    }
+
+  return ret;
+}
+
+
+void
+DistributionManager::set_replication_window(int v)
+{
+  configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_REPLICATION_WINDOW, v);
+}
+
+
+int
+DistributionManager::get_write_high_water() const
+{
+  int ret;
+  bool is_set = configurator->get_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_HIGH_WATER, ret);
+  if (!is_set)
+    {
+      ret = DEFAULT_WRITE_HIGH_WATER;
+    }
+
+  return ret;
+}
+
+
+void
+DistributionManager::set_write_high_water(int v)
+{
+  configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_HIGH_WATER, v);
+}
+
+
+int
+DistributionManager::get_write_limit() const
+{
+  int ret;
+  bool is_set = configurator->get_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_LIMIT, ret);
+  if (!is_set)
+    {
+      ret = DEFAULT_WRITE_LIMIT;
+    }
+
+  return ret;
+}
+
+
+void
+DistributionManager::set_write_limit(int v)
+{
+  configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_WRITE_LIMIT, v);
+}
+
+
 #endif
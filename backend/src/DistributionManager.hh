@@ -54,10 +54,12 @@ public:
   NodeState get_state() const;
   void init(Configurator *conf);
   void heartbeart();
+  time_t get_next_deadline() const;
   bool is_master() const;
   string get_master_id() const;
   string get_my_id() const;
   int get_number_of_peers();
+  bool has_legacy_peers();
   bool claim();
   bool set_lock_master(bool lock);
   bool connect(string url);
@@ -70,6 +72,7 @@ public:
   bool remove_listener(DistributionListener *listener);
 
   bool broadcast_client_message(DistributionClientMessageID id, PacketBuffer &buffer);
+  bool schedule_client_message(DistributionClientMessageID id);
   bool add_peer(string peer);
   bool remove_peer(string peer);
   bool disconnect_all();
@@ -103,6 +106,15 @@ public:
   int get_reconnect_interval() const;
   void set_reconnect_interval(int v);
 
+  int get_replication_window() const;
+  void set_replication_window(int v);
+
+  int get_write_high_water() const;
+  void set_write_high_water(int v);
+
+  int get_write_limit() const;
+  void set_write_limit(int v);
+
   // DistributionLinkListener
   void master_changed(bool result, std::string id);
   void signon_remote_client(char *client_id);
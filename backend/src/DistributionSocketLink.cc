@@ -48,6 +48,8 @@
 #include "DistributionManager.hh"
 #include "DistributionLink.hh"
 #include "DistributionSocketLink.hh"
+#include "Metrics.hh"
+#include "TimeSource.hh"
 
 #include "Util.hh"
 
@@ -57,6 +59,25 @@
 
 using namespace std;
 
+static Metrics::Gauge clients_metric("workrave_distribution_clients",
+                                     "Number of known distribution clients");
+static Metrics::Gauge scheduled_metric("workrave_distribution_scheduled_messages",
+                                       "Number of client messages waiting for the next batch");
+static Metrics::Counter packets_sent_metric("workrave_distribution_packets_sent_total",
+                                            "Number of packets written to distribution sockets");
+static Metrics::Counter bytes_sent_metric("workrave_distribution_bytes_sent_total",
+                                          "Number of bytes written to distribution sockets");
+static Metrics::Gauge queued_bytes_metric("workrave_distribution_queued_bytes",
+                                         "Number of bytes queued for slow distribution clients");
+static Metrics::Counter send_errors_metric("workrave_distribution_send_errors_total",
+                                           "Number of failed writes to distribution sockets");
+static Metrics::Counter stream_drops_metric("workrave_distribution_stream_drops_total",
+                                            "Number of client messages too large for a client without streams");
+static Metrics::Counter packets_received_metric("workrave_distribution_packets_received_total",
+                                                "Number of packets received from distribution sockets");
+static Metrics::Counter bytes_received_metric("workrave_distribution_bytes_received_total",
+                                              "Number of bytes read from distribution sockets");
+
 //! Construct a new socket link.
 /*!
  *  \param conf Configurator to use.
@@ -75,7 +96,12 @@ DistributionSocketLink::DistributionSocketLink(Configurator *conf) :
   server_enabled(false),
   reconnect_attempts(DEFAULT_ATTEMPTS),
   reconnect_interval(DEFAULT_INTERVAL),
-  heartbeat_count(0)
+  next_distribute_time(0),
+  next_flush_time(0),
+  replication_window(DEFAULT_REPLICATION_WINDOW),
+  write_high_water(DEFAULT_WRITE_HIGH_WATER),
+  write_limit(DEFAULT_WRITE_LIMIT),
+  stream_pump_id(0)
 {
   socket_driver = SocketDriver::create();
   init_my_id();
@@ -85,6 +111,11 @@ DistributionSocketLink::DistributionSocketLink(Configurator *conf) :
 //! Destructs the socket link.
 DistributionSocketLink::~DistributionSocketLink()
 {
+  if (stream_pump_id != 0)
+    {
+      g_source_remove(stream_pump_id);
+    }
+
   remove_client(NULL);
 
   g_free(username);
@@ -117,52 +148,94 @@ DistributionSocketLink::init()
 void
 DistributionSocketLink::heartbeat()
 {
+  clients_metric.set(clients.size());
+
+  int queued = 0;
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      if ((*i)->socket != NULL)
+        {
+          queued += (*i)->socket->get_queued_bytes();
+        }
+    }
+  queued_bytes_metric.set(queued);
+
+  // Streams normally continue when a socket drained. This is a fallback.
+  schedule_stream_pump();
+
   if (server_enabled)
     {
       TRACE_ENTER("DistributionSocketLink::heartbeat");
-      heartbeat_count++;
 
-      time_t current_time = time(NULL);
+      time_t current_time = TimeSource::get_clock()->get_time();
 
-      // See if we have some clients that need reconncting.
-      list<Client *>::iterator i = clients.begin();
-      while (i != clients.end())
+      // Reconnect the clients whose reconnect time has passed.
+      while (!reconnect_queue.empty() && current_time >= reconnect_queue.begin()->first)
         {
-          Client *c = *i;
+          Client *c = reconnect_queue.begin()->second;
+          unschedule_reconnect(c);
+
           if (c->type == CLIENTTYPE_DIRECT &&
               c->reconnect_count > 0 &&
-              c->reconnect_time != 0 && current_time >= c->reconnect_time &&
               c->hostname != NULL)
             {
               c->reconnect_count--;
-              c->reconnect_time = 0;
+              reconnect_client(c);
+            }
+        }
 
-              dist_manager->log(_("Reconnecting to %s."),
-                                c->id == NULL ? "Unknown" : c->id);
+      // Broadcast the batched client messages.
+      if (next_flush_time != 0 && current_time >= next_flush_time)
+        {
+          flush_client_messages();
+        }
+
+      // Periodically distribute state, in case the master crashes.
+      if (next_distribute_time == 0 || !i_am_master)
+        {
+          next_distribute_time = current_time + 30;
+        }
+      else if (current_time >= next_distribute_time)
+        {
+          send_client_message(DCMT_MASTER);
+          next_distribute_time = current_time + 30;
+        }
+      TRACE_EXIT();
+    }
+}
 
-              if (c->socket != NULL)
-                {
-                  c->socket->close();
-                  delete c->socket;
-                }
 
-              ISocket *socket = socket_driver->create_socket();
-              socket->set_data(c);
-              socket->set_listener(this);
-              socket->connect(c->hostname, c->port);
+//! Returns the time at which the next heartbeat is needed, or 0 if none.
+time_t
+DistributionSocketLink::get_next_deadline() const
+{
+  time_t ret = 0;
+
+  if (server_enabled)
+    {
+      if (!reconnect_queue.empty())
+        {
+          ret = reconnect_queue.begin()->first;
+        }
 
-              c->socket = socket;
+      if (i_am_master && !clients.empty() && next_distribute_time != 0)
+        {
+          if (ret == 0 || next_distribute_time < ret)
+            {
+              ret = next_distribute_time;
             }
-          i++;
         }
 
-      // Periodically distribute state, in case the master crashes.
-      if (heartbeat_count % 30 == 0 && i_am_master)
+      if (next_flush_time != 0)
         {
-          send_client_message(DCMT_MASTER);
+          if (ret == 0 || next_flush_time < ret)
+            {
+              ret = next_flush_time;
+            }
         }
-      TRACE_EXIT();
     }
+
+  return ret;
 }
 
 
@@ -233,6 +306,27 @@ DistributionSocketLink::get_number_of_peers()
 }
 
 
+//! Returns whether a remote peer may only support version 3 packets.
+/*!
+ *  The version of a direct peer is known once it sent a packet. The
+ *  version of a peer that is reached through another peer is not known.
+ */
+bool
+DistributionSocketLink::has_legacy_peers()
+{
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      Client *c = *i;
+      if (c->socket != NULL ? c->version < PACKET_VERSION : c->peer != NULL)
+        {
+          return true;
+        }
+    }
+
+  return false;
+}
+
+
 //! Join the WR network.
 void
 DistributionSocketLink::connect(string url)
@@ -500,7 +594,10 @@ DistributionSocketLink::broadcast_client_message(DistributionClientMessageID dsi
   string id = get_master();
   packet.pack_string(id);
 
-  packet.pack_ushort(1);
+  // Piggyback the scheduled client messages.
+  packet.pack_ushort(scheduled_messages.size() + 1);
+  pack_scheduled_messages(packet);
+
   packet.pack_ushort(dsid);
   packet.pack_ushort(buffer.bytes_written());
   packet.pack_raw((unsigned char *)buffer.get_buffer(),
@@ -512,6 +609,37 @@ DistributionSocketLink::broadcast_client_message(DistributionClientMessageID dsi
 }
 
 
+//! Schedules a client message for the next batched broadcast.
+/*!
+ *  The contents of the message are requested from its listener when the
+ *  batch is sent, so scheduling the same message several times within
+ *  the replication window results in a single, up-to-date message.
+ */
+bool
+DistributionSocketLink::schedule_client_message(DistributionClientMessageID id)
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::schedule_client_message", id);
+
+  if (find(scheduled_messages.begin(), scheduled_messages.end(), id) == scheduled_messages.end())
+    {
+      scheduled_messages.push_back(id);
+      scheduled_metric.set(scheduled_messages.size());
+    }
+
+  if (replication_window <= 0)
+    {
+      flush_client_messages();
+    }
+  else if (next_flush_time == 0)
+    {
+      next_flush_time = TimeSource::get_clock()->get_time() + replication_window;
+    }
+
+  TRACE_EXIT();
+  return true;
+}
+
+
 //! Returns whether the specified client is this client.
 bool
 DistributionSocketLink::client_is_me(gchar *id)
@@ -520,6 +648,14 @@ DistributionSocketLink::client_is_me(gchar *id)
 }
 
 
+//! Returns whether the specified client is this client.
+bool
+DistributionSocketLink::client_is_me(const PacketString &id)
+{
+  return id.equals(my_id.str().c_str());
+}
+
+
 
 //! Returns whether the specified client exists.
 /*!
@@ -563,20 +699,12 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
         }
 
       c->type = type;
+      c->outbound = true;
+      c->reconnect_delay = 0;
+      unschedule_reconnect(c);
       dist_manager->log(_("Connecting to %s."), host);
 
-      if (c->socket != NULL)
-        {
-          c->socket->close();
-          delete c->socket;
-        }
-
-      ISocket *socket = socket_driver->create_socket();
-      socket->set_data(c);
-      socket->set_listener(this);
-      socket->connect(host, port);
-
-      c->socket = socket;
+      reconnect_client(c);
     }
   else
     {
@@ -591,7 +719,7 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
       client->id = g_strdup(id);
       client->port = port;
 
-      clients.push_back(client);
+      register_client(client);
 
       if (client->id != NULL)
         {
@@ -602,18 +730,9 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
         {
           dist_manager->log(_("Connecting to %s."), host);
 
-          if (client->socket != NULL)
-            {
-              client->socket->close();
-              delete client->socket;
-            }
-
-          ISocket *socket = socket_driver->create_socket();
-          socket->set_data(client);
-          socket->set_listener(this);
-          socket->connect(host, port);
-
-          client->socket = socket;
+          // Failed connects are retried.
+          client->outbound = true;
+          reconnect_client(client);
         }
     }
   g_free(canonical_host);
@@ -679,11 +798,13 @@ DistributionSocketLink::set_client_id(Client *client, gchar *id)
   if (ret)
     {
       // No duplicate, so change the canonical name.
+      unindex_client(client);
       g_free(client->id);
       g_free(client->hostname);
       client->id = g_strdup(id);
       client->hostname = NULL;
       client->port = 0;
+      index_client(client);
 
       if (client->id != NULL)
         {
@@ -720,6 +841,7 @@ DistributionSocketLink::remove_client(Client *client)
 
           dist_manager->log(_("Removing client %s."),
                             (*i)->id == NULL ? "Unknown" : (*i)->id);
+          unregister_client(*i);
           delete *i;
           i = clients.erase(i);
         }
@@ -766,6 +888,7 @@ DistributionSocketLink::remove_peer_clients(Client *client)
               set_master(NULL);
             }
 
+          unregister_client(*i);
           delete *i;
           i = clients.erase(i);
         }
@@ -785,6 +908,14 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
   TRACE_ENTER_MSG("DistributionSocketLink::close_client",
 	  (client->id != NULL ? client->id : "Unknown") << " " << reconnect);
 
+  // Unfinished streams start over on the next connection. The receiver
+  // asks to skip what it already has.
+  for (list<OutgoingStream>::iterator s = client->streams.begin(); s != client->streams.end(); s++)
+    {
+      s->offset = 0;
+    }
+  client->version = 0;
+
   if (client->id != NULL)
     {
       dist_manager->signoff_remote_client(client->id);
@@ -816,15 +947,15 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
           if (reconnect)
             {
               TRACE_MSG("must reconnected");
-              client->reconnect_count = reconnect_attempts;
-              client->reconnect_time = time(NULL) + 5;
+              schedule_reconnect(client);
             }
           else
             {
               TRACE_MSG("set signed off");
               client->reconnect_count = 0;
-              client->reconnect_time = 0;
+              unschedule_reconnect(client);
               client->type = CLIENTTYPE_SIGNEDOFF;
+              remove_incoming_streams(client);
             }
         }
 
@@ -843,7 +974,7 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
           client->socket = NULL;
 
           client->reconnect_count = 0;
-          client->reconnect_time = 0;
+          unschedule_reconnect(client);
         }
 
       remove_peer_clients(client);
@@ -856,19 +987,176 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
 bool
 DistributionSocketLink::is_client_valid(Client *client)
 {
-  list<Client *>::iterator i = clients.begin();
-  bool ret = false;
+  return client_set.find(client) != client_set.end();
+}
+
+
+//! Adds a client to the list of clients.
+void
+DistributionSocketLink::register_client(Client *client)
+{
+  clients.push_back(client);
+  client_set.insert(client);
+  index_client(client);
+}
+
+
+//! Forgets a client before it is deleted.
+/*!
+ *  The caller removes the client from the list of clients.
+ */
+void
+DistributionSocketLink::unregister_client(Client *client)
+{
+  unschedule_reconnect(client);
+  unindex_client(client);
+  remove_incoming_streams(client);
+  client_set.erase(client);
+}
+
+
+//! Discards the partially received streams of a client.
+void
+DistributionSocketLink::remove_incoming_streams(Client *client)
+{
+  if (client->id == NULL)
+    {
+      return;
+    }
+
+  string prefix = string(client->id) + ":";
+  IncomingStreamMap::iterator i = incoming_streams.lower_bound(prefix);
+
+  while (i != incoming_streams.end() && i->first.compare(0, prefix.size(), prefix) == 0)
+    {
+      incoming_streams.erase(i++);
+    }
+}
+
 
-  while (!ret && i != clients.end())
+//! Indexes a client by its id and canonical name.
+void
+DistributionSocketLink::index_client(Client *client)
+{
+  if (client->id != NULL)
+    {
+      PacketString id(client->id, strlen(client->id));
+      clients_by_id.insert(make_pair(id, client));
+    }
+
+  if (client->hostname != NULL)
+    {
+      clients_by_address.insert(make_pair(make_pair(string(client->hostname), client->port), client));
+    }
+}
+
+
+//! Removes a client from the indices.
+/*!
+ *  Must be called before the id or canonical name of the client changes.
+ */
+void
+DistributionSocketLink::unindex_client(Client *client)
+{
+  if (client->id != NULL)
     {
-      if (*i == client)
+      PacketString id(client->id, strlen(client->id));
+      pair<ClientIdMap::iterator, ClientIdMap::iterator> range = clients_by_id.equal_range(id);
+
+      for (ClientIdMap::iterator i = range.first; i != range.second; i++)
         {
-          ret = true;
+          if (i->second == client)
+            {
+              clients_by_id.erase(i);
+              break;
+            }
         }
-      i++;
     }
 
-  return ret;
+  if (client->hostname != NULL)
+    {
+      pair<ClientAddressMap::iterator, ClientAddressMap::iterator> range =
+        clients_by_address.equal_range(make_pair(string(client->hostname), client->port));
+
+      for (ClientAddressMap::iterator i = range.first; i != range.second; i++)
+        {
+          if (i->second == client)
+            {
+              clients_by_address.erase(i);
+              break;
+            }
+        }
+    }
+}
+
+
+//! Schedules the next attempt to reconnect a client.
+/*!
+ *  The first attempt is made shortly after the connection was lost. The
+ *  delay doubles after each failed attempt, up to the reconnect interval.
+ *  Random jitter prevents all peers of a restarted client from
+ *  reconnecting at the same time.
+ */
+void
+DistributionSocketLink::schedule_reconnect(Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::schedule_reconnect");
+  unschedule_reconnect(client);
+
+  if (client->reconnect_delay == 0)
+    {
+      // Connection was lost. Start a new series of attempts.
+      client->reconnect_count = reconnect_attempts;
+      client->reconnect_delay = MIN_RECONNECT_DELAY;
+    }
+  else
+    {
+      // Last attempt failed. Back off.
+      client->reconnect_delay = MIN(client->reconnect_delay * 2,
+                                    MAX(reconnect_interval, MIN_RECONNECT_DELAY));
+    }
+
+  if (client->reconnect_count > 0)
+    {
+      int jitter = g_random_int_range(0, client->reconnect_delay / 4 + 1);
+
+      client->reconnect_time = TimeSource::get_clock()->get_time() + client->reconnect_delay + jitter;
+      client->reconnect_entry = reconnect_queue.insert(make_pair(client->reconnect_time, client));
+    }
+
+  TRACE_RETURN(client->reconnect_time);
+}
+
+
+//! Cancels the scheduled reconnect of a client.
+void
+DistributionSocketLink::unschedule_reconnect(Client *client)
+{
+  if (client->reconnect_time != 0)
+    {
+      reconnect_queue.erase(client->reconnect_entry);
+      client->reconnect_time = 0;
+    }
+}
+
+
+//! Connects to a direct client using its canonical name.
+void
+DistributionSocketLink::reconnect_client(Client *client)
+{
+  if (client->socket != NULL)
+    {
+      client->socket->close();
+      delete client->socket;
+    }
+
+  ISocket *socket = socket_driver->create_socket();
+  socket->set_data(client);
+  socket->set_listener(this);
+  socket->set_write_limit(write_limit);
+  client->socket = socket;
+
+  socket->connect(client->hostname, client->port);
 }
 
 
@@ -877,15 +1165,17 @@ DistributionSocketLink::Client *
 DistributionSocketLink::find_client_by_canonicalname(gchar *name, gint port)
 {
   Client *ret = NULL;
-  list<Client *>::iterator i = clients.begin();
 
-  while (i != clients.end())
+  if (name != NULL)
     {
-      if ((*i)->port == port && (*i)->hostname != NULL && strcmp((*i)->hostname, name) == 0)
+      pair<ClientAddressMap::iterator, ClientAddressMap::iterator> range =
+        clients_by_address.equal_range(make_pair(string(name), port));
+
+      if (range.first != range.second)
         {
-          ret = *i;
+          // Most recently added client.
+          ret = (--range.second)->second;
         }
-      i++;
     }
   return ret;
 }
@@ -895,15 +1185,30 @@ DistributionSocketLink::Client *
 DistributionSocketLink::find_client_by_id(gchar *id)
 {
   Client *ret = NULL;
-  list<Client *>::iterator i = clients.begin();
 
-  while (i != clients.end())
+  if (id != NULL)
+    {
+      ret = find_client_by_id(PacketString(id, strlen(id)));
+    }
+  return ret;
+}
+
+
+//! Finds a remote client by its id.
+DistributionSocketLink::Client *
+DistributionSocketLink::find_client_by_id(const PacketString &id)
+{
+  Client *ret = NULL;
+
+  if (!id.is_null())
     {
-      if ((*i)->id != NULL && strcmp((*i)->id, id) == 0)
+      pair<ClientIdMap::iterator, ClientIdMap::iterator> range = clients_by_id.equal_range(id);
+
+      if (range.first != range.second)
         {
-          ret = *i;
+          // Most recently added client.
+          ret = (--range.second)->second;
         }
-      i++;
     }
   return ret;
 }
@@ -997,7 +1302,7 @@ DistributionSocketLink::init_packet(PacketBuffer &packet, PacketCommand cmd)
   // Length.
   packet.pack_ushort(0);
   // Version
-  packet.pack_byte(3);
+  packet.pack_byte(PACKET_VERSION);
   // Flags
   packet.pack_byte(0);
   // Command
@@ -1023,11 +1328,6 @@ DistributionSocketLink::send_packet_except(PacketBuffer &packet, Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::send_packet_except");
 
-  gint size = packet.bytes_written();
-
-  // Length.
-  packet.poke_ushort(0, size);
-
   list<Client *>::iterator i = clients.begin();
   while (i != clients.end())
     {
@@ -1035,15 +1335,7 @@ DistributionSocketLink::send_packet_except(PacketBuffer &packet, Client *client)
 
       if (c != client && c->socket != NULL)
         {
-          int bytes_written = 0;
-          try
-            {
-              c->socket->write(packet.get_buffer(), size, bytes_written);
-            }
-          catch (SocketException &)
-            {
-              TRACE_MSG("Failed to send");
-            }
+          write_packet(c, packet);
         }
       i++;
     }
@@ -1091,41 +1383,116 @@ DistributionSocketLink::send_packet(Client *client, PacketBuffer &packet)
           TRACE_MSG("Sending to " << client->id);
         }
 
-      gint size = packet.bytes_written();
+      write_packet(client, packet);
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Writes the specified packet to the connection of a direct client.
+/*!
+ *  A packet of up to 64 KiB is framed by its 16 bit length. A larger
+ *  packet is framed by a 16 bit length of 0, followed by its 32 bit
+ *  length, and can only be sent to clients that use packet version 4.
+ */
+void
+DistributionSocketLink::write_packet(Client *client, PacketBuffer &packet)
+{
+  if (!client->deferred_messages.empty())
+    {
+      // Keep the messages in order.
+      send_deferred_messages(client);
+    }
 
-      // Length.
-      packet.poke_ushort(0, size);
+  gint size = packet.bytes_written();
+  int bytes_written = 0;
 
-      int bytes_written = 0;
-      try
+  try
+    {
+      if (size <= MAX_SMALL_PACKET_SIZE)
         {
+          // Length.
+          packet.poke_ushort(0, size);
           client->socket->write(packet.get_buffer(), size, bytes_written);
         }
-      catch (SocketException &)
+      else if (client->version >= PACKET_VERSION)
         {
-          TRACE_MSG("Failed to send");
+          guint8 header[6] = { 0, 0,
+                               (guint8) (size >> 24), (guint8) (size >> 16),
+                               (guint8) (size >> 8), (guint8) size };
+          int header_written = 0;
+
+          client->socket->write(header, sizeof(header), header_written);
+          client->socket->write(packet.get_buffer() + 2, size - 2, bytes_written);
+          bytes_written += header_written;
+        }
+      else
+        {
+          TRACE_MSG("Packet too large for client " << size);
+          send_errors_metric.inc();
+          return;
         }
-    }
 
-  TRACE_EXIT();
+      packets_sent_metric.inc();
+      bytes_sent_metric.inc(bytes_written);
+    }
+  catch (SocketException &)
+    {
+      TRACE_MSG("Failed to send");
+      send_errors_metric.inc();
+    }
 }
 
 
-//! Processed an incoming packet.
-void
-DistributionSocketLink::process_client_packet(Client *client)
+//! Returns the size of the frame at the read position, or 0 if not yet known.
+/*!
+ *  \param header Number of bytes that precede the packet in the frame.
+ */
+int
+DistributionSocketLink::peek_frame_size(PacketBuffer &packet, int &header)
 {
-  TRACE_ENTER("DistributionSocketLink::process_client_packet");
-  PacketBuffer &packet = client->packet;
+  int size = 0;
+  header = 0;
 
-  client->claim_count = 0;
-
-  gint size = packet.unpack_ushort();
-  g_assert(size == packet.bytes_written());
+  if (packet.bytes_available() >= 2)
+    {
+      size = packet.peek_ushort(0);
+
+      if (size == 0)
+        {
+          // Large frame. The 32 bit length replaces the upper bits of the
+          // 16 bit length field in the packet.
+          size = packet.bytes_available() >= 6 ? (int) packet.peek_ulong(2) + 4 : 0;
+          header = 4;
+        }
+    }
+
+  return size;
+}
+
+
+//! Processed an incoming packet.
+void
+DistributionSocketLink::process_client_packet(Client *client, PacketBuffer &packet)
+{
+  TRACE_ENTER("DistributionSocketLink::process_client_packet");
+
+  client->claim_count = 0;
+
+  // Large packets only have the lower 16 bits of their length here.
+  gint size = packet.unpack_ushort();
+  g_assert(size == (packet.bytes_written() & 0xffff));
 
   gint version = packet.unpack_byte();
   gint flags = packet.unpack_byte();
 
+  // Routed packets carry the version of their originator.
+  if ((flags & PACKETFLAG_SOURCE) == 0)
+    {
+      client->version = version;
+    }
+
   gint type = packet.unpack_ushort();
   TRACE_MSG("type = " << type);
   if (client != NULL && client->id != NULL)
@@ -1137,7 +1504,7 @@ DistributionSocketLink::process_client_packet(Client *client)
   bool forward = true;
   if (flags & PACKETFLAG_SOURCE)
     {
-      gchar *id = packet.unpack_string();
+      PacketString id = packet.unpack_string();
 
       if (!client_is_me(id))
         {
@@ -1168,14 +1535,13 @@ DistributionSocketLink::process_client_packet(Client *client)
 //           send_duplicate(client);
 //           remove_client(client);
         }
-      g_free(id);
     }
 
   if (flags & PACKETFLAG_DEST)
     {
-      gchar *id = packet.unpack_string();
+      PacketString id = packet.unpack_string();
 
-      if (id != NULL && !client_is_me(id))
+      if (!id.is_null() && !client_is_me(id))
         {
           TRACE_MSG("Destination = " << id);
           Client *dest = find_client_by_id(id);
@@ -1188,7 +1554,6 @@ DistributionSocketLink::process_client_packet(Client *client)
 
           source = NULL;
         }
-        g_free(id);
     }
 
   TRACE_MSG("size = " << size << ", version = " << version << ", flags = " << flags);
@@ -1240,6 +1605,15 @@ DistributionSocketLink::process_client_packet(Client *client)
         case PACKET_CLAIM_REJECT:
           handle_claim_reject(packet, source);
           break;
+
+        case PACKET_CHUNK:
+          handle_chunk(packet, source, client);
+          break;
+
+        case PACKET_CHUNK_RESUME:
+          handle_chunk_resume(packet, source);
+          forward = false;
+          break;
         }
 
       if (forward &&
@@ -1249,13 +1623,6 @@ DistributionSocketLink::process_client_packet(Client *client)
         }
     }
 
-  if (find(clients.begin(), clients.end(), client) != clients.end())
-    {
-      // hack... client may have been removed...
-      packet.clear();
-      packet.resize(0);
-    }
-  
   TRACE_EXIT();
 }
 
@@ -1343,9 +1710,9 @@ DistributionSocketLink::handle_hello1(PacketBuffer &packet, Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::handle_hello1");
   
-  gchar *user = packet.unpack_string();
-  gchar *id = packet.unpack_string();
-  gchar *rnd = packet.unpack_string();
+  gchar *user = packet.unpack_string().dup();
+  gchar *id = packet.unpack_string().dup();
+  gchar *rnd = packet.unpack_string().dup();
 
   TRACE_MSG(user << " " << id << " " << rnd);
   
@@ -1404,9 +1771,9 @@ DistributionSocketLink::handle_hello2(PacketBuffer &packet, Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::handle_hello2");
 
-  gchar *user = packet.unpack_string();
-  gchar *pass = packet.unpack_string();
-  gchar *id = packet.unpack_string();
+  gchar *user = packet.unpack_string().dup();
+  gchar *pass = packet.unpack_string().dup();
+  gchar *id = packet.unpack_string().dup();
 
   TRACE_MSG(user << " " << pass << " " << id << " " << client->challenge);
   
@@ -1428,6 +1795,7 @@ DistributionSocketLink::handle_hello2(PacketBuffer &packet, Client *client)
           // Welcome!
           send_welcome(client);
           client->welcome = true;
+          client->reconnect_delay = 0;
         }
       else
         {
@@ -1503,13 +1871,12 @@ DistributionSocketLink::handle_signoff(PacketBuffer &packet, Client *client)
       return;
     }
 
-  gchar *id = packet.unpack_string();
+  PacketString id = packet.unpack_string();
   Client *c = NULL;
 
-  if (id != NULL)
+  if (!id.is_null())
     {
       c = find_client_by_id(id);
-      g_free(id);
     }
 
   if (c != NULL)
@@ -1521,6 +1888,7 @@ DistributionSocketLink::handle_signoff(PacketBuffer &packet, Client *client)
         {
           TRACE_MSG("Direct connection. setting signedoff");
           c->type = CLIENTTYPE_SIGNEDOFF;
+          remove_incoming_streams(c);
           remove_peer_clients(c);
 
           if (c->socket != NULL)
@@ -1600,8 +1968,8 @@ DistributionSocketLink::handle_welcome(PacketBuffer &packet, Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::handle_welcome");
 
-  gchar *id = packet.unpack_string();
-  gchar *name = packet.unpack_string();
+  gchar *id = packet.unpack_string().dup();
+  gchar *name = packet.unpack_string().dup();
   /*gint port = */ packet.unpack_ushort();
 
   dist_manager->log(_("Client %s is welcoming us."),
@@ -1612,7 +1980,8 @@ DistributionSocketLink::handle_welcome(PacketBuffer &packet, Client *client)
   if (ok)
     {
       client->welcome = true;
-      
+      client->reconnect_delay = 0;
+
       // The connected client offers the master client.
       // This info will be received in the client list.
       // So, we no longer know who's master...
@@ -1752,8 +2121,8 @@ DistributionSocketLink::handle_client_list(PacketBuffer &packet, Client *client,
       gint pos = packet.bytes_read();
       gint size = packet.unpack_ushort();
       gint flags = packet.unpack_ushort();
-      gchar *id = packet.unpack_string();
-      gchar *name = packet.unpack_string();
+      gchar *id = packet.unpack_string().dup();
+      gchar *name = packet.unpack_string().dup();
       gint port = packet.unpack_ushort();
 
       if (flags & CLIENTLIST_MASTER)
@@ -1849,7 +2218,7 @@ DistributionSocketLink::send_claim(Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::send_claim");
 
-  if (client->next_claim_time == 0 || time(NULL) >= client->next_claim_time)
+  if (client->next_claim_time == 0 || TimeSource::get_clock()->get_time() >= client->next_claim_time)
     {
       PacketBuffer packet;
 
@@ -1861,7 +2230,7 @@ DistributionSocketLink::send_claim(Client *client)
 
       packet.pack_ushort(0);
 
-      client->next_claim_time = time(NULL) + 10;
+      client->next_claim_time = TimeSource::get_clock()->get_time() + 10;
 
       send_packet(client, packet);
 
@@ -1973,7 +2342,7 @@ DistributionSocketLink::handle_claim_reject(PacketBuffer &packet, Client *client
           count = 6;
         }
 
-      client->next_claim_time = time(NULL) + 5 * count;
+      client->next_claim_time = TimeSource::get_clock()->get_time() + 5 * count;
     }
 
   TRACE_EXIT();
@@ -2036,7 +2405,7 @@ DistributionSocketLink::handle_new_master(PacketBuffer &packet, Client *client)
       (*i)->reject_count = 0;
     }
 
-  gchar *id = packet.unpack_string();
+  gchar *id = packet.unpack_string().dup();
   /* gint count = */ packet.unpack_ushort();
 
   dist_manager->log(_("Client %s is now the new master."),
@@ -2082,7 +2451,16 @@ DistributionSocketLink::send_client_message(DistributionClientMessageType type)
       packet.pack_ushort(id);
       packet.reserve_size(pos);
 
-      if ((sl.type & type) != 0)
+      if ((sl.type & type) != 0 && (sl.type & DCMT_STREAM) != 0)
+        {
+          // Sent separately. An empty message is ignored by the receiver.
+          TRACE_MSG("stream " << id << " " << type);
+          PacketBuffer data;
+          data.create();
+          itf->request_client_message(id, data);
+          start_stream(id, data);
+        }
+      else if ((sl.type & type) != 0)
         {
           TRACE_MSG("request " << id << " " << type);
           itf->request_client_message(id, packet);
@@ -2098,6 +2476,506 @@ DistributionSocketLink::send_client_message(DistributionClientMessageType type)
 }
 
 
+//! Starts streaming a client message to all direct clients.
+/*!
+ *  The message is sent in chunks, interleaved with other packets, and at
+ *  the pace at which each client receives it. Clients that do not support
+ *  streams receive the message in a single packet, if it fits.
+ */
+void
+DistributionSocketLink::start_stream(DistributionClientMessageID id, PacketBuffer &data)
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::start_stream", id << " " << data.bytes_written());
+
+  int size = data.bytes_written();
+  if (size == 0)
+    {
+      TRACE_RETURN("Empty");
+      return;
+    }
+
+  // FNV-1a
+  guint32 checksum = 2166136261U;
+  const guint8 *bytes = (const guint8 *) data.get_buffer();
+  for (int i = 0; i < size; i++)
+    {
+      checksum = (checksum ^ bytes[i]) * 16777619U;
+    }
+
+  PacketBuffer legacy;
+
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      Client *c = *i;
+
+      if (c->socket == NULL)
+        {
+          continue;
+        }
+
+      if (c->version >= PACKET_VERSION)
+        {
+          bool found = false;
+          for (list<OutgoingStream>::iterator s = c->streams.begin(); s != c->streams.end(); s++)
+            {
+              if (s->id == id && s->checksum != checksum)
+                {
+                  // Restart an unfinished stream of outdated contents. The
+                  // receiver starts over when the checksum changes.
+                  s->master = get_master();
+                  s->checksum = checksum;
+                  s->data = data;
+                  s->offset = 0;
+                }
+
+              // An unfinished stream of the same contents is continued, so
+              // that it can be resumed.
+              found = found || s->id == id;
+            }
+
+          if (!found)
+            {
+              OutgoingStream stream;
+              stream.id = id;
+              stream.master = get_master();
+              stream.checksum = checksum;
+              stream.data = data;
+              c->streams.push_back(stream);
+            }
+        }
+      else if (size <= MAX_SMALL_PACKET_SIZE - 256)
+        {
+          if (legacy.get_buffer() == NULL)
+            {
+              legacy.create();
+              init_packet(legacy, PACKET_CLIENTMSG);
+              legacy.pack_string(get_master());
+              legacy.pack_ushort(1);
+              legacy.pack_ushort(id);
+              legacy.pack_ushort(size);
+              legacy.pack_raw((guint8 *) data.get_buffer(), size);
+            }
+          send_packet(c, legacy);
+        }
+      else
+        {
+          TRACE_MSG("Too large for client " << (c->id != NULL ? c->id : "Unknown"));
+          stream_drops_metric.inc();
+        }
+    }
+
+  schedule_stream_pump();
+  TRACE_EXIT();
+}
+
+
+//! Sends the next chunk of a stream.
+void
+DistributionSocketLink::send_chunk(Client *client, OutgoingStream &stream)
+{
+  int total = stream.data.bytes_written();
+  int size = MIN(STREAM_CHUNK_SIZE, total - stream.offset);
+
+  TRACE_ENTER_MSG("DistributionSocketLink::send_chunk", stream.id << " " << stream.offset << " " << size);
+
+  PacketBuffer packet;
+  packet.create(size + 256);
+  init_packet(packet, PACKET_CHUNK);
+
+  packet.pack_string(stream.master);
+  packet.pack_ushort(stream.id);
+  packet.pack_ulong(stream.checksum);
+  packet.pack_ulong(total);
+  packet.pack_ulong(stream.offset);
+  packet.pack_ushort(size);
+  packet.pack_raw((guint8 *) stream.data.get_buffer() + stream.offset, size);
+
+  stream.offset += size;
+
+  send_packet(client, packet);
+  TRACE_EXIT();
+}
+
+
+//! Requests the sender of a stream to continue at the specified offset.
+void
+DistributionSocketLink::send_chunk_resume(Client *client, DistributionClientMessageID id, guint32 checksum, int offset)
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::send_chunk_resume", id << " " << offset);
+
+  PacketBuffer packet;
+  packet.create();
+  init_packet(packet, PACKET_CHUNK_RESUME);
+
+  packet.pack_ushort(id);
+  packet.pack_ulong(checksum);
+  packet.pack_ulong(offset);
+
+  send_packet(client, packet);
+  TRACE_EXIT();
+}
+
+
+void
+DistributionSocketLink::schedule_stream_pump()
+{
+  if (stream_pump_id == 0)
+    {
+      stream_pump_id = g_idle_add(static_pump_streams, this);
+    }
+}
+
+
+gboolean
+DistributionSocketLink::static_pump_streams(gpointer data)
+{
+  DistributionSocketLink *link = (DistributionSocketLink *) data;
+  link->stream_pump_id = 0;
+  link->pump_streams();
+  return FALSE;
+}
+
+
+//! Sends the next chunk of each stream, and the deferred client messages.
+/*!
+ *  A client receives the next chunk once the previous chunks left the
+ *  socket. Streams and deferred messages to a slow client continue when
+ *  its socket drained.
+ */
+void
+DistributionSocketLink::pump_streams()
+{
+  TRACE_ENTER("DistributionSocketLink::pump_streams");
+  bool more = false;
+
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      Client *c = *i;
+
+      if (c->socket != NULL && !c->deferred_messages.empty() && !is_congested(c))
+        {
+          send_deferred_messages(c);
+        }
+
+      if (c->socket == NULL || c->streams.empty() ||
+          c->socket->get_queued_bytes() >= STREAM_CHUNK_SIZE)
+        {
+          continue;
+        }
+
+      OutgoingStream &stream = c->streams.front();
+      send_chunk(c, stream);
+
+      if (stream.offset >= stream.data.bytes_written())
+        {
+          c->streams.pop_front();
+        }
+
+      more = more || (c->socket != NULL && !c->streams.empty() &&
+                      c->socket->get_queued_bytes() < STREAM_CHUNK_SIZE);
+    }
+
+  if (more)
+    {
+      schedule_stream_pump();
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Handles a chunk of a streamed client message.
+/*!
+ *  Chunks are appended in order. If the first chunk of a stream arrives
+ *  of which the start was already received over a previous connection,
+ *  the sender is asked to continue where that connection stopped.
+ */
+void
+DistributionSocketLink::handle_chunk(PacketBuffer &packet, Client *client, Client *direct)
+{
+  TRACE_ENTER("DistributionSocketLink::handle_chunk");
+
+  if (!client->welcome || client->id == NULL)
+    {
+      TRACE_EXIT();
+      return;
+    }
+
+  PacketString master = packet.unpack_string();
+  DistributionClientMessageID id = (DistributionClientMessageID) packet.unpack_ushort();
+  guint32 checksum = packet.unpack_ulong();
+  int total = (int) packet.unpack_ulong();
+  int offset = (int) packet.unpack_ulong();
+  int size = packet.unpack_ushort();
+
+  if (packet.bytes_available() < size ||
+      total <= 0 || total > MAX_PACKET_SIZE || offset < 0 || offset > total - size)
+    {
+      TRACE_RETURN("Invalid chunk");
+      return;
+    }
+
+  // Copied into the stream without an intermediate copy.
+  const guint8 *chunk = packet.read_ptr;
+  packet.skip(size);
+
+  char key[16];
+  g_snprintf(key, sizeof(key), ":%d", id);
+  string stream_key = string(client->id) + key;
+  IncomingStreamMap::iterator si = incoming_streams.find(stream_key);
+
+  if (si == incoming_streams.end())
+    {
+      if (offset != 0)
+        {
+          TRACE_RETURN("Unknown stream");
+          return;
+        }
+      si = incoming_streams.insert(make_pair(stream_key, IncomingStream())).first;
+    }
+
+  IncomingStream &stream = si->second;
+
+  if (offset == 0)
+    {
+      if (stream.checksum == checksum && stream.total == total &&
+          stream.data.get_buffer() != NULL && stream.data.bytes_written() > 0)
+        {
+          if (client == direct)
+            {
+              send_chunk_resume(client, id, checksum, stream.data.bytes_written());
+            }
+        }
+      else
+        {
+          stream.checksum = checksum;
+          stream.total = total;
+          stream.data.create(total);
+        }
+    }
+
+  if (stream.checksum == checksum && stream.total == total &&
+      stream.data.get_buffer() != NULL && stream.data.bytes_written() == offset)
+    {
+      stream.data.pack_raw(chunk, size);
+    }
+
+  if (stream.data.get_buffer() != NULL && stream.data.bytes_written() == stream.total)
+    {
+      PacketBuffer data = stream.data;
+      incoming_streams.erase(si);
+
+      bool will_i_become_master = !master.is_null() && client_is_me(master);
+
+      ClientMessageMap::iterator it = client_message_map.find(id);
+      if (it != client_message_map.end())
+        {
+          it->second.listener->client_message(id, will_i_become_master, client->id, data);
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Handles a request to continue a stream at a later offset.
+void
+DistributionSocketLink::handle_chunk_resume(PacketBuffer &packet, Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::handle_chunk_resume");
+
+  DistributionClientMessageID id = (DistributionClientMessageID) packet.unpack_ushort();
+  guint32 checksum = packet.unpack_ulong();
+  int offset = (int) packet.unpack_ulong();
+
+  for (list<OutgoingStream>::iterator s = client->streams.begin(); s != client->streams.end(); s++)
+    {
+      if (s->id == id && s->checksum == checksum &&
+          offset > s->offset && offset <= s->data.bytes_written())
+        {
+          TRACE_MSG("Resume at " << offset);
+          s->offset = offset;
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Packs all scheduled client messages.
+void
+DistributionSocketLink::pack_scheduled_messages(PacketBuffer &packet)
+{
+  TRACE_ENTER("DistributionSocketLink::pack_scheduled_messages");
+
+  list<DistributionClientMessageID>::iterator i = scheduled_messages.begin();
+  while (i != scheduled_messages.end())
+    {
+      DistributionClientMessageID id = *i;
+
+      int pos = 0;
+      packet.pack_ushort(id);
+      packet.reserve_size(pos);
+
+      ClientMessageMap::iterator it = client_message_map.find(id);
+      if (it != client_message_map.end())
+        {
+          TRACE_MSG("request " << id);
+          it->second.listener->request_client_message(id, packet);
+        }
+
+      packet.update_size(pos);
+
+      i++;
+    }
+
+  scheduled_messages.clear();
+  scheduled_metric.set(0);
+  next_flush_time = 0;
+
+  TRACE_EXIT();
+}
+
+
+//! Returns whether more than the high-water mark is queued for the specified client.
+bool
+DistributionSocketLink::is_congested(Client *client) const
+{
+  return (write_high_water > 0 && client->socket != NULL &&
+          client->socket->get_queued_bytes() >= write_high_water);
+}
+
+
+//! Broadcasts all scheduled client messages in a single packet.
+/*!
+ *  Clients with more than the high-water mark queued do not receive the
+ *  packet. Their messages are deferred until the socket drained. A newer
+ *  message replaces a deferred message with the same id, so the deferred
+ *  messages of a slow client do not grow.
+ */
+void
+DistributionSocketLink::flush_client_messages()
+{
+  TRACE_ENTER("DistributionSocketLink::flush_client_messages");
+
+  if (clients.empty())
+    {
+      // Nobody is listening.
+      scheduled_messages.clear();
+      scheduled_metric.set(0);
+      next_flush_time = 0;
+    }
+  else if (!scheduled_messages.empty())
+    {
+      int count = scheduled_messages.size();
+
+      PacketBuffer messages;
+      messages.create();
+      pack_scheduled_messages(messages);
+
+      PacketBuffer packet;
+      packet.create();
+      init_packet(packet, PACKET_CLIENTMSG);
+
+      string id = get_master();
+      packet.pack_string(id);
+
+      packet.pack_ushort(count);
+      packet.pack_raw((const guint8 *) messages.get_buffer(), messages.bytes_written());
+
+      DeferredMessageMap batch;
+
+      for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+        {
+          Client *c = *i;
+
+          if (c->socket == NULL)
+            {
+              continue;
+            }
+
+          if (c->deferred_messages.empty() && !is_congested(c))
+            {
+              write_packet(c, packet);
+              continue;
+            }
+
+          if (batch.empty())
+            {
+              split_client_messages(messages, batch);
+            }
+
+          TRACE_MSG("Defer for " << (c->id != NULL ? c->id : "Unknown"));
+          for (DeferredMessageMap::iterator m = batch.begin(); m != batch.end(); m++)
+            {
+              c->deferred_messages[m->first] = m->second;
+            }
+
+          if (!is_congested(c))
+            {
+              send_deferred_messages(c);
+            }
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Splits packed client messages by id.
+void
+DistributionSocketLink::split_client_messages(PacketBuffer &messages, DeferredMessageMap &result)
+{
+  messages.restart_read();
+
+  while (messages.bytes_available() >= 4)
+    {
+      const guint8 *begin = messages.read_ptr;
+      DistributionClientMessageID id = (DistributionClientMessageID) messages.unpack_ushort();
+      int size = messages.unpack_ushort();
+
+      if (size > messages.bytes_available())
+        {
+          break;
+        }
+
+      messages.skip(size);
+      result[id] = string((const char *) begin, messages.read_ptr - begin);
+    }
+}
+
+
+//! Sends the deferred client messages of a client.
+void
+DistributionSocketLink::send_deferred_messages(Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::send_deferred_messages");
+
+  DeferredMessageMap messages;
+  messages.swap(client->deferred_messages);
+
+  if (client->socket != NULL && !messages.empty())
+    {
+      PacketBuffer packet;
+      packet.create();
+      init_packet(packet, PACKET_CLIENTMSG);
+
+      string id = get_master();
+      packet.pack_string(id);
+
+      packet.pack_ushort(messages.size());
+      for (DeferredMessageMap::iterator i = messages.begin(); i != messages.end(); i++)
+        {
+          packet.pack_raw((const guint8 *) i->second.data(), i->second.size());
+        }
+
+      write_packet(client, packet);
+    }
+
+  TRACE_EXIT();
+}
+
+
 //! Handles client message  from a remote client.
 void
 DistributionSocketLink::handle_client_message(PacketBuffer &packet, Client *client)
@@ -2114,14 +2992,13 @@ DistributionSocketLink::handle_client_message(PacketBuffer &packet, Client *clie
 
   // dist_manager->log(_("Reveived client message from client %s:%d."), client->hostname, client->port);
 
-  gchar *id = packet.unpack_string();
+  PacketString id = packet.unpack_string();
 
-  if (id != NULL)
+  if (!id.is_null())
     {
       //TRACE_MSG("id = " << id);
 
       will_i_become_master = client_is_me(id);
-      g_free(id);
     }
 
   gint size = packet.unpack_ushort();
@@ -2137,16 +3014,14 @@ DistributionSocketLink::handle_client_message(PacketBuffer &packet, Client *clie
 
       if (datalen != 0)
         {
-          // Narrow the buffer to the client message data.
-          packet.narrow(-1, datalen);
+          // Share the client message data without copying it.
+          PacketBuffer data = packet.slice(packet.bytes_read(), datalen);
 
           ClientMessageMap::iterator it = client_message_map.find(id);
           if (it != client_message_map.end())
             {
-              client_message_map[id].listener->client_message(id, will_i_become_master, client->id, packet);
+              client_message_map[id].listener->client_message(id, will_i_become_master, client->id, data);
             }
-
-          packet.narrow(0, -1);
         }
 
       packet.skip_size(pos);
@@ -2204,12 +3079,11 @@ DistributionSocketLink::socket_accepted(ISocketServer *scon, ISocket *ccon)
       client->hostname = NULL;
       client->id = NULL;
       client->port = 0;
-      client->reconnect_count = 0;
-      client->reconnect_time = 0;
 
       ccon->set_data(client);
       ccon->set_listener(this);
-      clients.push_back(client);
+      ccon->set_write_limit(write_limit);
+      register_client(client);
 
       send_hello1(client);
     }
@@ -2234,32 +3108,28 @@ DistributionSocketLink::socket_io(ISocket *con, void *data)
       return;
     }
 
-  int bytes_read = 0;
-  int bytes_to_read = 4;
+  PacketBuffer &packet = client->packet;
 
-  TRACE_MSG("2 " << client->packet.bytes_available() );
+  int header = 0;
+  int frame_size = peek_frame_size(packet, header);
 
-  if (client->packet.bytes_available() >= 4)
+  if (frame_size > packet.get_buffer_size() && frame_size <= MAX_PACKET_SIZE)
     {
-      TRACE_MSG("3");
-
-      bytes_to_read = client->packet.peek_ushort(0) - 4;
-
-      TRACE_MSG("4 " << bytes_to_read);
-
-      if (bytes_to_read + 4 > client->packet.get_buffer_size())
-        {
-          TRACE_MSG("5 " << bytes_to_read << " " << client->packet.get_buffer_size());
-          // FIXME: the 1024 is lame...
-          client->packet.resize(bytes_to_read + 4 + 1024);
-        }
+      // Make room for the complete packet.
+      packet.resize(frame_size);
+    }
+  else if (packet.bytes_written() == packet.get_buffer_size())
+    {
+      packet.grow(GROW_SIZE);
     }
 
-  TRACE_MSG("5");
+  int bytes_read = 0;
+  int bytes_to_read = packet.get_buffer_size() - packet.bytes_written();
+
   bool ok = true;
   try
     {
-      con->read(client->packet.get_write_ptr(), bytes_to_read, bytes_read);
+      con->read(packet.get_write_ptr(), bytes_to_read, bytes_read);
     }
   catch (SocketException &)
     {
@@ -2281,12 +3151,43 @@ DistributionSocketLink::socket_io(ISocket *con, void *data)
   else
     {
       g_assert(bytes_read > 0);
-      client->packet.write_ptr += bytes_read;
+      packet.write_ptr += bytes_read;
+      bytes_received_metric.inc(bytes_read);
 
-      if (client->packet.peek_ushort(0) == client->packet.bytes_written())
+      // Process all complete packets that were received.
+      while (ret && (frame_size = peek_frame_size(packet, header)) != 0)
         {
-          process_client_packet(client);
+          TRACE_MSG("size " << frame_size << " " << packet.bytes_available());
+
+          if (frame_size - header < 6 || frame_size > MAX_PACKET_SIZE)
+            {
+              dist_manager->log(_("Client %s sent an invalid packet, closing."),
+                                client->id == NULL ? "Unknown" : client->id);
+              ret = false;
+            }
+          else if (packet.bytes_available() < frame_size)
+            {
+              break;
+            }
+          else
+            {
+              PacketBuffer client_packet = packet.slice(packet.bytes_read() + header,
+                                                        frame_size - header);
+              packet.skip(frame_size);
+
+              packets_received_metric.inc();
+              process_client_packet(client, client_packet);
+
+              if (!is_client_valid(client) || client->socket != con)
+                {
+                  // Client was closed or reconnected.
+                  TRACE_EXIT();
+                  return;
+                }
+            }
         }
+
+      packet.compact();
     }
 
   if (!ret)
@@ -2318,15 +3219,26 @@ DistributionSocketLink::socket_connected(ISocket *con, void *data)
   dist_manager->log(_("Client %s connected."),
                     client->id != NULL ? client->id : "Unknown");
 
-  client->reconnect_count = 0;
-  client->reconnect_time = 0;
+  // Attempts are only reset once the client welcomes us.
+  unschedule_reconnect(client);
   client->outbound = true;
   client->socket = con;
+  client->deferred_messages.clear();
 
   TRACE_EXIT();
 }
 
 
+void
+DistributionSocketLink::socket_drained(ISocket *con, void *data)
+{
+  (void) con;
+  (void) data;
+
+  schedule_stream_pump();
+}
+
+
 void
 DistributionSocketLink::socket_closed(ISocket *con, void *data)
 {
@@ -2385,6 +3297,17 @@ DistributionSocketLink::read_configuration()
 
   reconnect_interval = dist_manager->get_reconnect_interval();
   reconnect_attempts = dist_manager->get_reconnect_attempts();
+  replication_window = dist_manager->get_replication_window();
+  write_high_water = dist_manager->get_write_high_water();
+  write_limit = dist_manager->get_write_limit();
+
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      if ((*i)->socket != NULL)
+        {
+          (*i)->socket->set_write_limit(write_limit);
+        }
+    }
 
   string str;
   str = dist_manager->get_username();
@@ -21,6 +21,8 @@
 
 #include <list>
 #include <map>
+#include <set>
+#include <string.h>
 
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
@@ -44,6 +46,9 @@
 #define DEFAULT_PORT (27273)
 #define DEFAULT_INTERVAL (15)
 #define DEFAULT_ATTEMPTS (5)
+#define DEFAULT_REPLICATION_WINDOW (2)
+#define DEFAULT_WRITE_HIGH_WATER (64 * 1024)
+#define DEFAULT_WRITE_LIMIT (1024 * 1024)
 
 class Configurator;
 
@@ -66,6 +71,8 @@ private:
     PACKET_CLAIM_REJECT = 0x0008,
     PACKET_SIGNOFF      = 0x0009,
     PACKET_HELLO2       = 0x000A,
+    PACKET_CHUNK        = 0x000B,
+    PACKET_CHUNK_RESUME = 0x000C,
   };
 
   enum PacketFlags {
@@ -91,6 +98,51 @@ private:
     }
   };
 
+  //! Client message that is sent in chunks.
+  struct OutgoingStream
+  {
+    OutgoingStream() :
+      id(DCM_IDLELOG),
+      checksum(0),
+      offset(0)
+    {
+    }
+
+    //! ID of the client message.
+    DistributionClientMessageID id;
+
+    //! ID of the master when the stream started.
+    std::string master;
+
+    //! Checksum that identifies the contents.
+    guint32 checksum;
+
+    //! The contents, shared between all receivers.
+    PacketBuffer data;
+
+    //! Number of bytes sent.
+    int offset;
+  };
+
+  //! Client message of which chunks are being received.
+  struct IncomingStream
+  {
+    IncomingStream() :
+      checksum(0),
+      total(0)
+    {
+    }
+
+    //! Checksum that identifies the contents.
+    guint32 checksum;
+
+    //! Size of the contents.
+    int total;
+
+    //! The contents received so far.
+    PacketBuffer data;
+  };
+
   enum ClientType
     {
       CLIENTTYPE_UNKNOWN    = 1,
@@ -99,6 +151,14 @@ private:
       CLIENTTYPE_SIGNEDOFF  = 4,
     };
 
+  struct Client;
+
+  //! Packed client messages, by id.
+  typedef map<DistributionClientMessageID, std::string> DeferredMessageMap;
+
+  //! Clients that must be reconnected, by reconnect time.
+  typedef multimap<time_t, Client *> ReconnectQueue;
+
   struct Client
   {
     Client() :
@@ -112,10 +172,12 @@ private:
       welcome(false),
       reconnect_count(0),
       reconnect_time(0),
+      reconnect_delay(0),
       next_claim_time(0),
       reject_count(0),
       claim_count(0),
-      outbound(false)
+      outbound(false),
+      version(0)
     {
     }
 
@@ -165,9 +227,16 @@ private:
     //! Reconnect counter;
     int reconnect_count;
 
-    //! Last reconnect attempt time;
+    //! Next reconnect attempt time, or 0 if none is scheduled.
     time_t reconnect_time;
 
+    //! Entry in the reconnect queue, if a reconnect is scheduled.
+    ReconnectQueue::iterator reconnect_entry;
+
+    //! Delay before the last reconnect attempt, or 0 if the client was
+    //! welcomed since.
+    int reconnect_delay;
+
     //! Next time we can try to claim from this client;
     time_t next_claim_time;
 
@@ -179,6 +248,15 @@ private:
 
     //! Is this an outbound connection
     bool outbound;
+
+    //! Packet version of the direct connection, or 0 if not known yet.
+    int version;
+
+    //! Client messages that are being streamed to this client.
+    std::list<OutgoingStream> streams;
+
+    //! Packed client messages that wait until the socket drained, by id.
+    DeferredMessageMap deferred_messages;
   };
 
 
@@ -189,9 +267,11 @@ public:
   void init_my_id();
   std::string get_my_id() const;
   int get_number_of_peers();
+  bool has_legacy_peers();
   void set_distribution_manager(DistributionManager *dll);
   void init();
   void heartbeat();
+  time_t get_next_deadline() const;
   bool set_network_enabled(bool enabled);
   bool set_server_enabled(bool enabled);
   void set_user(string user, string password);
@@ -206,21 +286,32 @@ public:
                                IDistributionClientMessage *callback);
   bool unregister_client_message(DistributionClientMessageID id);
   bool broadcast_client_message(DistributionClientMessageID id, PacketBuffer &buffer);
+  bool schedule_client_message(DistributionClientMessageID id);
 
   void socket_accepted(ISocketServer *server, ISocket *con);
   void socket_connected(ISocket *con, void *data);
   void socket_io(ISocket *con, void *data);
   void socket_closed(ISocket *con, void *data);
+  void socket_drained(ISocket *con, void *data);
 
 private:
   bool is_client_valid(Client *client);
+  void register_client(Client *client);
+  void unregister_client(Client *client);
+  void index_client(Client *client);
+  void unindex_client(Client *client);
+  void schedule_reconnect(Client *client);
+  void unschedule_reconnect(Client *client);
+  void reconnect_client(Client *client);
   bool add_client(gchar *id, gchar *host, gint port, ClientType type, Client *peer = NULL);
   void remove_client(Client *client);
   void remove_peer_clients(Client *client);
   void close_client(Client *client, bool reconnect = false);
   Client *find_client_by_canonicalname(gchar *name, gint port);
   Client *find_client_by_id(gchar *id);
+  Client *find_client_by_id(const PacketString &id);
   bool client_is_me(gchar *id);
+  bool client_is_me(const PacketString &id);
   bool exists_client(gchar *id);
 
   bool set_client_id(Client *client, gchar *id);
@@ -234,10 +325,12 @@ private:
   void send_packet_broadcast(PacketBuffer &packet);
   void send_packet_except(PacketBuffer &packet, Client *client);
   void send_packet(Client *client, PacketBuffer &packet);
+  void write_packet(Client *client, PacketBuffer &packet);
+  int peek_frame_size(PacketBuffer &packet, int &header);
   void forward_packet_except(PacketBuffer &packet, Client *client, Client *source);
   void forward_packet(PacketBuffer &packet, Client *dest, Client *source);
 
-  void process_client_packet(Client *client);
+  void process_client_packet(Client *client, PacketBuffer &packet);
   void handle_hello1(PacketBuffer &packet, Client *client);
   void handle_hello2(PacketBuffer &packet, Client *client);
   void handle_signoff(PacketBuffer &packet, Client *client);
@@ -248,6 +341,8 @@ private:
   void handle_new_master(PacketBuffer &packet, Client *client);
   void handle_client_message(PacketBuffer &packet, Client *client);
   void handle_claim_reject(PacketBuffer &packet, Client *client);
+  void handle_chunk(PacketBuffer &packet, Client *client, Client *direct);
+  void handle_chunk_resume(PacketBuffer &packet, Client *client);
 
   void send_hello1(Client *client);
   void send_hello2(Client *client, gchar *rnd);
@@ -259,6 +354,18 @@ private:
   void send_new_master(Client *client = NULL);
   void send_claim_reject(Client *client);
   void send_client_message(DistributionClientMessageType type);
+  void pack_scheduled_messages(PacketBuffer &packet);
+  bool is_congested(Client *client) const;
+  void split_client_messages(PacketBuffer &messages, DeferredMessageMap &result);
+  void send_deferred_messages(Client *client);
+  void flush_client_messages();
+  void start_stream(DistributionClientMessageID id, PacketBuffer &data);
+  void send_chunk(Client *client, OutgoingStream &stream);
+  void send_chunk_resume(Client *client, DistributionClientMessageID id, guint32 checksum, int offset);
+  void schedule_stream_pump();
+  void remove_incoming_streams(Client *client);
+  void pump_streams();
+  static gboolean static_pump_streams(gpointer data);
 
   bool start_async_server();
 
@@ -268,7 +375,38 @@ private:
   std::string get_random_string() const;
   
 private:
+  //! Orders client ids in packets and clients without copying them.
+  struct ClientIdLess
+  {
+    bool operator()(const PacketString &a, const PacketString &b) const
+    {
+      if (a.get_length() != b.get_length())
+        {
+          return a.get_length() < b.get_length();
+        }
+      return memcmp(a.get_data(), b.get_data(), a.get_length()) < 0;
+    }
+  };
+
+  typedef multimap<PacketString, Client *, ClientIdLess> ClientIdMap;
+  typedef multimap<pair<std::string, gint>, Client *> ClientAddressMap;
   typedef map<DistributionClientMessageID, ClientMessageListener> ClientMessageMap;
+  typedef map<std::string, IncomingStream> IncomingStreamMap;
+
+  //! Packet version. Version 4 adds large frames and streams.
+  static const int PACKET_VERSION = 4;
+
+  //! Largest packet that fits in a frame with a 16 bit length.
+  static const int MAX_SMALL_PACKET_SIZE = 0xffff;
+
+  //! Largest packet that is accepted.
+  static const int MAX_PACKET_SIZE = 16 * 1024 * 1024;
+
+  //! Number of bytes sent in a single chunk of a stream.
+  static const int STREAM_CHUNK_SIZE = 16 * 1024;
+
+  //! Number of seconds before the first reconnect attempt.
+  static const int MIN_RECONNECT_DELAY = 5;
 
   //! The distribution manager.
   DistributionManager *dist_manager;
@@ -290,6 +428,18 @@ private:
   //! All clients.
   list<Client *> clients;
 
+  //! All clients, for validity checks.
+  set<Client *> client_set;
+
+  //! Clients by id. Duplicates are kept in the order they were added.
+  ClientIdMap clients_by_id;
+
+  //! Clients by canonical name and port.
+  ClientAddressMap clients_by_address;
+
+  //! Clients that must be reconnected.
+  ReconnectQueue reconnect_queue;
+
   //! Active client
   Client *master_client;
 
@@ -321,11 +471,32 @@ private:
   //!
   int reconnect_attempts;
 
-  //!
+  //! Maximum number of seconds between reconnect attempts of a client.
   int reconnect_interval;
 
-  //!
-  int heartbeat_count;
+  //! Next time the master state is distributed.
+  time_t next_distribute_time;
+
+  //! Client messages that are broadcast in the next batch.
+  list<DistributionClientMessageID> scheduled_messages;
+
+  //! Time at which the scheduled client messages are broadcast, or 0 if none.
+  time_t next_flush_time;
+
+  //! Number of seconds during which scheduled client messages are batched.
+  int replication_window;
+
+  //! Number of queued bytes for a client above which its client messages are deferred.
+  int write_high_water;
+
+  //! Maximum number of queued bytes before a client is dropped.
+  int write_limit;
+
+  //! Client messages that are being received in chunks, by source and message.
+  IncomingStreamMap incoming_streams;
+
+  //! Idle source that sends the next chunks of all streams.
+  guint stream_pump_id;
 };
 
 #endif // DISTRIBUTIONSOCKETLINK_HH
@@ -108,30 +108,44 @@ GIOSocket::static_connected_callback(GObject *source_object,
 {
   TRACE_ENTER("GIOSocketServer::static_connected_callback");
 
-  GIOSocket *socket = (GIOSocket *)user_data;
   GError *error = NULL;
 
   GSocketConnection *socket_connection =
     g_socket_client_connect_finish(G_SOCKET_CLIENT(source_object), result, &error);
 
-  if (error != NULL)
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
     {
-      TRACE_MSG("failed to connect");
+      // The socket was deleted.
+      TRACE_MSG("cancelled");
       g_error_free(error);
+      TRACE_EXIT();
+      return;
+    }
+
+  GIOSocket *socket = (GIOSocket *)user_data;
+
+  if (error != NULL || socket_connection == NULL)
+    {
+      TRACE_MSG("failed to connect");
+      if (error != NULL)
+        {
+          g_error_free(error);
+        }
+
+      // The listener may delete the socket.
+      if (socket->listener != NULL)
+        {
+          socket->listener->socket_closed(socket, socket->user_data);
+        }
     }
-  else if (socket_connection != NULL)
+  else
     {
       socket->connection = socket_connection;
       socket->socket = g_socket_connection_get_socket(socket->connection);
       g_socket_set_blocking(socket->socket, FALSE);
       g_socket_set_keepalive(socket->socket, TRUE);
 
-      socket->source = g_socket_create_source(socket->socket,
-                                              (GIOCondition) (G_IO_IN | G_IO_ERR | G_IO_HUP),
-                                              NULL);
-      g_source_set_callback(socket->source, reinterpret_cast<GSourceFunc>(static_data_callback), (void*)socket, NULL);
-      g_source_attach(socket->source, NULL);
-      // g_source_unref(source);
+      socket->watch_input();
 
       if (socket->listener != NULL)
         {
@@ -188,10 +202,82 @@ GIOSocket::static_data_callback(GSocket *socket,
   return ret;
 }
 
+
+gboolean
+GIOSocket::static_write_callback(GSocket *socket,
+                                 GIOCondition condition,
+                                 gpointer user_data)
+{
+  TRACE_ENTER_MSG("GIOSocket::static_write_callback", (int)condition);
+
+  GIOSocket *giosocket = (GIOSocket *)user_data;
+  gboolean ret = TRUE;
+
+  (void) socket;
+  (void) condition;
+
+  try
+    {
+      giosocket->flush();
+      giosocket->update_watches();
+      ret = giosocket->out_source != NULL;
+
+      if (!ret && giosocket->listener != NULL)
+        {
+          giosocket->listener->socket_drained(giosocket, giosocket->user_data);
+        }
+    }
+  catch(...)
+    {
+      // Make sure that no exception reach the glib mainloop.
+      TRACE_MSG("Exception. Closing socket");
+      giosocket->close();
+      if (giosocket->listener != NULL)
+        {
+          giosocket->listener->socket_closed(giosocket, giosocket->user_data);
+        }
+      ret = FALSE;
+    }
+  TRACE_EXIT();
+  return ret;
+}
+
+
+gboolean
+GIOSocket::static_dropped_callback(gpointer user_data)
+{
+  TRACE_ENTER("GIOSocket::static_dropped_callback");
+
+  GIOSocket *giosocket = (GIOSocket *)user_data;
+  giosocket->dropped_id = 0;
+
+  try
+    {
+      if (giosocket->listener != NULL)
+        {
+          giosocket->listener->socket_closed(giosocket, giosocket->user_data);
+        }
+    }
+  catch(...)
+    {
+      // Make sure that no exception reach the glib mainloop.
+    }
+  TRACE_EXIT();
+  return FALSE;
+}
+
+
 //! Creates a new connection.
 GIOSocket::GIOSocket(GSocketConnection *connection) :
   connection(connection),
-  resolver(NULL)
+  resolver(NULL),
+  cancellable(NULL),
+  source(NULL),
+  port(0),
+  out_source(NULL),
+  out_offset(0),
+  out_queued(0),
+  dropped_id(0)
 {
   TRACE_ENTER("GIOSocket::GIOSocket(con)");
   socket = g_socket_connection_get_socket(connection);
@@ -200,10 +286,7 @@ GIOSocket::GIOSocket(GSocketConnection *connection) :
   g_socket_set_blocking(socket, FALSE);
   g_socket_set_keepalive(socket, TRUE);
 
-  source = g_socket_create_source(socket, (GIOCondition)G_IO_IN, NULL);
-  g_source_set_callback(source, reinterpret_cast<GSourceFunc>(static_data_callback), (void*)this, NULL);
-  g_source_attach(source, NULL);
-  g_source_unref(source);
+  watch_input();
   TRACE_EXIT();
 }
 
@@ -213,8 +296,13 @@ GIOSocket::GIOSocket() :
   connection(NULL),
   socket(NULL),
   resolver(NULL),
+  cancellable(NULL),
   source(NULL),
-  port(0)
+  port(0),
+  out_source(NULL),
+  out_offset(0),
+  out_queued(0),
+  dropped_id(0)
 {
   TRACE_ENTER("GIOSocket::GIOSocket()");
   TRACE_EXIT();
@@ -225,6 +313,22 @@ GIOSocket::GIOSocket() :
 GIOSocket::~GIOSocket()
 {
   TRACE_ENTER("GIOSocket::~GIOSocket");
+  if (dropped_id != 0)
+    {
+      g_source_remove(dropped_id);
+    }
+  if (out_source != NULL)
+    {
+      g_source_destroy(out_source);
+      g_source_unref(out_source);
+    }
+  unwatch_input();
+
+  if (cancellable != NULL)
+    {
+      g_cancellable_cancel(cancellable);
+      g_object_unref(cancellable);
+    }
   if (connection != NULL)
     {
       g_object_unref(connection);
@@ -233,10 +337,6 @@ GIOSocket::~GIOSocket()
     {
       g_object_unref(resolver);
     }
-  if (source != NULL)
-    {
-      g_source_destroy(source);
-    }
   TRACE_EXIT();
 }
 
@@ -248,6 +348,11 @@ GIOSocket::connect(const string &host, int port)
   TRACE_ENTER_MSG("GIOSocket::connect", host << " " << port);
   this->port = port;
 
+  if (cancellable == NULL)
+    {
+      cancellable = g_cancellable_new();
+    }
+
   GInetAddress *inet_addr = g_inet_address_new_from_string(host.c_str());
   if (inet_addr != NULL)
     {
@@ -259,7 +364,7 @@ GIOSocket::connect(const string &host, int port)
       resolver = g_resolver_get_default();
       g_resolver_lookup_by_name_async(resolver,
                                       host.c_str(),
-                                      NULL,
+                                      cancellable,
                                       static_connect_after_resolve,
                                       this);
 
@@ -276,9 +381,13 @@ GIOSocket::connect(GInetAddress *inet_addr, int port)
 
   g_socket_client_connect_async(socket_client,
                                 G_SOCKET_CONNECTABLE(socket_address),
-                                NULL,
+                                cancellable,
                                 static_connected_callback,
                                 this);
+
+  // The pending connect holds its own references.
+  g_object_unref(socket_client);
+  g_object_unref(socket_address);
   TRACE_EXIT();
 }
 
@@ -289,22 +398,38 @@ GIOSocket::static_connect_after_resolve(GObject *source_object, GAsyncResult *re
   GError *error = NULL;
   GList *addresses = g_resolver_lookup_by_name_finish((GResolver *)source_object, res, &error);
 
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      // The socket was deleted.
+      TRACE_MSG("cancelled");
+      g_error_free(error);
+      TRACE_EXIT();
+      return;
+    }
+
+  GIOSocket *socket = (GIOSocket *) user_data;
+
   if (error != NULL)
     {
       TRACE_MSG("failed");
       g_error_free(error);
     }
 
-  if (addresses != NULL)
+  if (addresses != NULL && addresses->data != NULL)
     {
       // Take first result
-      if (addresses->data != NULL)
-        {
-          GInetAddress *a = (GInetAddress *) addresses->data;
-          GIOSocket *socket = (GIOSocket *) user_data;
-          socket->connect(a, socket->port);
-        }
-       g_resolver_free_addresses(addresses);
+      GInetAddress *a = (GInetAddress *) addresses->data;
+      socket->connect(a, socket->port);
+    }
+  else if (socket->listener != NULL)
+    {
+      // The listener may delete the socket.
+      socket->listener->socket_closed(socket, socket->user_data);
+    }
+
+  if (addresses != NULL)
+    {
+      g_resolver_free_addresses(addresses);
     }
   TRACE_EXIT();
 }
@@ -335,20 +460,65 @@ GIOSocket::read(void *buf, int count, int &bytes_read)
 
 
 //! Write to the connection.
+/*!
+ *  Data is sent immediately if nothing is queued. Whatever the socket does
+ *  not accept is queued and sent once the socket becomes writable, so that
+ *  packets are never truncated.
+ */
 void
 GIOSocket::write(void *buf, int count, int &bytes_written)
 {
-  GError *error = NULL;
-  gsize num_written = 0;
-  if (socket != NULL)
+  bytes_written = 0;
+  if (socket == NULL)
+    {
+      return;
+    }
+
+  int offset = 0;
+  if (out_queue.empty())
     {
-      num_written = g_socket_send(socket, (char *)buf, count, NULL, &error);
+      GError *error = NULL;
+      gssize num_written = g_socket_send(socket, (char *)buf, count, NULL, &error);
       if (error != NULL)
         {
-          throw SocketException(string("socket write error: ") + error->message);
+          if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              string msg = error->message;
+              g_error_free(error);
+              throw SocketException(string("socket write error: ") + msg);
+            }
+          g_error_free(error);
+        }
+      else
+        {
+          offset = (int) num_written;
         }
     }
-  bytes_written = (int) num_written;
+
+  if (offset < count && write_limit > 0 && out_queued + count - offset > write_limit)
+    {
+      TRACE_ENTER_MSG("GIOSocket::write", "queue full " << out_queued);
+      drop();
+      TRACE_EXIT();
+      throw SocketException("socket write queue full");
+    }
+
+  if (offset < count)
+    {
+      out_queue.push_back(string((char *)buf + offset, count - offset));
+      out_queued += count - offset;
+      update_watches();
+    }
+
+  bytes_written = count;
+}
+
+
+//! Returns the number of bytes that are queued for sending.
+int
+GIOSocket::get_queued_bytes() const
+{
+  return out_queued;
 }
 
 
@@ -358,6 +528,17 @@ GIOSocket::close()
 {
   TRACE_ENTER("GIOSocket::close");
   GError *error = NULL;
+
+  if (out_source != NULL)
+    {
+      g_source_destroy(out_source);
+      g_source_unref(out_source);
+      out_source = NULL;
+    }
+  out_queue.clear();
+  out_offset = 0;
+  out_queued = 0;
+
   if (socket != NULL)
     {
       g_socket_shutdown(socket, TRUE, TRUE, &error);
@@ -367,6 +548,139 @@ GIOSocket::close()
   TRACE_EXIT();
 }
 
+
+//! Starts reading from the socket.
+void
+GIOSocket::watch_input()
+{
+  source = g_socket_create_source(socket,
+                                  (GIOCondition) (G_IO_IN | G_IO_ERR | G_IO_HUP),
+                                  NULL);
+  g_source_set_callback(source, reinterpret_cast<GSourceFunc>(static_data_callback), (void*)this, NULL);
+  g_source_attach(source, NULL);
+}
+
+
+//! Stops reading from the socket.
+void
+GIOSocket::unwatch_input()
+{
+  if (source != NULL)
+    {
+      g_source_destroy(source);
+      g_source_unref(source);
+      source = NULL;
+    }
+}
+
+
+//! Sends as much queued data as the socket accepts.
+/*!
+ *  Consecutive queued buffers are coalesced into a single vectored write.
+ */
+void
+GIOSocket::flush()
+{
+  while (socket != NULL && !out_queue.empty())
+    {
+      GOutputVector vectors[MAX_WRITE_VECTORS];
+      int num_vectors = 0;
+
+      for (deque<string>::iterator i = out_queue.begin();
+           i != out_queue.end() && num_vectors < MAX_WRITE_VECTORS;
+           i++, num_vectors++)
+        {
+          size_t skip = num_vectors == 0 ? out_offset : 0;
+          vectors[num_vectors].buffer = i->data() + skip;
+          vectors[num_vectors].size = i->size() - skip;
+        }
+
+      GError *error = NULL;
+      gssize num_written = g_socket_send_message(socket, NULL, vectors, num_vectors,
+                                                 NULL, 0, 0, NULL, &error);
+      if (error != NULL)
+        {
+          if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_error_free(error);
+              break;
+            }
+
+          string msg = error->message;
+          g_error_free(error);
+          throw SocketException(string("socket write error: ") + msg);
+        }
+
+      consume(num_written);
+    }
+}
+
+
+//! Removes sent data from the queue.
+void
+GIOSocket::consume(gssize count)
+{
+  out_queued -= (int) count;
+
+  while (count > 0)
+    {
+      gssize remaining = (gssize) (out_queue.front().size() - out_offset);
+      if (count >= remaining)
+        {
+          count -= remaining;
+          out_queue.pop_front();
+          out_offset = 0;
+        }
+      else
+        {
+          out_offset += count;
+          count = 0;
+        }
+    }
+}
+
+
+//! Watches for writability while data is queued.
+void
+GIOSocket::update_watches()
+{
+  if (socket == NULL)
+    {
+      return;
+    }
+
+  if (!out_queue.empty() && out_source == NULL)
+    {
+      out_source = g_socket_create_source(socket, G_IO_OUT, NULL);
+      g_source_set_callback(out_source, reinterpret_cast<GSourceFunc>(static_write_callback), (void*)this, NULL);
+      g_source_attach(out_source, NULL);
+    }
+  else if (out_queue.empty() && out_source != NULL)
+    {
+      g_source_destroy(out_source);
+      g_source_unref(out_source);
+      out_source = NULL;
+    }
+}
+
+
+//! Drops the connection to a peer that does not keep up.
+/*!
+ *  The listener is notified from the main loop, because the connection is
+ *  usually dropped while the listener is sending.
+ */
+void
+GIOSocket::drop()
+{
+  close();
+
+  if (dropped_id == 0)
+    {
+      dropped_id = g_idle_add(static_dropped_callback, this);
+    }
+}
+
+
 //! Create a new socket
 ISocket *
 GIOSocketDriver::create_socket()
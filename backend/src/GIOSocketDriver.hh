@@ -21,6 +21,9 @@
 
 #if defined(HAVE_GIO_NET) && defined(HAVE_DISTRIBUTION)
 
+#include <string>
+#include <deque>
+
 #include <glib.h>
 #include <glib-object.h>
 #include <gio/gio.h>
@@ -65,10 +68,17 @@ public:
   virtual void connect(const std::string &hostname, int port);
   virtual void read(void *buf, int count, int &bytes_read);
   virtual void write(void *buf, int count, int &bytes_written);
+  virtual int get_queued_bytes() const;
   virtual void close();
 
 private:
   void connect(GInetAddress *inet_addr, int port);
+  void watch_input();
+  void unwatch_input();
+  void flush();
+  void consume(gssize count);
+  void update_watches();
+  void drop();
 
   static void static_connect_after_resolve(GObject *source_object, GAsyncResult *res, gpointer user_data);
 
@@ -80,12 +90,40 @@ private:
                                    GIOCondition condition,
                                    gpointer user_data);
 
+  static gboolean static_write_callback(GSocket *socket,
+                                        GIOCondition condition,
+                                        gpointer user_data);
+
+  static gboolean static_dropped_callback(gpointer user_data);
+
 private:
+  //! Maximum number of queued buffers sent in a single write.
+  static const int MAX_WRITE_VECTORS = 16;
+
   GSocketConnection *connection;
   GSocket *socket;
   GResolver *resolver;
+
+  //! Cancels a pending resolve or connect when the socket is deleted.
+  GCancellable *cancellable;
+
   GSource *source;
   int port;
+
+  //! Watches the socket for writability while data is queued.
+  GSource *out_source;
+
+  //! Data that could not be sent yet.
+  std::deque<std::string> out_queue;
+
+  //! Number of bytes of the first queued buffer that were already sent.
+  size_t out_offset;
+
+  //! Total number of queued bytes not yet sent.
+  int out_queued;
+
+  //! Idle source that reports a dropped connection.
+  guint dropped_id;
 };
 
 
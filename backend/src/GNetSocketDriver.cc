@@ -302,6 +302,17 @@ GNetSocket::write(void *buf, int count, int &bytes_written)
 }
 
 
+//! Returns the number of bytes that are queued for sending.
+/*!
+ *  GNet sockets do not queue outgoing data.
+ */
+int
+GNetSocket::get_queued_bytes() const
+{
+  return 0;
+}
+
+
 //! Close the connection.
 void
 GNetSocket::close()
@@ -71,6 +71,7 @@ public:
   virtual void connect(const std::string &hostname, int port);
   virtual void read(void *buf, int count, int &bytes_read);
   virtual void write(void *buf, int count, int &bytes_written);
+  virtual int get_queued_bytes() const;
   virtual void close();
 
 private:
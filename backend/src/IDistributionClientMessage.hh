@@ -28,6 +28,7 @@ enum DistributionClientMessageID
     DCM_IDLELOG = 0x0012,
     DCM_SCRIPT  = 0x0013,
     DCM_CONFIG  = 0x0014,
+    DCM_TIMERS_DELTA = 0x0015,
     DCM_BREAKS  = 0x0020,
     DCM_STATS   = 0x0030,
     DCM_BREAKCONTROL = 0x0040,
@@ -38,6 +39,9 @@ enum DistributionClientMessageType
     DCMT_PASSIVE  = 0x0000,
     DCMT_MASTER   = 0x0010,
     DCMT_SIGNON   = 0x0020,
+
+    //! The message can be large and is streamed in chunks.
+    DCMT_STREAM   = 0x1000,
   };
 
 
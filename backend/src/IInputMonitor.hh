@@ -46,6 +46,9 @@ public:
 
   //! Unsubscribe for statistics monitor.
   virtual void unsubscribe_statistics(IInputMonitorListener *listener) = 0;
+
+  //! Delivers all pending input events to the listeners.
+  virtual void flush() = 0;
 };
 
 #endif // IINPUTMONITOR_HH
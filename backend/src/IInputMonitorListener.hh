@@ -20,7 +20,34 @@
 #ifndef INPUTMONITORLISTENER_HH
 #define INPUTMONITORLISTENER_HH
 
-#include <string>
+#include <glib.h>
+
+//! Compact record of a single input event.
+struct InputEvent
+{
+  enum Type
+    {
+      INPUT_EVENT_ACTION,
+      INPUT_EVENT_MOUSE,
+      INPUT_EVENT_BUTTON,
+      INPUT_EVENT_KEYBOARD,
+    };
+
+  //! Type of the event.
+  guint8 type;
+
+  //! Button is pressed (button) or key repeat (keyboard).
+  guint8 flag;
+
+  //! Mouse wheel delta.
+  gint16 wheel;
+
+  //! Mouse X coordinate
+  gint32 x;
+
+  //! Mouse Y coordinate
+  gint32 y;
+};
 
 //! Listener for events from the input monitor.
 class IInputMonitorListener
@@ -28,17 +55,16 @@ class IInputMonitorListener
 public:
   virtual ~IInputMonitorListener() {}
 
-  //! Generic user activity (if no details info is available)
-  virtual void action_notify() = 0;
-
-  //! Reports mouse movement activity
-  virtual void mouse_notify(int x, int y, int wheel = 0) = 0;
-
-  //! Reports mouse button activity
-  virtual void button_notify(bool is_press) = 0;
-
-  //! Reports keyboard activity
-  virtual void keyboard_notify(bool repeat) = 0;
+  //! Reports a batch of input events.
+  /*!
+   *  Events are collected by the input monitor and delivered from the
+   *  main loop in order of arrival.
+   *
+   *  \param events the events.
+   *  \param count number of events.
+   *  \param time the (wall clock) time in usec at which the batch was collected.
+   */
+  virtual void input_notify(const InputEvent *events, int count, gint64 time) = 0;
 };
 
 #endif // IINPUTMONITORLISTENER_HH
@@ -29,6 +29,7 @@
 #include "debug.hh"
 #include <fstream>
 #include <sstream>
+#include <string.h>
 #include <assert.h>
 
 #ifdef HAVE_UNISTD_H
@@ -39,19 +40,37 @@
 #include "IdleLogManager.hh"
 #include "TimeSource.hh"
 #include "PacketBuffer.hh"
+#include "StateWriter.hh"
+#include "Metrics.hh"
+#include "Varint.hh"
 
 #define IDLELOG_MAXSIZE     (4000)
 #define IDLELOG_MAXAGE    (12 * 60 * 60)
 #define IDLELOG_INTERVAL    (30 * 60)
 #define IDLELOG_VERSION   (3)
 #define IDLELOG_INTERVAL_SIZE (17)
+#define IDLELOG_FILE_VERSION (2)
+#define IDLELOG_COMPACT_SIZE (2 * IDLELOG_MAXSIZE)
+#define IDLELOG_CHECKPOINT_INTERVAL (64)
+#define IDLELOG_TAIL_SIZE (20)
+
+static const char IDLELOG_MAGIC[4] = { 'W', 'R', 'I', 'L' };
+static const guint32 IDLELOG_HEADER_SIZE = sizeof(IDLELOG_MAGIC) + 1;
+
+static Metrics::Counter index_save_metric("workrave_idlelog_index_saves_total",
+                                          "Number of times the idlelog index was saved");
+static Metrics::Counter rewrite_metric("workrave_idlelog_rewrites_total",
+                                       "Number of times an idlelog file was rewritten");
+static Metrics::Counter append_metric("workrave_idlelog_appends_total",
+                                      "Number of idle intervals appended to an idlelog file");
 
 
 //! Constructs a new idlelog manager.
-IdleLogManager::IdleLogManager(string myid, const TimeSource *time_source)
+IdleLogManager::IdleLogManager(string myid, const TimeSource *time_source, StateWriter *writer)
 {
   this->myid = myid;
   this->time_source = time_source;
+  this->state_writer = writer;
   this->last_expiration_time = 0;
 }
 
@@ -127,6 +146,7 @@ IdleLogManager::init()
       myinfo.current_interval = IdleInterval(1, time_source->get_time());
       myinfo.client_id = myid;
 
+      rebuild_common_idle();
       save();
     }
   else
@@ -143,7 +163,17 @@ IdleLogManager::init()
 void
 IdleLogManager::terminate()
 {
-  save();
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = (*i).second;
+      if (!info.idlelog.empty() && info.idlelog.front().to_be_saved)
+        {
+          update_idlelog(info, info.idlelog.front());
+          info.idlelog.front().to_be_saved = false;
+        }
+    }
+
+  save_index();
 }
 
 
@@ -172,37 +202,28 @@ IdleLogManager::expire()
 void
 IdleLogManager::expire(ClientInfo &info)
 {
-  if (info.idlelog.size() > IDLELOG_MAXSIZE)
-    {
-      info.idlelog.resize(IDLELOG_MAXSIZE);
-    }
-
   time_t current_time = time_source->get_time();
-  int count = 0;
-  for (IdleLogRIter i = info.idlelog.rbegin(); i != info.idlelog.rend(); i++)
+
+  while (!info.idlelog.empty() &&
+         info.idlelog.back().end_idle_time < current_time - IDLELOG_MAXAGE)
     {
-      IdleInterval &idle = info.idlelog.back();
-      if (idle.end_idle_time < current_time - IDLELOG_MAXAGE)
-        {
-          count++;
-        }
-      else
-        {
-          break;
-        }
+      expire_common_idle(info.idlelog.back().end_idle_time);
+      info.idlelog.pop_back();
     }
+}
+
 
-  if (count != 0)
+//! Adds a new idle interval to the idle log of a single client.
+void
+IdleLogManager::push_idlelog(ClientInfo &info, const IdleInterval &idle)
+{
+  if (info.idlelog.is_full())
     {
-      if (info.idlelog.size() > (size_t)count)
-        {
-          info.idlelog.resize(info.idlelog.size() - count);
-        }
-      else
-        {
-          info.idlelog.clear();
-        }
+      expire_common_idle(info.idlelog.back().end_idle_time);
     }
+
+  info.idlelog.push_front(idle);
+  update_common_idle(info);
 }
 
 
@@ -242,7 +263,7 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
 
           // Push current
           info.current_interval.to_be_saved = true;
-          info.idlelog.push_front(info.current_interval);
+          push_idlelog(info, info.current_interval);
 
           // create a new (empty) idle interval.
           info.current_interval = IdleInterval(current_time, current_time);
@@ -285,9 +306,19 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
 
               if (oldidle.to_be_saved)
                 {
+                  // The interval may be part of the most recent common
+                  // idle period.
+                  bool rebuild = (!common_idle.empty() &&
+                                  common_idle.back().end_time > oldidle.begin_time);
+
                   info.current_interval = oldidle;
                   info.idlelog.pop_front();
                   idle = &(info.current_interval);
+
+                  if (rebuild)
+                    {
+                      rebuild_common_idle();
+                    }
                 }
             }
 
@@ -335,117 +366,51 @@ IdleLogManager::compute_active_time(int length)
 
   time_t current_time = time_source->get_time();
 
-  // Number of client.
-  int size = clients.size();
-
-  // Data for each client.
-  IdleLogIter *iterators = new IdleLogIter[size];
-  IdleLogIter *end_iterators = new IdleLogIter[size];
-  bool *at_end = new bool[size];
-  time_t *active_time = new time_t[size];
-
-  // Init data for all clients.
-  int count = 0;
   for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
       ClientInfo &info = (*i).second;
-
-      iterators[count] = info.idlelog.begin();
-      end_iterators[count] = info.idlelog.end();
-      active_time[count] = 0;
-      at_end[count] = true;
-
       info.update_active_time(current_time);
-      count++;
     }
 
-
-  // Number of simultaneous idle periods.
-  int idle_count = 0;
-
-  // Time of last unprocessed event.
-  time_t last_time = -1;
-
-  // Iterator of last unprocessed event.
-  int last_iter = -1;
-
-  // Stop criterium
-  bool stop = false;
-
-  // Begin and End time of idle perdiod.
-  time_t end_idle_time = -1;
-
-  while (!stop)
+  // Find the most recent common idle period that is long enough. The
+  // lengths of the common idle periods decrease from oldest to newest.
+  int low = 0;
+  int high = common_idle.size();
+  while (low < high)
     {
-      // Find latest event.
-      last_time = -1;
-      for (int i = 0; i < size; i ++)
+      int mid = low + (high - low) / 2;
+      if (common_idle[mid].length() > length)
         {
-          if (iterators[i] != end_iterators[i])
-            {
-              IdleInterval &ii = *(iterators[i]);
-              time_t t = at_end[i] ? ii.end_idle_time : ii.begin_time;
-
-              if (last_time == -1 || t > last_time)
-                {
-                  last_time = t;
-                  last_iter = i;
-                }
-            }
-        }
-
-      // Did we found one?
-      if (last_time != -1)
-        {
-          IdleInterval &ii = *(iterators[last_iter]);
-          if (at_end[last_iter])
-            {
-              TRACE_MSG("End time " << ii.end_idle_time << " active " << ii.active_time);
-              idle_count++;
-
-              at_end[last_iter] = false;
-              active_time[last_iter] += ii.active_time;
-              end_idle_time = ii.end_idle_time;
-            }
-          else
-            {
-              TRACE_MSG("Begin time " << ii.begin_time);
-
-              at_end[last_iter] = true;
-              iterators[last_iter]++;
-
-              if (idle_count == size)
-                {
-                  TRACE_MSG("Common idle period of " << (end_idle_time - ii.begin_time));
-                  if ((end_idle_time - ii.begin_time) > length)
-                    {
-                      stop = true;
-                    }
-                }
-
-              idle_count--;
-            }
+          low = mid + 1;
         }
       else
         {
-          stop = true;
+          high = mid;
         }
     }
 
   time_t total_active_time = 0;
-  for (int i = 0; i < size; i++)
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
-      TRACE_MSG("active time of " << i << " = " << active_time[i]);
-      total_active_time += active_time[i];
-    }
+      IdleLog &idlelog = (*i).second.idlelog;
 
-  TRACE_MSG("total = " << total_active_time);
+      int num = idlelog.size();
+      if (low > 0)
+        {
+          const CommonIdle &idle = common_idle[low - 1];
+          TRACE_MSG("Common idle period of " << idle.length());
+
+          // Active time since the idle interval of this client that
+          // covers the common idle period.
+          num = idlelog.count_ending_after(idle.end_time);
+        }
 
-  delete [] iterators;
-  delete [] end_iterators;
-  delete [] at_end;
-  delete [] active_time;
+      time_t active_time = idlelog.get_active_time(num);
+      TRACE_MSG("active time of " << (*i).first << " = " << active_time);
+      total_active_time += active_time;
+    }
 
+  TRACE_MSG("total = " << total_active_time);
   TRACE_EXIT();
   return total_active_time;
 }
@@ -467,6 +432,11 @@ IdleLogManager::compute_idle_time()
       ClientInfo &info = (*i).second;
       info.update_active_time(current_time);
 
+      if (info.idlelog.empty())
+        {
+          continue;
+        }
+
       IdleInterval &idle = info.idlelog.front();
       if (idle.active_time == 0)
         {
@@ -492,6 +462,144 @@ IdleLogManager::compute_idle_time()
 }
 
 
+//! Adds a common idle period that is more recent than all known periods.
+void
+IdleLogManager::add_common_idle(const CommonIdle &idle)
+{
+  // Older periods that are not longer will never be the most recent
+  // period of a certain minimum length.
+  while (!common_idle.empty() && common_idle.back().length() <= idle.length())
+    {
+      common_idle.pop_back();
+    }
+
+  common_idle.push_back(idle);
+}
+
+
+//! Removes the common idle periods that end before the specified time.
+void
+IdleLogManager::expire_common_idle(time_t time)
+{
+  while (!common_idle.empty() && common_idle.front().end_time <= time)
+    {
+      common_idle.pop_front();
+    }
+}
+
+
+//! Adds the common idle periods that are closed by the most recent interval of a client.
+void
+IdleLogManager::update_common_idle(ClientInfo &info)
+{
+  TRACE_ENTER_MSG("IdleLogManager::update_common_idle", info.client_id);
+
+  const IdleInterval &idle = info.idlelog.front();
+
+  CommonIdleList periods;
+  periods.push_back(CommonIdle(idle.begin_time, idle.end_idle_time));
+
+  for (ClientMapIter i = clients.begin(); i != clients.end() && !periods.empty(); i++)
+    {
+      if (&(*i).second != &info)
+        {
+          intersect_idlelog(periods, (*i).second.idlelog);
+        }
+    }
+
+  for (CommonIdleList::iterator i = periods.begin(); i != periods.end(); i++)
+    {
+      if (i->length() > 0)
+        {
+          TRACE_MSG("Common idle " << i->begin_time << " " << i->end_time);
+          add_common_idle(*i);
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Recomputes all common idle periods from the idle logs of all clients.
+void
+IdleLogManager::rebuild_common_idle()
+{
+  TRACE_ENTER("IdleLogManager::rebuild_common_idle");
+
+  common_idle.clear();
+
+  CommonIdleList periods;
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      IdleLog &idlelog = (*i).second.idlelog;
+
+      if (i == clients.begin())
+        {
+          for (int j = idlelog.size() - 1; j >= 0; j--)
+            {
+              periods.push_back(CommonIdle(idlelog[j].begin_time, idlelog[j].end_idle_time));
+            }
+        }
+      else
+        {
+          intersect_idlelog(periods, idlelog);
+        }
+    }
+
+  for (CommonIdleList::iterator i = periods.begin(); i != periods.end(); i++)
+    {
+      if (i->length() > 0)
+        {
+          add_common_idle(*i);
+        }
+    }
+
+  TRACE_RETURN(common_idle.size());
+}
+
+
+//! Restricts the specified periods to the idle intervals of a client.
+/*!
+ *  Both the periods and the idle intervals must be sorted and must not
+ *  overlap. Only idle intervals that end after the start of the oldest
+ *  period are visited.
+ */
+void
+IdleLogManager::intersect_idlelog(CommonIdleList &periods, const IdleLog &idlelog) const
+{
+  CommonIdleList result;
+
+  if (!periods.empty())
+    {
+      CommonIdleList::const_iterator p = periods.begin();
+      int i = idlelog.count_ending_after(p->begin_time) - 1;
+
+      while (p != periods.end() && i >= 0)
+        {
+          const IdleInterval &idle = idlelog[i];
+
+          time_t begin = max(p->begin_time, idle.begin_time);
+          time_t end = min(p->end_time, idle.end_idle_time);
+
+          if (begin < end)
+            {
+              result.push_back(CommonIdle(begin, end));
+            }
+
+          if (p->end_time < idle.end_idle_time)
+            {
+              p++;
+            }
+          else
+            {
+              i--;
+            }
+        }
+    }
+
+  periods.swap(result);
+}
+
 
 //! Packs the idle interval to the buffer.
 void
@@ -535,8 +643,12 @@ IdleLogManager::unpack_idle_interval(PacketBuffer &buffer, IdleInterval &idle, t
 
 
 //! Packs the idlelog header to the buffer.
+/*!
+ *  The index also contains the tail of the idlelog file, which older
+ *  versions skip.
+ */
 void
-IdleLogManager::pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const
+IdleLogManager::pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci, bool index) const
 {
   time_t current_time = time_source->get_time();
 
@@ -552,6 +664,15 @@ IdleLogManager::pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const
   buffer.pack_byte(ci.state);
   buffer.pack_ushort(ci.idlelog.size());
 
+  if (index)
+    {
+      buffer.pack_ulong(ci.saved_size);
+      buffer.pack_ulong(ci.tail.offset);
+      buffer.pack_ulong((guint32)ci.tail.ref_time);
+      buffer.pack_ulong((guint32)ci.tail.end_idle_time);
+      buffer.pack_ulong(ci.tail.count);
+    }
+
   buffer.update_size(pos);
 }
 
@@ -568,11 +689,11 @@ IdleLogManager::unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci,
     {
       pack_time = buffer.unpack_ulong();
 
-      char *id = buffer.unpack_string();
+      PacketString id = buffer.unpack_string();
 
-      if (id != NULL)
+      if (!id.is_null())
         {
-          ci.client_id = id;
+          ci.client_id = id.str();
         }
 
       ci.total_active_time = buffer.unpack_ulong();
@@ -581,7 +702,14 @@ IdleLogManager::unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci,
 
       num_intervals = buffer.unpack_ushort();
 
-      g_free(id);
+      if (pos - buffer.bytes_read() >= IDLELOG_TAIL_SIZE)
+        {
+          ci.saved_size = buffer.unpack_ulong();
+          ci.tail.offset = buffer.unpack_ulong();
+          ci.tail.ref_time = buffer.unpack_ulong();
+          ci.tail.end_idle_time = buffer.unpack_ulong();
+          ci.tail.count = buffer.unpack_ulong();
+        }
 
       buffer.skip_size(pos);
     }
@@ -604,21 +732,17 @@ IdleLogManager::unlink_idlelog(PacketBuffer &buffer) const
   if (size > 0 && buffer.bytes_available() >= size)
     {
       buffer.unpack_ulong(); // skip pack time.
-      char *id = buffer.unpack_string();
+      PacketString id = buffer.unpack_string();
 
-      if (id != NULL)
+      if (!id.is_null())
         {
-          stringstream ss;
-          ss << Util::get_home_directory();
-          ss << "idlelog." << id << ".log" << ends;
+          string filename = get_idlelog_filename(id.str());
 
 #ifdef PLATFORM_OS_WIN32
-          _unlink(ss.str().c_str());
+          _unlink(filename.c_str());
 #else
-          unlink(ss.str().c_str());
+          unlink(filename.c_str());
 #endif
-
-          g_free(id);
         }
 
       buffer.skip_size(pos);
@@ -649,16 +773,12 @@ IdleLogManager::save_index()
       info.update_active_time(time_source->get_time());
       TRACE_MSG("Saving " << i->first << " " << info.client_id);
 
-      pack_idlelog(buffer, info);
+      pack_idlelog(buffer, info, true);
     }
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog.idx" << ends;
-
-  ofstream file(ss.str().c_str(), ios::binary);
-  file.write(buffer.get_buffer(), buffer.bytes_written());
-  file.close();
+  string filename = Util::get_home_directory() + "idlelog.idx";
+  index_save_metric.inc();
+  state_writer->write(filename, string(buffer.get_buffer(), buffer.bytes_written()));
 
   TRACE_EXIT();
 }
@@ -706,8 +826,8 @@ IdleLogManager::load_index()
         {
           TRACE_MSG("Version - ok");
 
-          char *id = buffer.unpack_string();
-          if (id != NULL)
+          PacketString id = buffer.unpack_string();
+          if (!id.is_null())
             {
               TRACE_MSG("id = " << id);
             }
@@ -727,15 +847,13 @@ IdleLogManager::load_index()
 
               clients[info.client_id] = info;
             }
-
-          g_free(id);
         }
       else
         {
           TRACE_MSG("Old version - deleting logs of old version");
 
-          char *id = buffer.unpack_string();
-          if (id != NULL)
+          PacketString id = buffer.unpack_string();
+          if (!id.is_null())
             {
               TRACE_MSG("id = " << id);
             }
@@ -744,8 +862,6 @@ IdleLogManager::load_index()
             {
               unlink_idlelog(buffer);
             }
-
-          g_free(id);
         }
     }
   TRACE_EXIT();
@@ -753,61 +869,317 @@ IdleLogManager::load_index()
 
 
 
+//! Returns the check byte of an idlelog record.
+static guchar
+record_checksum(const guchar *data, gsize size)
+{
+  guint sum = 0xa5;
+  for (gsize i = 0; i < size; i++)
+    {
+      sum = ((sum << 1) | (sum >> 7)) & 0xff;
+      sum ^= data[i];
+    }
+  return (guchar)sum;
+}
+
+
+//! Packs an idle interval as deltas to the start time of the previous interval.
+/*!
+ *  The record is preceded by its length and followed by a check byte, so
+ *  that a partially appended record can be detected.
+ */
+void
+IdleLogManager::pack_idle_record(string &data, const IdleInterval &idle, time_t &ref_time) const
+{
+  string record;
+  Varint::pack_signed(record, idle.begin_time - ref_time);
+  Varint::pack_signed(record, idle.end_idle_time - idle.begin_time);
+  Varint::pack_signed(record, idle.end_time - idle.end_idle_time);
+  Varint::pack_signed(record, idle.active_time);
+
+  Varint::pack(data, record.size());
+  data += record;
+  data += (char)record_checksum((const guchar *)record.data(), record.size());
+
+  ref_time = idle.begin_time;
+}
+
+
+//! Unpacks an idle interval packed by pack_idle_record.
+/*!
+ *  Returns false, without consuming any data, if the record is
+ *  incomplete or corrupt.
+ */
+bool
+IdleLogManager::unpack_idle_record(const guchar *&data, const guchar *end,
+                                   IdleInterval &idle, time_t &ref_time) const
+{
+  const guchar *ptr = data;
+  guint64 length;
+
+  if (!Varint::unpack(ptr, end, length) || length == 0 ||
+      length >= (guint64)(end - ptr))
+    {
+      return false;
+    }
+
+  const guchar *record_end = ptr + length;
+  if (record_checksum(ptr, length) != *record_end)
+    {
+      return false;
+    }
+
+  gint64 begin_delta, idle_length, active_length, active_time;
+
+  bool ret = (Varint::unpack_signed(ptr, record_end, begin_delta) &&
+              Varint::unpack_signed(ptr, record_end, idle_length) &&
+              Varint::unpack_signed(ptr, record_end, active_length) &&
+              Varint::unpack_signed(ptr, record_end, active_time) &&
+              ptr == record_end);
+
+  if (ret)
+    {
+      idle.begin_time = ref_time + begin_delta;
+      idle.end_idle_time = idle.begin_time + idle_length;
+      idle.end_time = idle.end_idle_time + active_length;
+      idle.active_time = active_time;
+
+      ref_time = idle.begin_time;
+      data = record_end + 1;
+    }
+
+  return ret;
+}
+
+
+//! Returns the name of the idlelog file of the specified client.
+string
+IdleLogManager::get_idlelog_filename(const string &client_id) const
+{
+  return Util::get_home_directory() + "idlelog." + client_id + ".log";
+}
+
+
 //! Saves the idlelog for the specified client.
+/*!
+ *  Rewrites the entire file. New intervals are normally appended by
+ *  update_idlelog; this compacts the file to the intervals in memory.
+ *  An interval that is yet to be saved is left to update_idlelog.
+ */
 void
 IdleLogManager::save_idlelog(ClientInfo &info)
 {
   info.update_active_time(time_source->get_time());
 
-  PacketBuffer buffer;
-  buffer.create();
+  string data(IDLELOG_MAGIC, sizeof(IDLELOG_MAGIC));
+  data += (char)IDLELOG_FILE_VERSION;
 
-  for (IdleLogRIter i = info.idlelog.rbegin(); i != info.idlelog.rend(); i++)
+  info.saved_count = 0;
+  info.saved_begin_time = 0;
+  info.saved_end_idle_time = 0;
+  info.tail = Checkpoint();
+  info.tail.offset = data.size();
+  info.checkpoints.clear();
+
+  for (int i = info.idlelog.size() - 1; i >= 0; i--)
     {
-      IdleInterval &idle = *i;
+      IdleInterval &idle = info.idlelog[i];
 
-      pack_idle_interval(buffer, idle);
+      if (!idle.to_be_saved)
+        {
+          add_checkpoint(info, data.size());
+          pack_idle_record(data, idle, info.saved_begin_time);
+          info.saved_end_idle_time = idle.end_idle_time;
+          info.saved_count++;
+        }
     }
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
+  info.saved_size = data.size();
+  advance_tail(info);
 
-  ofstream file(ss.str().c_str(), ios::binary);
-  file.write(buffer.get_buffer(), buffer.bytes_written());
-  file.close();
+  rewrite_metric.inc();
+  state_writer->write(get_idlelog_filename(info.client_id), data);
 }
 
 
 //! Loads the idlelog for the specified client.
+/*!
+ *  Decoding starts at the tail saved in the index, so that records that
+ *  are too old to be loaded are not read. The entire file is decoded if
+ *  the index does not match the file.
+ */
 void
 IdleLogManager::load_idlelog(ClientInfo &info)
 {
   TRACE_ENTER("IdleLogManager::load_idlelog()");
 
+  string filename = get_idlelog_filename(info.client_id);
+  bool compact = false;
+
+  GMappedFile *file = g_mapped_file_new(filename.c_str(), FALSE, NULL);
+  if (file != NULL)
+    {
+      const gchar *data = g_mapped_file_get_contents(file);
+      gsize size = g_mapped_file_get_length(file);
+
+      if (size > sizeof(IDLELOG_MAGIC) &&
+          memcmp(data, IDLELOG_MAGIC, sizeof(IDLELOG_MAGIC)) == 0)
+        {
+          bool complete = false;
+          if (data[sizeof(IDLELOG_MAGIC)] == IDLELOG_FILE_VERSION)
+            {
+              Checkpoint tail = info.tail;
+              if (tail.offset > IDLELOG_HEADER_SIZE && tail.offset <= size && info.saved_size == size)
+                {
+                  complete = load_packed_idlelog(info, (const guchar *)data, size, tail);
+                  TRACE_MSG("Loaded tail at " << tail.offset << " " << complete);
+                }
+
+              if (!complete)
+                {
+                  Checkpoint header;
+                  header.offset = IDLELOG_HEADER_SIZE;
+
+                  info.idlelog.clear();
+                  complete = load_packed_idlelog(info, (const guchar *)data, size, header);
+                }
+            }
+
+          // Truncate a partially written record before appending to the file.
+          compact = (!complete || info.saved_count >= IDLELOG_COMPACT_SIZE);
+        }
+      else if (size > 0)
+        {
+          TRACE_MSG("Converting old idlelog");
+          load_old_idlelog(info, data, size);
+          compact = true;
+        }
+
+      g_mapped_file_unref(file);
+    }
+
+  if (info.idlelog.size() > 0)
+    {
+      IdleInterval &idle = info.idlelog.back();
+      idle.begin_time = 1;
+    }
+
+  dump_idlelog(info);
+  fix_idlelog(info);
+  dump_idlelog(info);
+
+  if (compact)
+    {
+      save_idlelog(info);
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Loads an idlelog in the current format, starting at the specified record.
+/*!
+ *  Stops at the first incomplete or corrupt record. Returns whether the
+ *  rest of the file was valid.
+ */
+bool
+IdleLogManager::load_packed_idlelog(ClientInfo &info, const guchar *data, gsize size, const Checkpoint &start)
+{
+  TRACE_ENTER_MSG("IdleLogManager::load_packed_idlelog", start.offset);
+
   time_t current_time = time_source->get_time();
+  const guchar *end = data + size;
+  const guchar *record = data + start.offset;
+  const guchar *ptr = record;
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
+  info.saved_count = start.count;
+  info.saved_begin_time = start.ref_time;
+  info.saved_end_idle_time = start.end_idle_time;
+  info.tail = start;
+  info.checkpoints.clear();
+
+  time_t ref_time = start.ref_time;
+
+  IdleInterval idle;
+  while (ptr < end && unpack_idle_record(ptr, end, idle, ref_time))
+    {
+      add_checkpoint(info, record - data);
+
+      if (idle.end_idle_time >= current_time - IDLELOG_MAXAGE)
+        {
+          info.idlelog.push_front(idle);
+        }
+
+      info.saved_begin_time = ref_time;
+      info.saved_end_idle_time = idle.end_idle_time;
+      info.saved_count++;
+      record = ptr;
+    }
+
+  info.saved_size = record - data;
+  advance_tail(info);
+
+  TRACE_RETURN(info.saved_count << " " << (ptr == end));
+  return ptr == end;
+}
+
+
+//! Remembers the position of the next record in the idlelog file.
+/*!
+ *  Only every IDLELOG_CHECKPOINT_INTERVAL records are remembered.
+ */
+void
+IdleLogManager::add_checkpoint(ClientInfo &info, guint32 offset)
+{
+  if (info.saved_count % IDLELOG_CHECKPOINT_INTERVAL == 0)
+    {
+      Checkpoint checkpoint;
+      checkpoint.offset = offset;
+      checkpoint.ref_time = info.saved_begin_time;
+      checkpoint.end_idle_time = info.saved_end_idle_time;
+      checkpoint.count = info.saved_count;
 
-  // Open file
-  ifstream file(ss.str().c_str(), ios::binary);
+      info.checkpoints.push_back(checkpoint);
+    }
+}
+
+
+//! Moves the tail past the records that are too old to be loaded.
+/*!
+ *  Intervals are loaded if their idle part ended less than IDLELOG_MAXAGE
+ *  ago. Records are in chronological order, so all records before a
+ *  checkpoint are too old once the record before it is.
+ */
+void
+IdleLogManager::advance_tail(ClientInfo &info)
+{
+  time_t expire_time = time_source->get_time() - IDLELOG_MAXAGE;
+
+  while (!info.checkpoints.empty() && info.checkpoints.front().end_idle_time < expire_time)
+    {
+      info.tail = info.checkpoints.front();
+      info.checkpoints.pop_front();
+    }
+}
+
+
+//! Loads an idlelog of fixed size intervals written by older versions.
+void
+IdleLogManager::load_old_idlelog(ClientInfo &info, const gchar *data, gsize size)
+{
+  TRACE_ENTER("IdleLogManager::load_old_idlelog");
 
-  // get file size using buffer's members
-  filebuf *pbuf=file.rdbuf();
-  int size=pbuf->pubseekoff (0,ios::end,ios::in);
-  pbuf->pubseekpos (0,ios::in);
+  time_t current_time = time_source->get_time();
 
   // Process it.
   int num_intervals = size / IDLELOG_INTERVAL_SIZE;
-  if (num_intervals * IDLELOG_INTERVAL_SIZE == size)
+  if (num_intervals * IDLELOG_INTERVAL_SIZE == (int)size)
     {
       if (num_intervals > IDLELOG_MAXSIZE)
         {
           TRACE_MSG("Skipping " << (num_intervals - IDLELOG_MAXSIZE) << " intervals");
           int skip = (num_intervals - IDLELOG_MAXSIZE) * IDLELOG_INTERVAL_SIZE;
-          file.seekg(skip);
+          data += skip;
           size -= skip;
           num_intervals = IDLELOG_MAXSIZE;
         }
@@ -815,8 +1187,7 @@ IdleLogManager::load_idlelog(ClientInfo &info)
       // Create buffer and load data.
       PacketBuffer buffer;
       buffer.create(size);
-      file.read(buffer.get_buffer(), size);
-      file.close();
+      memcpy(buffer.get_buffer(), data, size);
       buffer.write_ptr += size;
 
       TRACE_MSG("loading " << num_intervals << " intervals");
@@ -830,17 +1201,8 @@ IdleLogManager::load_idlelog(ClientInfo &info)
               info.idlelog.push_front(idle);
             }
         }
-
-	  if (info.idlelog.size() > 0)
-	    {
-           IdleInterval &idle = info.idlelog.back();
-           idle.begin_time = 1;
-	    }
     }
 
-  dump_idlelog(info);
-  fix_idlelog(info);
-  dump_idlelog(info);
   TRACE_EXIT();
 }
 
@@ -856,21 +1218,27 @@ IdleLogManager::load()
       ClientInfo &info = (*i).second;
       load_idlelog(info);
     }
+
+  rebuild_common_idle();
 }
 
 
 
 //! Saves the entire idlelog.
+/*!
+ *  The index is saved last, as it contains the tails of the rewritten
+ *  files.
+ */
 void
 IdleLogManager::save()
 {
-  save_index();
-
   for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
       ClientInfo &info = (*i).second;
       save_idlelog(info);
     }
+
+  save_index();
 }
 
 
@@ -880,18 +1248,22 @@ IdleLogManager::update_idlelog(ClientInfo &info, const IdleInterval &idle)
 {
   info.update_active_time(time_source->get_time());
 
-  PacketBuffer buffer;
-  buffer.create();
-
-  pack_idle_interval(buffer, idle);
+  if (info.saved_count >= IDLELOG_COMPACT_SIZE || info.saved_count == 0)
+    {
+      // Compact the file, or create it in the current format.
+      save_idlelog(info);
+    }
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
+  string data;
+  add_checkpoint(info, info.saved_size);
+  pack_idle_record(data, idle, info.saved_begin_time);
+  info.saved_end_idle_time = idle.end_idle_time;
+  info.saved_count++;
+  info.saved_size += data.size();
+  advance_tail(info);
 
-  ofstream file(ss.str().c_str(), ios::app | ios::binary);
-  file.write(buffer.get_buffer(), buffer.bytes_written());
-  file.close();
+  append_metric.inc();
+  state_writer->append(get_idlelog_filename(info.client_id), data);
 
   save_index();
 }
@@ -912,9 +1284,9 @@ IdleLogManager::get_idlelog(PacketBuffer &buffer)
   // Pack header.
   pack_idlelog(buffer, myinfo);
 
-  for (IdleLogIter i = myinfo.idlelog.begin(); i != myinfo.idlelog.end(); i++)
+  for (int i = 0; i < myinfo.idlelog.size(); i++)
     {
-      pack_idle_interval(buffer, *i);
+      pack_idle_interval(buffer, myinfo.idlelog[i]);
     }
 
   TRACE_EXIT();
@@ -947,8 +1319,9 @@ IdleLogManager::set_idlelog(PacketBuffer &buffer)
     }
 
   fix_idlelog(info);
-  save_index();
+  rebuild_common_idle();
   save_idlelog(clients[info.client_id]);
+  save_index();
 
   TRACE_EXIT();
 }
@@ -965,9 +1338,10 @@ IdleLogManager::signon_remote_client(string client_id)
   ClientInfo &info = clients[client_id];
   info.idlelog.push_front(IdleInterval(1, current_time));
   info.client_id = client_id;
+  rebuild_common_idle();
 
-  save_index();
   save_idlelog(info);
+  save_index();
 
   TRACE_EXIT();
 }
@@ -1021,10 +1395,9 @@ IdleLogManager::dump_idlelog(ClientInfo &info)
                    );
   }
 
-  IdleLogIter i = info.idlelog.begin();
-  while (i != info.idlelog.end())
+  for (int i = 0; i < info.idlelog.size(); i++)
     {
-      IdleInterval &idle = *i;
+      IdleInterval &idle = info.idlelog[i];
 
       struct tm begin_time;
       localtime_r(&idle.begin_time, &begin_time);
@@ -1044,7 +1417,6 @@ IdleLogManager::dump_idlelog(ClientInfo &info)
                    << end_time.tm_min << ":"
                    << end_time.tm_sec
                    );
-      i++;
     }
   TRACE_EXIT();
 #endif
@@ -1061,9 +1433,9 @@ IdleLogManager::fix_idlelog(ClientInfo &info)
 
   time_t next_time = -1;
 
-  for (IdleLogRIter i = info.idlelog.rbegin(); i != info.idlelog.rend(); i++)
+  for (int i = info.idlelog.size() - 1; i >= 0; i--)
     {
-      IdleInterval &idle = *i;
+      IdleInterval &idle = info.idlelog[i];
 
       TRACE_MSG(idle.begin_time << " "
                 << idle.end_time << " "
@@ -1103,3 +1475,156 @@ IdleLogManager::fix_idlelog(ClientInfo &info)
 
   TRACE_EXIT();
 }
+
+
+//! Constructs an empty idle log.
+IdleLogManager::IdleLog::IdleLog() :
+  head(0),
+  count(0)
+{
+}
+
+
+//! Removes all idle intervals.
+void
+IdleLogManager::IdleLog::clear()
+{
+  intervals.clear();
+  head = 0;
+  count = 0;
+}
+
+
+//! Returns whether adding an interval drops the oldest interval.
+bool
+IdleLogManager::IdleLog::is_full() const
+{
+  return count == IDLELOG_MAXSIZE;
+}
+
+
+//! Adds an interval that is more recent than all intervals in the log.
+void
+IdleLogManager::IdleLog::push_front(const IdleInterval &idle)
+{
+  time_t older_active_time = count > 0 ? front().older_active_time + front().active_time : 0;
+
+  if (count == IDLELOG_MAXSIZE)
+    {
+      pop_back();
+    }
+  else if (count == (int)intervals.size())
+    {
+      grow();
+    }
+
+  head = (head + intervals.size() - 1) % intervals.size();
+  count++;
+
+  front() = idle;
+  front().older_active_time = older_active_time;
+}
+
+
+//! Adds an interval that is older than all intervals in the log.
+void
+IdleLogManager::IdleLog::push_back(const IdleInterval &idle)
+{
+  if (count == IDLELOG_MAXSIZE)
+    {
+      return;
+    }
+  else if (count == (int)intervals.size())
+    {
+      grow();
+    }
+
+  time_t older_active_time = (count > 0 ? back().older_active_time : 0) - idle.active_time;
+
+  count++;
+
+  back() = idle;
+  back().older_active_time = older_active_time;
+}
+
+
+//! Removes the most recent interval.
+void
+IdleLogManager::IdleLog::pop_front()
+{
+  head = (head + 1) % intervals.size();
+  count--;
+}
+
+
+//! Removes the oldest interval.
+void
+IdleLogManager::IdleLog::pop_back()
+{
+  count--;
+}
+
+
+//! Returns the number of intervals that end at or after the specified time.
+int
+IdleLogManager::IdleLog::count_ending_after(time_t time) const
+{
+  int low = 0;
+  int high = count;
+
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+      if ((*this)[mid].end_idle_time >= time)
+        {
+          low = mid + 1;
+        }
+      else
+        {
+          high = mid;
+        }
+    }
+
+  return low;
+}
+
+
+//! Returns the total active time of the specified number of most recent intervals.
+time_t
+IdleLogManager::IdleLog::get_active_time(int num) const
+{
+  time_t ret = 0;
+
+  if (num > 0)
+    {
+      const IdleInterval &newest = (*this)[0];
+      ret = newest.older_active_time + newest.active_time - (*this)[num - 1].older_active_time;
+    }
+
+  return ret;
+}
+
+
+//! Increases the capacity of the ring buffer.
+void
+IdleLogManager::IdleLog::grow()
+{
+  int capacity = intervals.size() * 2;
+  if (capacity < 16)
+    {
+      capacity = 16;
+    }
+  if (capacity > IDLELOG_MAXSIZE)
+    {
+      capacity = IDLELOG_MAXSIZE;
+    }
+
+  std::vector<IdleInterval> grown(capacity);
+  for (int i = 0; i < count; i++)
+    {
+      grown[i] = (*this)[i];
+    }
+
+  intervals.swap(grown);
+  head = 0;
+}
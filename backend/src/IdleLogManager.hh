@@ -37,15 +37,19 @@
 
 #include <iostream>
 #include <string>
-#include <list>
+#include <vector>
+#include <deque>
 #include <map>
 
+#include <glib.h>
+
 using namespace std;
 
 #include "ActivityMonitor.hh"
 
 class TimeSource;
 class PacketBuffer;
+class StateWriter;
 
 class IdleLogManager
 {
@@ -58,6 +62,7 @@ private:
       end_idle_time(0),
       end_time(0),
       active_time(0),
+      older_active_time(0),
       to_be_saved(false)
     {
     }
@@ -67,6 +72,7 @@ private:
       end_idle_time(e),
       end_time(e),
       active_time(0),
+      older_active_time(0),
       to_be_saved(false)
     {
     }
@@ -83,14 +89,94 @@ private:
     //! Elapsed active time AFTER the idle interval.
     time_t active_time;
 
+    //! Running total of the active time of all older intervals in the log.
+    time_t older_active_time;
+
     //! Yet to be saved
     bool to_be_saved;
   };
 
 
-  typedef list<IdleInterval> IdleLog;
-  typedef IdleLog::iterator IdleLogIter;
-  typedef IdleLog::reverse_iterator IdleLogRIter;
+  //! Idle intervals of a single client, most recent first.
+  /*!
+   *  The intervals are kept in a ring buffer of at most IDLELOG_MAXSIZE
+   *  intervals. Adding an interval to a full log drops the oldest one.
+   */
+  class IdleLog
+  {
+  public:
+    IdleLog();
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear();
+
+    IdleInterval &operator[](int index) { return intervals[(head + index) % intervals.size()]; }
+    const IdleInterval &operator[](int index) const { return intervals[(head + index) % intervals.size()]; }
+    IdleInterval &front() { return (*this)[0]; }
+    IdleInterval &back() { return (*this)[count - 1]; }
+
+    bool is_full() const;
+    void push_front(const IdleInterval &idle);
+    void push_back(const IdleInterval &idle);
+    void pop_front();
+    void pop_back();
+
+    int count_ending_after(time_t time) const;
+    time_t get_active_time(int num) const;
+
+  private:
+    void grow();
+
+    //! Storage of the ring buffer.
+    std::vector<IdleInterval> intervals;
+
+    //! Position of the most recent interval.
+    int head;
+
+    //! Number of intervals.
+    int count;
+  };
+
+  //! A period in which all clients were idle.
+  struct CommonIdle
+  {
+    CommonIdle(time_t b, time_t e) : begin_time(b), end_time(e) {}
+
+    time_t length() const { return end_time - begin_time; }
+
+    //! Start time of the common idle period.
+    time_t begin_time;
+
+    //! End time of the common idle period.
+    time_t end_time;
+  };
+
+  typedef std::vector<CommonIdle> CommonIdleList;
+
+  //! Position of a record in an idlelog file, from which the file can be loaded.
+  struct Checkpoint
+  {
+    Checkpoint() :
+      offset(0),
+      ref_time(0),
+      end_idle_time(0),
+      count(0)
+    {
+    }
+
+    //! Offset of the record in the file.
+    guint32 offset;
+
+    //! Start time of the previous record, to which the record is relative.
+    time_t ref_time;
+
+    //! End time of the idle part of the previous record.
+    time_t end_idle_time;
+
+    //! Number of records before the record.
+    int count;
+  };
 
   //! Idle information of a single client.
   struct ClientInfo
@@ -101,7 +187,11 @@ private:
       total_active_time(0),
       last_active_begin_time(0),
       last_active_time(0),
-      last_update_time()
+      last_update_time(),
+      saved_count(0),
+      saved_begin_time(0),
+      saved_end_idle_time(0),
+      saved_size(0)
     {
     }
 
@@ -132,6 +222,27 @@ private:
     //! Last time this idle log was updated.
     time_t last_update_time;
 
+    //! Number of intervals in the idle log file.
+    int saved_count;
+
+    //! Start time of the last interval in the idle log file.
+    time_t saved_begin_time;
+
+    //! End time of the idle part of the last interval in the idle log file.
+    time_t saved_end_idle_time;
+
+    //! Size of the idle log file.
+    guint32 saved_size;
+
+    //! Position from which the idle log file is loaded.
+    /*!
+     *  All earlier intervals are too old to be loaded.
+     */
+    Checkpoint tail;
+
+    //! Positions after the tail, oldest first.
+    std::deque<Checkpoint> checkpoints;
+
     //! Update the active time of the most recent idle interval.
     void update_active_time(time_t current_time)
     {
@@ -159,11 +270,17 @@ private:
   //! Time
   const TimeSource *time_source;
 
+  //! Writer of the idlelog files.
+  StateWriter *state_writer;
+
   //! Last time we performed an expiration run.
   time_t last_expiration_time;
 
+  //! Common idle periods that are longer than all later ones, oldest first.
+  std::deque<CommonIdle> common_idle;
+
 public:
-  IdleLogManager(string myid, const TimeSource *control);
+  IdleLogManager(string myid, const TimeSource *control, StateWriter *writer);
 
   void update_all_idlelogs(string master_id, ActivityState state);
   void reset();
@@ -182,20 +299,35 @@ public:
 
 private:
   void update_idlelog(ClientInfo &info, ActivityState state, bool master);
+  void push_idlelog(ClientInfo &info, const IdleInterval &idle);
   void expire();
   void expire(ClientInfo &info);
 
+  void add_common_idle(const CommonIdle &idle);
+  void expire_common_idle(time_t time);
+  void update_common_idle(ClientInfo &info);
+  void rebuild_common_idle();
+  void intersect_idlelog(CommonIdleList &periods, const IdleLog &idlelog) const;
+
   void pack_idle_interval(PacketBuffer &buffer, const IdleInterval &idle) const;
   void unpack_idle_interval(PacketBuffer &buffer, IdleInterval &idle, time_t delta_time) const;
 
-  void pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const;
+  void pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci, bool index = false) const;
   void unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci, time_t &pack_time, int &num_intervals) const;
   void unlink_idlelog(PacketBuffer &buffer) const;
 
+  void pack_idle_record(string &data, const IdleInterval &idle, time_t &ref_time) const;
+  bool unpack_idle_record(const guchar *&data, const guchar *end, IdleInterval &idle, time_t &ref_time) const;
+  string get_idlelog_filename(const string &client_id) const;
+
   void save_index();
   void load_index();
   void save_idlelog(ClientInfo &info);
   void load_idlelog(ClientInfo &info);
+  bool load_packed_idlelog(ClientInfo &info, const guchar *data, gsize size, const Checkpoint &start);
+  void add_checkpoint(ClientInfo &info, guint32 offset);
+  void advance_tail(ClientInfo &info);
+  void load_old_idlelog(ClientInfo &info, const gchar *data, gsize size);
 
   void save();
   void load();
@@ -24,17 +24,34 @@
 #include <assert.h>
 
 #include "InputMonitor.hh"
+#include "InputTrace.hh"
+#include "TimeSource.hh"
 
+Metrics::Counter InputMonitor::events_metric("workrave_input_events_total",
+                                             "Number of input events received from the input monitor");
+Metrics::Counter InputMonitor::dropped_metric("workrave_input_events_dropped_total",
+                                              "Number of input events dropped because the event ring was full");
+Metrics::Histogram InputMonitor::flush_metric("workrave_input_flush_usec",
+                                              "Duration of delivering queued input events");
+
+InputTraceWriter *InputMonitor::trace_writer = NULL;
 
 InputMonitor::InputMonitor()
   : activity_listener(NULL),
-    statistics_listener(NULL)
+    statistics_listener(NULL),
+    ring_head(0),
+    ring_tail(0),
+    ring_overflow(0),
+    flush_pending(0),
+    flushing(false)
 {
 }
 
 
 InputMonitor::~InputMonitor()
 {
+  while (g_source_remove_by_user_data(this))
+    ;
 }
 
 
@@ -70,3 +87,99 @@ InputMonitor::unsubscribe_statistics(IInputMonitorListener *listener)
   assert(statistics_listener != NULL);
   statistics_listener = NULL;
 }
+
+
+//! Delivers all queued events to the listeners.
+/*!
+ *  Must be called from the main loop.
+ */
+void
+InputMonitor::flush()
+{
+  if (flushing)
+    {
+      // Called back from one of the listeners.
+      return;
+    }
+  flushing = true;
+
+  Metrics::Stopwatch stopwatch(flush_metric);
+
+  // Events pushed from now on schedule a new flush.
+  g_atomic_int_set(&flush_pending, 0);
+
+  gint64 now = TimeSource::get_clock()->get_real_time();
+  gint head = g_atomic_int_get(&ring_head);
+  gint tail = g_atomic_int_get(&ring_tail);
+
+  if (head < tail)
+    {
+      deliver_events(ring + tail, RING_SIZE - tail, now);
+      tail = 0;
+    }
+  if (head > tail)
+    {
+      deliver_events(ring + tail, head - tail, now);
+    }
+
+  // Release the slots to the producer.
+  g_atomic_int_set(&ring_tail, head);
+
+  if (g_atomic_int_get(&ring_overflow) != 0)
+    {
+      g_atomic_int_set(&ring_overflow, 0);
+
+      InputEvent event;
+      event.type = InputEvent::INPUT_EVENT_ACTION;
+      event.flag = 0;
+      event.wheel = 0;
+      event.x = 0;
+      event.y = 0;
+      deliver_events(&event, 1, now);
+    }
+
+  flushing = false;
+}
+
+
+//! Records all events delivered by input monitors to the specified trace file.
+bool
+InputMonitor::record(const std::string &filename)
+{
+  if (trace_writer == NULL)
+    {
+      trace_writer = new InputTraceWriter();
+    }
+  return trace_writer->open(filename);
+}
+
+
+//! Delivers a batch of events to the listeners.
+/*!
+ *  Must be called from the main loop.
+ */
+void
+InputMonitor::deliver_events(const InputEvent *events, int count, gint64 now)
+{
+  if (trace_writer != NULL)
+    {
+      trace_writer->write(events, count, now);
+    }
+  if (activity_listener != NULL)
+    {
+      activity_listener->input_notify(events, count, now);
+    }
+  if (statistics_listener != NULL)
+    {
+      statistics_listener->input_notify(events, count, now);
+    }
+}
+
+
+gboolean
+InputMonitor::static_flush(gpointer data)
+{
+  InputMonitor *monitor = (InputMonitor *) data;
+  monitor->flush();
+  return FALSE;
+}
@@ -21,11 +21,16 @@
 #define INPUTMONITOR_HH
 
 #include <stdlib.h>
+#include <string>
+#include <glib.h>
+
 #include "IInputMonitor.hh"
 #include "IInputMonitorListener.hh"
+#include "Metrics.hh"
 
 // Forward declarion of internal interfaces.
 class IInputMonitorListener;
+class InputTraceWriter;
 
 //!  Base for activity monitors.
 class InputMonitor
@@ -39,19 +44,67 @@ public:
   virtual void subscribe_statistics(IInputMonitorListener *listener);
   virtual void unsubscribe_activity(IInputMonitorListener *listener);
   virtual void unsubscribe_statistics(IInputMonitorListener *listener);
+  virtual void flush();
+
+  static bool record(const std::string &filename);
 
 protected:
   void fire_action();
   void fire_mouse(int x, int y, int wheel = 0);
   void fire_button(bool is_press);
   void fire_keyboard(bool repeat);
+  void deliver_events(const InputEvent *events, int count, gint64 now);
+
+private:
+  void push_event(InputEvent::Type type, int x, int y, int wheel, bool flag);
+  static gboolean static_flush(gpointer data);
 
 private:
+  //! Size of the event ring, must be a power of two.
+  static const int RING_SIZE = 1024;
+
+  //! Interval in ms at which queued events are delivered.
+  static const int FLUSH_INTERVAL = 50;
+
   //!
   IInputMonitorListener *activity_listener;
 
   //!
   IInputMonitorListener *statistics_listener;
+
+  //! Events queued by the monitor thread.
+  /*!
+   *  Single producer (the monitor thread), single consumer (the main loop).
+   *  The producer only writes ring_head, the consumer only writes ring_tail.
+   */
+  InputEvent ring[RING_SIZE];
+
+  //! Next slot to be written by the producer.
+  volatile gint ring_head;
+
+  //! Next slot to be read by the consumer.
+  volatile gint ring_tail;
+
+  //! Were events dropped because the ring was full?
+  volatile gint ring_overflow;
+
+  //! Is a flush scheduled on the main loop?
+  volatile gint flush_pending;
+
+  //! Are events being delivered? Only used by the consumer.
+  bool flushing;
+
+  //! Number of events received from the monitor threads.
+  static Metrics::Counter events_metric;
+
+  //! Number of events dropped because the ring was full.
+  static Metrics::Counter dropped_metric;
+
+  //! Duration of delivering the queued events.
+  static Metrics::Histogram flush_metric;
+
+  //! Records all delivered events, if enabled.
+  static InputTraceWriter *trace_writer;
 };
 
 #include "InputMonitor.icc"
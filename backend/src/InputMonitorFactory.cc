@@ -54,6 +54,16 @@ InputMonitorFactory::init(const char *display)
     }
 }
 
+//! Replaces the platform specific factory.
+/*!
+ *  Must be called before init().
+ */
+void
+InputMonitorFactory::set_factory(IInputMonitorFactory *factory)
+{
+  InputMonitorFactory::factory = factory;
+}
+
 IInputMonitor *
 InputMonitorFactory::get_monitor(IInputMonitorFactory::MonitorCapability capability)
 {
@@ -30,6 +30,7 @@ class InputMonitorFactory
 {
 public:
   static void init(const char *display);
+  static void set_factory(IInputMonitorFactory *factory);
   static IInputMonitor *get_monitor(IInputMonitorFactory::MonitorCapability capability);
 
 private:
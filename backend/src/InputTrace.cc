@@ -0,0 +1,226 @@
+// InputTrace.cc --- Recorded input events
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "debug.hh"
+
+#include "InputTrace.hh"
+#include "Varint.hh"
+
+static const char TRACE_MAGIC[4] = { 'W', 'R', 'I', 'T' };
+static const guint8 TRACE_VERSION = 1;
+
+
+InputTraceWriter::InputTraceWriter() :
+  file(NULL),
+  last_time(0),
+  last_x(0),
+  last_y(0)
+{
+}
+
+
+InputTraceWriter::~InputTraceWriter()
+{
+  close();
+}
+
+
+//! Creates the specified trace file.
+bool
+InputTraceWriter::open(const std::string &filename)
+{
+  TRACE_ENTER_MSG("InputTraceWriter::open", filename);
+
+  close();
+
+  file = g_fopen(filename.c_str(), "wb");
+  if (file != NULL)
+    {
+      fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, file);
+      fwrite(&TRACE_VERSION, sizeof(TRACE_VERSION), 1, file);
+    }
+
+  last_time = 0;
+  last_x = 0;
+  last_y = 0;
+
+  TRACE_RETURN(file != NULL);
+  return file != NULL;
+}
+
+
+void
+InputTraceWriter::close()
+{
+  if (file != NULL)
+    {
+      fclose(file);
+      file = NULL;
+    }
+}
+
+
+//! Appends a batch of events.
+void
+InputTraceWriter::write(const InputEvent *events, int count, gint64 time)
+{
+  if (file == NULL)
+    {
+      return;
+    }
+
+  buffer.clear();
+  Varint::pack(buffer, time > last_time ? time - last_time : 0);
+  Varint::pack(buffer, count);
+  last_time = time > last_time ? time : last_time;
+
+  for (int i = 0; i < count; i++)
+    {
+      const InputEvent &event = events[i];
+
+      buffer += (char)(event.type | (event.flag << 4));
+      if (event.type == InputEvent::INPUT_EVENT_MOUSE)
+        {
+          Varint::pack_signed(buffer, (gint64)event.x - last_x);
+          Varint::pack_signed(buffer, (gint64)event.y - last_y);
+          Varint::pack_signed(buffer, event.wheel);
+          last_x = event.x;
+          last_y = event.y;
+        }
+    }
+
+  fwrite(buffer.data(), buffer.size(), 1, file);
+}
+
+
+InputTraceReader::InputTraceReader() :
+  pos(0),
+  last_time(0),
+  last_x(0),
+  last_y(0)
+{
+}
+
+
+//! Reads the specified trace file.
+bool
+InputTraceReader::load(const std::string &filename)
+{
+  TRACE_ENTER_MSG("InputTraceReader::load", filename);
+
+  gchar *contents = NULL;
+  gsize length = 0;
+  bool ok = g_file_get_contents(filename.c_str(), &contents, &length, NULL);
+
+  if (ok)
+    {
+      data.assign(contents, length);
+      g_free(contents);
+
+      ok = (data.size() > sizeof(TRACE_MAGIC) &&
+            memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+            (guint8)data[sizeof(TRACE_MAGIC)] == TRACE_VERSION);
+    }
+
+  pos = sizeof(TRACE_MAGIC) + 1;
+  last_time = 0;
+  last_x = 0;
+  last_y = 0;
+
+  if (!ok)
+    {
+      data.clear();
+      pos = 0;
+    }
+
+  TRACE_RETURN(ok);
+  return ok;
+}
+
+
+//! Reads the next batch of events.
+/*!
+ *  Returns false at the end of the trace, or if the trace is corrupt.
+ */
+bool
+InputTraceReader::next(std::vector<InputEvent> &events, gint64 &time)
+{
+  const guchar *ptr = (const guchar *)data.data() + pos;
+  const guchar *end = (const guchar *)data.data() + data.size();
+
+  guint64 delta = 0;
+  guint64 count = 0;
+
+  events.clear();
+
+  if (ptr >= end ||
+      !Varint::unpack(ptr, end, delta) ||
+      !Varint::unpack(ptr, end, count))
+    {
+      return false;
+    }
+
+  for (guint64 i = 0; i < count; i++)
+    {
+      if (ptr >= end)
+        {
+          return false;
+        }
+
+      InputEvent event;
+      memset(&event, 0, sizeof(event));
+
+      guchar byte = *ptr++;
+      event.type = byte & 0x0f;
+      event.flag = byte >> 4;
+
+      if (event.type == InputEvent::INPUT_EVENT_MOUSE)
+        {
+          gint64 dx, dy, wheel;
+          if (!Varint::unpack_signed(ptr, end, dx) ||
+              !Varint::unpack_signed(ptr, end, dy) ||
+              !Varint::unpack_signed(ptr, end, wheel))
+            {
+              return false;
+            }
+
+          last_x += (gint32)dx;
+          last_y += (gint32)dy;
+          event.x = last_x;
+          event.y = last_y;
+          event.wheel = (gint16)wheel;
+        }
+
+      events.push_back(event);
+    }
+
+  last_time += delta;
+  time = last_time;
+  pos = ptr - (const guchar *)data.data();
+
+  return true;
+}
@@ -0,0 +1,90 @@
+// InputTrace.hh --- Recorded input events
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INPUTTRACE_HH
+#define INPUTTRACE_HH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "IInputMonitorListener.hh"
+
+//! Writes input events to a trace file.
+/*!
+ *  A trace file starts with the magic "WRIT" and a version byte. It then
+ *  contains one record per batch of events that was delivered by the
+ *  input monitor: the time since the previous batch in usec and the number
+ *  of events, followed by the events. Each event is a byte with the type
+ *  and flag; mouse events add the movement since the previous mouse event
+ *  and the wheel delta. All numbers are (zigzag) LEB128 encoded.
+ */
+class InputTraceWriter
+{
+public:
+  InputTraceWriter();
+  ~InputTraceWriter();
+
+  bool open(const std::string &filename);
+  void close();
+  void write(const InputEvent *events, int count, gint64 time);
+
+private:
+  //! The trace file.
+  FILE *file;
+
+  //! Time of the previous batch.
+  gint64 last_time;
+
+  //! Position of the previous mouse event.
+  gint32 last_x;
+  gint32 last_y;
+
+  //! Encoded batch.
+  std::string buffer;
+};
+
+
+//! Reads input events from a trace file.
+class InputTraceReader
+{
+public:
+  InputTraceReader();
+
+  bool load(const std::string &filename);
+  bool next(std::vector<InputEvent> &events, gint64 &time);
+
+private:
+  //! Contents of the trace file.
+  std::string data;
+
+  //! Read position.
+  size_t pos;
+
+  //! Time of the previous batch.
+  gint64 last_time;
+
+  //! Position of the previous mouse event.
+  gint32 last_x;
+  gint32 last_y;
+};
+
+#endif // INPUTTRACE_HH
@@ -0,0 +1,293 @@
+// Metrics.cc --- Performance counters of the backend
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#include "Metrics.hh"
+
+Metrics::Metric *Metrics::metrics = NULL;
+
+//! Returns all registered metrics in the Prometheus text format.
+std::string
+Metrics::dump()
+{
+  std::string out;
+
+  for (Metric *m = metrics; m != NULL; m = m->next)
+    {
+      m->dump(out);
+    }
+
+  return out;
+}
+
+
+static void
+dump_header(std::string &out, const Metrics::Metric *metric, const char *type)
+{
+  out += "# HELP ";
+  out += metric->get_name();
+  out += " ";
+  out += metric->get_help();
+  out += "\n# TYPE ";
+  out += metric->get_name();
+  out += " ";
+  out += type;
+  out += "\n";
+}
+
+
+static void
+dump_value(std::string &out, const char *name, const char *suffix, const char *label, gint64 value)
+{
+  char buffer[32];
+  g_snprintf(buffer, sizeof(buffer), " %" G_GINT64_FORMAT "\n", value);
+
+  out += name;
+  out += suffix;
+  if (label != NULL)
+    {
+      out += "{";
+      out += label;
+      out += "}";
+    }
+  out += buffer;
+}
+
+
+//! Registers a metric.
+Metrics::Metric::Metric(const char *name, const char *help)
+  : name(name), help(help)
+{
+  // Metrics are static objects, so this runs before main.
+  next = Metrics::metrics;
+  Metrics::metrics = this;
+}
+
+
+const char *
+Metrics::Metric::get_name() const
+{
+  return name;
+}
+
+
+const char *
+Metrics::Metric::get_help() const
+{
+  return help;
+}
+
+
+Metrics::Counter::Counter(const char *name, const char *help)
+  : Metric(name, help), count(0)
+{
+}
+
+
+//! Increments the counter.
+void
+Metrics::Counter::inc(guint n)
+{
+  g_atomic_int_add(&count, (gint)n);
+}
+
+
+guint
+Metrics::Counter::get() const
+{
+  return (guint)g_atomic_int_get(&count);
+}
+
+
+void
+Metrics::Counter::dump(std::string &out) const
+{
+  dump_header(out, this, "counter");
+  dump_value(out, get_name(), "", NULL, get());
+}
+
+
+Metrics::Gauge::Gauge(const char *name, const char *help)
+  : Metric(name, help), value(0)
+{
+}
+
+
+void
+Metrics::Gauge::set(gint value)
+{
+  g_atomic_int_set(&this->value, value);
+}
+
+
+void
+Metrics::Gauge::add(gint delta)
+{
+  g_atomic_int_add(&value, delta);
+}
+
+
+gint
+Metrics::Gauge::get() const
+{
+  return g_atomic_int_get(&value);
+}
+
+
+void
+Metrics::Gauge::dump(std::string &out) const
+{
+  dump_header(out, this, "gauge");
+  dump_value(out, get_name(), "", NULL, get());
+}
+
+
+Metrics::Histogram::Histogram(const char *name, const char *help)
+  : Metric(name, help), count(0), sum(0), max(0)
+{
+  memset(buckets, 0, sizeof(buckets));
+}
+
+
+//! Records a latency.
+void
+Metrics::Histogram::record(gint64 usec)
+{
+  if (usec < 0)
+    {
+      // Monotonic time should not go backwards, but be safe.
+      usec = 0;
+    }
+
+  buckets[get_bucket(usec)]++;
+  count++;
+  sum += usec;
+  if (usec > max)
+    {
+      max = usec;
+    }
+}
+
+
+guint64
+Metrics::Histogram::get_count() const
+{
+  return count;
+}
+
+
+//! Returns the value below which the fraction q of the recorded values lie.
+gint64
+Metrics::Histogram::get_quantile(double q) const
+{
+  if (count == 0)
+    {
+      return 0;
+    }
+
+  guint64 target = (guint64)ceil(q * count);
+  if (target == 0)
+    {
+      target = 1;
+    }
+
+  guint64 seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if (seen >= target)
+        {
+          gint64 value = get_bucket_value(i);
+          return value < max ? value : max;
+        }
+    }
+
+  return max;
+}
+
+
+//! Returns the bucket that counts the specified value.
+int
+Metrics::Histogram::get_bucket(gint64 value)
+{
+  if (value < 2 * SUB_BUCKETS)
+    {
+      return (int)value;
+    }
+
+  int msb = 0;
+  while ((value >> (msb + 1)) != 0)
+    {
+      msb++;
+    }
+
+  if (msb >= MAX_BITS)
+    {
+      return NUM_BUCKETS - 1;
+    }
+
+  int shift = msb - SUB_BITS;
+  return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+
+//! Returns the largest value counted by the specified bucket.
+gint64
+Metrics::Histogram::get_bucket_value(int bucket)
+{
+  if (bucket < 2 * SUB_BUCKETS)
+    {
+      return bucket;
+    }
+
+  int shift = bucket / SUB_BUCKETS - 1;
+  gint64 low = (gint64)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return low + ((gint64)1 << shift) - 1;
+}
+
+
+void
+Metrics::Histogram::dump(std::string &out) const
+{
+  static const struct
+  {
+    double q;
+    const char *label;
+  } quantiles[] =
+      {
+        { 0.5,  "quantile=\"0.5\"" },
+        { 0.9,  "quantile=\"0.9\"" },
+        { 0.99, "quantile=\"0.99\"" },
+        { 1.0,  "quantile=\"1\"" },
+      };
+
+  dump_header(out, this, "summary");
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    {
+      dump_value(out, get_name(), "", quantiles[i].label, get_quantile(quantiles[i].q));
+    }
+  dump_value(out, get_name(), "_sum", NULL, sum);
+  dump_value(out, get_name(), "_count", NULL, (gint64)count);
+}
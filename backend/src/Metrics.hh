@@ -0,0 +1,185 @@
+// Metrics.hh --- Performance counters of the backend
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef METRICS_HH
+#define METRICS_HH
+
+#include <string>
+
+#include <glib.h>
+
+//! Registry of performance counters, gauges and latency histograms.
+/*!
+ *  Metrics are defined as static objects and register themselves on
+ *  construction. They are exported in the Prometheus text format by
+ *  Metrics::dump().
+ */
+class Metrics
+{
+public:
+  class Metric;
+  class Counter;
+  class Gauge;
+  class Histogram;
+  class Stopwatch;
+
+  static std::string dump();
+
+private:
+  //! All registered metrics.
+  static Metric *metrics;
+};
+
+
+//! Base class of all metrics.
+class Metrics::Metric
+{
+public:
+  Metric(const char *name, const char *help);
+  virtual ~Metric() {}
+
+  const char *get_name() const;
+  const char *get_help() const;
+
+  virtual void dump(std::string &out) const = 0;
+
+private:
+  //! Name of the metric.
+  const char *name;
+
+  //! Description of the metric.
+  const char *help;
+
+  //! Next registered metric.
+  Metric *next;
+
+  friend class Metrics;
+};
+
+
+//! Monotonically increasing count.
+/*!
+ *  May be incremented from any thread. The count wraps at 2^32, which
+ *  scrapers treat as a counter reset.
+ */
+class Metrics::Counter : public Metrics::Metric
+{
+public:
+  Counter(const char *name, const char *help);
+
+  void inc(guint n = 1);
+  guint get() const;
+
+  virtual void dump(std::string &out) const;
+
+private:
+  volatile gint count;
+};
+
+
+//! Value that can go up and down.
+/*!
+ *  May be set from any thread.
+ */
+class Metrics::Gauge : public Metrics::Metric
+{
+public:
+  Gauge(const char *name, const char *help);
+
+  void set(gint value);
+  void add(gint delta);
+  gint get() const;
+
+  virtual void dump(std::string &out) const;
+
+private:
+  volatile gint value;
+};
+
+
+//! Distribution of latencies in microseconds.
+/*!
+ *  Values are counted in log-linear buckets: each power of two is split
+ *  into SUB_BUCKETS buckets, so that the relative error of a reported
+ *  quantile is at most 1/SUB_BUCKETS. Must only be used from the main
+ *  loop.
+ */
+class Metrics::Histogram : public Metrics::Metric
+{
+public:
+  Histogram(const char *name, const char *help);
+
+  void record(gint64 usec);
+
+  guint64 get_count() const;
+  gint64 get_quantile(double q) const;
+
+  virtual void dump(std::string &out) const;
+
+private:
+  static int get_bucket(gint64 value);
+  static gint64 get_bucket_value(int bucket);
+
+private:
+  //! Number of bits used to select a sub-bucket.
+  static const int SUB_BITS = 3;
+
+  //! Number of buckets per power of two.
+  static const int SUB_BUCKETS = 1 << SUB_BITS;
+
+  //! Largest exponent that is counted, larger values go in the last bucket.
+  static const int MAX_BITS = 40;
+
+  //! Total number of buckets.
+  static const int NUM_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+  //! Number of values in each bucket.
+  guint32 buckets[NUM_BUCKETS];
+
+  //! Number of recorded values.
+  guint64 count;
+
+  //! Sum of all recorded values.
+  gint64 sum;
+
+  //! Largest recorded value.
+  gint64 max;
+};
+
+
+//! Records the lifetime of the stopwatch in a histogram.
+class Metrics::Stopwatch
+{
+public:
+  explicit Stopwatch(Histogram &histogram)
+    : histogram(histogram), start(g_get_monotonic_time())
+  {
+  }
+
+  ~Stopwatch()
+  {
+    histogram.record(g_get_monotonic_time() - start);
+  }
+
+private:
+  Histogram &histogram;
+  gint64 start;
+};
+
+#endif // METRICS_HH
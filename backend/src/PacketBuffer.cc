@@ -28,61 +28,148 @@
 #include <assert.h>
 
 #include "PacketBuffer.hh"
+#include "Varint.hh"
+
+#define POOL_BLOCK_SIZE (4096)
+#define POOL_MAX_SIZE (16)
+
+PacketBuffer::Storage *PacketBuffer::pool = NULL;
+int PacketBuffer::pool_size = 0;
+
+
+//! Returns whether the string is equal to the specified null-terminated string.
+bool
+PacketString::equals(const gchar *str) const
+{
+  if (data == NULL || str == NULL)
+    {
+      return data == NULL && str == NULL;
+    }
+
+  return strncmp(data, str, length) == 0 && str[length] == '\0';
+}
+
+
+//! Returns a null-terminated copy of the string that must be freed with g_free.
+gchar *
+PacketString::dup() const
+{
+  return data != NULL ? g_strndup(data, length) : NULL;
+}
+
+
+//! Returns a copy of the string.
+std::string
+PacketString::str() const
+{
+  return data != NULL ? std::string(data, length) : std::string();
+}
+
+
+std::ostream &
+operator<<(std::ostream &out, const PacketString &str)
+{
+  if (!str.is_null())
+    {
+      out.write(str.get_data(), str.get_length());
+    }
+  return out;
+}
+
 
 PacketBuffer::PacketBuffer() :
   buffer(NULL),
   read_ptr(NULL),
   write_ptr(NULL),
   buffer_size(0),
-  original_buffer(NULL),
-  original_buffer_size(0)
+  storage(NULL)
 {
 }
 
 
-PacketBuffer::~PacketBuffer()
+PacketBuffer::PacketBuffer(int size) :
+  buffer(NULL),
+  read_ptr(NULL),
+  write_ptr(NULL),
+  buffer_size(0),
+  storage(NULL)
+{
+  create(size);
+}
+
+
+//! Creates a buffer that shares the data of the specified buffer.
+PacketBuffer::PacketBuffer(const PacketBuffer &other) :
+  buffer(other.buffer),
+  read_ptr(other.read_ptr),
+  write_ptr(other.write_ptr),
+  buffer_size(other.buffer_size),
+  storage(other.storage)
 {
-  narrow(0, -1);
-  if (buffer != NULL)
+  if (storage != NULL)
     {
-      g_free(buffer);
+      storage->ref_count++;
     }
 }
 
-void
-PacketBuffer::create(int size)
+
+PacketBuffer::~PacketBuffer()
 {
-  narrow(0, -1);
+  release();
+}
+
 
-  if (buffer != NULL)
+//! Shares the data of the specified buffer.
+PacketBuffer &
+PacketBuffer::operator=(const PacketBuffer &other)
+{
+  if (this != &other)
     {
-      g_free(buffer);
+      if (other.storage != NULL)
+        {
+          other.storage->ref_count++;
+        }
+
+      release();
+
+      buffer = other.buffer;
+      read_ptr = other.read_ptr;
+      write_ptr = other.write_ptr;
+      buffer_size = other.buffer_size;
+      storage = other.storage;
     }
+  return *this;
+}
+
+
+void
+PacketBuffer::create(int size)
+{
+  release();
 
   if (size == 0)
     {
       size = 1024;
     }
 
-  buffer = g_new(guint8, size);
+  storage = allocate(size);
+  buffer = storage->data;
   read_ptr = buffer;
   write_ptr = buffer;
-  buffer_size = size;
+  buffer_size = storage->size;
 }
 
 
+//! Resizes the buffer. The data is copied if it is shared with other buffers.
 void
 PacketBuffer::resize(int size)
 {
-  //TRACE_ENTER_MSG("PacketBuffer::resize", size);
-  narrow(0, -1);
-
   if (size == 0)
     {
       size = 1024;
     }
 
-  if (size != buffer_size && buffer != NULL)
+  if (buffer != NULL && (size != buffer_size || storage->ref_count > 1))
     {
       int read_offset = read_ptr - buffer;
       int write_offset = write_ptr - buffer;
@@ -97,41 +184,179 @@ PacketBuffer::resize(int size)
           write_offset = size - 1;
         }
 
-      //TRACE_MSG(read_offset << " " << write_offset);
-
-      buffer = g_renew(guint8, buffer, size);
+      Storage *resized = allocate(size);
+      memcpy(resized->data, buffer, MIN(size, buffer_size));
 
-      //TRACE_MSG(buffer);
+      release();
 
+      storage = resized;
+      buffer = storage->data;
       read_ptr = buffer + read_offset;
       write_ptr = buffer + write_offset;
-      buffer_size = size;
+      buffer_size = storage->size;
     }
-  //TRACE_EXIT();
 }
 
 void
 PacketBuffer::grow(int size)
 {
-  //TRACE_ENTER_MSG("PacketBuffer::grow()", size)
   if (size < GROW_SIZE)
     {
       size = GROW_SIZE;
     }
 
   resize(buffer_size + size);
-  //TRACE_EXIT();
 }
 
 
+//! Returns a buffer that shares the specified part of this buffer.
+/*!
+ *  The slice contains the data of the specified part and starts reading
+ *  at its beginning.
+ */
+PacketBuffer
+PacketBuffer::slice(int pos, int size) const
+{
+  PacketBuffer ret(*this);
+
+  if (size > buffer_size - pos)
+    {
+      size = buffer_size - pos;
+    }
+
+  ret.buffer = buffer + pos;
+  ret.buffer_size = size;
+  ret.read_ptr = ret.buffer;
+  ret.write_ptr = ret.buffer + size;
+
+  return ret;
+}
+
+
+//! Moves the unread data to the start of the buffer.
+void
+PacketBuffer::compact()
+{
+  if (read_ptr != buffer)
+    {
+      int available = bytes_available();
+
+      if (storage->ref_count > 1)
+        {
+          Storage *compacted = allocate(buffer_size);
+          memcpy(compacted->data, read_ptr, available);
+
+          release();
+
+          storage = compacted;
+          buffer = storage->data;
+          buffer_size = storage->size;
+        }
+      else
+        {
+          memmove(buffer, read_ptr, available);
+        }
+
+      read_ptr = buffer;
+      write_ptr = buffer + available;
+    }
+}
+
+
+//! Makes room for writing the specified number of bytes.
+void
+PacketBuffer::reserve(int size)
+{
+  if (write_ptr + size >= buffer + buffer_size)
+    {
+      grow(size);
+    }
+  else if (storage->ref_count > 1)
+    {
+      resize(buffer_size);
+    }
+}
+
+
+//! Makes room for writing the specified number of bytes at the specified position.
+void
+PacketBuffer::reserve_at(int pos, int size)
+{
+  if (pos + size > buffer_size)
+    {
+      grow(pos + size - buffer_size);
+    }
+  else if (storage->ref_count > 1)
+    {
+      resize(buffer_size);
+    }
+}
+
+
+//! Drops the reference to the data.
+void
+PacketBuffer::release()
+{
+  if (storage != NULL && --storage->ref_count == 0)
+    {
+      recycle(storage);
+    }
+
+  storage = NULL;
+  buffer = NULL;
+  read_ptr = NULL;
+  write_ptr = NULL;
+  buffer_size = 0;
+}
+
+
+//! Allocates data of at least the specified size.
+PacketBuffer::Storage *
+PacketBuffer::allocate(int size)
+{
+  Storage *storage = NULL;
+
+  if (size <= POOL_BLOCK_SIZE && pool != NULL)
+    {
+      storage = pool;
+      pool = pool->next;
+      pool_size--;
+    }
+  else
+    {
+      storage = g_new(Storage, 1);
+      storage->size = MAX(size, POOL_BLOCK_SIZE);
+      storage->data = g_new(guint8, storage->size);
+    }
+
+  storage->ref_count = 1;
+  storage->next = NULL;
+  return storage;
+}
+
+
+//! Returns unused data to the pool.
+void
+PacketBuffer::recycle(Storage *storage)
+{
+  if (storage->size == POOL_BLOCK_SIZE && pool_size < POOL_MAX_SIZE)
+    {
+      storage->next = pool;
+      pool = storage;
+      pool_size++;
+    }
+  else
+    {
+      g_free(storage->data);
+      g_free(storage);
+    }
+}
+
 
 void
 PacketBuffer::pack(const guint8 *data, int size)
 {
-  if (write_ptr + size + 2 >= buffer + buffer_size)
-  {
-    grow(size + 2);
-  }
+  reserve(size + 2);
 
   pack_ushort(size);
   memcpy(write_ptr, data, size);
@@ -143,10 +368,7 @@ PacketBuffer::pack(const guint8 *data, int size)
 void
 PacketBuffer::pack_raw(const guint8 *data, int size)
 {
-  if (write_ptr + size >= buffer + buffer_size)
-  {
-    grow(size);
-  }
+  reserve(size);
 
   memcpy(write_ptr, data, size);
   write_ptr += size;
@@ -168,10 +390,7 @@ PacketBuffer::pack_string(const gchar *data)
       size = strlen(data);
     }
 
-  if (write_ptr + size + 2 >= buffer + buffer_size)
-  {
-    grow(size + 2);
-  }
+  reserve(size + 2);
 
   pack_ushort(size);
 
@@ -191,10 +410,7 @@ PacketBuffer::poke_string(int pos, const gchar *data)
       size = strlen(data);
     }
 
-  if (pos + size + 2 >= buffer_size)
-  {
-    grow(size + 2);
-  }
+  reserve_at(pos, size + 2);
 
   poke_ushort(pos, size);
 
@@ -208,10 +424,7 @@ PacketBuffer::poke_string(int pos, const gchar *data)
 void
 PacketBuffer::pack_ushort(guint16 data)
 {
-  if (write_ptr + 2 >= buffer + buffer_size)
-    {
-      grow(2);
-    }
+  reserve(2);
 
   guint8 *w = (guint8 *)write_ptr;
   w[0] = ((data & 0x0000ff00) >> 8);
@@ -224,10 +437,7 @@ PacketBuffer::pack_ushort(guint16 data)
 void
 PacketBuffer::pack_ulong(guint32 data)
 {
-  if (write_ptr + 4 >= buffer + buffer_size)
-    {
-      grow(4);
-    }
+  reserve(4);
 
   guint8 *w = (guint8 *)write_ptr;
   w[0] = ((data & 0xff000000) >> 24);
@@ -242,23 +452,35 @@ PacketBuffer::pack_ulong(guint32 data)
 void
 PacketBuffer::pack_byte(guint8 data)
 {
-  if (write_ptr + 1 >= buffer + buffer_size )
-    {
-      grow(1);
-    }
+  reserve(1);
 
   write_ptr[0] = data;
   write_ptr ++;
 }
 
 
+//! Packs an unsigned value in LEB128 encoding.
+void
+PacketBuffer::pack_varint(guint64 data)
+{
+  reserve(Varint::MAX_SIZE);
+
+  write_ptr = Varint::encode(write_ptr, data);
+}
+
+
+//! Packs a signed value in zigzag LEB128 encoding.
+void
+PacketBuffer::pack_signed_varint(gint64 data)
+{
+  pack_varint(Varint::zigzag(data));
+}
+
+
 void
 PacketBuffer::poke_byte(int pos, guint8 data)
 {
-  if (pos + 1 > buffer_size)
-    {
-      grow(pos + 1 - buffer_size);
-    }
+  reserve_at(pos, 1);
 
   buffer[pos] = data;
 }
@@ -266,10 +488,7 @@ PacketBuffer::poke_byte(int pos, guint8 data)
 void
 PacketBuffer::poke_ushort(int pos, guint16 data)
 {
-  if (pos + 2 > buffer_size )
-    {
-      grow(pos + 2 - buffer_size);
-    }
+  reserve_at(pos, 2);
 
   guint8 *w = (guint8 *)buffer;
 
@@ -325,25 +544,19 @@ PacketBuffer::unpack_raw(guint8 **data, int size)
 }
 
 
-gchar *
+PacketString
 PacketBuffer::unpack_string()
 {
-  gchar *str = NULL;
+  PacketString str;
 
-  if (read_ptr + 2 <= buffer + buffer_size)
+  if (read_ptr + 2 <= write_ptr)
     {
       int length = unpack_ushort();
 
-      if (read_ptr + length <= buffer + buffer_size)
+      if (read_ptr + length <= write_ptr)
         {
-          str = g_new(gchar, length + 1);
-          for (int i = 0; i < length; i++)
-            {
-              str[i] = *read_ptr;
-              read_ptr++;
-            }
-
-          str[length] = '\0';
+          str = PacketString((const gchar *)read_ptr, length);
+          read_ptr += length;
         }
     }
 
@@ -399,6 +612,35 @@ PacketBuffer::unpack_byte()
 }
 
 
+//! Unpacks an unsigned value in LEB128 encoding.
+/*!
+ *  Returns 0 and skips the remaining data if the value is truncated.
+ */
+guint64
+PacketBuffer::unpack_varint()
+{
+  const guint8 *data = read_ptr;
+  guint64 ret = 0;
+
+  if (!Varint::decode(data, write_ptr, ret))
+    {
+      read_ptr = write_ptr;
+      return 0;
+    }
+
+  read_ptr += data - read_ptr;
+  return ret;
+}
+
+
+//! Unpacks a signed value in zigzag LEB128 encoding.
+gint64
+PacketBuffer::unpack_signed_varint()
+{
+  return Varint::unzigzag(unpack_varint());
+}
+
+
 int
 PacketBuffer::peek(int pos, guint8 **data)
 {
@@ -420,20 +662,18 @@ PacketBuffer::peek(int pos, guint8 **data)
 }
 
 
-gchar *
+PacketString
 PacketBuffer::peek_string(int pos)
 {
-  gchar *str = NULL;
+  PacketString str;
 
-  if (read_ptr + pos + 2 <= buffer + buffer_size)
+  if (read_ptr + pos + 2 <= write_ptr)
     {
       int length = peek_ushort(pos);
 
-      if (read_ptr + 2 + pos + length <= buffer + buffer_size)
+      if (read_ptr + 2 + pos + length <= write_ptr)
         {
-          str = g_new(gchar, length + 1);
-          memcpy(str, read_ptr + pos + 2, length);
-          str[length] = '\0';
+          str = PacketString((const gchar *)read_ptr + pos + 2, length);
         }
     }
 
@@ -520,6 +760,8 @@ PacketBuffer::skip_size(int &pos)
 void
 PacketBuffer::insert(int pos, int size)
 {
+  reserve(size);
+
   if (pos < bytes_written())
     {
       int move = bytes_written() - pos;
@@ -529,44 +771,3 @@ PacketBuffer::insert(int pos, int size)
       write_ptr += size;
     }
 }
-
-
-void
-PacketBuffer::narrow(int pos, int size)
-{
-  //TRACE_ENTER_MSG("PacketBuffer::narrow", pos << " " << size);
-  if (pos == 0 && size == -1)
-    {
-      if (original_buffer != NULL)
-        {
-          // unnarrow.
-          buffer = original_buffer;
-          buffer_size = original_buffer_size;
-          original_buffer_size = 0;
-          original_buffer = NULL;
-        }
-    }
-  else
-    {
-      if (pos == -1)
-        {
-          pos = bytes_read();
-        }
-
-      if (original_buffer == NULL)
-        {
-          original_buffer = buffer;
-          original_buffer_size = buffer_size;
-        }
-
-      if (size > original_buffer_size - pos)
-        {
-          size = original_buffer_size - pos;
-        }
-
-      buffer = original_buffer + pos;
-      buffer_size = size;
-      read_ptr = buffer;
-    }
-  //TRACE_EXIT();
-}
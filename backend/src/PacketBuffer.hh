@@ -21,24 +21,66 @@
 #define PACKETBUFER_HH
 
 #include <string>
+#include <iostream>
 
 #include "glib.h"
 
 #define GROW_SIZE (4096)
 
+//! A string inside a packet buffer.
+/*!
+ *  The string is not copied out of the packet. It is not null-terminated
+ *  and remains valid as long as a PacketBuffer refers to the packet data.
+ */
+class PacketString
+{
+public:
+  PacketString() : data(NULL), length(0) {}
+  PacketString(const gchar *data, int length) : data(data), length(length) {}
+
+  bool is_null() const { return data == NULL; }
+  const gchar *get_data() const { return data; }
+  int get_length() const { return length; }
+
+  bool equals(const gchar *str) const;
+  gchar *dup() const;
+  std::string str() const;
+
+private:
+  //! Start of the string in the packet.
+  const gchar *data;
+
+  //! Length of the string.
+  int length;
+};
+
+std::ostream &operator<<(std::ostream &out, const PacketString &str);
+
+
+//! Buffer for packing and unpacking network packets.
+/*!
+ *  The packet data is reference counted. Copies and slices of a buffer
+ *  share the data until one of them is modified. Small buffers are
+ *  recycled through a pool. A PacketBuffer must only be used from the
+ *  main loop.
+ */
 class PacketBuffer
 {
 public:
   PacketBuffer();
   PacketBuffer(int size);
+  PacketBuffer(const PacketBuffer &other);
   ~PacketBuffer();
 
+  PacketBuffer &operator=(const PacketBuffer &other);
+
   void create(int size = 0);
   void resize(int size);
   void grow(int size);
-  void narrow(int pos, int size);
+  PacketBuffer slice(int pos, int size) const;
+  void compact();
 
-  void clear() { narrow(0, -1); write_ptr = read_ptr = buffer; }
+  void clear() { write_ptr = read_ptr = buffer; }
   void skip(int size) { read_ptr += size; }
   void insert(int pos, int size);
 
@@ -50,6 +92,8 @@ public:
   void pack_ushort(guint16 data);
   void pack_ulong(guint32 data);
   void pack_byte(guint8 data);
+  void pack_varint(guint64 data);
+  void pack_signed_varint(gint64 data);
 
   void poke_byte(int pos, guint8 data);
   void poke_ushort(int pos, guint16 data);
@@ -57,13 +101,15 @@ public:
 
   int unpack(guint8 **data);
   int unpack_raw(guint8 **data, int size);
-  gchar *unpack_string();
+  PacketString unpack_string();
   guint32 unpack_ulong();
   guint16 unpack_ushort();
   guint8 unpack_byte();
+  guint64 unpack_varint();
+  gint64 unpack_signed_varint();
 
   int peek(int pos, guint8 **data);
-  gchar *peek_string(int pos);
+  PacketString peek_string(int pos);
   guint32 peek_ulong(int pos);
   guint16 peek_ushort(int pos);
   guint8 peek_byte(int pos);
@@ -81,14 +127,45 @@ public:
   int get_buffer_size() { return buffer_size; }
   void restart_read() { read_ptr = buffer; }
 
+private:
+  //! Reference counted packet data.
+  struct Storage
+  {
+    //! Number of buffers that refer to the data.
+    int ref_count;
+
+    //! Size of the data.
+    int size;
+
+    //! The data.
+    guint8 *data;
+
+    //! Next unused storage in the pool.
+    Storage *next;
+  };
+
+  void reserve(int size);
+  void reserve_at(int pos, int size);
+  void release();
+
+  static Storage *allocate(int size);
+  static void recycle(Storage *storage);
+
 public:
   guint8 *buffer;
   guint8 *read_ptr;
   guint8 *write_ptr;
   int buffer_size;
 
-  guint8 *original_buffer;
-  int original_buffer_size;
+private:
+  //! Data of this buffer.
+  Storage *storage;
+
+  //! Pool of unused storage.
+  static Storage *pool;
+
+  //! Number of unused storage in the pool.
+  static int pool_size;
 };
 
 
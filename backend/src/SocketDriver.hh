@@ -42,6 +42,9 @@ public:
 
   //! The specified socket closed its connection.
   virtual void socket_closed(ISocket *con, void *data) = 0;
+
+  //! The specified socket sent all queued data.
+  virtual void socket_drained(ISocket *con, void *data) = 0;
 };
 
 
@@ -62,7 +65,8 @@ class ISocket
 {
 public:
   ISocket() :
-    listener(NULL)
+    listener(NULL),
+    write_limit(0)
   {
   }
 
@@ -75,8 +79,14 @@ public:
   virtual void read(void *buf, int count, int &bytes_read) = 0;
 
   //! Write data to the connection
+  /*! Data that cannot be sent immediately is queued and sent in the
+   *  background. A write either queues all data or throws.
+   */
   virtual void write(void *buf, int count, int &bytes_written) = 0;
 
+  //! Returns the number of bytes that are queued for sending.
+  virtual int get_queued_bytes() const = 0;
+
   //! Close the connection.
   virtual void close() = 0;
 
@@ -86,12 +96,21 @@ public:
   //! Set user data
   void set_data(void *data);
 
+  //! Limits the amount of queued data.
+  /*! The connection is dropped when more than \p limit bytes would be
+   *  queued. A value of 0 disables the limit.
+   */
+  void set_write_limit(int limit);
+
 protected:
   //! Listener that received notifications of socket events.
   ISocketListener *listener;
 
   // User data for callback.
   void *user_data;
+
+  //! Maximum number of queued bytes.
+  int write_limit;
 };
 
 
@@ -0,0 +1,261 @@
+// StateWriter.cc --- Atomic, coalesced writes of state files
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef PLATFORM_OS_WIN32
+#include <io.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "debug.hh"
+
+#include "StateWriter.hh"
+#include "Metrics.hh"
+
+static Metrics::Histogram flush_metric("workrave_state_flush_usec",
+                                       "Duration of writing all pending state files");
+static Metrics::Counter replace_metric("workrave_state_files_replaced_total",
+                                       "Number of state files that were replaced on disk");
+static Metrics::Counter append_metric("workrave_state_files_appended_total",
+                                      "Number of state files that were appended to on disk");
+static Metrics::Counter unchanged_metric("workrave_state_files_unchanged_total",
+                                         "Number of state file writes skipped because the contents did not change");
+static Metrics::Counter bytes_metric("workrave_state_bytes_written_total",
+                                     "Number of bytes written to state files");
+static Metrics::Counter error_metric("workrave_state_write_errors_total",
+                                     "Number of failed state file writes");
+
+//! Constructor.
+StateWriter::StateWriter() :
+  sync(true)
+{
+}
+
+
+//! Specifies whether files are synced to disk before they replace the original.
+void
+StateWriter::set_sync(bool sync)
+{
+  this->sync = sync;
+}
+
+
+//! Queues a write that replaces the contents of the specified file.
+void
+StateWriter::write(const std::string &filename, const std::string &contents)
+{
+  PendingWrite &write = pending[filename];
+  write.contents = contents;
+  write.append = false;
+}
+
+
+//! Queues data to be appended to the specified file.
+void
+StateWriter::append(const std::string &filename, const std::string &contents)
+{
+  PendingIter i = pending.find(filename);
+  if (i != pending.end())
+    {
+      // Also extends a pending replacement of the file.
+      i->second.contents += contents;
+    }
+  else
+    {
+      PendingWrite &write = pending[filename];
+      write.contents = contents;
+      write.append = true;
+    }
+}
+
+
+//! Forgets all pending and previous writes of the specified file.
+/*!
+ *  Must be called when the file is removed or modified by other means.
+ */
+void
+StateWriter::forget(const std::string &filename)
+{
+  pending.erase(filename);
+  written.erase(filename);
+}
+
+
+//! Returns whether there are writes that are not yet flushed.
+bool
+StateWriter::is_pending() const
+{
+  return !pending.empty();
+}
+
+
+//! Writes all pending data to disk.
+bool
+StateWriter::flush()
+{
+  TRACE_ENTER_MSG("StateWriter::flush", pending.size());
+
+  Metrics::Stopwatch stopwatch(flush_metric);
+  bool ret = true;
+  for (PendingIter i = pending.begin(); i != pending.end(); i++)
+    {
+      const std::string &filename = i->first;
+      PendingWrite &write = i->second;
+
+      if (write.append)
+        {
+          ret = append_file(filename, write.contents) && ret;
+          append_metric.inc();
+
+          // The file contents are no longer known.
+          written.erase(filename);
+        }
+      else
+        {
+          std::map<std::string, std::string>::iterator w = written.find(filename);
+          if (w != written.end() && w->second == write.contents)
+            {
+              TRACE_MSG("Unchanged " << filename);
+              unchanged_metric.inc();
+            }
+          else if (replace_file(filename, write.contents))
+            {
+              replace_metric.inc();
+              written[filename] = write.contents;
+            }
+          else
+            {
+              written.erase(filename);
+              ret = false;
+            }
+        }
+    }
+
+  pending.clear();
+
+  TRACE_RETURN(ret);
+  return ret;
+}
+
+
+//! Atomically replaces the contents of the specified file.
+bool
+StateWriter::replace_file(const std::string &filename, const std::string &contents)
+{
+  TRACE_ENTER_MSG("StateWriter::replace_file", filename);
+
+  std::string tmp_filename = filename + ".tmp";
+  FILE *file = g_fopen(tmp_filename.c_str(), "wb");
+  bool ret = (file != NULL);
+
+  if (ret && !contents.empty())
+    {
+      ret = fwrite(contents.data(), contents.size(), 1, file) == 1;
+      bytes_metric.inc(contents.size());
+    }
+
+  if (ret)
+    {
+      ret = sync_file(file);
+    }
+
+  if (file != NULL)
+    {
+      ret = (fclose(file) == 0) && ret;
+    }
+
+  if (ret)
+    {
+#ifdef PLATFORM_OS_WIN32
+      g_remove(filename.c_str());
+#endif
+      ret = g_rename(tmp_filename.c_str(), filename.c_str()) == 0;
+    }
+  else
+    {
+      g_remove(tmp_filename.c_str());
+    }
+
+  if (!ret)
+    {
+      error_metric.inc();
+    }
+
+  TRACE_RETURN(ret);
+  return ret;
+}
+
+
+//! Appends data to the specified file.
+bool
+StateWriter::append_file(const std::string &filename, const std::string &contents)
+{
+  FILE *file = g_fopen(filename.c_str(), "ab");
+  bool ret = (file != NULL);
+
+  if (ret && !contents.empty())
+    {
+      ret = fwrite(contents.data(), contents.size(), 1, file) == 1;
+      bytes_metric.inc(contents.size());
+    }
+
+  if (ret)
+    {
+      ret = sync_file(file);
+    }
+
+  if (file != NULL)
+    {
+      ret = (fclose(file) == 0) && ret;
+    }
+
+  if (!ret)
+    {
+      error_metric.inc();
+    }
+
+  return ret;
+}
+
+
+//! Flushes the specified file and, if enabled, syncs it to disk.
+bool
+StateWriter::sync_file(FILE *file)
+{
+  bool ret = fflush(file) == 0;
+
+  if (ret && sync)
+    {
+#if defined(PLATFORM_OS_WIN32)
+      ret = _commit(_fileno(file)) == 0;
+#elif HAVE_UNISTD_H
+      ret = fsync(fileno(file)) == 0;
+#endif
+    }
+
+  return ret;
+}
@@ -0,0 +1,79 @@
+// StateWriter.hh --- Atomic, coalesced writes of state files
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef STATEWRITER_HH
+#define STATEWRITER_HH
+
+#include <stdio.h>
+#include <string>
+#include <map>
+
+//! Coalesces writes of state files into a single burst of I/O.
+/*!
+ *  Writes are queued until flush() is called. Files are replaced by writing
+ *  a temporary file that is renamed over the original, so that a crash
+ *  never leaves a truncated file behind. A file is not rewritten if its
+ *  contents did not change since the last write.
+ */
+class StateWriter
+{
+public:
+  StateWriter();
+
+  void set_sync(bool sync);
+
+  void write(const std::string &filename, const std::string &contents);
+  void append(const std::string &filename, const std::string &contents);
+  void forget(const std::string &filename);
+
+  bool is_pending() const;
+  bool flush();
+
+private:
+  //! Pending write of a single file.
+  struct PendingWrite
+  {
+    PendingWrite() : append(false) {}
+
+    //! Data to write.
+    std::string contents;
+
+    //! Append the data instead of replacing the file.
+    bool append;
+  };
+
+  typedef std::map<std::string, PendingWrite> PendingMap;
+  typedef PendingMap::iterator PendingIter;
+
+  bool replace_file(const std::string &filename, const std::string &contents);
+  bool append_file(const std::string &filename, const std::string &contents);
+  bool sync_file(FILE *file);
+
+private:
+  //! Writes that are not yet flushed.
+  PendingMap pending;
+
+  //! Last contents written to each replaced file.
+  std::map<std::string, std::string> written;
+
+  //! Sync files to disk before renaming.
+  bool sync;
+};
+
+#endif // STATEWRITER_HH
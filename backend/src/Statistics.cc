@@ -35,6 +35,8 @@
 #include "Statistics.hh"
 
 #include "Core.hh"
+#include "StateWriter.hh"
+#include "Metrics.hh"
 #include "Util.hh"
 #include "Timer.hh"
 #include "TimePred.hh"
@@ -51,6 +53,11 @@ const int STATSVERSION = 4;
 
 #define MAX_JUMP (10000)
 
+static Metrics::Counter save_day_metric("workrave_statistics_day_saves_total",
+                                        "Number of times the statistics of today were saved");
+static Metrics::Histogram history_metric("workrave_statistics_history_add_usec",
+                                         "Duration of adding a day to the statistics history");
+
 //! Constructor
 Statistics::Statistics() :
   core(NULL),
@@ -62,6 +69,12 @@ Statistics::Statistics() :
   click_y(-1)
 {
    last_mouse_time = 0;
+   next_history_day = 0;
+
+   for (int i = 0; i < HISTORY_DAY_SLOTS; i++)
+     {
+       history_day_index[i] = -1;
+     }
 }
 
 
@@ -70,11 +83,6 @@ Statistics::~Statistics()
 {
   update();
 
-  for (vector<DailyStatsImpl *>::iterator i = history.begin(); i != history.end(); i++)
-    {
-      delete *i;
-    }
-
   delete current_day;
 
   if (input_monitor != NULL)
@@ -117,6 +125,11 @@ Statistics::update()
 {
   TRACE_ENTER("Statistics::update");
 
+  if (input_monitor != NULL)
+    {
+      input_monitor->flush();
+    }
+
   IActivityMonitor *monitor = core->get_activity_monitor();
   ActivityState state = monitor->get_current_state();
 
@@ -147,15 +160,18 @@ Statistics::delete_all_history()
     {
         return false;
     }
-    else
-    {
-        for( vector<DailyStatsImpl *>::iterator i = history.begin(); ( i != history.end() ); delete *i++ )
-            ;
 
-        history.clear();
+    if( !history.remove() )
+    {
+        return false;
+    }
+    for (int i = 0; i < HISTORY_DAY_SLOTS; i++)
+    {
+        history_day_index[i] = -1;
     }
 
     string todayfile = Util::get_home_directory() + "todaystats";
+    core->get_state_writer()->forget( todayfile );
     if( Util::file_exists( todayfile.c_str() ) && std::remove( todayfile.c_str() ) )
     {
         return false;
@@ -194,6 +210,7 @@ Statistics::start_new_day()
           TRACE_MSG("Save old day");
           day_to_history(current_day);
           day_to_remote_history(current_day);
+          delete current_day;
         }
 
       current_day = new DailyStatsImpl();
@@ -210,26 +227,12 @@ Statistics::start_new_day()
 }
 
 
+//! Adds the specified day to the history.
 void
 Statistics::day_to_history(DailyStatsImpl *stats)
 {
-  add_history(stats);
-
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "historystats" << ends;
-
-  bool exists = Util::file_exists(ss.str());
-  ofstream stats_file(ss.str().c_str(), ios::app);
-
-  if (!exists)
-    {
-      stats_file << WORKRAVESTATS << " " << STATSVERSION  << endl;
-    }
-
-  save_day(stats, stats_file);
-  stats_file.close();
-
+  Metrics::Stopwatch stopwatch(history_metric);
+  history.add_day(*stats);
 }
 
 
@@ -259,7 +262,7 @@ Statistics::day_to_remote_history(DailyStatsImpl *stats)
 
 //! Saves the current day to the specified stream.
 void
-Statistics::save_day(DailyStatsImpl *stats, ofstream &stats_file)
+Statistics::save_day(DailyStatsImpl *stats, ostream &stats_file)
 {
   stats_file << "D "
              << stats->start.tm_mday << " "
@@ -291,8 +294,6 @@ Statistics::save_day(DailyStatsImpl *stats, ofstream &stats_file)
       stats_file << stats->misc_stats[j] << " ";
     }
   stats_file << endl;
-
-  stats_file.close();
 }
 
 
@@ -300,21 +301,20 @@ Statistics::save_day(DailyStatsImpl *stats, ofstream &stats_file)
 void
 Statistics::save_day(DailyStatsImpl *stats)
 {
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "todaystats" << ends;
-
-  ofstream stats_file(ss.str().c_str());
+  stringstream stats_file;
 
   stats_file << WORKRAVESTATS << " " << STATSVERSION  << endl;
 
   save_day(stats, stats_file);
+
+  save_day_metric.inc();
+  core->get_state_writer()->write(Util::get_home_directory() + "todaystats", stats_file.str());
 }
 
 
 //! Add the stats the the history list.
 void
-Statistics::add_history(DailyStatsImpl *stats)
+Statistics::add_history(History &history, DailyStatsImpl *stats)
 {
   if (history.size() == 0)
     {
@@ -376,7 +376,7 @@ Statistics::load_current_day()
 
   ifstream stats_file(ss.str().c_str());
 
-  load(stats_file, false);
+  load(stats_file, NULL);
 
   been_active = true;
 
@@ -391,20 +391,54 @@ Statistics::load_history()
 {
   TRACE_ENTER("Statistics::load_history");
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "historystats" << ends;
+  string filename = Util::get_home_directory() + "historystats.bin";
+  string text_filename = Util::get_home_directory() + "historystats";
 
-  ifstream stats_file(ss.str().c_str());
+  bool convert = !Util::file_exists(filename) && Util::file_exists(text_filename);
+
+  history.open(filename);
+  if (convert)
+    {
+      convert_history(text_filename);
+    }
 
-  load(stats_file, true);
   TRACE_EXIT();
 }
 
 
+//! Converts the history of older versions to the binary history.
+/*!
+ *  The text history is left in place so that older versions of Workrave
+ *  continue to work.
+ */
+void
+Statistics::convert_history(const string &filename)
+{
+  TRACE_ENTER_MSG("Statistics::convert_history", filename);
+
+  History days;
+  ifstream stats_file(filename.c_str());
+
+  load(stats_file, &days);
+
+  vector<DailyStats> converted;
+  converted.reserve(days.size());
+
+  for (HistoryIter i = days.begin(); i != days.end(); i++)
+    {
+      converted.push_back(**i);
+      delete *i;
+    }
+
+  history.add_days(converted);
+
+  TRACE_RETURN(days.size());
+}
+
+
 //! Loads the statistics.
 void
-Statistics::load(ifstream &infile, bool history)
+Statistics::load(ifstream &infile, History *history)
 {
   TRACE_ENTER("Statistics::load");
 
@@ -444,12 +478,12 @@ Statistics::load(ifstream &infile, bool history)
 
           if (cmd == 'D')
             {
-              if (history && stats != NULL)
+              if (history != NULL && stats != NULL)
                 {
-                  add_history(stats);
+                  add_history(*history, stats);
                   stats = NULL;
                 }
-              else if (!history && stats != NULL)
+              else if (history == NULL && stats != NULL)
                 {
                   /* Corrupt today stats */
                   return;
@@ -468,7 +502,7 @@ Statistics::load(ifstream &infile, bool history)
                  >> stats->stop.tm_hour
                  >> stats->stop.tm_min;
 
-              if (!history)
+              if (history == NULL)
                 {
                   current_day = stats;
                 }
@@ -533,9 +567,9 @@ Statistics::load(ifstream &infile, bool history)
         }
     }
 
-  if (history && stats != NULL)
+  if (history != NULL && stats != NULL)
     {
-      add_history(stats);
+      add_history(*history, stats);
     }
 
   TRACE_EXIT();
@@ -656,9 +690,28 @@ Statistics::get_day(int day) const
           day--;
         }
 
-      if (day < int(history.size()) && day >= 0)
+      if (day >= 0 && day < history.size())
         {
-          ret = history[day];
+          // Days are decoded into a small ring of slots, so that the
+          // last few results remain valid.
+          int slot = 0;
+          while (slot < HISTORY_DAY_SLOTS && history_day_index[slot] != day)
+            {
+              slot++;
+            }
+
+          if (slot == HISTORY_DAY_SLOTS)
+            {
+              slot = next_history_day;
+              next_history_day = (next_history_day + 1) % HISTORY_DAY_SLOTS;
+              history_day_index[slot] = day;
+            }
+
+          // Decoded again, because the history may have changed.
+          if (history.get_day(day, history_days[slot]))
+            {
+              ret = &history_days[slot];
+            }
         }
     }
 
@@ -671,22 +724,36 @@ Statistics::get_day_index_by_date(int y, int m, int d,
 {
   TRACE_ENTER_MSG("Statistics::get_day_by_date", y << "/" << m << "/" << d);
   idx = next = prev = -1;
-  for (int i = 0; i <= int(history.size()); i++)
+
+  int size = history.size();
+  bool found = false;
+  int pos = history.find_date(StatisticsHistory::make_date_key(y, m, d), found);
+  int next_pos = found ? pos + 1 : pos;
+
+  if (found)
     {
-      int j = history.size() - i;
-      DailyStatsImpl *stats = j == 0 ? current_day : history[i];
-      if (idx < 0 && stats->starts_at_date(y, m, d))
-        {
-          idx = j;
-        }
-      else if (stats->starts_before_date(y, m, d))
-        {
-          prev = j;
-        }
-      else if (next < 0)
-        {
-          next = j;
-        }
+      idx = size - pos;
+    }
+  if (pos > 0)
+    {
+      prev = size - (pos - 1);
+    }
+  if (next_pos < size)
+    {
+      next = size - next_pos;
+    }
+
+  if (idx < 0 && current_day->starts_at_date(y, m, d))
+    {
+      idx = 0;
+    }
+  else if (current_day->starts_before_date(y, m, d))
+    {
+      prev = 0;
+    }
+  else if (next < 0)
+    {
+      next = 0;
     }
 
   if (prev < 0 && current_day->starts_before_date(y, m, d))
@@ -702,6 +769,48 @@ Statistics::get_day_index_by_date(int y, int m, int d,
 }
 
 
+//! Sums the statistics of all days between two dates.
+/*!
+ *  Takes two lookups in the history, regardless of the number of days.
+ */
+int
+Statistics::get_stats_by_date_range(int y1, int m1, int d1, int y2, int m2, int d2,
+                                    DailyStats &total, bool &today) const
+{
+  int from_key = StatisticsHistory::make_date_key(y1, m1, d1);
+  int to_key = StatisticsHistory::make_date_key(y2, m2, d2);
+
+  int count = history.get_totals(from_key, to_key, total);
+  today = false;
+
+  // The current day is not part of the history yet.
+  int key = StatisticsHistory::make_date_key(*current_day);
+  bool found = false;
+  history.find_date(key, found);
+
+  if (!found && key >= from_key && key <= to_key)
+    {
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          for (int j = 0; j < STATS_BREAKVALUE_SIZEOF; j++)
+            {
+              total.break_stats[i][j] += current_day->break_stats[i][j];
+            }
+        }
+
+      for (int j = 0; j < STATS_VALUE_SIZEOF; j++)
+        {
+          total.misc_stats[j] += current_day->misc_stats[j];
+        }
+
+      today = true;
+      count++;
+    }
+
+  return count;
+}
+
+
 int
 Statistics::get_history_size() const
 {
@@ -935,6 +1044,7 @@ Statistics::client_message(DistributionClientMessageID id, bool master, const ch
             {
               TRACE_MSG("Save to history");
               day_to_history(stats);
+              delete stats;
               stats_to_history = false;
             }
           break;
@@ -954,6 +1064,7 @@ Statistics::client_message(DistributionClientMessageID id, bool master, const ch
       // this should not happend. but just to avoid a potential memory leak...
       TRACE_MSG("Save to history");
       day_to_history(stats);
+      delete stats;
       stats_to_history = false;
     }
 
@@ -984,22 +1095,55 @@ Statistics::DailyStatsImpl::starts_before_date(int y, int m, int d)
 }
 
 
-//! Activity is reported by the input monitor.
+//! Input activity is reported by the input monitor.
 void
-Statistics::action_notify()
+Statistics::input_notify(const InputEvent *events, int count, gint64 time)
 {
+  lock.lock();
+
+  if (current_day != NULL)
+    {
+      for (int i = 0; i < count; i++)
+        {
+          const InputEvent &event = events[i];
+
+          switch (event.type)
+            {
+            case InputEvent::INPUT_EVENT_MOUSE:
+              mouse_notify(event, time);
+              break;
+
+            case InputEvent::INPUT_EVENT_BUTTON:
+              button_notify(event);
+              break;
+
+            case InputEvent::INPUT_EVENT_KEYBOARD:
+              if (!event.flag)
+                {
+                  current_day->misc_stats[STATS_VALUE_TOTAL_KEYSTROKES]++;
+                }
+              break;
+
+            default:
+              break;
+            }
+        }
+    }
+
+  lock.unlock();
 }
 
 
-//! Mouse activity is reported by the input monitor.
+//! Processes a mouse movement.
 void
-Statistics::mouse_notify(int x, int y, int wheel_delta)
+Statistics::mouse_notify(const InputEvent &event, gint64 now)
 {
   static const int sensitivity = 3;
 
-  lock.lock();
+  int x = event.x;
+  int y = event.y;
 
-  if (current_day != NULL && x >=0 && y >= 0)
+  if (x >= 0 && y >= 0)
     {
       int delta_x = sensitivity;
       int delta_y = sensitivity;
@@ -1015,7 +1159,7 @@ Statistics::mouse_notify(int x, int y, int wheel_delta)
 
       // Sanity checks, ignore unreasonable large jumps...
       if ( delta_x < MAX_JUMP && delta_y < MAX_JUMP &&
-          (delta_x >= sensitivity || delta_y >= sensitivity || wheel_delta != 0 ))
+          (delta_x >= sensitivity || delta_y >= sensitivity || event.wheel != 0 ))
         {
           int64_t movement = current_day->misc_stats[STATS_VALUE_TOTAL_MOUSE_MOVEMENT];
           int distance = int(sqrt((double)(delta_x * delta_x + delta_y * delta_y)));
@@ -1026,8 +1170,8 @@ Statistics::mouse_notify(int x, int y, int wheel_delta)
               current_day->misc_stats[STATS_VALUE_TOTAL_MOUSE_MOVEMENT] = movement;
             }
 
-
-          gint64 now = g_get_real_time();
+          // All events of a batch share the same time, so the movement
+          // time only advances between batches.
           gint64 tv = now - last_mouse_time;
 
           int tv_sec = tv / G_USEC_PER_SEC;
@@ -1040,57 +1184,34 @@ Statistics::mouse_notify(int x, int y, int wheel_delta)
           last_mouse_time = now;
         }
     }
-
-  lock.unlock();
 }
 
 
-//! Mouse button activity is reported by the input monitor.
+//! Processes a mouse button event.
 void
-Statistics::button_notify(bool is_press)
+Statistics::button_notify(const InputEvent &event)
 {
-  lock.lock();
-  if (current_day != NULL)
+  if (click_x != -1 && click_y != -1 &&
+      prev_x != -1  && prev_y != -1)
     {
-      if (click_x != -1 && click_y != -1 &&
-          prev_x != -1  && prev_y != -1)
-        {
-          int delta_x = click_x - prev_x;
-          int delta_y = click_y - prev_y;
-
-          int64_t movement = current_day->misc_stats[STATS_VALUE_TOTAL_CLICK_MOVEMENT];
-          int64_t distance = int(sqrt((double)(delta_x * delta_x + delta_y * delta_y)));
-
-          movement += distance;
-          if (movement > 0)
-            {
-              current_day->misc_stats[STATS_VALUE_TOTAL_CLICK_MOVEMENT] = movement;
-            }
-        }
+      int delta_x = click_x - prev_x;
+      int delta_y = click_y - prev_y;
 
-      click_x = prev_x;
-      click_y = prev_y;
+      int64_t movement = current_day->misc_stats[STATS_VALUE_TOTAL_CLICK_MOVEMENT];
+      int64_t distance = int(sqrt((double)(delta_x * delta_x + delta_y * delta_y)));
 
-      if (is_press)
+      movement += distance;
+      if (movement > 0)
         {
-          current_day->misc_stats[STATS_VALUE_TOTAL_CLICKS]++;
+          current_day->misc_stats[STATS_VALUE_TOTAL_CLICK_MOVEMENT] = movement;
         }
     }
-  lock.unlock();
-}
 
+  click_x = prev_x;
+  click_y = prev_y;
 
-//! Keyboard activity is reported by the input monitor.
-void
-Statistics::keyboard_notify(bool repeat)
-{
-  if (repeat)
-    return;
-
-  lock.lock();
-  if (current_day != NULL)
+  if (event.flag)
     {
-      current_day->misc_stats[STATS_VALUE_TOTAL_KEYSTROKES]++;
+      current_day->misc_stats[STATS_VALUE_TOTAL_CLICKS]++;
     }
-  lock.unlock();
 }
@@ -29,6 +29,7 @@
 #include "IStatistics.hh"
 #include "IInputMonitorListener.hh"
 #include "Mutex.hh"
+#include "StatisticsHistory.hh"
 
 // Forward declarion of external interface.
 namespace workrave {
@@ -131,30 +132,32 @@ public:
   DailyStatsImpl *get_current_day() const;
   DailyStatsImpl *get_day(int day) const;
   void get_day_index_by_date(int y, int m, int d, int &idx, int &next, int &prev) const;
+  int get_stats_by_date_range(int y1, int m1, int d1, int y2, int m2, int d2,
+                              DailyStats &total, bool &today) const;
 
   int get_history_size() const;
   void set_counter(StatsValueType t, int value);
   int64_t get_counter(StatsValueType t);
 
 private:
-  void action_notify();
-  void mouse_notify(int x, int y, int wheel = 0);
-  void button_notify(bool is_press);
-  void keyboard_notify(bool repeat);
+  void input_notify(const InputEvent *events, int count, gint64 time);
+  void mouse_notify(const InputEvent &event, gint64 now);
+  void button_notify(const InputEvent &event);
 
   bool load_current_day();
   void update_current_day(bool active);
   void load_history();
+  void convert_history(const std::string &filename);
 
 private:
   void save_day(DailyStatsImpl *stats);
-  void save_day(DailyStatsImpl *stats, std::ofstream &stats_file);
-  void load(std::ifstream &infile, bool history);
+  void save_day(DailyStatsImpl *stats, std::ostream &stats_file);
+  void load(std::ifstream &infile, History *history);
 
   void day_to_history(DailyStatsImpl *stats);
   void day_to_remote_history(DailyStatsImpl *stats);
 
-  void add_history(DailyStatsImpl *stats);
+  void add_history(History &history, DailyStatsImpl *stats);
 
 #ifdef HAVE_DISTRIBUTION
   void init_distribution_manager();
@@ -181,7 +184,19 @@ private:
   bool been_active;
 
   //! History
-  History history;
+  StatisticsHistory history;
+
+  //! Number of days returned by get_day that remain valid.
+  static const int HISTORY_DAY_SLOTS = 8;
+
+  //! Days of the history returned by get_day.
+  mutable DailyStatsImpl history_days[HISTORY_DAY_SLOTS];
+
+  //! History index of each day returned by get_day, or -1 if unused.
+  mutable int history_day_index[HISTORY_DAY_SLOTS];
+
+  //! Slot in which get_day decodes the next day.
+  mutable int next_history_day;
 
   //! Internal locking
   Mutex lock;
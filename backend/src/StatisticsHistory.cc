@@ -0,0 +1,598 @@
+// StatisticsHistory.cc --- Binary store of daily statistics
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <glib/gstdio.h>
+
+#include "debug.hh"
+
+#include "StatisticsHistory.hh"
+
+static const char HISTORY_MAGIC[4] = { 'W', 'R', 'S', 'H' };
+static const guint32 HISTORY_BYTE_ORDER = 0x01020304;
+static const guint32 HISTORY_VERSION = 1;
+
+//! Constructor.
+StatisticsHistory::StatisticsHistory() :
+  mapped_file(NULL),
+  records(NULL),
+  num_records(0)
+{
+}
+
+
+//! Destructor.
+StatisticsHistory::~StatisticsHistory()
+{
+  close();
+}
+
+
+//! Opens the specified history file.
+/*!
+ *  A missing file is treated as an empty history. A file with an
+ *  incompatible header is moved aside and replaced by an empty history.
+ */
+bool
+StatisticsHistory::open(const std::string &filename)
+{
+  TRACE_ENTER_MSG("StatisticsHistory::open", filename);
+
+  close();
+  this->filename = filename;
+
+  bool ret = true;
+  if (g_file_test(filename.c_str(), G_FILE_TEST_EXISTS) && !map())
+    {
+      TRACE_MSG("Incompatible history, moving aside");
+      std::string old_filename = filename + ".old";
+      g_remove(old_filename.c_str());
+      ret = g_rename(filename.c_str(), old_filename.c_str()) == 0;
+    }
+  update_totals(0);
+
+  TRACE_RETURN(num_records);
+  return ret;
+}
+
+
+//! Closes the history.
+void
+StatisticsHistory::close()
+{
+  unmap();
+  totals.clear();
+}
+
+
+//! Removes the history file.
+bool
+StatisticsHistory::remove()
+{
+  unmap();
+  update_totals(0);
+
+  bool ret = true;
+  if (g_file_test(filename.c_str(), G_FILE_TEST_EXISTS))
+    {
+      ret = g_remove(filename.c_str()) == 0;
+    }
+
+  return ret;
+}
+
+
+//! Returns the number of days in the history.
+int
+StatisticsHistory::size() const
+{
+  return num_records;
+}
+
+
+//! Retrieves the statistics of the day at the specified index (0 is the oldest day).
+bool
+StatisticsHistory::get_day(int index, IStatistics::DailyStats &stats) const
+{
+  const Record *record = get_record(index);
+  if (record != NULL)
+    {
+      decode(*record, stats);
+    }
+  return record != NULL;
+}
+
+
+//! Returns the date key of the day at the specified index.
+int
+StatisticsHistory::get_date_key(int index) const
+{
+  const Record *record = get_record(index);
+  return record != NULL ? record->date_key : -1;
+}
+
+
+//! Returns the index of the first day on or after the specified date key.
+int
+StatisticsHistory::find_date(int key, bool &found) const
+{
+  int low = 0;
+  int high = num_records;
+
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+      if (records[mid].date_key < key)
+        {
+          low = mid + 1;
+        }
+      else
+        {
+          high = mid;
+        }
+    }
+
+  found = (low < num_records && records[low].date_key == key);
+  return low;
+}
+
+
+//! Adds (or replaces) the statistics of a day.
+bool
+StatisticsHistory::add_day(const IStatistics::DailyStats &stats)
+{
+  TRACE_ENTER("StatisticsHistory::add_day");
+
+  bool found = false;
+  int index = find_date(make_date_key(stats), found);
+  bool ret = false;
+
+  if (found || index == num_records)
+    {
+      // Common case: append the latest day.
+      ret = write_record(stats, index);
+    }
+  else
+    {
+      ret = insert_record(stats, index);
+    }
+
+  TRACE_RETURN(ret);
+  return ret;
+}
+
+
+//! Adds (or replaces) the statistics of a number of days.
+/*!
+ *  The history is rewritten and mapped once, regardless of the number
+ *  of days. If a date occurs more than once, the last day is kept.
+ */
+bool
+StatisticsHistory::add_days(const std::vector<IStatistics::DailyStats> &days)
+{
+  TRACE_ENTER_MSG("StatisticsHistory::add_days", days.size());
+
+  if (days.empty())
+    {
+      TRACE_RETURN(true);
+      return true;
+    }
+
+  std::vector<Record> added(days.size());
+  for (size_t i = 0; i < days.size(); i++)
+    {
+      encode(days[i], added[i]);
+    }
+  std::stable_sort(added.begin(), added.end(), record_less);
+
+  std::vector<Record> all;
+  all.reserve(num_records + added.size());
+
+  // Merge the sorted days with the history. Added days replace existing ones.
+  int r = 0;
+  for (size_t i = 0; i < added.size(); i++)
+    {
+      const Record &record = added[i];
+      while (r < num_records && records[r].date_key < record.date_key)
+        {
+          all.push_back(records[r++]);
+        }
+      if (r < num_records && records[r].date_key == record.date_key)
+        {
+          r++;
+        }
+
+      if (!all.empty() && all.back().date_key == record.date_key)
+        {
+          all.back() = record;
+        }
+      else
+        {
+          all.push_back(record);
+        }
+    }
+  all.insert(all.end(), records + r, records + num_records);
+
+  bool ret = rewrite(all);
+  update_totals(0);
+
+  TRACE_RETURN(ret);
+  return ret;
+}
+
+
+//! Sums the statistics of all days between the specified date keys (inclusive).
+/*!
+ *  Returns the number of days in the range.
+ */
+int
+StatisticsHistory::get_totals(int from_key, int to_key, IStatistics::DailyStats &stats) const
+{
+  memset((void *)&stats, 0, sizeof(stats));
+
+  bool found;
+  int first = find_date(from_key, found);
+  int last = find_date(to_key + 1, found);
+
+  if (last <= first)
+    {
+      return 0;
+    }
+
+  const Totals &low = totals[first];
+  const Totals &high = totals[last];
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          stats.break_stats[i][j] = (int)(high.break_stats[i][j] - low.break_stats[i][j]);
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      stats.misc_stats[j] = high.misc_stats[j] - low.misc_stats[j];
+    }
+
+  return last - first;
+}
+
+
+//! Returns a sortable key of the specified date.
+int
+StatisticsHistory::make_date_key(int y, int m, int d)
+{
+  return y * 10000 + m * 100 + d;
+}
+
+
+//! Returns a sortable key of the start date of the specified day.
+int
+StatisticsHistory::make_date_key(const IStatistics::DailyStats &stats)
+{
+  return make_date_key(stats.start.tm_year + 1900, stats.start.tm_mon + 1, stats.start.tm_mday);
+}
+
+
+void
+StatisticsHistory::init_header(Header &header) const
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+  header.byte_order = HISTORY_BYTE_ORDER;
+  header.version = HISTORY_VERSION;
+  header.record_size = sizeof(Record);
+  header.num_breaks = BREAK_ID_SIZEOF;
+  header.num_break_values = IStatistics::STATS_BREAKVALUE_SIZEOF;
+  header.num_misc_values = IStatistics::STATS_VALUE_SIZEOF;
+}
+
+
+bool
+StatisticsHistory::check_header(const Header &header) const
+{
+  Header expected;
+  init_header(expected);
+  return memcmp(&header, &expected, sizeof(Header)) == 0;
+}
+
+
+//! Maps the history file into memory.
+bool
+StatisticsHistory::map()
+{
+  unmap();
+
+  GError *error = NULL;
+  mapped_file = g_mapped_file_new(filename.c_str(), FALSE, &error);
+  if (mapped_file == NULL)
+    {
+      g_error_free(error);
+      return false;
+    }
+
+  gsize length = g_mapped_file_get_length(mapped_file);
+  const gchar *contents = g_mapped_file_get_contents(mapped_file);
+
+  if (length < sizeof(Header) || !check_header(*(const Header *)contents))
+    {
+      unmap();
+      return false;
+    }
+
+  records = (const Record *)(contents + sizeof(Header));
+  num_records = (length - sizeof(Header)) / sizeof(Record);
+  return true;
+}
+
+
+//! Removes the mapping of the history file.
+void
+StatisticsHistory::unmap()
+{
+  if (mapped_file != NULL)
+    {
+      g_mapped_file_unref(mapped_file);
+      mapped_file = NULL;
+    }
+
+  records = NULL;
+  num_records = 0;
+}
+
+
+const StatisticsHistory::Record *
+StatisticsHistory::get_record(int index) const
+{
+  if (index >= 0 && index < num_records)
+    {
+      return &records[index];
+    }
+  return NULL;
+}
+
+
+//! Writes a record at the specified index, which is at most one past the end.
+bool
+StatisticsHistory::write_record(const IStatistics::DailyStats &stats, int index)
+{
+  Record record;
+  encode(stats, record);
+
+  // Windows does not allow a mapped file to be modified.
+  unmap();
+
+  bool exists = g_file_test(filename.c_str(), G_FILE_TEST_EXISTS);
+  FILE *file = g_fopen(filename.c_str(), exists ? "r+b" : "wb");
+  bool ret = (file != NULL);
+
+  if (ret && !exists)
+    {
+      Header header;
+      init_header(header);
+      ret = fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+  if (ret)
+    {
+      ret = fseek(file, sizeof(Header) + index * sizeof(Record), SEEK_SET) == 0;
+    }
+
+  if (ret)
+    {
+      ret = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+
+  if (file != NULL)
+    {
+      ret = (fclose(file) == 0) && ret;
+    }
+
+  map();
+  update_totals(index);
+  return ret;
+}
+
+
+//! Inserts a record before the specified index by rewriting the history.
+bool
+StatisticsHistory::insert_record(const IStatistics::DailyStats &stats, int index)
+{
+  TRACE_ENTER_MSG("StatisticsHistory::insert_record", index);
+
+  Record record;
+  encode(stats, record);
+
+  std::vector<Record> all(records, records + num_records);
+  all.insert(all.begin() + index, record);
+
+  bool ret = rewrite(all);
+  update_totals(index);
+
+  TRACE_RETURN(ret);
+  return ret;
+}
+
+
+//! Replaces the history by the specified records.
+bool
+StatisticsHistory::rewrite(const std::vector<Record> &all)
+{
+  Header header;
+  init_header(header);
+
+  std::string tmp_filename = filename + ".tmp";
+  FILE *file = g_fopen(tmp_filename.c_str(), "wb");
+  bool ret = (file != NULL);
+
+  if (ret)
+    {
+      ret = fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+  if (ret && !all.empty())
+    {
+      ret = fwrite(&all[0], sizeof(Record), all.size(), file) == all.size();
+    }
+
+  if (file != NULL)
+    {
+      ret = (fclose(file) == 0) && ret;
+    }
+
+  unmap();
+
+  if (ret)
+    {
+#ifdef PLATFORM_OS_WIN32
+      g_remove(filename.c_str());
+#endif
+      ret = g_rename(tmp_filename.c_str(), filename.c_str()) == 0;
+    }
+  else
+    {
+      g_remove(tmp_filename.c_str());
+    }
+
+  map();
+  return ret;
+}
+
+
+//! Recomputes the running totals from the specified index onwards.
+/*!
+ *  Appending a day only adds a single total.
+ */
+void
+StatisticsHistory::update_totals(int index)
+{
+  if (totals.empty() || index > (int)totals.size() - 1)
+    {
+      index = 0;
+    }
+
+  totals.resize(num_records + 1);
+  if (index == 0)
+    {
+      memset(&totals[0], 0, sizeof(Totals));
+    }
+
+  for (int r = index; r < num_records; r++)
+    {
+      const Record &record = records[r];
+      const Totals &prev = totals[r];
+      Totals &next = totals[r + 1];
+
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+            {
+              next.break_stats[i][j] = prev.break_stats[i][j] + record.break_stats[i][j];
+            }
+        }
+
+      for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+        {
+          next.misc_stats[j] = prev.misc_stats[j] + record.misc_stats[j];
+        }
+    }
+}
+
+
+bool
+StatisticsHistory::record_less(const Record &a, const Record &b)
+{
+  return a.date_key < b.date_key;
+}
+
+
+void
+StatisticsHistory::encode(const IStatistics::DailyStats &stats, Record &record)
+{
+  memset(&record, 0, sizeof(record));
+
+  record.date_key = make_date_key(stats);
+
+  record.start[0] = stats.start.tm_mday;
+  record.start[1] = stats.start.tm_mon;
+  record.start[2] = stats.start.tm_year;
+  record.start[3] = stats.start.tm_hour;
+  record.start[4] = stats.start.tm_min;
+
+  record.stop[0] = stats.stop.tm_mday;
+  record.stop[1] = stats.stop.tm_mon;
+  record.stop[2] = stats.stop.tm_year;
+  record.stop[3] = stats.stop.tm_hour;
+  record.stop[4] = stats.stop.tm_min;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          record.break_stats[i][j] = stats.break_stats[i][j];
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      record.misc_stats[j] = stats.misc_stats[j];
+    }
+}
+
+
+void
+StatisticsHistory::decode(const Record &record, IStatistics::DailyStats &stats)
+{
+  memset((void *)&stats.start, 0, sizeof(stats.start));
+  memset((void *)&stats.stop, 0, sizeof(stats.stop));
+
+  stats.start.tm_mday = record.start[0];
+  stats.start.tm_mon = record.start[1];
+  stats.start.tm_year = record.start[2];
+  stats.start.tm_hour = record.start[3];
+  stats.start.tm_min = record.start[4];
+
+  stats.stop.tm_mday = record.stop[0];
+  stats.stop.tm_mon = record.stop[1];
+  stats.stop.tm_year = record.stop[2];
+  stats.stop.tm_hour = record.stop[3];
+  stats.stop.tm_min = record.stop[4];
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          stats.break_stats[i][j] = record.break_stats[i][j];
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      stats.misc_stats[j] = record.misc_stats[j];
+    }
+}
@@ -0,0 +1,122 @@
+// StatisticsHistory.hh --- Binary store of daily statistics
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef STATISTICSHISTORY_HH
+#define STATISTICSHISTORY_HH
+
+#include <string>
+#include <vector>
+#include <glib.h>
+
+#include "IStatistics.hh"
+
+using namespace workrave;
+
+//! Append-only, memory-mapped store of the statistics of past days.
+/*!
+ *  The store is a file with a fixed header followed by fixed size records,
+ *  sorted by date. Records are read directly from a read-only mapping of
+ *  the file, so lookup by index is O(1) and lookup by date is O(log n).
+ *  Running totals of all days are kept in memory, so that the totals of
+ *  any range of dates (a week, a month or a year) take two lookups.
+ */
+class StatisticsHistory
+{
+public:
+  StatisticsHistory();
+  ~StatisticsHistory();
+
+  bool open(const std::string &filename);
+  void close();
+  bool remove();
+
+  int size() const;
+  bool get_day(int index, IStatistics::DailyStats &stats) const;
+  int get_date_key(int index) const;
+  int find_date(int key, bool &found) const;
+  bool add_day(const IStatistics::DailyStats &stats);
+  bool add_days(const std::vector<IStatistics::DailyStats> &days);
+  int get_totals(int from_key, int to_key, IStatistics::DailyStats &stats) const;
+
+  static int make_date_key(int y, int m, int d);
+  static int make_date_key(const IStatistics::DailyStats &stats);
+
+private:
+  //! File header.
+  struct Header
+  {
+    char magic[4];
+    guint32 byte_order;
+    guint32 version;
+    guint32 record_size;
+    guint16 num_breaks;
+    guint16 num_break_values;
+    guint16 num_misc_values;
+    guint16 reserved;
+  };
+
+  //! Statistics of a single day.
+  struct Record
+  {
+    gint64 misc_stats[IStatistics::STATS_VALUE_SIZEOF];
+    gint32 date_key;
+    gint32 start[5];
+    gint32 stop[5];
+    gint32 break_stats[BREAK_ID_SIZEOF][IStatistics::STATS_BREAKVALUE_SIZEOF];
+  };
+
+  //! Sum of the statistics of a number of days.
+  struct Totals
+  {
+    gint64 misc_stats[IStatistics::STATS_VALUE_SIZEOF];
+    gint64 break_stats[BREAK_ID_SIZEOF][IStatistics::STATS_BREAKVALUE_SIZEOF];
+  };
+
+  void init_header(Header &header) const;
+  bool check_header(const Header &header) const;
+  bool map();
+  void unmap();
+  const Record *get_record(int index) const;
+  bool write_record(const IStatistics::DailyStats &stats, int index);
+  bool insert_record(const IStatistics::DailyStats &stats, int index);
+  bool rewrite(const std::vector<Record> &all);
+  void update_totals(int index);
+
+  static bool record_less(const Record &a, const Record &b);
+  static void encode(const IStatistics::DailyStats &stats, Record &record);
+  static void decode(const Record &record, IStatistics::DailyStats &stats);
+
+private:
+  //! Name of the history file.
+  std::string filename;
+
+  //! Read-only mapping of the file.
+  GMappedFile *mapped_file;
+
+  //! Records in the mapping.
+  const Record *records;
+
+  //! Number of records.
+  int num_records;
+
+  //! Totals of the records before each index, plus the total of all records.
+  std::vector<Totals> totals;
+};
+
+#endif // STATISTICSHISTORY_HH
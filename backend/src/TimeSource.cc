@@ -0,0 +1,47 @@
+// TimeSource.cc --- The Time
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "TimeSource.hh"
+
+static SystemTimeSource system_time_source;
+
+const TimeSource *TimeSource::clock = &system_time_source;
+
+//! Returns the clock from which the backend reads the current time.
+const TimeSource *
+TimeSource::get_clock()
+{
+  return clock;
+}
+
+
+//! Replaces the clock of the backend.
+/*!
+ *  Must be called before the core is initialized. NULL restores the
+ *  system clock.
+ */
+void
+TimeSource::set_clock(const TimeSource *clock)
+{
+  TimeSource::clock = (clock != NULL) ? clock : &system_time_source;
+}
@@ -31,6 +31,8 @@
 # endif
 #endif
 
+#include <glib.h>
+
 //! A source of time.
 class TimeSource
 {
@@ -39,6 +41,67 @@ public:
 
   //! Returns the time of this source.
   virtual time_t get_time() const = 0;
+
+  //! Returns the time of this source in microseconds.
+  virtual gint64 get_real_time() const
+  {
+    return (gint64)get_time() * G_USEC_PER_SEC;
+  }
+
+  static const TimeSource *get_clock();
+  static void set_clock(const TimeSource *clock);
+
+private:
+  //! The clock of the backend.
+  static const TimeSource *clock;
+};
+
+
+//! The wall clock of the system.
+class SystemTimeSource : public TimeSource
+{
+public:
+  virtual time_t get_time() const
+  {
+    return time(NULL);
+  }
+
+  virtual gint64 get_real_time() const
+  {
+    return g_get_real_time();
+  }
+};
+
+
+//! A clock that only advances when told to.
+/*!
+ *  Allows the backend to run in virtual time, e.g. to replay recorded
+ *  input faster than real time.
+ */
+class VirtualTimeSource : public TimeSource
+{
+public:
+  VirtualTimeSource(gint64 time = 0) : now(time) {}
+
+  virtual time_t get_time() const
+  {
+    return (time_t)(now / G_USEC_PER_SEC);
+  }
+
+  virtual gint64 get_real_time() const
+  {
+    return now;
+  }
+
+  //! Sets the time in microseconds.
+  void set_real_time(gint64 time)
+  {
+    now = time;
+  }
+
+private:
+  //! Current time in microseconds.
+  gint64 now;
 };
 
 #endif // TIMESOURCE_HH
@@ -881,7 +881,19 @@ Timer::serialize_state() const
 
   ss << timer_id << " "
      << core->get_time() << " "
-     << get_elapsed_time() << " "
+     << serialize_state_values();
+
+  return ss.str();
+}
+
+
+//! Returns the serialized state without the timer id and save time.
+std::string
+Timer::serialize_state_values() const
+{
+  stringstream ss;
+
+  ss << get_elapsed_time() << " "
      << last_pred_reset_time << " "
      << total_overdue_time << " "
      << snooze_inhibited << " "
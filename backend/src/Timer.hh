@@ -144,6 +144,7 @@ public:
   time_t get_auto_reset() const;
   TimePred *get_auto_reset_predicate() const;
   time_t get_next_reset_time() const;
+  time_t get_next_pred_reset_time() const;
 
   // Limiting.
   void set_limit(int t);
@@ -158,6 +159,7 @@ public:
 
   // State serialization.
   std::string serialize_state() const;
+  std::string serialize_state_values() const;
   bool deserialize_state(const std::string &state, int version);
   void set_state(int elapsed, int idle, int overdue = -1);
 
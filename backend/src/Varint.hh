@@ -0,0 +1,110 @@
+// Varint.hh --- LEB128 variable length integers
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef VARINT_HH
+#define VARINT_HH
+
+#include <string>
+
+#include "glib.h"
+
+//! Unsigned LEB128 and signed zigzag encoding of integers.
+class Varint
+{
+public:
+  //! Maximum size of an encoded value.
+  static const int MAX_SIZE = 10;
+
+  //! Encodes an unsigned value and returns the end of the encoded data.
+  /*!
+   *  \param out buffer with room for at least MAX_SIZE bytes.
+   */
+  static guint8 *encode(guint8 *out, guint64 value)
+  {
+    while (value >= 0x80)
+      {
+        *out++ = (guint8)((value & 0x7f) | 0x80);
+        value >>= 7;
+      }
+    *out++ = (guint8)value;
+    return out;
+  }
+
+  //! Decodes an unsigned value.
+  /*!
+   *  Advances \a data past the value. Returns false if the value is
+   *  truncated by \a end.
+   */
+  static bool decode(const guint8 *&data, const guint8 *end, guint64 &value)
+  {
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7)
+      {
+        guint8 byte = *data++;
+        value |= (guint64)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+
+  //! Maps a signed value to an unsigned value with a small magnitude.
+  static guint64 zigzag(gint64 value)
+  {
+    return ((guint64)value << 1) ^ (guint64)(value >> 63);
+  }
+
+  //! Reverses zigzag.
+  static gint64 unzigzag(guint64 value)
+  {
+    return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+  }
+
+  //! Appends an unsigned value.
+  static void pack(std::string &data, guint64 value)
+  {
+    guint8 buffer[MAX_SIZE];
+    data.append((const char *)buffer, encode(buffer, value) - buffer);
+  }
+
+  //! Appends a signed value in zigzag encoding.
+  static void pack_signed(std::string &data, gint64 value)
+  {
+    pack(data, zigzag(value));
+  }
+
+  //! Reads an unsigned value.
+  static bool unpack(const guchar *&data, const guchar *end, guint64 &value)
+  {
+    return decode(data, end, value);
+  }
+
+  //! Reads a signed value in zigzag encoding.
+  static bool unpack_signed(const guchar *&data, const guchar *end, gint64 &value)
+  {
+    guint64 raw = 0;
+    bool ret = decode(data, end, raw);
+    value = unzigzag(raw);
+    return ret;
+  }
+};
+
+#endif // VARINT_HH
@@ -0,0 +1,437 @@
+// EvdevInputMonitor.cc --- ActivityMonitor for Linux input devices
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "debug.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#include "EvdevInputMonitor.hh"
+
+#include "Thread.hh"
+
+using namespace std;
+
+#define BITS_PER_LONG           (sizeof(unsigned long) * 8)
+#define NUM_LONGS(bits)         (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array)    ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+
+EvdevInputMonitor::EvdevInputMonitor(const char *device_dir) :
+  device_dir(device_dir),
+  epoll_fd(-1),
+  inotify_fd(-1),
+  abort(0)
+{
+  wakeup_pipe[0] = -1;
+  wakeup_pipe[1] = -1;
+  monitor_thread = new Thread(this);
+}
+
+
+EvdevInputMonitor::~EvdevInputMonitor()
+{
+  TRACE_ENTER("EvdevInputMonitor::~EvdevInputMonitor");
+  if (monitor_thread != NULL)
+    {
+      monitor_thread->wait();
+      delete monitor_thread;
+    }
+
+  for (DeviceIter i = devices.begin(); i != devices.end(); i++)
+    {
+      close(i->second->fd);
+      delete i->second;
+    }
+
+  if (inotify_fd != -1)
+    {
+      close(inotify_fd);
+    }
+  if (wakeup_pipe[0] != -1)
+    {
+      close(wakeup_pipe[0]);
+      close(wakeup_pipe[1]);
+    }
+  if (epoll_fd != -1)
+    {
+      close(epoll_fd);
+    }
+  TRACE_EXIT();
+}
+
+
+//! Opens all readable input devices.
+/*!
+ *  Fails if no input device can be read.
+ */
+bool
+EvdevInputMonitor::init()
+{
+  TRACE_ENTER("EvdevInputMonitor::init");
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1 || pipe(wakeup_pipe) != 0)
+    {
+      TRACE_RETURN("Cannot create epoll or pipe");
+      return false;
+    }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_pipe[0];
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_pipe[0], &event);
+
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd != -1)
+    {
+      // Device nodes become readable once udev changed their permissions.
+      if (inotify_add_watch(inotify_fd, device_dir.c_str(), IN_CREATE | IN_ATTRIB) != -1)
+        {
+          event.data.fd = inotify_fd;
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event);
+        }
+    }
+
+  scan_devices();
+
+  bool ok = !devices.empty();
+  if (ok)
+    {
+      monitor_thread->start();
+    }
+
+  TRACE_RETURN(ok);
+  return ok;
+}
+
+
+void
+EvdevInputMonitor::terminate()
+{
+  TRACE_ENTER("EvdevInputMonitor::terminate");
+
+  g_atomic_int_set(&abort, 1);
+  if (wakeup_pipe[1] != -1)
+    {
+      char c = 0;
+      if (write(wakeup_pipe[1], &c, 1) != 1)
+        {
+          TRACE_MSG("Failed to wake up monitor thread");
+        }
+    }
+
+  monitor_thread->wait();
+
+  TRACE_EXIT();
+}
+
+
+void
+EvdevInputMonitor::run()
+{
+  TRACE_ENTER("EvdevInputMonitor::run");
+
+  struct epoll_event events[16];
+
+  while (!g_atomic_int_get(&abort))
+    {
+      int count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+      if (count == -1 && errno != EINTR)
+        {
+          TRACE_MSG("epoll_wait failed " << errno);
+          break;
+        }
+
+      for (int i = 0; i < count; i++)
+        {
+          int fd = events[i].data.fd;
+
+          if (fd == inotify_fd)
+            {
+              read_hotplug();
+            }
+          else if (fd != wakeup_pipe[0])
+            {
+              DeviceIter it = devices.find(fd);
+              if (it != devices.end())
+                {
+                  read_device(it->second);
+                }
+            }
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Opens all event devices in the device directory.
+void
+EvdevInputMonitor::scan_devices()
+{
+  DIR *dir = opendir(device_dir.c_str());
+  if (dir != NULL)
+    {
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != NULL)
+        {
+          if (strncmp(entry->d_name, "event", 5) == 0)
+            {
+              add_device(entry->d_name);
+            }
+        }
+      closedir(dir);
+    }
+}
+
+
+//! Opens the specified event device, if it generates user input.
+bool
+EvdevInputMonitor::add_device(const string &name)
+{
+  TRACE_ENTER_MSG("EvdevInputMonitor::add_device", name);
+
+  for (DeviceIter i = devices.begin(); i != devices.end(); i++)
+    {
+      if (i->second->name == name)
+        {
+          TRACE_RETURN("Already open");
+          return true;
+        }
+    }
+
+  string path = device_dir + "/" + name;
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+    {
+      TRACE_RETURN("Cannot open " << errno);
+      return false;
+    }
+
+  unsigned long types[NUM_LONGS(EV_CNT)];
+  memset(types, 0, sizeof(types));
+
+  if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) == -1 ||
+      !(TEST_BIT(EV_KEY, types) || TEST_BIT(EV_REL, types) || TEST_BIT(EV_ABS, types)))
+    {
+      close(fd);
+      TRACE_RETURN("Not an input device");
+      return false;
+    }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      close(fd);
+      TRACE_RETURN("Cannot poll");
+      return false;
+    }
+
+  Device *device = new Device();
+  device->fd = fd;
+  device->name = name;
+  devices[fd] = device;
+
+  TRACE_RETURN(fd);
+  return true;
+}
+
+
+void
+EvdevInputMonitor::remove_device(Device *device)
+{
+  TRACE_ENTER_MSG("EvdevInputMonitor::remove_device", device->name);
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+  close(device->fd);
+  devices.erase(device->fd);
+  delete device;
+
+  TRACE_EXIT();
+}
+
+
+//! Reads all pending events of a device.
+void
+EvdevInputMonitor::read_device(Device *device)
+{
+  struct input_event events[EVENT_BATCH_SIZE];
+
+  while (true)
+    {
+      ssize_t size = read(device->fd, events, sizeof(events));
+
+      if (size > 0)
+        {
+          process_events(device, events, size / sizeof(struct input_event));
+        }
+      else if (size == -1 && errno == EINTR)
+        {
+          continue;
+        }
+      else
+        {
+          if (size == 0 || errno != EAGAIN)
+            {
+              // Device was unplugged.
+              remove_device(device);
+            }
+          break;
+        }
+    }
+}
+
+
+//! Opens devices that were added to the device directory.
+void
+EvdevInputMonitor::read_hotplug()
+{
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  ssize_t size;
+  while ((size = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+      char *ptr = buffer;
+      while (ptr < buffer + size)
+        {
+          struct inotify_event *event = (struct inotify_event *) ptr;
+
+          if (event->len > 0 && strncmp(event->name, "event", 5) == 0)
+            {
+              add_device(event->name);
+            }
+
+          ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+
+//! Decodes a batch of input events.
+/*!
+ *  Pointer movement is reported once per batch, keys and buttons are
+ *  reported immediately.
+ */
+void
+EvdevInputMonitor::process_events(Device *device, const struct input_event *events, int count)
+{
+  for (int i = 0; i < count; i++)
+    {
+      const struct input_event &event = events[i];
+
+      if (event.type == EV_SYN)
+        {
+          if (event.code == SYN_DROPPED)
+            {
+              // The kernel buffer overflowed. Skip the incomplete report.
+              device->dropped = true;
+              fire_action();
+            }
+          else if (event.code == SYN_REPORT)
+            {
+              device->dropped = false;
+            }
+          continue;
+        }
+
+      if (device->dropped)
+        {
+          continue;
+        }
+
+      switch (event.type)
+        {
+        case EV_KEY:
+          if (event.code >= BTN_MOUSE && event.code <= BTN_TASK)
+            {
+              fire_button(event.value != 0);
+            }
+          else if (event.code >= BTN_MISC && event.code < KEY_OK)
+            {
+              // Touch, tool and joystick buttons.
+              fire_action();
+            }
+          else if (event.value == 1)
+            {
+              fire_keyboard(false);
+            }
+          else if (event.value == 2)
+            {
+              fire_keyboard(true);
+            }
+          break;
+
+        case EV_REL:
+          if (event.code == REL_X)
+            {
+              device->x += event.value;
+              device->moved = true;
+            }
+          else if (event.code == REL_Y)
+            {
+              device->y += event.value;
+              device->moved = true;
+            }
+          else if (event.code == REL_WHEEL || event.code == REL_HWHEEL)
+            {
+              device->wheel += event.value;
+            }
+          break;
+
+        case EV_ABS:
+          if (event.code == ABS_X)
+            {
+              device->x = event.value;
+              device->moved = true;
+            }
+          else if (event.code == ABS_Y)
+            {
+              device->y = event.value;
+              device->moved = true;
+            }
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  if (device->moved || device->wheel != 0)
+    {
+      fire_mouse(device->x, device->y, device->wheel);
+      device->moved = false;
+      device->wheel = 0;
+    }
+}
@@ -0,0 +1,122 @@
+// EvdevInputMonitor.hh --- ActivityMonitor for Linux input devices
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef EVDEVINPUTMONITOR_HH
+#define EVDEVINPUTMONITOR_HH
+
+#include <string>
+#include <map>
+
+#include <linux/input.h>
+
+#include "InputMonitor.hh"
+
+#include "Runnable.hh"
+#include "Thread.hh"
+
+//! Activity monitor that reads the Linux evdev input devices.
+/*!
+ *  Works without a display server, e.g. in Wayland sessions. The user
+ *  must be allowed to read the event devices, usually by membership of
+ *  the input group. Devices that are added later, including uinput
+ *  devices, are picked up automatically.
+ */
+class EvdevInputMonitor :
+  public InputMonitor,
+  public Runnable
+{
+public:
+  //! Constructor.
+  EvdevInputMonitor(const char *device_dir = "/dev/input");
+
+  //! Destructor.
+  virtual ~EvdevInputMonitor();
+
+  //! Initialize
+  virtual bool init();
+
+  //! Terminate the monitor.
+  virtual void terminate();
+
+private:
+  //! State of a single event device.
+  struct Device
+  {
+    Device() : fd(-1), x(0), y(0), wheel(0), moved(false), dropped(false) {}
+
+    //! File descriptor of the device.
+    int fd;
+
+    //! Name of the device file.
+    std::string name;
+
+    //! Pointer position. Relative devices move a virtual pointer.
+    int x;
+    int y;
+
+    //! Wheel movement since the last report.
+    int wheel;
+
+    //! Did the pointer move since the last report?
+    bool moved;
+
+    //! Are events being dropped until the next SYN_REPORT?
+    bool dropped;
+  };
+
+  typedef std::map<int, Device *> DeviceMap;
+  typedef DeviceMap::iterator DeviceIter;
+
+  //! The monitor's execution thread.
+  virtual void run();
+
+  void scan_devices();
+  bool add_device(const std::string &name);
+  void remove_device(Device *device);
+  void read_device(Device *device);
+  void read_hotplug();
+  void process_events(Device *device, const struct input_event *events, int count);
+
+private:
+  //! Number of events read at once.
+  static const int EVENT_BATCH_SIZE = 64;
+
+  //! Directory with the event devices.
+  std::string device_dir;
+
+  //! Open devices by file descriptor.
+  DeviceMap devices;
+
+  //! Polls the devices, the hotplug watch and the wakeup pipe.
+  int epoll_fd;
+
+  //! Watches the device directory for new devices.
+  int inotify_fd;
+
+  //! Wakes up the monitor thread on termination.
+  int wakeup_pipe[2];
+
+  //! Abort the main loop
+  volatile gint abort;
+
+  //! The activity monitor thread.
+  Thread *monitor_thread;
+};
+
+#endif // EVDEVINPUTMONITOR_HH
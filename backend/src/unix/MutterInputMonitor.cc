@@ -28,21 +28,13 @@ using namespace std;
 
 MutterInputMonitor::MutterInputMonitor()
 {
-  monitor_thread = new Thread(this);
-  g_mutex_init(&mutex);
-  g_cond_init(&cond);
+  cancellable = g_cancellable_new();
 }
 
 MutterInputMonitor::~MutterInputMonitor()
 {
-  if (monitor_thread != NULL)
-    {
-      monitor_thread->wait();
-      delete monitor_thread;
-    }
-
-  g_mutex_clear(&mutex);
-  g_cond_clear(&cond);
+  terminate();
+  g_object_unref(cancellable);
 }
 
 bool
@@ -64,35 +56,46 @@ MutterInputMonitor::init()
 bool
 MutterInputMonitor::init_idle_monitor()
 {
-  TRACE_ENTER("MutterInputMonitor::init");
+  TRACE_ENTER("MutterInputMonitor::init_idle_monitor");
   GError *error = NULL;
   bool result = true;
 
+  // Only asks the bus daemon whether Mutter is running. The compositor
+  // itself is never called synchronously.
   idle_proxy = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                             G_DBUS_PROXY_FLAGS_NONE,
+                                             GDBusProxyFlags(G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                                             G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START),
                                              NULL,
                                              "org.gnome.Mutter.IdleMonitor",
                                              "/org/gnome/Mutter/IdleMonitor/Core",
                                              "org.gnome.Mutter.IdleMonitor",
                                              NULL,
                                              &error);
-  if (error == NULL)
+  if (error != NULL)
     {
-      g_signal_connect(idle_proxy, "g-signal", G_CALLBACK(on_idle_monitor_signal), this);
-
-      result = register_active_watch();
-      result = result && register_idle_watch();
-
-      if (result)
+      TRACE_MSG("Error: " << error->message);
+      g_error_free(error);
+      result = false;
+    }
+  else
+    {
+      gchar *owner = g_dbus_proxy_get_name_owner(idle_proxy);
+      if (owner == NULL)
         {
-          monitor_thread->start();
+          TRACE_MSG("Mutter is not running");
+          g_object_unref(idle_proxy);
+          idle_proxy = NULL;
+          result = false;
         }
+      g_free(owner);
     }
-  else
+
+  if (result)
     {
-      TRACE_MSG("Error: " << error->message);
-      g_error_free(error);
-      result = false;
+      g_signal_connect(idle_proxy, "g-signal", G_CALLBACK(on_idle_monitor_signal), this);
+
+      register_active_watch_async();
+      register_idle_watch_async();
     }
 
   TRACE_EXIT();
@@ -102,54 +105,57 @@ MutterInputMonitor::init_idle_monitor()
 void
 MutterInputMonitor::init_inhibitors()
 {
-  TRACE_ENTER("MutterInputMonitor::monitor_inhibitors");
-
-  session_proxy = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                G_DBUS_PROXY_FLAGS_NONE,
-                                                NULL,
-                                                "org.gnome.SessionManager",
-                                                "/org/gnome/SessionManager",
-                                                "org.gnome.SessionManager",
-                                                NULL,
-                                                NULL);
-  if (session_proxy != NULL)
-    {
-      g_signal_connect(session_proxy, "g-properties-changed", G_CALLBACK(on_session_manager_property_changed), this);
-
-      GVariant *v = g_dbus_proxy_get_cached_property(session_proxy, "InhibitedActions");
-      inhibited = (g_variant_get_uint32(v) & GSM_INHIBITOR_FLAG_IDLE) != 0;
-      TRACE_MSG("Inhibited:" << g_variant_get_uint32(v) << " " << inhibited);
-      g_variant_unref(v);
-    }
+  TRACE_ENTER("MutterInputMonitor::init_inhibitors");
+  g_dbus_proxy_new_for_bus(G_BUS_TYPE_SESSION,
+                           G_DBUS_PROXY_FLAGS_NONE,
+                           NULL,
+                           "org.gnome.SessionManager",
+                           "/org/gnome/SessionManager",
+                           "org.gnome.SessionManager",
+                           cancellable,
+                           on_session_proxy_ready,
+                           this);
   TRACE_EXIT();
 }
 
-bool
-MutterInputMonitor::register_active_watch()
+void
+MutterInputMonitor::on_session_proxy_ready(GObject *object, GAsyncResult *res, gpointer user_data)
 {
-  TRACE_ENTER("MutterInputMonitor::register_active_watch");
+  TRACE_ENTER("MutterInputMonitor::on_session_proxy_ready");
+  (void) object;
+
   GError *error = NULL;
-  GVariant *reply = g_dbus_proxy_call_sync(idle_proxy, "AddUserActiveWatch", NULL, G_DBUS_CALL_FLAGS_NONE, 10000, NULL, &error);
+  GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
 
-  if (error == NULL)
+  if (error != NULL)
     {
-      g_variant_get(reply, "(u)", &watch_active);
-      g_variant_unref(reply);
+      // When cancelled, the monitor may already be deleted.
+      TRACE_MSG("Error: " << error->message);
+      g_error_free(error);
     }
   else
     {
-      TRACE_MSG("Error: " << error->message);
-      g_error_free(error);
+      MutterInputMonitor *self = (MutterInputMonitor *)user_data;
+      self->session_proxy = proxy;
+
+      g_signal_connect(proxy, "g-properties-changed", G_CALLBACK(on_session_manager_property_changed), self);
+
+      GVariant *v = g_dbus_proxy_get_cached_property(proxy, "InhibitedActions");
+      if (v != NULL)
+        {
+          TRACE_MSG("Inhibited:" << g_variant_get_uint32(v));
+          self->set_inhibited(g_variant_get_uint32(v));
+          g_variant_unref(v);
+        }
     }
   TRACE_EXIT();
-  return error == NULL;
 }
 
 void
 MutterInputMonitor::register_active_watch_async()
 {
-  TRACE_ENTER("MutterInputMonitor::register_active_watch_aync");
-  g_dbus_proxy_call(idle_proxy, "AddUserActiveWatch", NULL, G_DBUS_CALL_FLAGS_NONE, 10000, NULL, on_register_active_watch_reply, this);
+  TRACE_ENTER("MutterInputMonitor::register_active_watch_async");
+  g_dbus_proxy_call(idle_proxy, "AddUserActiveWatch", NULL, G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT, cancellable, on_register_active_watch_reply, this);
   TRACE_EXIT();
 }
 
@@ -158,131 +164,201 @@ MutterInputMonitor::on_register_active_watch_reply(GObject *object, GAsyncResult
 {
   TRACE_ENTER("MutterInputMonitor::on_register_active_watch_reply");
   GError *error = NULL;
-  GDBusProxy *proxy = G_DBUS_PROXY(object);
-  MutterInputMonitor *self = (MutterInputMonitor *)user_data;
+  GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(object), res, &error);
 
-  GVariant *params = g_dbus_proxy_call_finish(proxy, res, &error);
-  if (error)
+  if (error != NULL)
     {
+      // When cancelled, the monitor may already be deleted.
       TRACE_MSG("Error: " << error->message);
-      g_clear_error(&error);
-      return;
+      g_error_free(error);
     }
+  else
+    {
+      MutterInputMonitor *self = (MutterInputMonitor *)user_data;
+      g_variant_get(reply, "(u)", &self->watch_active);
+      g_variant_unref(reply);
+    }
+  TRACE_EXIT();
+}
 
-  g_variant_get(params, "(u)", &self->watch_active);
-  g_variant_unref(params);
+void
+MutterInputMonitor::register_idle_watch_async()
+{
+  TRACE_ENTER("MutterInputMonitor::register_idle_watch_async");
+  g_dbus_proxy_call(idle_proxy, "AddIdleWatch", g_variant_new("(t)", (guint64)500), G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT, cancellable, on_register_idle_watch_reply, this);
+  TRACE_EXIT();
 }
 
-bool
-MutterInputMonitor::unregister_active_watch()
+void
+MutterInputMonitor::on_register_idle_watch_reply(GObject *object, GAsyncResult *res, gpointer user_data)
 {
-  TRACE_ENTER("MutterInputMonitor::unregister_active_watch");
+  TRACE_ENTER("MutterInputMonitor::on_register_idle_watch_reply");
   GError *error = NULL;
-  if (watch_active != 0)
+  GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(object), res, &error);
+
+  if (error != NULL)
     {
-      GVariant *result = g_dbus_proxy_call_sync(idle_proxy, "RemoveWatch", g_variant_new("(u)", watch_active), G_DBUS_CALL_FLAGS_NONE, 10000, NULL, &error);
-      if (error == NULL)
-        {
-          g_variant_unref(result);
-          watch_active = 0;
-        }
-      else
-        {
-          TRACE_MSG("Error: " << error->message);
-          g_error_free(error);
-        }
+      // When cancelled, the monitor may already be deleted.
+      TRACE_MSG("Error: " << error->message);
+      g_error_free(error);
+    }
+  else
+    {
+      MutterInputMonitor *self = (MutterInputMonitor *)user_data;
+      g_variant_get(reply, "(u)", &self->watch_idle);
+      g_variant_unref(reply);
     }
   TRACE_EXIT();
-  return error == NULL;
 }
 
+//! Removes a watch without waiting for the reply.
 void
-MutterInputMonitor::unregister_active_watch_async()
+MutterInputMonitor::remove_watch(guint watch)
 {
-  TRACE_ENTER("MutterInputMonitor::unregister_active_watch_async");
-  if (watch_active != 0)
+  if (watch != 0)
     {
-      g_dbus_proxy_call(idle_proxy, "RemoveWatch", g_variant_new("(u)", watch_active), G_DBUS_CALL_FLAGS_NONE, 10000, NULL, on_unregister_active_watch_reply, this);
+      g_dbus_proxy_call(idle_proxy, "RemoveWatch", g_variant_new("(u)", watch), G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT, NULL, NULL, NULL);
     }
-  TRACE_EXIT();
 }
 
+//! Asks the compositor for the idle time, unless a previous request is outstanding.
 void
-MutterInputMonitor::on_unregister_active_watch_reply(GObject *object, GAsyncResult *res, gpointer user_data)
+MutterInputMonitor::poll_idletime_async()
+{
+  if (!idletime_pending)
+    {
+      idletime_pending = true;
+      g_dbus_proxy_call(idle_proxy, "GetIdletime", NULL, G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT, cancellable, on_idletime_reply, this);
+    }
+}
+
+void
+MutterInputMonitor::on_idletime_reply(GObject *object, GAsyncResult *res, gpointer user_data)
 {
-  TRACE_ENTER("MutterInputMonitor::on_unregister_active_watch_reply");
   GError *error = NULL;
-  GDBusProxy *proxy = G_DBUS_PROXY(object);
+  GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(object), res, &error);
+
+  if (error != NULL)
+    {
+      bool cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+      g_error_free(error);
+
+      if (cancelled)
+        {
+          // The monitor may already be deleted.
+          return;
+        }
+    }
+
   MutterInputMonitor *self = (MutterInputMonitor *)user_data;
+  self->idletime_pending = false;
 
-  g_dbus_proxy_call_finish(proxy, res, &error);
-  if (error)
+  if (reply != NULL)
     {
-      TRACE_MSG("Error: " << error->message);
-      g_clear_error(&error);
-      return;
+      guint64 idletime;
+      g_variant_get(reply, "(t)", &idletime);
+      g_variant_unref(reply);
+
+      if (idletime < IDLE_THRESHOLD)
+        {
+          /* Notify the activity monitor */
+          self->fire_action();
+        }
     }
-  self->watch_active = 0;
-  TRACE_EXIT();
 }
 
-bool
-MutterInputMonitor::register_idle_watch()
+void
+MutterInputMonitor::terminate()
 {
-  TRACE_ENTER("MutterInputMonitor::register_idle_watch");
-  GError *error = NULL;
-  GVariant *reply = g_dbus_proxy_call_sync(idle_proxy, "AddIdleWatch", g_variant_new("(t)", 500), G_DBUS_CALL_FLAGS_NONE, 10000, NULL, &error);
+  TRACE_ENTER("MutterInputMonitor::terminate");
 
-  if (error == NULL)
+  g_cancellable_cancel(cancellable);
+
+  if (timer_id != 0)
     {
-      g_variant_get(reply, "(u)", &watch_idle);
-      g_variant_unref(reply);
+      g_source_remove(timer_id);
+      timer_id = 0;
     }
-  else
+
+  if (idle_proxy != NULL)
     {
-      TRACE_MSG("Error: " << error->message);
-      g_error_free(error);
+      g_signal_handlers_disconnect_by_data(idle_proxy, this);
+      remove_watch(watch_idle);
+      remove_watch(watch_active);
+      watch_idle = 0;
+      watch_active = 0;
+
+      g_object_unref(idle_proxy);
+      idle_proxy = NULL;
     }
+
+  if (session_proxy != NULL)
+    {
+      g_signal_handlers_disconnect_by_data(session_proxy, this);
+      g_object_unref(session_proxy);
+      session_proxy = NULL;
+    }
+
   TRACE_EXIT();
-  return error == NULL;
 }
 
-bool
-MutterInputMonitor::unregister_idle_watch()
+void
+MutterInputMonitor::set_active(bool active)
 {
-  TRACE_ENTER("MutterInputMonitor::unregister_idle_watch");
-  GError *error = NULL;
-  if (watch_idle != 0)
+  this->active = active;
+
+  if (active)
     {
-      GVariant *result = g_dbus_proxy_call_sync(idle_proxy, "RemoveWatch", g_variant_new("(u)", watch_idle), G_DBUS_CALL_FLAGS_NONE, 10000, NULL, &error);
-      if (error == NULL)
-        {
-          g_variant_unref(result);
-          watch_idle = 0;
-        }
-      else
-        {
-          TRACE_MSG("Error: " << error->message);
-          g_error_free(error);
-        }
+      /* Notify the activity monitor */
+      fire_action();
     }
-  TRACE_EXIT();
-  return error == NULL;
+  update_timer();
 }
 
 void
-MutterInputMonitor::terminate()
+MutterInputMonitor::set_inhibited(guint32 actions)
+{
+  inhibited = (actions & GSM_INHIBITOR_FLAG_IDLE) != 0;
+  update_timer();
+}
+
+//! Runs the timer only while activity must be reported or polled.
+/*!
+ *  While an idle inhibitor is active, the idle watches of the compositor
+ *  cannot be relied upon, so the idle time is polled.
+ */
+void
+MutterInputMonitor::update_timer()
+{
+  bool need_timer = active || inhibited;
+
+  if (need_timer && timer_id == 0)
+    {
+      timer_id = g_timeout_add_seconds(1, on_timer, this);
+    }
+  else if (!need_timer && timer_id != 0)
+    {
+      g_source_remove(timer_id);
+      timer_id = 0;
+    }
+}
+
+gboolean
+MutterInputMonitor::on_timer(gpointer user_data)
 {
-  unregister_idle_watch();
-  unregister_active_watch();
+  MutterInputMonitor *self = (MutterInputMonitor *)user_data;
 
-  g_mutex_lock(&mutex);
-  abort = true;
-  g_cond_broadcast(&cond);
-  g_mutex_unlock(&mutex);
+  if (self->inhibited)
+    {
+      self->poll_idletime_async();
+    }
+  else if (self->active)
+    {
+      /* Notify the activity monitor */
+      self->fire_action();
+    }
 
-  monitor_thread->wait();
-  monitor_thread = NULL;
+  return TRUE;
 }
 
 void
@@ -300,13 +376,14 @@ MutterInputMonitor::on_idle_monitor_signal(GDBusProxy *proxy, gchar *sender_name
 
       if (handlerID == self->watch_active)
         {
-          self->unregister_active_watch_async();
-          self->active = true;
+          // User active watches are removed by Mutter once they fire.
+          self->watch_active = 0;
+          self->set_active(true);
         }
       else if (handlerID == self->watch_idle)
         {
           self->register_active_watch_async();
-          self->active = false;
+          self->set_active(false);
         }
     }
 }
@@ -323,52 +400,9 @@ MutterInputMonitor::on_session_manager_property_changed(GDBusProxy *session, GVa
   GVariant *v = g_variant_lookup_value(changed, "InhibitedActions", G_VARIANT_TYPE_UINT32);
   if (v != NULL)
     {
-      self->inhibited = g_variant_get_uint32(v) & GSM_INHIBITOR_FLAG_IDLE;
       TRACE_MSG("Inhibited:" << g_variant_get_uint32(v));
+      self->set_inhibited(g_variant_get_uint32(v));
       g_variant_unref(v);
     }
   TRACE_EXIT();
 }
-
-void
-MutterInputMonitor::run()
-{
-  TRACE_ENTER("MutterInputMonitor::run");
-
-  g_mutex_lock(&mutex);
-  while (!abort)
-    {
-      bool local_active = active;
-
-      if (inhibited)
-        {
-          GError *error = NULL;
-          guint64 idletime;
-          GVariant *reply = g_dbus_proxy_call_sync(idle_proxy, "GetIdletime", NULL, G_DBUS_CALL_FLAGS_NONE, 10000, NULL, &error);
-          if (error == NULL)
-            {
-
-              g_variant_get(reply, "(t)", &idletime);
-              g_variant_unref(reply);
-              local_active = idletime < 1000;
-            }
-          else
-            {
-              TRACE_MSG("Error: " << error->message);
-              g_error_free(error);
-            }
-        }
-
-      if (local_active)
-        {
-          /* Notify the activity monitor */
-          fire_action();
-        }
-
-      gint64 end_time = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
-      g_cond_wait_until(&cond, &mutex, end_time);
-    }
-  g_mutex_unlock(&mutex);
-
-  TRACE_EXIT();
-}
@@ -21,14 +21,17 @@
 #include "InputMonitor.hh"
 
 #include <gio/gio.h>
-#include <atomic>
-
-#include "Runnable.hh"
-#include "Thread.hh"
 
+//! Activity monitor based on the idle monitor of Mutter.
+/*!
+ *  Activity is detected with the idle and user active watches of the
+ *  compositor. All D-Bus calls are asynchronous and run on the main loop.
+ *  Activity is reported every second while the user is active. Nothing
+ *  runs periodically while the user is idle, unless an idle inhibitor
+ *  is active.
+ */
 class MutterInputMonitor :
-  public InputMonitor,
-  public Runnable
+  public InputMonitor
 {
 public:
   MutterInputMonitor();
@@ -45,19 +48,21 @@ public:
 private:
   static void on_idle_monitor_signal(GDBusProxy *proxy, gchar *sender_name, gchar *signal_name, GVariant *parameters, gpointer user_data);
   static void on_session_manager_property_changed(GDBusProxy *session, GVariant *changed, char **invalidated, gpointer user_data);
+  static void on_session_proxy_ready(GObject *source_object, GAsyncResult *res, gpointer user_data);
 
   static void on_register_active_watch_reply(GObject *source_object, GAsyncResult *res, gpointer user_data);
-  static void on_unregister_active_watch_reply(GObject *source_object, GAsyncResult *res, gpointer user_data);
-
-  //! The monitor's execution thread.
-  virtual void run();
+  static void on_register_idle_watch_reply(GObject *source_object, GAsyncResult *res, gpointer user_data);
+  static void on_idletime_reply(GObject *source_object, GAsyncResult *res, gpointer user_data);
+  static gboolean on_timer(gpointer user_data);
 
-  bool register_active_watch();
-  bool unregister_active_watch();
   void register_active_watch_async();
-  void unregister_active_watch_async();
-  bool register_idle_watch();
-  bool unregister_idle_watch();
+  void register_idle_watch_async();
+  void remove_watch(guint watch);
+  void poll_idletime_async();
+
+  void set_active(bool active);
+  void set_inhibited(guint32 actions);
+  void update_timer();
 
   bool init_idle_monitor();
   void init_inhibitors();
@@ -65,17 +70,28 @@ private:
 private:
   static const int GSM_INHIBITOR_FLAG_IDLE = 8;
 
+  //! Time in ms after which the user is considered idle.
+  static const int IDLE_THRESHOLD = 1000;
+
+  //! Timeout in ms of the D-Bus calls to the compositor.
+  static const int CALL_TIMEOUT = 10000;
+
   GDBusProxy *idle_proxy = NULL;
   GDBusProxy *session_proxy = NULL;
-  std::atomic<bool> active { false };
-  std::atomic<bool> inhibited { false };
+
+  //! Cancels all outstanding calls on termination.
+  GCancellable *cancellable = NULL;
+
+  bool active = false;
+  bool inhibited = false;
   guint watch_active = 0;
   guint watch_idle = 0;
 
-  bool abort = false;
-  Thread *monitor_thread = NULL;
-  GMutex mutex;
-  GCond cond;
+  //! Is a GetIdletime call outstanding?
+  bool idletime_pending = false;
+
+  //! Source that reports activity every second.
+  guint timer_id = 0;
 };
 
 #endif // MUTTERINPUTMONITOR_HH
@@ -37,6 +37,9 @@
 #include "X11InputMonitor.hh"
 #include "XScreenSaverMonitor.hh"
 #include "MutterInputMonitor.hh"
+#ifdef HAVE_EVDEV
+#include "EvdevInputMonitor.hh"
+#endif
 
 UnixInputMonitorFactory::UnixInputMonitorFactory()
   : error_reported(false)
@@ -108,8 +111,18 @@ UnixInputMonitorFactory::get_monitor(IInputMonitorFactory::MonitorCapability cap
             {
               monitor = new MutterInputMonitor();
             }
+#ifdef HAVE_EVDEV
+          else if (actual_monitor_method == "evdev")
+            {
+              // Reading the input devices directly is opt-in.
+              if (configure_monitor_method == "evdev")
+                {
+                  monitor = new EvdevInputMonitor();
+                }
+            }
+#endif
 
-          initialized = monitor->init();
+          initialized = monitor != NULL && monitor->init();
 
           if (initialized)
             {
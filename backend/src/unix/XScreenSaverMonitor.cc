@@ -23,6 +23,8 @@
 
 #include "debug.hh"
 
+#include <string.h>
+
 #include <gdk/gdkx.h>
 
 #include "XScreenSaverMonitor.hh"
@@ -32,32 +34,25 @@
 #include "ICoreEventListener.hh"
 #include "IInputMonitorListener.hh"
 
-#include "Thread.hh"
-
 using namespace std;
 using namespace workrave;
 
 XScreenSaverMonitor::XScreenSaverMonitor() :
-  abort(false),
-  screen_saver_info(NULL)
+  xdisplay(NULL),
+  sync_event_base(0),
+  idle_counter(None),
+  idle_alarm(None),
+  active_alarm(None),
+  active(false),
+  timer_id(0)
 {
-  monitor_thread = new Thread(this);
-  g_mutex_init(&mutex);
-  g_cond_init(&cond);
 }
 
 
 XScreenSaverMonitor::~XScreenSaverMonitor()
 {
   TRACE_ENTER("XScreenSaverMonitor::~XScreenSaverMonitor");
-  if (monitor_thread != NULL)
-    {
-      monitor_thread->wait();
-      delete monitor_thread;
-    }
-
-  g_mutex_clear(&mutex);
-  g_cond_clear(&cond);
+  terminate();
   TRACE_EXIT();
 }
 
@@ -65,61 +60,174 @@ XScreenSaverMonitor::~XScreenSaverMonitor()
 bool
 XScreenSaverMonitor::init()
 {
+  TRACE_ENTER("XScreenSaverMonitor::init");
   int event_base;
   int error_base;
 
-  Bool has_extension = XScreenSaverQueryExtension(gdk_x11_display_get_xdisplay(gdk_display_get_default()), &event_base, &error_base);
+  xdisplay = gdk_x11_display_get_xdisplay(gdk_display_get_default());
+
+  Bool has_extension = XScreenSaverQueryExtension(xdisplay, &event_base, &error_base);
+  bool result = has_extension && init_idle_counter();
+
+  if (result)
+    {
+      idle_alarm = create_alarm(XSyncPositiveTransition);
+      active_alarm = create_alarm(XSyncNegativeTransition);
+
+      gdk_window_add_filter(NULL, static_event_filter, this);
+
+      // The alarms only report transitions, so get the current state.
+      XScreenSaverInfo *screen_saver_info = XScreenSaverAllocInfo();
+      XScreenSaverQueryInfo(xdisplay, gdk_x11_get_default_root_xwindow(), screen_saver_info);
+      set_active(screen_saver_info->idle < IDLE_THRESHOLD);
+      XFree(screen_saver_info);
+    }
+
+  TRACE_RETURN(result);
+  return result;
+}
+
+
+//! Finds the IDLETIME counter of the SYNC extension.
+bool
+XScreenSaverMonitor::init_idle_counter()
+{
+  int sync_error_base;
+  int major;
+  int minor;
+
+  if (!XSyncQueryExtension(xdisplay, &sync_event_base, &sync_error_base) ||
+      !XSyncInitialize(xdisplay, &major, &minor))
+    {
+      return false;
+    }
+
+  int num_counters = 0;
+  XSyncSystemCounter *counters = XSyncListSystemCounters(xdisplay, &num_counters);
+  for (int i = 0; i < num_counters; i++)
+    {
+      if (strcmp(counters[i].name, "IDLETIME") == 0)
+        {
+          idle_counter = counters[i].counter;
+          break;
+        }
+    }
+
+  if (counters != NULL)
+    {
+      XSyncFreeSystemCounterList(counters);
+    }
+
+  return idle_counter != None;
+}
+
 
-  if (has_extension)
-  {
-    screen_saver_info = XScreenSaverAllocInfo();
-    monitor_thread->start();
-  }
+//! Creates an alarm that fires when the idle time crosses the threshold.
+XSyncAlarm
+XScreenSaverMonitor::create_alarm(XSyncTestType test_type)
+{
+  XSyncAlarmAttributes attr;
+  memset(&attr, 0, sizeof(attr));
+
+  attr.trigger.counter = idle_counter;
+  attr.trigger.value_type = XSyncAbsolute;
+  attr.trigger.test_type = test_type;
+  XSyncIntToValue(&attr.trigger.wait_value, IDLE_THRESHOLD);
+  XSyncIntToValue(&attr.delta, 0);
+  attr.events = True;
 
-  return has_extension;
+  unsigned long flags = (XSyncCACounter | XSyncCAValueType | XSyncCATestType |
+                         XSyncCAValue | XSyncCADelta | XSyncCAEvents);
+
+  return XSyncCreateAlarm(xdisplay, flags, &attr);
 }
 
+
 void
 XScreenSaverMonitor::terminate()
 {
   TRACE_ENTER("XScreenSaverMonitor::terminate");
 
-  g_mutex_lock(&mutex);
-  abort = true;
-  g_cond_broadcast(&cond);
-  g_mutex_unlock(&mutex);
+  if (timer_id != 0)
+    {
+      g_source_remove(timer_id);
+      timer_id = 0;
+    }
+
+  if (idle_alarm != None || active_alarm != None)
+    {
+      gdk_window_remove_filter(NULL, static_event_filter, this);
+
+      XSyncDestroyAlarm(xdisplay, idle_alarm);
+      XSyncDestroyAlarm(xdisplay, active_alarm);
+      XFlush(xdisplay);
 
-  monitor_thread->wait();
-  monitor_thread = NULL;
+      idle_alarm = None;
+      active_alarm = None;
+    }
 
   TRACE_EXIT();
 }
 
 
+//! Reports activity every second while the user is active.
 void
-XScreenSaverMonitor::run()
+XScreenSaverMonitor::set_active(bool active)
 {
-  TRACE_ENTER("XScreenSaverMonitor::run");
+  this->active = active;
 
-  g_mutex_lock(&mutex);
-  while (!abort)
+  if (active)
     {
-      XScreenSaverQueryInfo(gdk_x11_display_get_xdisplay(gdk_display_get_default()), gdk_x11_get_default_root_xwindow(), screen_saver_info);
+      /* Notify the activity monitor */
+      fire_action();
 
-      if (screen_saver_info->idle < 1000)
+      if (timer_id == 0)
         {
-          /* Notify the activity monitor */
-          fire_action();
+          timer_id = g_timeout_add_seconds(1, static_on_timer, this);
         }
+    }
+  else if (timer_id != 0)
+    {
+      g_source_remove(timer_id);
+      timer_id = 0;
+    }
+}
 
-#if GLIB_CHECK_VERSION(2, 32, 0)
-      gint64 end_time = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
-      g_cond_wait_until(&cond, &mutex, end_time);
-#else
-      g_usleep(500000);
-#endif
+
+GdkFilterReturn
+XScreenSaverMonitor::static_event_filter(GdkXEvent *xevent, GdkEvent *event, gpointer data)
+{
+  (void) event;
+
+  XScreenSaverMonitor *self = (XScreenSaverMonitor *) data;
+  XEvent *ev = (XEvent *) xevent;
+
+  if (ev->type == self->sync_event_base + XSyncAlarmNotify)
+    {
+      XSyncAlarmNotifyEvent *alarm_event = (XSyncAlarmNotifyEvent *) ev;
+
+      if (alarm_event->alarm == self->idle_alarm)
+        {
+          self->set_active(false);
+          return GDK_FILTER_REMOVE;
+        }
+      else if (alarm_event->alarm == self->active_alarm)
+        {
+          self->set_active(true);
+          return GDK_FILTER_REMOVE;
+        }
     }
-  g_mutex_unlock(&mutex);
 
-  TRACE_EXIT();
+  return GDK_FILTER_CONTINUE;
+}
+
+
+gboolean
+XScreenSaverMonitor::static_on_timer(gpointer data)
+{
+  XScreenSaverMonitor *self = (XScreenSaverMonitor *) data;
+
+  /* Notify the activity monitor */
+  self->fire_action();
+  return TRUE;
 }
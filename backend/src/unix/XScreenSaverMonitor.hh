@@ -25,16 +25,21 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
 
-#include "InputMonitor.hh"
+#include <gdk/gdk.h>
 
-#include "Runnable.hh"
-#include "Thread.hh"
+#include "InputMonitor.hh"
 
 //! Activity monitor for a local X server.
+/*!
+ *  Uses alarms on the IDLETIME counter of the X server to detect when
+ *  the user becomes idle or active. Activity is reported every second
+ *  while the user is active. Nothing runs periodically while the user is
+ *  idle.
+ */
 class XScreenSaverMonitor :
-  public InputMonitor,
-  public Runnable
+  public InputMonitor
 {
 public:
   //! Constructor.
@@ -50,22 +55,37 @@ public:
   virtual void terminate();
 
 private:
-  //! The monitor's execution thread.
-  virtual void run();
+  bool init_idle_counter();
+  XSyncAlarm create_alarm(XSyncTestType test_type);
+  void set_active(bool active);
 
+  static GdkFilterReturn static_event_filter(GdkXEvent *xevent, GdkEvent *event, gpointer data);
+  static gboolean static_on_timer(gpointer data);
 
 private:
-  //! Abort the main loop
-  bool abort;
+  //! Time in ms after which the user is considered idle.
+  static const int IDLE_THRESHOLD = 1000;
+
+  //! The X display.
+  Display *xdisplay;
+
+  //! First event number of the SYNC extension.
+  int sync_event_base;
+
+  //! The IDLETIME system counter.
+  XSyncCounter idle_counter;
+
+  //! Alarm that fires when the user becomes idle.
+  XSyncAlarm idle_alarm;
 
-  //! The activity monitor thread.
-  Thread *monitor_thread;
+  //! Alarm that fires when the user becomes active.
+  XSyncAlarm active_alarm;
 
-  //
-  XScreenSaverInfo *screen_saver_info;
+  //! Is the user active?
+  bool active;
 
-  GMutex mutex;
-  GCond cond;
+  //! Source that reports activity every second.
+  guint timer_id;
 };
 
 #endif // XSCREENSAVERMONITOR_HH
@@ -0,0 +1,154 @@
+// Headless.hh --- Runs the backend without user interface or input devices
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADLESS_HH
+#define HEADLESS_HH
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "IApp.hh"
+#include "ICoreEventListener.hh"
+
+#include "IInputMonitorFactory.hh"
+#include "InputMonitor.hh"
+
+using namespace workrave;
+
+//! Application without user interface.
+/*!
+ *  Breaks are never responded to, so they run their course exactly as if
+ *  the user ignored all break windows.
+ */
+class HeadlessApp : public IApp
+{
+public:
+  virtual void set_break_response(IBreakResponse *rep) { (void) rep; }
+  virtual void create_prelude_window(BreakId break_id) { (void) break_id; }
+  virtual void create_break_window(BreakId break_id, BreakHint break_hint) { (void) break_id; (void) break_hint; }
+  virtual void hide_break_window() {}
+  virtual void show_break_window() {}
+  virtual void refresh_break_window() {}
+  virtual void set_break_progress(int value, int max_value) { (void) value; (void) max_value; }
+  virtual void set_prelude_stage(PreludeStage stage) { (void) stage; }
+  virtual void set_prelude_progress_text(PreludeProgressText text) { (void) text; }
+  virtual void terminate() {}
+};
+
+
+//! Records wakeup requests of the core.
+class HeadlessEventListener : public ICoreEventListener
+{
+public:
+  HeadlessEventListener() : wakeup(false) {}
+
+  virtual void core_event_notify(const CoreEvent event) { (void) event; }
+  virtual void core_event_operation_mode_changed(const OperationMode m) { (void) m; }
+  virtual void core_event_usage_mode_changed(const UsageMode m) { (void) m; }
+  virtual void core_event_wakeup() { wakeup = true; }
+
+  //! Did the core request an immediate heartbeat?
+  bool wakeup;
+};
+
+
+//! Input monitor that delivers events on request.
+class ScriptedInputMonitor : public InputMonitor
+{
+public:
+  virtual bool init() { return true; }
+  virtual void terminate() {}
+
+  void deliver(const std::vector<InputEvent> &events, gint64 time)
+  {
+    deliver_events(&events[0], (int)events.size(), time);
+  }
+};
+
+
+//! Factory that always returns the scripted monitor.
+class ScriptedInputMonitorFactory : public IInputMonitorFactory
+{
+public:
+  ScriptedInputMonitorFactory(ScriptedInputMonitor *monitor) : monitor(monitor) {}
+
+  virtual void init(const char *display) { (void) display; }
+
+  virtual IInputMonitor *get_monitor(MonitorCapability capability)
+  {
+    (void) capability;
+    return monitor;
+  }
+
+private:
+  ScriptedInputMonitor *monitor;
+};
+
+
+//! Creates a temporary home directory with an empty configuration.
+/*!
+ *  Returns an empty string on failure.
+ */
+inline std::string
+create_headless_home(const char *name)
+{
+  gchar *home = g_strdup_printf("/tmp/%s-XXXXXX", name);
+  if (g_mkdtemp(home) == NULL)
+    {
+      g_free(home);
+      return "";
+    }
+
+  std::string home_dir = home;
+  g_free(home);
+
+  g_file_set_contents((home_dir + "/workrave.ini").c_str(), "", 0, NULL);
+  return home_dir;
+}
+
+
+//! Removes the temporary home directory.
+inline void
+remove_headless_home(const std::string &dir)
+{
+  GDir *d = g_dir_open(dir.c_str(), 0, NULL);
+  if (d != NULL)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(d)) != NULL)
+        {
+          std::string path = dir + "/" + name;
+          if (g_file_test(path.c_str(), G_FILE_TEST_IS_DIR))
+            {
+              remove_headless_home(path);
+            }
+          else
+            {
+              g_unlink(path.c_str());
+            }
+        }
+      g_dir_close(d);
+    }
+  g_rmdir(dir.c_str());
+}
+
+#endif // HEADLESS_HH
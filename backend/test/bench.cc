@@ -0,0 +1,916 @@
+// bench.cc --- Microbenchmarks of the backend
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Usage: workrave-bench [--filter SUBSTRING] [--samples N] [--min-time MS] [--output FILE]
+//
+// Runs microbenchmarks of the hot paths of the backend against a headless
+// core on a virtual clock. Each benchmark is calibrated to run at least
+// --min-time per sample. Results are written as JSON, a summary is
+// printed on stderr.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "ICore.hh"
+#include "CoreFactory.hh"
+#include "Util.hh"
+
+#include "ActivityMonitor.hh"
+#include "Configurator.hh"
+#include "ConfiguratorFactory.hh"
+#include "Core.hh"
+#include "IdleLogManager.hh"
+#include "InputMonitorFactory.hh"
+#include "PacketBuffer.hh"
+#include "StateWriter.hh"
+#include "Statistics.hh"
+#include "StatisticsHistory.hh"
+#include "TimeSource.hh"
+#include "Timer.hh"
+
+#ifdef HAVE_DBUS
+#include <gio/gio.h>
+#include "dbus/DBusException.hh"
+#include "dbus/DBusFactory.hh"
+#include "dbus/IDBus.hh"
+#endif
+
+#include "Headless.hh"
+
+using namespace std;
+using namespace workrave;
+
+
+//! A single benchmark.
+class Benchmark
+{
+public:
+  Benchmark(const string &name) : name(name) {}
+  virtual ~Benchmark() {}
+
+  const string &get_name() const { return name; }
+
+  //! Prepares the benchmark. Benchmarks that cannot run return false.
+  virtual bool setup() { return true; }
+
+  //! Performs the specified number of operations.
+  virtual void run(int iterations) = 0;
+
+  virtual void teardown() {}
+
+protected:
+  void set_name(const string &name) { this->name = name; }
+
+private:
+  //! Name of the benchmark, including its parameters.
+  string name;
+};
+
+
+//! Runs benchmarks and collects their results.
+class BenchRunner
+{
+public:
+  BenchRunner() : samples(5), min_time(100 * 1000) {}
+
+  void set_filter(const string &f) { filter = f; }
+  void set_samples(int n) { samples = n; }
+  void set_min_time(gint64 usec) { min_time = usec; }
+
+  void run(Benchmark *benchmark);
+  string get_json() const;
+
+private:
+  struct Result
+  {
+    string name;
+    int iterations;
+    double ns_min;
+    double ns_median;
+    double ns_max;
+  };
+
+  int calibrate(Benchmark *benchmark);
+  static gint64 measure(Benchmark *benchmark, int iterations);
+
+private:
+  //! Only benchmarks whose name contains the filter are run.
+  string filter;
+
+  //! Number of measurements per benchmark.
+  int samples;
+
+  //! Minimum duration of a single measurement in usec.
+  gint64 min_time;
+
+  //! Results of all benchmarks that ran.
+  vector<Result> results;
+};
+
+
+//! Returns the duration of the specified number of operations in usec.
+gint64
+BenchRunner::measure(Benchmark *benchmark, int iterations)
+{
+  gint64 start = g_get_monotonic_time();
+  benchmark->run(iterations);
+  return g_get_monotonic_time() - start;
+}
+
+
+//! Returns the number of operations that takes at least min_time.
+int
+BenchRunner::calibrate(Benchmark *benchmark)
+{
+  int iterations = 1;
+
+  while (true)
+    {
+      gint64 duration = measure(benchmark, iterations);
+      if (duration >= min_time || iterations >= G_MAXINT / 10)
+        {
+          return iterations;
+        }
+
+      if (duration < min_time / 100)
+        {
+          iterations *= 10;
+        }
+      else
+        {
+          // Close enough to extrapolate.
+          return (int)((gint64)iterations * min_time * 12 / 10 / duration) + 1;
+        }
+    }
+}
+
+
+void
+BenchRunner::run(Benchmark *benchmark)
+{
+  if (benchmark->get_name().find(filter) == string::npos)
+    {
+      delete benchmark;
+      return;
+    }
+
+  if (!benchmark->setup())
+    {
+      fprintf(stderr, "%-48s skipped\n", benchmark->get_name().c_str());
+      delete benchmark;
+      return;
+    }
+
+  int iterations = calibrate(benchmark);
+
+  vector<double> ns;
+  for (int i = 0; i < samples; i++)
+    {
+      gint64 duration = measure(benchmark, iterations);
+      ns.push_back(duration * 1000.0 / iterations);
+    }
+  sort(ns.begin(), ns.end());
+
+  benchmark->teardown();
+
+  Result result;
+  result.name = benchmark->get_name();
+  result.iterations = iterations;
+  result.ns_min = ns.front();
+  result.ns_median = ns[ns.size() / 2];
+  result.ns_max = ns.back();
+  results.push_back(result);
+
+  fprintf(stderr, "%-48s %12.1f ns/op %14.0f op/s\n", result.name.c_str(),
+          result.ns_median, result.ns_median > 0 ? 1e9 / result.ns_median : 0.0);
+
+  delete benchmark;
+}
+
+
+//! Returns the results as a JSON document.
+string
+BenchRunner::get_json() const
+{
+  string out;
+  char buffer[256];
+
+#ifdef PACKAGE_VERSION
+  const char *version = PACKAGE_VERSION;
+#else
+  const char *version = "unknown";
+#endif
+
+  g_snprintf(buffer, sizeof(buffer), "{\n  \"suite\": \"workrave-backend\",\n  \"version\": \"%s\",\n"
+             "  \"samples\": %d,\n  \"benchmarks\": [\n", version, samples);
+  out += buffer;
+
+  for (size_t i = 0; i < results.size(); i++)
+    {
+      const Result &r = results[i];
+      g_snprintf(buffer, sizeof(buffer),
+                 "    { \"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.1f, "
+                 "\"ns_per_op_min\": %.1f, \"ns_per_op_max\": %.1f, \"ops_per_sec\": %.0f }%s\n",
+                 r.name.c_str(), r.iterations, r.ns_median, r.ns_min, r.ns_max,
+                 r.ns_median > 0 ? 1e9 / r.ns_median : 0.0,
+                 i + 1 < results.size() ? "," : "");
+      out += buffer;
+    }
+
+  out += "  ]\n}\n";
+  return out;
+}
+
+
+//! Creates a batch of mouse movement, clicks and keystrokes.
+static void
+make_input(vector<InputEvent> &events, int count)
+{
+  events.resize(count);
+  for (int i = 0; i < count; i++)
+    {
+      InputEvent &e = events[i];
+      memset(&e, 0, sizeof(e));
+
+      switch (i % 8)
+        {
+        case 3:
+          e.type = InputEvent::INPUT_EVENT_BUTTON;
+          e.flag = (i / 8) % 2 == 0;
+          break;
+        case 6:
+          e.type = InputEvent::INPUT_EVENT_KEYBOARD;
+          break;
+        default:
+          e.type = InputEvent::INPUT_EVENT_MOUSE;
+          e.x = (i * 7) % 1024;
+          e.y = (i * 3) % 768;
+          break;
+        }
+    }
+}
+
+
+//! Delivers batches of input events to an input listener.
+/*!
+ *  One operation is a single event.
+ */
+class InputBenchmark : public Benchmark
+{
+public:
+  InputBenchmark(const string &name, IInputMonitorListener *listener)
+    : Benchmark(name), listener(listener), time(0)
+  {
+  }
+
+  virtual bool setup()
+  {
+    make_input(events, BATCH_SIZE);
+    time = TimeSource::get_clock()->get_real_time();
+    return listener != NULL;
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i += BATCH_SIZE)
+      {
+        int count = std::min(BATCH_SIZE, iterations - i);
+
+        // Events arrive in batches every 50ms.
+        time += 50 * 1000;
+        listener->input_notify(&events[0], count, time);
+      }
+  }
+
+private:
+  static const int BATCH_SIZE = 64;
+
+  IInputMonitorListener *listener;
+  vector<InputEvent> events;
+  gint64 time;
+};
+
+
+//! Processes a timer once per tick.
+class TimerBenchmark : public Benchmark
+{
+public:
+  TimerBenchmark(Timer *timer) : Benchmark("timer_process"), timer(timer), tick(0) {}
+
+  virtual bool setup()
+  {
+    return timer != NULL;
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i++, tick++)
+      {
+        // Alternate between activity and pauses of 10 ticks.
+        ActivityState state = (tick / 10) % 2 == 0 ? ACTIVITY_ACTIVE : ACTIVITY_IDLE;
+
+        TimerInfo info;
+        timer->process(state, info);
+      }
+  }
+
+private:
+  Timer *timer;
+  int tick;
+};
+
+
+//! Runs a heartbeat of the core every virtual second.
+class HeartbeatBenchmark : public Benchmark
+{
+public:
+  HeartbeatBenchmark(ICore *core, VirtualTimeSource *clock)
+    : Benchmark("core_heartbeat"), core(core), clock(clock)
+  {
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i++)
+      {
+        clock->set_real_time(clock->get_real_time() + G_USEC_PER_SEC);
+        core->heartbeat();
+      }
+  }
+
+private:
+  ICore *core;
+  VirtualTimeSource *clock;
+};
+
+
+//! Computes the active time over the idle logs of several clients.
+class IdleLogBenchmark : public Benchmark
+{
+public:
+  IdleLogBenchmark(const string &home_dir, int num_clients, int num_intervals)
+    : Benchmark("idlelog_compute_active_time"), home_dir(home_dir),
+      num_clients(num_clients), num_intervals(num_intervals), manager(NULL)
+  {
+    set_name(get_name() + "/clients=" + make_id(num_clients) + "/intervals=" + make_id(num_intervals));
+  }
+
+  virtual ~IdleLogBenchmark()
+  {
+    delete manager;
+  }
+
+  virtual bool setup()
+  {
+    // The idle logs are stored in the home directory. Do not mix them
+    // with the logs of the core.
+    string dir = home_dir + "/idlelog-" + make_id(num_clients) + "-" + make_id(num_intervals);
+    g_mkdir_with_parents(dir.c_str(), 0700);
+    old_home_dir = Util::get_home_directory();
+    Util::set_home_directory(dir + "/");
+
+    clock.set_real_time(TimeSource::get_clock()->get_real_time());
+    manager = new IdleLogManager("bench-0", &clock, &state_writer);
+    manager->init();
+
+    vector<string> ids;
+    ids.push_back("bench-0");
+    for (int i = 1; i < num_clients; i++)
+      {
+        ids.push_back("bench-" + make_id(i));
+        manager->signon_remote_client(ids.back());
+      }
+
+    // Each client in turn is master and active for a second, followed by
+    // an idle period long enough to start a new interval.
+    for (int i = 0; i < num_intervals; i++)
+      {
+        for (int c = 0; c < num_clients; c++)
+          {
+            manager->update_all_idlelogs(ids[c], ACTIVITY_ACTIVE);
+            advance(1);
+            manager->update_all_idlelogs(ids[c], ACTIVITY_IDLE);
+            advance(11);
+          }
+      }
+
+    state_writer.flush();
+    return true;
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i++)
+      {
+        manager->compute_active_time(60);
+      }
+  }
+
+  virtual void teardown()
+  {
+    Util::set_home_directory(old_home_dir);
+  }
+
+private:
+  void advance(int seconds)
+  {
+    clock.set_real_time(clock.get_real_time() + (gint64)seconds * G_USEC_PER_SEC);
+  }
+
+  static string make_id(int n)
+  {
+    char buffer[16];
+    g_snprintf(buffer, sizeof(buffer), "%d", n);
+    return buffer;
+  }
+
+private:
+  string home_dir;
+  string old_home_dir;
+  int num_clients;
+  int num_intervals;
+  VirtualTimeSource clock;
+  StateWriter state_writer;
+  IdleLogManager *manager;
+};
+
+
+//! Packs or unpacks a message the size of a typical distribution packet.
+class PacketBufferBenchmark : public Benchmark
+{
+public:
+  PacketBufferBenchmark(bool unpack)
+    : Benchmark(unpack ? "packetbuffer_unpack" : "packetbuffer_pack"), unpack(unpack)
+  {
+  }
+
+  virtual bool setup()
+  {
+    buffer.create();
+    for (int i = 0; i < NUM_MESSAGES; i++)
+      {
+        pack_message(buffer);
+      }
+    work = buffer;
+    return true;
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i++)
+      {
+        if (unpack)
+          {
+            if (work.bytes_available() == 0)
+              {
+                work = buffer;
+              }
+            unpack_message(work);
+          }
+        else
+          {
+            if (i % NUM_MESSAGES == 0)
+              {
+                work.clear();
+              }
+            pack_message(work);
+          }
+      }
+  }
+
+private:
+  static void pack_message(PacketBuffer &packet)
+  {
+    int pos = 0;
+    packet.reserve_size(pos);
+    packet.pack_ushort(1);
+    packet.pack_string("workrave-bench:27273");
+    for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+      {
+        packet.pack_byte((guint8)i);
+        packet.pack_ulong(12345 + i);
+        packet.pack_ulong(678 + i);
+        packet.pack_ushort(3);
+      }
+    packet.update_size(pos);
+  }
+
+  static void unpack_message(PacketBuffer &packet)
+  {
+    int pos = 0;
+    packet.read_size(pos);
+    packet.unpack_ushort();
+    packet.unpack_string();
+    for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+      {
+        packet.unpack_byte();
+        packet.unpack_ulong();
+        packet.unpack_ulong();
+        packet.unpack_ushort();
+      }
+    packet.skip_size(pos);
+  }
+
+private:
+  //! Number of messages that are packed in a single buffer.
+  static const int NUM_MESSAGES = 1024;
+
+  bool unpack;
+
+  //! Packed messages.
+  PacketBuffer buffer;
+
+  //! Buffer that is being packed or unpacked.
+  PacketBuffer work;
+};
+
+
+//! Reads configuration values through the specified configuration backend.
+class ConfiguratorBenchmark : public Benchmark
+{
+public:
+  ConfiguratorBenchmark(const string &name, ConfiguratorFactory::Format format, const string &filename)
+    : Benchmark(name), format(format), filename(filename), configurator(NULL)
+  {
+  }
+
+  virtual ~ConfiguratorBenchmark()
+  {
+    delete configurator;
+  }
+
+  virtual bool setup()
+  {
+    configurator = ConfiguratorFactory::create(format);
+    if (configurator == NULL)
+      {
+        return false;
+      }
+    configurator->load(filename);
+
+    for (int i = 0; i < NUM_KEYS; i++)
+      {
+        if (!configurator->set_value(get_key(i), i))
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  virtual void run(int iterations)
+  {
+    int value;
+    for (int i = 0; i < iterations; i++)
+      {
+        configurator->get_value(get_key(i % NUM_KEYS), value);
+      }
+  }
+
+private:
+  static string get_key(int i)
+  {
+    static const char *keys[NUM_KEYS] =
+      {
+        "timers/micro_pause/limit", "timers/micro_pause/auto_reset", "timers/micro_pause/snooze",
+        "timers/rest_break/limit", "timers/rest_break/auto_reset", "timers/rest_break/snooze",
+        "timers/daily_limit/limit", "timers/daily_limit/snooze",
+        "monitor/noise", "monitor/activity", "monitor/idle", "monitor/sensitivity",
+        "breaks/micro_pause/max_preludes", "breaks/rest_break/max_preludes",
+        "breaks/daily_limit/max_preludes", "general/usage-mode",
+      };
+    return keys[i];
+  }
+
+private:
+  static const int NUM_KEYS = 16;
+
+  ConfiguratorFactory::Format format;
+  string filename;
+  Configurator *configurator;
+};
+
+
+//! Opens a history of several years and reads all days.
+class HistoryBenchmark : public Benchmark
+{
+public:
+  HistoryBenchmark(const string &home_dir, int years)
+    : Benchmark("statistics_load_history"), years(years)
+  {
+    char buffer[64];
+    g_snprintf(buffer, sizeof(buffer), "/years=%d", years);
+    set_name(get_name() + buffer);
+    g_snprintf(buffer, sizeof(buffer), "/historystats-%d.bin", years);
+    filename = home_dir + buffer;
+  }
+
+  virtual bool setup()
+  {
+    StatisticsHistory history;
+    if (!history.open(filename))
+      {
+        return false;
+      }
+
+    IStatistics::DailyStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    // One record per day, starting January 1st, 2000.
+    for (int day = 0; day < years * 365; day++)
+      {
+        time_t t = 946684800 + (time_t)day * 24 * 60 * 60;
+        struct tm *tm = gmtime(&t);
+
+        stats.start = *tm;
+        stats.stop = *tm;
+        stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME] = day % 28800;
+        stats.break_stats[BREAK_ID_MICRO_BREAK][IStatistics::STATS_BREAKVALUE_TAKEN] = day % 50;
+
+        history.add_day(stats);
+      }
+
+    return history.size() == years * 365;
+  }
+
+  virtual void run(int iterations)
+  {
+    IStatistics::DailyStats stats;
+    for (int i = 0; i < iterations; i++)
+      {
+        StatisticsHistory history;
+        history.open(filename);
+        for (int day = 0; day < history.size(); day++)
+          {
+            history.get_day(day, stats);
+          }
+      }
+  }
+
+private:
+  int years;
+  string filename;
+};
+
+
+#ifdef HAVE_DBUS
+//! Calls a method of the core over the session bus.
+class DBusBenchmark : public Benchmark
+{
+public:
+  DBusBenchmark(Core *core) : Benchmark("dbus_round_trip"), core(core), client(NULL), pending(false) {}
+
+  virtual ~DBusBenchmark()
+  {
+    if (client != NULL)
+      {
+        g_object_unref(client);
+      }
+  }
+
+  virtual bool setup()
+  {
+    try
+      {
+        dbus = workrave::dbus::DBusFactory::create();
+        dbus->init();
+
+        extern void init_DBusWorkrave(workrave::dbus::IDBus::Ptr dbus);
+        init_DBusWorkrave(dbus);
+
+        dbus->connect(OBJECT_PATH, "org.workrave.CoreInterface", core);
+        dbus->register_object_path(OBJECT_PATH);
+        dbus->register_service(SERVICE_NAME);
+      }
+    catch (workrave::dbus::DBusException &)
+      {
+        return false;
+      }
+
+    // Use a separate connection, so that each call passes through the bus.
+    gchar *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (address == NULL)
+      {
+        return false;
+      }
+
+    client = g_dbus_connection_new_for_address_sync(address,
+                                                    (GDBusConnectionFlags)
+                                                    (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                                                    NULL, NULL, NULL);
+    g_free(address);
+    if (client == NULL)
+      {
+        return false;
+      }
+
+    // Wait until the service name is acquired.
+    for (int i = 0; i < 100; i++)
+      {
+        if (call())
+          {
+            return true;
+          }
+        g_usleep(20 * 1000);
+      }
+    return false;
+  }
+
+  virtual void run(int iterations)
+  {
+    for (int i = 0; i < iterations; i++)
+      {
+        call();
+      }
+  }
+
+private:
+  //! Calls GetTime and runs the main loop until the reply is received.
+  bool call()
+  {
+    pending = true;
+    ok = false;
+    g_dbus_connection_call(client, SERVICE_NAME, OBJECT_PATH, "org.workrave.CoreInterface",
+                           "GetTime", NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           &DBusBenchmark::on_reply, this);
+    while (pending)
+      {
+        g_main_context_iteration(NULL, TRUE);
+      }
+    return ok;
+  }
+
+  static void on_reply(GObject *object, GAsyncResult *res, gpointer user_data)
+  {
+    DBusBenchmark *self = (DBusBenchmark *) user_data;
+
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(object), res, NULL);
+    if (result != NULL)
+      {
+        g_variant_unref(result);
+      }
+    self->ok = result != NULL;
+    self->pending = false;
+  }
+
+private:
+  static const char *const SERVICE_NAME;
+  static const char *const OBJECT_PATH;
+
+  Core *core;
+  workrave::dbus::IDBus::Ptr dbus;
+  GDBusConnection *client;
+  bool pending;
+  bool ok;
+};
+
+const char *const DBusBenchmark::SERVICE_NAME = "org.workrave.Bench";
+const char *const DBusBenchmark::OBJECT_PATH = "/org/workrave/Bench";
+#endif
+
+
+static void
+usage()
+{
+  fprintf(stderr, "Usage: workrave-bench [--filter SUBSTRING] [--samples N] [--min-time MS] [--output FILE]\n");
+  exit(2);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  BenchRunner runner;
+  string output_file;
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+          runner.set_filter(argv[++i]);
+        }
+      else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+        {
+          runner.set_samples(std::max(1, atoi(argv[++i])));
+        }
+      else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+          runner.set_min_time((gint64)std::max(1, atoi(argv[++i])) * 1000);
+        }
+      else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+          output_file = argv[++i];
+        }
+      else
+        {
+          usage();
+        }
+    }
+
+  g_setenv("TZ", "UTC", TRUE);
+  tzset();
+
+  string home_dir = create_headless_home("workrave-bench");
+  if (home_dir == "")
+    {
+      fprintf(stderr, "Cannot create temporary directory\n");
+      return 2;
+    }
+  Util::set_home_directory(home_dir + "/");
+
+  // Start at a fixed time, so that all runs do the same work.
+  VirtualTimeSource clock(G_GINT64_CONSTANT(1356998400) * G_USEC_PER_SEC);
+  TimeSource::set_clock(&clock);
+
+  ScriptedInputMonitor monitor;
+  InputMonitorFactory::set_factory(new ScriptedInputMonitorFactory(&monitor));
+
+  HeadlessApp app;
+  HeadlessEventListener listener;
+
+  ICore *core = CoreFactory::get_core();
+  core->set_core_events_listener(&listener);
+  core->init(argc, argv, &app, NULL);
+
+  Core *core_impl = Core::get_instance();
+
+  runner.run(new InputBenchmark("activity_monitor_input_notify",
+                                dynamic_cast<ActivityMonitor *>(core_impl->get_activity_monitor())));
+  runner.run(new InputBenchmark("statistics_input_notify", core_impl->get_statistics()));
+  runner.run(new TimerBenchmark(core_impl->get_timer(BREAK_ID_MICRO_BREAK)));
+  runner.run(new HeartbeatBenchmark(core, &clock));
+
+  static const int clients[] = { 1, 4, 16 };
+  static const int intervals[] = { 10, 100 };
+  for (size_t c = 0; c < sizeof(clients) / sizeof(clients[0]); c++)
+    {
+      for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+        {
+          runner.run(new IdleLogBenchmark(home_dir, clients[c], intervals[i]));
+        }
+    }
+
+  runner.run(new PacketBufferBenchmark(false));
+  runner.run(new PacketBufferBenchmark(true));
+
+  runner.run(new ConfiguratorBenchmark("configurator_get_value/ini", ConfiguratorFactory::FormatIni,
+                                       home_dir + "/bench.ini"));
+#ifdef HAVE_GDOME
+  runner.run(new ConfiguratorBenchmark("configurator_get_value/xml", ConfiguratorFactory::FormatXml,
+                                       home_dir + "/bench.xml"));
+#endif
+
+  static const int years[] = { 1, 5, 20 };
+  for (size_t y = 0; y < sizeof(years) / sizeof(years[0]); y++)
+    {
+      runner.run(new HistoryBenchmark(home_dir, years[y]));
+    }
+
+#ifdef HAVE_DBUS
+  runner.run(new DBusBenchmark(core_impl));
+#endif
+
+  string json = runner.get_json();
+  if (output_file == "")
+    {
+      fputs(json.c_str(), stdout);
+    }
+  else if (!g_file_set_contents(output_file.c_str(), json.c_str(), json.size(), NULL))
+    {
+      fprintf(stderr, "Cannot write %s\n", output_file.c_str());
+      return 2;
+    }
+
+  remove_headless_home(home_dir);
+  return 0;
+}
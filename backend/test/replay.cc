@@ -0,0 +1,358 @@
+// replay.cc --- Replays recorded input through the backend in virtual time
+//
+// Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Usage: workrave-replay [--golden FILE] [--update] [--tail SECONDS] TRACE
+//
+// Feeds an input trace recorded with WORKRAVE_RECORD_INPUT=<file> through
+// InputMonitor -> ActivityMonitor -> Core::heartbeat. The backend runs on
+// a virtual clock, so hours of input replay in seconds. The resulting
+// timers and statistics are printed, and compared against the golden file
+// if one is specified. Throughput is reported on stderr.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "ICore.hh"
+#include "IBreak.hh"
+#include "IStatistics.hh"
+#include "CoreFactory.hh"
+#include "Util.hh"
+
+#include "InputMonitorFactory.hh"
+#include "InputTrace.hh"
+#include "TimeSource.hh"
+
+#include "Headless.hh"
+
+using namespace std;
+using namespace workrave;
+
+
+//! Drives the core on a virtual clock.
+class Replay
+{
+public:
+  Replay() : core(NULL), heartbeats(0) {}
+
+  void init(int argc, char **argv)
+  {
+    TimeSource::set_clock(&clock);
+    InputMonitorFactory::set_factory(new ScriptedInputMonitorFactory(&monitor));
+
+    core = CoreFactory::get_core();
+    core->set_core_events_listener(&listener);
+    core->init(argc, argv, &app, NULL);
+  }
+
+  void set_time(gint64 time)
+  {
+    clock.set_real_time(time);
+  }
+
+  //! Runs all heartbeats that are due up to the specified time.
+  void run_until(gint64 time)
+  {
+    while (true)
+      {
+        gint64 now = clock.get_real_time();
+        gint64 delay = (gint64)core->get_heartbeat_delay() * 1000;
+
+        // Always make progress, even if the core is late.
+        gint64 next = now + (delay > 0 ? delay : 1000);
+        if (next > time)
+          {
+            break;
+          }
+
+        clock.set_real_time(next);
+        heartbeat();
+      }
+
+    clock.set_real_time(time);
+  }
+
+  void replay(const vector<InputEvent> &events, gint64 time)
+  {
+    monitor.deliver(events, time);
+    dispatch();
+  }
+
+  //! Returns the outcome of the replay.
+  string get_summary()
+  {
+    string out;
+    char buffer[128];
+
+    for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+      {
+        IBreak *b = core->get_break(BreakId(i));
+        g_snprintf(buffer, sizeof(buffer), "%s.elapsed %ld\n%s.idle %ld\n",
+                   b->get_name().c_str(), (long)b->get_elapsed_time(),
+                   b->get_name().c_str(), (long)b->get_elapsed_idle_time());
+        out += buffer;
+      }
+
+    IStatistics *statistics = core->get_statistics();
+    statistics->update();
+
+    IStatistics::DailyStats *day = statistics->get_current_day();
+    if (day != NULL)
+      {
+        for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+          {
+            IBreak *b = core->get_break(BreakId(i));
+            for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+              {
+                g_snprintf(buffer, sizeof(buffer), "stats.%s.%d %d\n",
+                           b->get_name().c_str(), j, day->break_stats[i][j]);
+                out += buffer;
+              }
+          }
+
+        for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+          {
+            g_snprintf(buffer, sizeof(buffer), "stats.misc.%d %" G_GINT64_FORMAT "\n",
+                       j, (gint64)day->misc_stats[j]);
+            out += buffer;
+          }
+      }
+
+    return out;
+  }
+
+  int get_heartbeats() const
+  {
+    return heartbeats;
+  }
+
+private:
+  void heartbeat()
+  {
+    listener.wakeup = false;
+    core->heartbeat();
+    heartbeats++;
+    dispatch();
+  }
+
+  //! Runs pending main loop sources and the requested wakeups.
+  void dispatch()
+  {
+    while (g_main_context_iteration(NULL, FALSE))
+      ;
+
+    if (listener.wakeup)
+      {
+        heartbeat();
+      }
+  }
+
+private:
+  VirtualTimeSource clock;
+  ScriptedInputMonitor monitor;
+  HeadlessApp app;
+  HeadlessEventListener listener;
+  ICore *core;
+  int heartbeats;
+};
+
+
+//! Compares the outcome with the golden file and reports the differences.
+static bool
+compare(const string &summary, const string &golden_file)
+{
+  gchar *contents = NULL;
+  if (!g_file_get_contents(golden_file.c_str(), &contents, NULL, NULL))
+    {
+      fprintf(stderr, "Cannot read %s\n", golden_file.c_str());
+      return false;
+    }
+
+  string golden = contents;
+  g_free(contents);
+
+  if (golden == summary)
+    {
+      return true;
+    }
+
+  gchar **expected = g_strsplit(golden.c_str(), "\n", -1);
+  gchar **actual = g_strsplit(summary.c_str(), "\n", -1);
+
+  guint num_expected = g_strv_length(expected);
+  guint num_actual = g_strv_length(actual);
+
+  for (guint i = 0; i < num_expected || i < num_actual; i++)
+    {
+      const char *e = i < num_expected ? expected[i] : NULL;
+      const char *a = i < num_actual ? actual[i] : NULL;
+
+      if (e == NULL || a == NULL || strcmp(e, a) != 0)
+        {
+          if (e != NULL)
+            {
+              fprintf(stderr, "-%s\n", e);
+            }
+          if (a != NULL)
+            {
+              fprintf(stderr, "+%s\n", a);
+            }
+        }
+    }
+
+  g_strfreev(expected);
+  g_strfreev(actual);
+  return false;
+}
+
+
+static void
+usage()
+{
+  fprintf(stderr, "Usage: workrave-replay [--golden FILE] [--update] [--tail SECONDS] TRACE\n");
+  exit(2);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  string golden_file;
+  string trace_file;
+  bool update = false;
+  int tail = 0;
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+        {
+          golden_file = argv[++i];
+        }
+      else if (strcmp(argv[i], "--tail") == 0 && i + 1 < argc)
+        {
+          tail = atoi(argv[++i]);
+        }
+      else if (strcmp(argv[i], "--update") == 0)
+        {
+          update = true;
+        }
+      else if (argv[i][0] != '-' && trace_file == "")
+        {
+          trace_file = argv[i];
+        }
+      else
+        {
+          usage();
+        }
+    }
+
+  if (trace_file == "" || (update && golden_file == ""))
+    {
+      usage();
+    }
+
+  // Statistics are kept per local day.
+  g_setenv("TZ", "UTC", TRUE);
+  tzset();
+
+  InputTraceReader reader;
+  if (!reader.load(trace_file))
+    {
+      fprintf(stderr, "Cannot read trace %s\n", trace_file.c_str());
+      return 2;
+    }
+
+  vector<InputEvent> events;
+  gint64 time = 0;
+  if (!reader.next(events, time))
+    {
+      fprintf(stderr, "Trace %s is empty\n", trace_file.c_str());
+      return 2;
+    }
+
+  // Run with a clean configuration and state.
+  string home_dir = create_headless_home("workrave-replay");
+  if (home_dir == "")
+    {
+      fprintf(stderr, "Cannot create temporary directory\n");
+      return 2;
+    }
+  Util::set_home_directory(home_dir + "/");
+
+  Replay replay;
+  replay.set_time(time);
+  replay.init(argc, argv);
+
+  gint64 start_time = time;
+  gint64 start = g_get_monotonic_time();
+  long num_events = 0;
+
+  do
+    {
+      replay.run_until(time);
+      replay.replay(events, time);
+      num_events += (long)events.size();
+    }
+  while (reader.next(events, time));
+
+  replay.run_until(time + (gint64)tail * G_USEC_PER_SEC);
+
+  gint64 duration = g_get_monotonic_time() - start;
+  double virtual_seconds = (double)(time - start_time) / G_USEC_PER_SEC + tail;
+  double real_seconds = duration > 0 ? (double)duration / G_USEC_PER_SEC : 1e-6;
+
+  fprintf(stderr, "%ld events, %d heartbeats, %.0f virtual seconds in %.3f s: "
+          "%.0f events/s, %.0fx real time\n",
+          num_events, replay.get_heartbeats(), virtual_seconds, real_seconds,
+          num_events / real_seconds, virtual_seconds / real_seconds);
+
+  string summary = replay.get_summary();
+  remove_headless_home(home_dir);
+
+  if (update)
+    {
+      if (!g_file_set_contents(golden_file.c_str(), summary.c_str(), summary.size(), NULL))
+        {
+          fprintf(stderr, "Cannot write %s\n", golden_file.c_str());
+          return 2;
+        }
+      return 0;
+    }
+
+  fputs(summary.c_str(), stdout);
+
+  if (golden_file != "" && !compare(summary, golden_file))
+    {
+      fprintf(stderr, "Outcome differs from %s\n", golden_file.c_str());
+      return 1;
+    }
+
+  return 0;
+}
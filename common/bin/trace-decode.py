@@ -0,0 +1,141 @@
+#!/usr/bin/python
+#
+# Copyright (C) 2013 Rob Caelers <robc@krandor.nl>
+# All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+"""
+Decodes the binary trace written by Workrave when built with TRACING
+"""
+
+import struct
+import sys
+import time
+
+from optparse import OptionParser
+
+TRACE_KIND_ENTER = 1
+TRACE_KIND_ENTER_MSG = 2
+TRACE_KIND_RETURN = 3
+TRACE_KIND_EXIT = 4
+TRACE_KIND_MSG = 5
+
+class Site(object):
+    def __init__(self, kind, line, filename, method):
+        self.kind = kind
+        self.line = line
+        self.filename = filename
+        self.method = method
+
+class TraceReader(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+        self.order = '<'
+
+    def read(self, fmt):
+        fmt = self.order + fmt
+        values = struct.unpack_from(fmt, self.data, self.pos)
+        self.pos += struct.calcsize(fmt)
+        return values
+
+    def read_string(self):
+        (length,) = self.read('I')
+        value = self.data[self.pos:self.pos + length].decode('utf-8', 'replace')
+        self.pos += length
+        return value
+
+    def parse(self):
+        if self.data[0:4] != b'WRTR':
+            raise ValueError('Not a Workrave trace')
+        self.pos = 4
+
+        (byte_order,) = struct.unpack_from('<I', self.data, self.pos)
+        if byte_order != 0x01020304:
+            self.order = '>'
+        (byte_order, version, record_size) = self.read('III')
+        if version != 1:
+            raise ValueError('Unsupported trace version %d' % version)
+
+        (monotonic_time, real_time) = self.read('qq')
+        self.time_offset = real_time - monotonic_time
+
+        (num_sites,) = self.read('I')
+        self.sites = [ None ]
+        for i in range(num_sites):
+            (kind, line) = self.read('II')
+            filename = self.read_string()
+            method = self.read_string()
+            self.sites.append(Site(kind, line, filename, method))
+
+        self.records = []
+        (num_rings,) = self.read('I')
+        for i in range(num_rings):
+            (thread, count) = self.read('II')
+            for j in range(count):
+                (timestamp, site, scope, size) = struct.unpack_from(self.order + 'qIII', self.data, self.pos)
+                message = self.data[self.pos + 24:self.pos + 24 + size].decode('utf-8', 'replace')
+                self.records.append((timestamp, thread, site, scope, message))
+                self.pos += record_size
+
+        self.records.sort(key = lambda r: (r[0], r[1]))
+
+    def format(self, record, show_source):
+        (timestamp, thread, site_id, scope_id, message) = record
+        site = self.sites[site_id]
+        scope = self.sites[scope_id] if scope_id < len(self.sites) else None
+        method = scope.method if scope is not None else '?'
+
+        real_time = timestamp + self.time_offset
+        text = time.strftime('%d%b%Y %H:%M:%S', time.localtime(real_time // 1000000))
+        text += '.%06d [%d] ' % (real_time % 1000000, thread)
+
+        if site.kind in (TRACE_KIND_ENTER, TRACE_KIND_ENTER_MSG):
+            text += '>>> ' + site.method
+        elif site.kind in (TRACE_KIND_RETURN, TRACE_KIND_EXIT):
+            text += '<<< ' + method
+        else:
+            text += '    ' + method
+
+        if message != '':
+            text += ' ' + message
+
+        if show_source:
+            text += '  (%s:%d)' % (site.filename, site.line)
+
+        return text
+
+# Main program
+
+if __name__ == '__main__':
+    usage = "usage: %prog [options] <trace-file>"
+    parser = OptionParser(usage=usage)
+    parser.add_option("-t", "--thread", type="int", dest="thread",
+                      help="only show the records of the specified thread")
+    parser.add_option("-s", "--source", action="store_true", dest="source", default=False,
+                      help="show the source location of each record")
+    (options, args) = parser.parse_args()
+
+    if len(args) != 1:
+        parser.error("Expected one parameter")
+
+    f = open(args[0], 'rb')
+    try:
+        reader = TraceReader(f.read())
+    finally:
+        f.close()
+
+    reader.parse()
+
+    for record in reader.records:
+        if options.thread is None or options.thread == record[1]:
+            print(reader.format(record, options.source))
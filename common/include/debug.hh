@@ -34,48 +34,83 @@
 #else
 
 #include <iostream>
-#include <iomanip>
 #include <fstream>
-#include <ctime>
 #include <string>
 
-#include "Mutex.hh"
+#include <glib.h>
 
-extern Mutex g_log_mutex;
-extern std::ofstream g_log_stream;
+//! Static description of a trace call site.
+/*!
+ *  Each TRACE_* macro defines a static site, so that trace records only
+ *  refer to the site by its id. The file name and method name are
+ *  written once, when the trace is dumped.
+ */
+struct TraceSite
+{
+  const char *file;
+  int line;
+  const char *method;
+  int kind;
+  volatile gint id;
+};
 
+//! Per-thread, lock-free binary trace.
+/*!
+ *  Each thread writes fixed size records into its own ring buffer.
+ *  Records contain a monotonic timestamp, the id of the site, the id of
+ *  the enclosing TRACE_ENTER site and the formatted message, if any. The
+ *  rings are written to a binary file at exit or on a fatal signal, which
+ *  can be decoded with common/bin/trace-decode.py.
+ */
 class Debug
 {
 public:
-  static void init();
-  static std::string trace_get_time();
-};
-
-#define TRACE_ENTER(x   ) g_log_mutex.lock(); \
-                          const char *_trace_method_name = x;   \
-                          std::cerr << Debug::trace_get_time() << ">>> " << x << std::endl; \
-                          g_log_mutex.unlock();
+  enum TraceKind
+    {
+      TRACE_KIND_ENTER = 1,
+      TRACE_KIND_ENTER_MSG,
+      TRACE_KIND_RETURN,
+      TRACE_KIND_EXIT,
+      TRACE_KIND_MSG
+    };
 
-#define TRACE_ENTER_MSG(x, y) g_log_mutex.lock(); \
-                          const char *_trace_method_name = x; \
-                          std::cerr  << Debug::trace_get_time() << ">>> " << x << " " << y << std::endl; \
-                          g_log_mutex.unlock();
-
-#define TRACE_RETURN(y)   g_log_mutex.lock(); \
-                          std::cerr << Debug::trace_get_time() << "<<< " << _trace_method_name << y << std::endl; \
-                          g_log_mutex.unlock();
-
-#define TRACE_EXIT()      g_log_mutex.lock(); \
-                          std::cerr << Debug::trace_get_time() << "<<< " << _trace_method_name << std::endl; \
-                          g_log_mutex.unlock();
+  static void init();
+  static void dump();
 
-#define TRACE_MSG(msg)    g_log_mutex.lock(); \
-                          std::cerr << Debug::trace_get_time() << "    " << _trace_method_name << " " << msg  << std::endl; \
-                          g_log_mutex.unlock();
+  static void trace(TraceSite &site, const TraceSite &scope);
+  static std::ostream &trace_begin();
+  static void trace_end(TraceSite &site, const TraceSite &scope);
+};
 
-#define TRACE_MSG2(x,y)   g_log_mutex.lock(); \
-                          std::cerr << Debug::trace_get_time() << "    " << _trace_method_name << " " << x << " " << y << std::endl; \
-                          g_log_mutex.unlock();
+#define TRACE_ENTER(x)    static TraceSite _trace_site = { __FILE__, __LINE__, x, Debug::TRACE_KIND_ENTER, 0 }; \
+                          Debug::trace(_trace_site, _trace_site);
+
+#define TRACE_ENTER_MSG(x, y) static TraceSite _trace_site = { __FILE__, __LINE__, x, Debug::TRACE_KIND_ENTER_MSG, 0 }; \
+                          Debug::trace_begin() << y; \
+                          Debug::trace_end(_trace_site, _trace_site);
+
+#define TRACE_RETURN(y)   do { \
+                            static TraceSite _trace_site_here = { __FILE__, __LINE__, NULL, Debug::TRACE_KIND_RETURN, 0 }; \
+                            Debug::trace_begin() << y; \
+                            Debug::trace_end(_trace_site_here, _trace_site); \
+                          } while (0);
+
+#define TRACE_EXIT()      do { \
+                            static TraceSite _trace_site_here = { __FILE__, __LINE__, NULL, Debug::TRACE_KIND_EXIT, 0 }; \
+                            Debug::trace(_trace_site_here, _trace_site); \
+                          } while (0);
+
+#define TRACE_MSG(msg)    do { \
+                            static TraceSite _trace_site_here = { __FILE__, __LINE__, NULL, Debug::TRACE_KIND_MSG, 0 }; \
+                            Debug::trace_begin() << msg; \
+                            Debug::trace_end(_trace_site_here, _trace_site); \
+                          } while (0);
+
+#define TRACE_MSG2(x,y)   do { \
+                            static TraceSite _trace_site_here = { __FILE__, __LINE__, NULL, Debug::TRACE_KIND_MSG, 0 }; \
+                            Debug::trace_begin() << x << " " << y; \
+                            Debug::trace_end(_trace_site_here, _trace_site); \
+                          } while (0);
 
 #endif // TRACING
 
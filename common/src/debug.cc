@@ -31,26 +31,379 @@
 #include <windows.h> /* for GetFileAttributes */
 #endif
 
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <vector>
+
 #include "Mutex.hh"
 #include "debug.hh"
 
 using namespace std;
 
+//! Size of a trace record.
+#define TRACE_RECORD_SIZE       256
+
+//! Number of records in the ring buffer of each thread.
+#define TRACE_RING_SIZE         4096
+
+//! Version of the binary trace file.
+#define TRACE_FILE_VERSION      1
+
+static const char TRACE_MAGIC[4] = { 'W', 'R', 'T', 'R' };
+static const guint32 TRACE_BYTE_ORDER = 0x01020304;
+
+//! A single trace record.
+struct TraceRecord
+{
+  gint64 time;
+  guint32 site;
+  guint32 scope;
+  guint32 size;
+  guint32 reserved;
+  char message[TRACE_RECORD_SIZE - 24];
+};
+
+//! Stream buffer that formats into a fixed size buffer, truncating the excess.
+class TraceStreamBuf : public std::streambuf
+{
+public:
+  void reset(char *buffer, size_t size)
+  {
+    setp(buffer, buffer + size);
+  }
+
+  size_t size() const
+  {
+    return pptr() - pbase();
+  }
+
+protected:
+  virtual int_type overflow(int_type c)
+  {
+    return traits_type::not_eof(c);
+  }
+};
+
+//! Trace records of a single thread.
+/*!
+ *  Only the owning thread writes to the ring, so no locking is needed.
+ */
+struct TraceRing
+{
+  TraceRing() : head(0), wrapped(0), depth(0), thread(0), active(true), next(NULL), stream(&buf), null_stream(NULL)
+  {
+  }
+
+  TraceRecord records[TRACE_RING_SIZE];
+  volatile gint head;
+  volatile gint wrapped;
+
+  //! Message being formatted.
+  char scratch[sizeof(((TraceRecord *)0)->message)];
+
+  //! Nesting depth of messages, when a message argument traces itself.
+  int depth;
+
+  guint32 thread;
+
+  //! Whether the ring is owned by a running thread. Protected by g_log_mutex.
+  bool active;
+  TraceRing *next;
+
+  TraceStreamBuf buf;
+  std::ostream stream;
+  std::ostream null_stream;
+};
+
 Mutex g_log_mutex;
 std::ofstream g_log_stream;
 
-std::string
-Debug::trace_get_time()
+//! Registered trace sites, indexed by id - 1. Protected by g_log_mutex.
+static std::vector<TraceSite *> *trace_sites = NULL;
+
+//! Rings of all threads. Protected by g_log_mutex.
+static TraceRing *trace_rings = NULL;
+static guint32 trace_num_rings = 0;
+static guint32 trace_num_threads = 0;
+
+//! Name of the binary trace file.
+static std::string trace_filename;
+
+//! Set while the trace is written from a fatal signal.
+static volatile sig_atomic_t trace_crashed = 0;
+
+//! Signals on which the trace is written before the process terminates.
+static const int trace_fatal_signals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGILL,
+#ifdef SIGBUS
+                                           SIGBUS,
+#endif
+};
+
+static void trace_release_ring(gpointer data);
+
+#if GLIB_CHECK_VERSION(2, 31, 18)
+static GPrivate trace_ring_key = G_PRIVATE_INIT(trace_release_ring);
+#else
+static GStaticPrivate trace_ring_key = G_STATIC_PRIVATE_INIT;
+#endif
+
+
+//! Releases the ring of an exiting thread.
+/*!
+ *  The records are kept, so that they are still dumped, until the ring
+ *  is reused by a new thread.
+ */
+static void
+trace_release_ring(gpointer data)
 {
-  char logtime[128];
-  time_t ltime;
+  TraceRing *ring = (TraceRing *) data;
 
-  time(&ltime);
-  struct tm *tmlt = localtime(&ltime);
-  strftime(logtime, 128, "%d%b%Y %H:%M:%S ", tmlt);
-  return logtime;
+  g_log_mutex.lock();
+  ring->active = false;
+  g_log_mutex.unlock();
+}
+
+
+//! Returns the ring of the current thread.
+static TraceRing *
+trace_get_ring()
+{
+#if GLIB_CHECK_VERSION(2, 31, 18)
+  TraceRing *ring = (TraceRing *) g_private_get(&trace_ring_key);
+#else
+  TraceRing *ring = (TraceRing *) g_static_private_get(&trace_ring_key);
+#endif
+
+  if (ring == NULL)
+    {
+      g_log_mutex.lock();
+      for (ring = trace_rings; ring != NULL; ring = ring->next)
+        {
+          if (!ring->active)
+            {
+              // Reuse the ring of an exited thread.
+              ring->active = true;
+              ring->depth = 0;
+              g_atomic_int_set(&ring->head, 0);
+              g_atomic_int_set(&ring->wrapped, 0);
+              break;
+            }
+        }
+
+      if (ring == NULL)
+        {
+          ring = new TraceRing();
+          ring->next = trace_rings;
+          trace_rings = ring;
+          trace_num_rings++;
+        }
+      ring->thread = trace_num_threads++;
+      g_log_mutex.unlock();
+
+#if GLIB_CHECK_VERSION(2, 31, 18)
+      g_private_set(&trace_ring_key, ring);
+#else
+      g_static_private_set(&trace_ring_key, ring, trace_release_ring);
+#endif
+    }
+
+  return ring;
+}
+
+
+//! Assigns an id to a trace site when it is first used.
+static void
+trace_register_site(TraceSite &site)
+{
+  g_log_mutex.lock();
+  if (site.id == 0)
+    {
+      if (trace_sites == NULL)
+        {
+          trace_sites = new std::vector<TraceSite *>();
+        }
+      trace_sites->push_back(&site);
+      g_atomic_int_set(&site.id, (gint)trace_sites->size());
+    }
+  g_log_mutex.unlock();
+}
+
+
+static void
+trace_write(TraceRing *ring, TraceSite &site, const TraceSite &scope, const char *message, size_t size)
+{
+  if (g_atomic_int_get(&site.id) == 0)
+    {
+      trace_register_site(site);
+    }
+
+  gint head = ring->head;
+  TraceRecord &record = ring->records[head];
+
+  record.time = g_get_monotonic_time();
+  record.site = site.id;
+  record.scope = scope.id;
+  record.size = size;
+  memcpy(record.message, message, size);
+
+  head++;
+  if (head == TRACE_RING_SIZE)
+    {
+      g_atomic_int_set(&ring->wrapped, 1);
+      head = 0;
+    }
+  g_atomic_int_set(&ring->head, head);
+}
+
+
+static void
+trace_write_uint32(FILE *file, guint32 value)
+{
+  fwrite(&value, sizeof(value), 1, file);
+}
+
+
+static void
+trace_write_string(FILE *file, const char *str)
+{
+  guint32 len = (str != NULL) ? strlen(str) : 0;
+  trace_write_uint32(file, len);
+  fwrite(str, 1, len, file);
+}
+
+
+//! Records a trace without message.
+void
+Debug::trace(TraceSite &site, const TraceSite &scope)
+{
+  trace_write(trace_get_ring(), site, scope, NULL, 0);
+}
+
+
+//! Returns the stream in which the message of the next trace is formatted.
+std::ostream &
+Debug::trace_begin()
+{
+  TraceRing *ring = trace_get_ring();
+
+  if (ring->depth++ > 0)
+    {
+      // The message of a trace is being formatted. Drop the message
+      // of this nested trace.
+      return ring->null_stream;
+    }
+
+  ring->buf.reset(ring->scratch, sizeof(ring->scratch));
+  ring->stream.clear();
+  return ring->stream;
+}
+
+
+//! Records a trace with the message formatted since trace_begin.
+void
+Debug::trace_end(TraceSite &site, const TraceSite &scope)
+{
+  TraceRing *ring = trace_get_ring();
+
+  if (--ring->depth > 0)
+    {
+      trace_write(ring, site, scope, NULL, 0);
+    }
+  else
+    {
+      trace_write(ring, site, scope, ring->scratch, ring->buf.size());
+    }
+}
+
+
+//! Writes the trace records of all threads to the binary trace file.
+/*!
+ *  Other threads continue tracing while the trace is written, so their
+ *  oldest records may be overwritten.
+ */
+void
+Debug::dump()
+{
+  if (trace_filename == "")
+    {
+      return;
+    }
+
+  FILE *file = g_fopen(trace_filename.c_str(), "wb");
+  if (file == NULL)
+    {
+      return;
+    }
+
+  g_log_mutex.lock();
+
+  fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, file);
+  trace_write_uint32(file, TRACE_BYTE_ORDER);
+  trace_write_uint32(file, TRACE_FILE_VERSION);
+  trace_write_uint32(file, sizeof(TraceRecord));
+
+  // Allows the decoder to convert the monotonic timestamps to real time.
+  gint64 monotonic_time = g_get_monotonic_time();
+  gint64 real_time = g_get_real_time();
+  fwrite(&monotonic_time, sizeof(monotonic_time), 1, file);
+  fwrite(&real_time, sizeof(real_time), 1, file);
+
+  guint32 num_sites = (trace_sites != NULL) ? trace_sites->size() : 0;
+  trace_write_uint32(file, num_sites);
+  for (guint32 i = 0; i < num_sites; i++)
+    {
+      TraceSite *site = (*trace_sites)[i];
+      trace_write_uint32(file, site->kind);
+      trace_write_uint32(file, site->line);
+      trace_write_string(file, site->file);
+      trace_write_string(file, site->method);
+    }
+
+  trace_write_uint32(file, trace_num_rings);
+  for (TraceRing *ring = trace_rings; ring != NULL; ring = ring->next)
+    {
+      gint head = g_atomic_int_get(&ring->head);
+      bool wrapped = g_atomic_int_get(&ring->wrapped) != 0;
+
+      trace_write_uint32(file, ring->thread);
+      trace_write_uint32(file, wrapped ? TRACE_RING_SIZE : head);
+      if (wrapped)
+        {
+          fwrite(ring->records + head, sizeof(TraceRecord), TRACE_RING_SIZE - head, file);
+        }
+      fwrite(ring->records, sizeof(TraceRecord), head, file);
+    }
+
+  g_log_mutex.unlock();
+
+  fclose(file);
+}
+
+
+//! Writes the trace when the process is killed by a fatal signal.
+/*!
+ *  Writing the file is not async-signal-safe, but the process is about
+ *  to terminate anyway. The default action is restored and the signal
+ *  raised again, so that a core dump is still produced.
+ */
+static void
+trace_fatal_signal(int sig)
+{
+  signal(sig, SIG_DFL);
+
+  if (!trace_crashed)
+    {
+      trace_crashed = 1;
+      Debug::dump();
+    }
+
+  raise(sig);
 }
 
+
 void
 Debug::init()
 {
@@ -92,6 +445,15 @@ Debug::init()
     {
       std::cerr.rdbuf(g_log_stream.rdbuf());
     }
+
+  trace_filename = debug_filename + ".trace";
+  atexit(Debug::dump);
+
+  // Also keep the trace when crashing, aborting or failing an assertion.
+  for (size_t i = 0; i < sizeof(trace_fatal_signals) / sizeof(trace_fatal_signals[0]); i++)
+    {
+      signal(trace_fatal_signals[i], trace_fatal_signal);
+    }
 }
 
 #endif
@@ -72,9 +72,22 @@ public:
 
 
 private:
+  //! Contents of a time bar.
+  struct TimeBarState
+  {
+    std::string text;
+    ITimeBar::ColorId primary_color;
+    int primary_val;
+    int primary_max;
+    ITimeBar::ColorId secondary_color;
+    int secondary_val;
+    int secondary_max;
+  };
+
   // IConfiguratorListener
   void config_changed_notify(const std::string &key);
   void update_widgets();
+  bool update_bar_state(BreakId id, const TimeBarState &state);
   void init_table();
   void init_icon();
 
@@ -120,6 +133,12 @@ private:
 
   //! Never show any timers.
   bool force_empty;
+
+  //! Time bar contents last passed to the view.
+  TimeBarState bar_state[BREAK_ID_SIZEOF];
+
+  //! Whether bar_state is known to the view.
+  bool bar_state_valid[BREAK_ID_SIZEOF];
 };
 
 #endif // TIMERBOXCONTROL_HH
@@ -35,12 +35,43 @@
 #include "Util.hh"
 #include <debug.hh>
 
+#include <string.h>
+
 using namespace std;
 using namespace workrave;
 
+#define WAVE_FORMAT_PCM         (0x0001)
+#define WAVE_FORMAT_EXTENSIBLE  (0xFFFE)
+
+static guint16
+read_le16(const guint8 *data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+static guint32
+read_le32(const guint8 *data)
+{
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+}
+
+
 GstSoundPlayer::GstSoundPlayer() :
-  gst_ok(false)
+  gst_ok(false),
+  events(NULL),
+  volume(100),
+  pipeline(NULL),
+  source(NULL),
+  volume_element(NULL),
+  pipeline_watch(0),
+  pipeline_failed(false),
+  current(NULL)
 {
+  for (int i = 0; i < SOUND_MAX; i++)
+    {
+      samples[i] = NULL;
+    }
+
 	GError *error = NULL;
 
   gst_ok = gst_init_check(NULL, NULL, &error);
@@ -61,6 +92,14 @@ GstSoundPlayer::~GstSoundPlayer()
   TRACE_ENTER("GstSoundPlayer::~GstSoundPlayer");
   if (gst_ok)
     {
+      CoreFactory::get_configurator()->remove_listener(this);
+
+      destroy_pipeline();
+      for (int i = 0; i < SOUND_MAX; i++)
+        {
+          free_sample(samples[i]);
+        }
+
   		gst_deinit();
     }
   TRACE_EXIT();
@@ -71,6 +110,30 @@ void
 GstSoundPlayer::init(ISoundDriverEvents *events)
 {
   this->events = events;
+
+  if (gst_ok)
+    {
+      IConfigurator *config = CoreFactory::get_configurator();
+      config->get_value(SoundPlayer::CFG_KEY_SOUND_VOLUME, volume);
+      config->add_listener(SoundPlayer::CFG_KEY_SOUND_VOLUME, this);
+    }
+}
+
+
+void
+GstSoundPlayer::config_changed_notify(const string &key)
+{
+  TRACE_ENTER_MSG("GstSoundPlayer::config_changed_notify", key);
+  if (key == SoundPlayer::CFG_KEY_SOUND_VOLUME)
+    {
+      CoreFactory::get_configurator()->get_value(SoundPlayer::CFG_KEY_SOUND_VOLUME, volume);
+
+      if (volume_element != NULL)
+        {
+          g_object_set(G_OBJECT(volume_element), "volume", (gdouble)(volume / 100.0), NULL);
+        }
+    }
+  TRACE_EXIT();
 }
 
 bool
@@ -101,14 +164,43 @@ GstSoundPlayer::play_sound(SoundEvent snd)
 }
 
 
+//! Plays a sound file.
+/*!
+ *  Preloaded sounds are played by the long-lived pipeline, so that they
+ *  start without delay. Other files are played by a new playbin.
+ */
 void
 GstSoundPlayer::play_sound(std::string wavfile)
 {
   TRACE_ENTER_MSG("GstSoundPlayer::play_sound", wavfile);
 
-	GstElement *play = NULL;
+  Sample *sample = NULL;
+  for (int i = 0; sample == NULL && i < SOUND_MAX; i++)
+    {
+      if (samples[i] != NULL && samples[i]->filename == wavfile)
+        {
+          sample = samples[i];
+        }
+    }
+
+  if (sample != NULL && (pipeline != NULL || create_pipeline()))
+    {
+      play_sample(sample);
+    }
+  else
+    {
+      play_file(wavfile);
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Creates the audio sink.
+GstElement *
+GstSoundPlayer::create_sink()
+{
 	GstElement *sink = NULL;
-  GstBus *bus = NULL;
 
   string method = "automatic";
 
@@ -132,6 +224,179 @@ GstSoundPlayer::play_sound(std::string wavfile)
       sink = gst_element_factory_make("alsasink", "sink");
     }
 
+  return sink;
+}
+
+
+//! Creates the pipeline that plays preloaded sounds.
+/*!
+ *  The pipeline is kept in the READY state between sounds, so that the
+ *  audio device remains open.
+ */
+bool
+GstSoundPlayer::create_pipeline()
+{
+  TRACE_ENTER("GstSoundPlayer::create_pipeline");
+
+  if (!gst_ok || pipeline_failed)
+    {
+      TRACE_RETURN(false);
+      return false;
+    }
+
+  pipeline = gst_pipeline_new("sound");
+  source = gst_element_factory_make("appsrc", "source");
+  GstElement *convert = gst_element_factory_make("audioconvert", "convert");
+  GstElement *resample = gst_element_factory_make("audioresample", "resample");
+  volume_element = gst_element_factory_make("volume", "volume");
+  GstElement *sink = create_sink();
+
+  GstElement *elements[] = { source, convert, resample, volume_element, sink };
+  int num_elements = sizeof(elements) / sizeof(elements[0]);
+
+  bool ok = (pipeline != NULL);
+  for (int i = 0; i < num_elements; i++)
+    {
+      if (elements[i] == NULL)
+        {
+          ok = false;
+        }
+    }
+
+  if (!ok)
+    {
+      for (int i = 0; i < num_elements; i++)
+        {
+          if (elements[i] != NULL)
+            {
+              gst_object_unref(GST_OBJECT(elements[i]));
+            }
+        }
+      if (pipeline != NULL)
+        {
+          gst_object_unref(GST_OBJECT(pipeline));
+        }
+      pipeline = NULL;
+      source = NULL;
+      volume_element = NULL;
+      pipeline_failed = true;
+
+      TRACE_RETURN("Missing element");
+      return false;
+    }
+
+  gst_bin_add_many(GST_BIN(pipeline), source, convert, resample, volume_element, sink, NULL);
+
+  if (!gst_element_link_many(source, convert, resample, volume_element, sink, NULL))
+    {
+      destroy_pipeline();
+      pipeline_failed = true;
+
+      TRACE_RETURN("Cannot link");
+      return false;
+    }
+
+  g_object_set(G_OBJECT(source), "format", GST_FORMAT_TIME, NULL);
+  g_object_set(G_OBJECT(volume_element), "volume", (gdouble)(volume / 100.0), NULL);
+
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  pipeline_watch = gst_bus_add_watch(bus, pipeline_bus_watch, this);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_READY);
+
+  TRACE_RETURN(true);
+  return true;
+}
+
+
+void
+GstSoundPlayer::destroy_pipeline()
+{
+  if (pipeline != NULL)
+    {
+      if (pipeline_watch != 0)
+        {
+          g_source_remove(pipeline_watch);
+          pipeline_watch = 0;
+        }
+
+      gst_element_set_state(pipeline, GST_STATE_NULL);
+      gst_object_unref(GST_OBJECT(pipeline));
+
+      pipeline = NULL;
+      source = NULL;
+      volume_element = NULL;
+      current = NULL;
+    }
+}
+
+
+//! Stops the sound that is being played.
+void
+GstSoundPlayer::stop_pipeline()
+{
+  if (pipeline != NULL && current != NULL)
+    {
+      gst_element_set_state(pipeline, GST_STATE_READY);
+
+      // Drop the messages of the stopped sound.
+      GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+      gst_bus_set_flushing(bus, TRUE);
+      gst_bus_set_flushing(bus, FALSE);
+      gst_object_unref(bus);
+
+      current = NULL;
+    }
+}
+
+
+//! Plays a preloaded sound.
+void
+GstSoundPlayer::play_sample(Sample *sample)
+{
+  TRACE_ENTER_MSG("GstSoundPlayer::play_sample", sample->filename);
+  GstFlowReturn ret;
+
+  stop_pipeline();
+
+  g_object_set(G_OBJECT(source), "caps", sample->caps, NULL);
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  // The buffer refers to the preloaded data, which is not freed while playing.
+#if GST_CHECK_VERSION(1, 0, 0)
+  GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+                                                  (gpointer) sample->data, sample->size,
+                                                  0, sample->size, NULL, NULL);
+  GST_BUFFER_PTS(buffer) = 0;
+#else
+  GstBuffer *buffer = gst_buffer_new();
+  GST_BUFFER_DATA(buffer) = (guint8 *) sample->data;
+  GST_BUFFER_SIZE(buffer) = sample->size;
+  GST_BUFFER_TIMESTAMP(buffer) = 0;
+#endif
+  GST_BUFFER_DURATION(buffer) = sample->duration;
+
+  g_signal_emit_by_name(source, "push-buffer", buffer, &ret);
+  gst_buffer_unref(buffer);
+
+  g_signal_emit_by_name(source, "end-of-stream", &ret);
+
+  current = sample;
+  TRACE_EXIT();
+}
+
+
+//! Plays a sound file using a new playbin.
+void
+GstSoundPlayer::play_file(const string &wavfile)
+{
+  TRACE_ENTER_MSG("GstSoundPlayer::play_file", wavfile);
+
+	GstElement *play = NULL;
+	GstElement *sink = create_sink();
+  GstBus *bus = NULL;
+
   if (sink != NULL)
     {
       play = gst_element_factory_make("playbin", "play");
@@ -148,9 +413,6 @@ GstSoundPlayer::play_sound(std::string wavfile)
 
       char *uri = g_strdup_printf("file://%s", wavfile.c_str());
 
-      int volume = 100;
-      CoreFactory::get_configurator()->get_value(SoundPlayer::CFG_KEY_SOUND_VOLUME, volume);
-
       TRACE_MSG((float)volume);
       gst_element_set_state(play, GST_STATE_NULL);
 
@@ -214,6 +476,171 @@ GstSoundPlayer::bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
   return ret;
 }
 
+
+gboolean
+GstSoundPlayer::pipeline_bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
+{
+  GstSoundPlayer *player = (GstSoundPlayer *) data;
+  GError *err = NULL;
+
+  (void) bus;
+
+  switch (GST_MESSAGE_TYPE (msg))
+    {
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error(msg, &err, NULL);
+      g_error_free(err);
+
+      // Recreate the pipeline for the next sound, e.g. if the audio device changed.
+      player->destroy_pipeline();
+
+      if (player->events != NULL)
+        {
+          player->events->eos_event();
+        }
+      break;
+
+    case GST_MESSAGE_EOS:
+      gst_element_set_state(player->pipeline, GST_STATE_READY);
+      player->current = NULL;
+
+      if (player->events != NULL)
+        {
+          player->events->eos_event();
+        }
+      break;
+
+    case GST_MESSAGE_WARNING:
+      gst_message_parse_warning(msg, &err, NULL);
+      g_error_free(err);
+      break;
+
+    default:
+      break;
+    }
+
+  return TRUE;
+}
+
+
+//! Loads the PCM data of a WAV file.
+/*!
+ *  \return the sample, or NULL if the file is not an uncompressed WAV file.
+ */
+GstSoundPlayer::Sample *
+GstSoundPlayer::load_sample(const string &wavfile)
+{
+  TRACE_ENTER_MSG("GstSoundPlayer::load_sample", wavfile);
+
+  gchar *contents = NULL;
+  gsize length = 0;
+
+  if (!g_file_get_contents(wavfile.c_str(), &contents, &length, NULL))
+    {
+      TRACE_RETURN("Cannot read");
+      return NULL;
+    }
+
+  const guint8 *file = (const guint8 *) contents;
+  const guint8 *data = NULL;
+  gsize size = 0;
+  int format = 0;
+  int channels = 0;
+  int rate = 0;
+  int bits = 0;
+
+  if (length <= MAX_SAMPLE_SIZE && length >= 12 &&
+      memcmp(file, "RIFF", 4) == 0 && memcmp(file + 8, "WAVE", 4) == 0)
+    {
+      gsize pos = 12;
+      while (data == NULL && pos + 8 <= length)
+        {
+          const guint8 *chunk = file + pos;
+          gsize chunk_size = read_le32(chunk + 4);
+          gsize available = length - pos - 8;
+
+          if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && chunk_size <= available)
+            {
+              format = read_le16(chunk + 8);
+              channels = read_le16(chunk + 10);
+              rate = read_le32(chunk + 12);
+              bits = read_le16(chunk + 22);
+
+              if (format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40)
+                {
+                  // The sub format GUID starts with the format code.
+                  format = read_le16(chunk + 32);
+                }
+            }
+          else if (memcmp(chunk, "data", 4) == 0)
+            {
+              data = chunk + 8;
+              size = MIN(chunk_size, available);
+            }
+          else if (chunk_size > available)
+            {
+              break;
+            }
+
+          pos += 8 + chunk_size + (chunk_size & 1);
+        }
+    }
+
+  int frame_size = channels * bits / 8;
+  bool ok = (data != NULL && format == WAVE_FORMAT_PCM &&
+             channels >= 1 && channels <= 8 && rate > 0 &&
+             (bits == 8 || bits == 16 || bits == 24 || bits == 32) &&
+             size >= (gsize) frame_size);
+
+  if (!ok)
+    {
+      g_free(contents);
+      TRACE_RETURN("Unsupported format");
+      return NULL;
+    }
+
+  Sample *sample = new Sample;
+  sample->filename = wavfile;
+  sample->contents = contents;
+  sample->data = data;
+  sample->size = size - size % frame_size;
+  sample->duration = gst_util_uint64_scale(sample->size / frame_size, GST_SECOND, rate);
+
+#if GST_CHECK_VERSION(1, 0, 0)
+  const char *pcm_format = (bits == 8 ? "U8" : bits == 16 ? "S16LE" : bits == 24 ? "S24LE" : "S32LE");
+  sample->caps = gst_caps_new_simple("audio/x-raw",
+                                     "format", G_TYPE_STRING, pcm_format,
+                                     "layout", G_TYPE_STRING, "interleaved",
+                                     "rate", G_TYPE_INT, rate,
+                                     "channels", G_TYPE_INT, channels,
+                                     NULL);
+#else
+  sample->caps = gst_caps_new_simple("audio/x-raw-int",
+                                     "endianness", G_TYPE_INT, G_LITTLE_ENDIAN,
+                                     "signed", G_TYPE_BOOLEAN, (gboolean) (bits > 8),
+                                     "width", G_TYPE_INT, bits,
+                                     "depth", G_TYPE_INT, bits,
+                                     "rate", G_TYPE_INT, rate,
+                                     "channels", G_TYPE_INT, channels,
+                                     NULL);
+#endif
+
+  TRACE_RETURN(sample->size);
+  return sample;
+}
+
+
+void
+GstSoundPlayer::free_sample(Sample *sample)
+{
+  if (sample != NULL)
+    {
+      gst_caps_unref(sample->caps);
+      g_free(sample->contents);
+      delete sample;
+    }
+}
+
 bool
 GstSoundPlayer::get_sound_enabled(SoundEvent snd, bool &enabled)
 {
@@ -238,11 +665,38 @@ GstSoundPlayer::get_sound_wav_file(SoundEvent snd, std::string &wav_file)
   return false;
 }
 
+//! Preloads the sound of an event.
 void
 GstSoundPlayer::set_sound_wav_file(SoundEvent snd, const std::string &wav_file)
 {
-  (void) snd;
-  (void) wav_file;
+  TRACE_ENTER_MSG("GstSoundPlayer::set_sound_wav_file", snd << " " << wav_file);
+
+  if (gst_ok && snd >= SOUND_MIN && snd < SOUND_MAX &&
+      (samples[snd] == NULL || samples[snd]->filename != wav_file))
+    {
+      if (samples[snd] != NULL)
+        {
+          if (current == samples[snd])
+            {
+              stop_pipeline();
+            }
+          free_sample(samples[snd]);
+          samples[snd] = NULL;
+        }
+
+      if (wav_file != "")
+        {
+          samples[snd] = load_sample(wav_file);
+        }
+
+      if (samples[snd] != NULL && pipeline == NULL)
+        {
+          // Open the audio device before the first sound.
+          create_pipeline();
+        }
+    }
+
+  TRACE_EXIT();
 }
 
 #endif
@@ -26,7 +26,11 @@
 
 #include <gst/gst.h>
 
-class GstSoundPlayer : public ISoundDriver
+#include "IConfiguratorListener.hh"
+
+class GstSoundPlayer :
+  public ISoundDriver,
+  public workrave::IConfiguratorListener
 {
 public:
   GstSoundPlayer();
@@ -42,15 +46,81 @@ public:
   bool get_sound_wav_file(SoundEvent snd, std::string &wav_file);
   void set_sound_wav_file(SoundEvent snd, const std::string &wav_file);
 
+  void config_changed_notify(const std::string &key);
+
   static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data);
 
 private:
+  //! PCM contents of a WAV file.
+  struct Sample
+  {
+    Sample() : contents(NULL), data(NULL), size(0), caps(NULL), duration(0) {}
+
+    //! Name of the WAV file.
+    std::string filename;
+
+    //! Contents of the file.
+    gchar *contents;
+
+    //! Start of the PCM data in the contents.
+    const guint8 *data;
+
+    //! Size of the PCM data.
+    gsize size;
+
+    //! Format of the PCM data.
+    GstCaps *caps;
+
+    //! Duration of the sound.
+    GstClockTime duration;
+  };
+
+  GstElement *create_sink();
+  bool create_pipeline();
+  void destroy_pipeline();
+  void stop_pipeline();
+  void play_sample(Sample *sample);
+  void play_file(const std::string &wavfile);
+
+  static Sample *load_sample(const std::string &wavfile);
+  static void free_sample(Sample *sample);
+
+  static gboolean pipeline_bus_watch(GstBus *bus, GstMessage *msg, gpointer data);
+
+private:
+  //! Largest WAV file that is kept in memory.
+  static const gsize MAX_SAMPLE_SIZE = 4 * 1024 * 1024;
+
   //! GStreamer init OK.
   gboolean gst_ok;
 
   //!
   ISoundDriverEvents *events;
 
+  //! Current sound volume in percent.
+  int volume;
+
+  //! Preloaded sounds, by sound event.
+  Sample *samples[SOUND_MAX];
+
+  //! Long-lived pipeline that plays the preloaded sounds.
+  GstElement *pipeline;
+
+  //! Source of the pipeline.
+  GstElement *source;
+
+  //! Volume control of the pipeline.
+  GstElement *volume_element;
+
+  //! Bus watch of the pipeline.
+  guint pipeline_watch;
+
+  //! Whether the pipeline could not be created.
+  bool pipeline_failed;
+
+  //! Sound that is being played by the pipeline.
+  Sample *current;
+
   struct WatchData
   {
     GstSoundPlayer *player;
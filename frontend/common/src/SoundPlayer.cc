@@ -429,6 +429,11 @@ SoundPlayer::activate_theme(const Theme &theme, bool force)
         {
           set_sound_wav_file((SoundEvent)idx, filename);
         }
+      else if (driver != NULL)
+        {
+          // Let the driver preload the current sound.
+          driver->set_sound_wav_file((SoundEvent)idx, current_filename);
+        }
 
       idx++;
     }
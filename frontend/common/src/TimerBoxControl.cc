@@ -87,6 +87,11 @@ TimerBoxControl::update()
       // Configuration was changed. reinit.
       init_table();
 
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          bar_state_valid[i] = false;
+        }
+
       operation_mode = mode;
       init_icon();
 
@@ -160,6 +165,7 @@ TimerBoxControl::init()
           break_slots[i][j] = -1;
         }
       break_slot_cycle[i] = 0;
+      bar_state_valid[i] = false;
     }
 
   // Load the configuration
@@ -182,17 +188,13 @@ TimerBoxControl::update_widgets()
       ICore *core = CoreFactory::get_core();
       IBreak *b = core->get_break((BreakId)count);
 
-      std::string text;
-      ITimeBar::ColorId primary_color;
-      int primary_val, primary_max;
-      ITimeBar::ColorId secondary_color;
-      int secondary_val, secondary_max;
-
       if (b == NULL)
         {
           continue;
         }
 
+      TimeBarState state;
+
       // Collect some data.
       time_t maxActiveTime = b->get_limit();
       time_t activeTime = b->get_elapsed_time();
@@ -203,35 +205,64 @@ TimerBoxControl::update_widgets()
       // Set the text
       if (b->is_limit_enabled() && maxActiveTime != 0)
         {
-          text = Text::time_to_string(maxActiveTime - activeTime);
+          state.text = Text::time_to_string(maxActiveTime - activeTime);
         }
       else
         {
-          text = Text::time_to_string(activeTime);
+          state.text = Text::time_to_string(activeTime);
         }
       // And set the bar.
-      secondary_val = secondary_max = 0;
-      secondary_color = ITimeBar::COLOR_ID_INACTIVE;
+      state.secondary_val = state.secondary_max = 0;
+      state.secondary_color = ITimeBar::COLOR_ID_INACTIVE;
 
       // Timer is running, show elapsed time.
-      primary_val = (int)activeTime;
-      primary_max = (int)maxActiveTime;
+      state.primary_val = (int)activeTime;
+      state.primary_max = (int)maxActiveTime;
 
-      primary_color = overdue
+      state.primary_color = overdue
         ? ITimeBar::COLOR_ID_OVERDUE : ITimeBar::COLOR_ID_ACTIVE;
 
       if (b->is_auto_reset_enabled() && breakDuration != 0)
         {
           // resting.
-          secondary_color = ITimeBar::COLOR_ID_INACTIVE;
-          secondary_val = (int)idleTime;
-          secondary_max = (int)breakDuration;
+          state.secondary_color = ITimeBar::COLOR_ID_INACTIVE;
+          state.secondary_val = (int)idleTime;
+          state.secondary_max = (int)breakDuration;
+        }
+
+      // Only pass changed contents to the view.
+      if (update_bar_state(BreakId(count), state))
+        {
+          view->set_time_bar(BreakId(count), state.text,
+                             state.primary_color, state.primary_val, state.primary_max,
+                             state.secondary_color, state.secondary_val, state.secondary_max);
         }
+    }
+}
+
 
-      view->set_time_bar(BreakId(count), text,
-                         primary_color, primary_val, primary_max,
-                         secondary_color, secondary_val, secondary_max);
+//! Stores the contents of a time bar. Returns whether they changed.
+bool
+TimerBoxControl::update_bar_state(BreakId id, const TimeBarState &state)
+{
+  TimeBarState &old = bar_state[id];
+
+  bool changed = (!bar_state_valid[id] ||
+                  old.text != state.text ||
+                  old.primary_color != state.primary_color ||
+                  old.primary_val != state.primary_val ||
+                  old.primary_max != state.primary_max ||
+                  old.secondary_color != state.secondary_color ||
+                  old.secondary_val != state.secondary_val ||
+                  old.secondary_max != state.secondary_max);
+
+  if (changed)
+    {
+      old = state;
+      bar_state_valid[id] = true;
     }
+
+  return changed;
 }
 
 
@@ -374,7 +374,28 @@ GUI::on_timer()
         }
     }
 
-  return true;
+  schedule_timer();
+  return false;
+}
+
+
+//! Schedules the next heartbeat.
+/*!
+ *  The timers are displayed every second while they change. Once all
+ *  timers are settled, the core decides when it needs the next heartbeat.
+ */
+void
+GUI::schedule_timer()
+{
+  int delay = core->get_heartbeat_delay();
+
+  if (delay > 1000 && (active_break_count > 0 || !core->are_timers_settled()))
+    {
+      delay = 1000;
+    }
+
+  timer_connection.disconnect();
+  timer_connection = Glib::signal_timeout().connect(sigc::mem_fun(*this, &GUI::on_timer), delay);
 }
 
 #if defined(NDEBUG)
@@ -814,9 +835,6 @@ GUI::init_gui()
   win32_init_filter();
 #endif
 
-  // Periodic timer.
-  Glib::signal_timeout().connect(sigc::mem_fun(*this, &GUI::on_timer), 1000);
-
 #ifndef HAVE_GTK3
   static const gchar *rc_string =
     {
@@ -997,6 +1015,13 @@ GUI::core_event_usage_mode_changed(const UsageMode m)
   menus->resync();
 }
 
+void
+GUI::core_event_wakeup()
+{
+  timer_connection.disconnect();
+  on_timer();
+}
+
 void
 GUI::config_changed_notify(const std::string &key)
 {
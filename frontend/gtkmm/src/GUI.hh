@@ -126,6 +126,7 @@ public:
   void core_event_notify(const CoreEvent event);
   void core_event_operation_mode_changed(const OperationMode m);
   void core_event_usage_mode_changed(const UsageMode m);
+  void core_event_wakeup();
 
 #ifdef HAVE_DBUS
   virtual void bus_name_presence(const std::string &name, bool present);
@@ -150,6 +151,7 @@ public:
 private:
   std::string get_timers_tooltip();
   bool on_timer();
+  void schedule_timer();
   void init_platform();
   void init_debug();
   void init_nls();
@@ -290,6 +292,9 @@ private:
 
   // UI Event connections
   std::list<sigc::connection> event_connections;
+
+  //! Connection to the heartbeat timer.
+  sigc::connection timer_connection;
   
 };
 
@@ -45,9 +45,17 @@
 #define  WORKRAVE_INDICATOR_SERVICE_IFACE    "org.workrave.AppletInterface"
 #define  WORKRAVE_INDICATOR_SERVICE_OBJ      "/org/workrave/Workrave/UI"
 
+//! Maximum number of seconds without an update to applets that did not
+//! subscribe. These applets consider Workrave gone when they do not
+//! receive any update for 5 (Cinnamon) or 10 seconds.
+#define  KEEPALIVE_INTERVAL                 2
+
+//! Number of milliseconds between keep-alive checks.
+#define  KEEPALIVE_CHECK_INTERVAL           1000
+
 //! Constructor.
 GenericDBusApplet::GenericDBusApplet() :
-  enabled(false), visible(false), dbus(NULL)
+  enabled(false), visible(false), sent_data_valid(false), last_sent_time(0), keepalive_id(0), dbus(NULL)
 {
   timer_box_control = new TimerBoxControl("applet", *this);
   timer_box_view = this;
@@ -55,6 +63,7 @@ GenericDBusApplet::GenericDBusApplet() :
   for (int i = 0; i < BREAK_ID_SIZEOF; i++)
     {
       data[i].bar_text = "";
+      data[i].slot = BREAK_ID_NONE;
       data[i].bar_primary_color = 0;
       data[i].bar_primary_val = 0;
       data[i].bar_primary_max = 0;
@@ -70,6 +79,10 @@ GenericDBusApplet::GenericDBusApplet() :
 //! Destructor.
 GenericDBusApplet::~GenericDBusApplet()
 {
+  if (keepalive_id != 0)
+    {
+      g_source_remove(keepalive_id);
+    }
 }
 
 void
@@ -99,19 +112,156 @@ GenericDBusApplet::set_time_bar(BreakId id,
   TRACE_EXIT();
 }
 
+//! Sends the timer data to the applets if anything visible has changed.
+/*!
+ *  Applets that subscribed with a granularity only receive an update
+ *  when a value crosses a multiple of the granularity.
+ */
 void
 GenericDBusApplet::update_view()
 {
   TRACE_ENTER("GenericDBusApplet::update_view");
 
+  bool changed = !sent_data_valid;
+  int granularity = get_granularity();
+
+  for (int i = 0; !changed && i < BREAK_ID_SIZEOF; i++)
+    {
+      changed = is_changed(data[i], sent_data[i], granularity);
+    }
+
+  if (changed)
+    {
+      send_timers();
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Sends the timer data to the applets.
+void
+GenericDBusApplet::send_timers()
+{
+  TRACE_ENTER("GenericDBusApplet::send_timers");
+
   org_workrave_AppletInterface *iface = org_workrave_AppletInterface::instance(dbus);
   assert(iface != NULL);
   iface->TimersUpdated(WORKRAVE_INDICATOR_SERVICE_OBJ,
                        data[BREAK_ID_MICRO_BREAK], data[BREAK_ID_REST_BREAK], data[BREAK_ID_DAILY_LIMIT]);
 
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      sent_data[i] = data[i];
+    }
+  sent_data_valid = true;
+  last_sent_time = g_get_monotonic_time();
+
   TRACE_EXIT();
 }
 
+
+//! Returns whether the applet visible contents of the timer data differs.
+/*!
+ *  Values are compared in units of the granularity. The text is only
+ *  compared at a granularity of one second, as it usually includes the
+ *  seconds.
+ */
+bool
+GenericDBusApplet::is_changed(const TimerData &a, const TimerData &b, int granularity)
+{
+  return (a.slot != b.slot ||
+          a.bar_primary_color != b.bar_primary_color ||
+          a.bar_primary_max != b.bar_primary_max ||
+          a.bar_primary_val / granularity != b.bar_primary_val / granularity ||
+          a.bar_secondary_color != b.bar_secondary_color ||
+          a.bar_secondary_max != b.bar_secondary_max ||
+          a.bar_secondary_val / granularity != b.bar_secondary_val / granularity ||
+          (granularity <= 1 && a.bar_text != b.bar_text));
+}
+
+
+//! Returns the finest granularity requested by the embedded applets.
+/*!
+ *  Applets that did not subscribe receive every change.
+ */
+int
+GenericDBusApplet::get_granularity() const
+{
+  int ret = 0;
+
+  for (std::set<std::string>::const_iterator i = active_bus_names.begin(); i != active_bus_names.end(); i++)
+    {
+      std::map<std::string, int>::const_iterator s = subscriptions.find(*i);
+      int granularity = (s != subscriptions.end()) ? s->second : 1;
+
+      if (ret == 0 || granularity < ret)
+        {
+          ret = granularity;
+        }
+    }
+
+  return ret > 0 ? ret : 1;
+}
+
+
+//! Sends a keep-alive update to applets that did not subscribe.
+/*!
+ *  The core heartbeat can be minutes apart once the timers are settled,
+ *  so the keep-alive runs on its own timeout while applets that did not
+ *  subscribe are embedded. It is only sent if no update was sent for
+ *  KEEPALIVE_INTERVAL seconds, measured on the monotonic clock.
+ */
+gboolean
+GenericDBusApplet::static_keepalive(gpointer data)
+{
+  GenericDBusApplet *applet = (GenericDBusApplet *) data;
+
+  if (!applet->needs_keepalive())
+    {
+      applet->keepalive_id = 0;
+      return FALSE;
+    }
+
+  gint64 now = g_get_monotonic_time();
+  if (applet->sent_data_valid &&
+      now - applet->last_sent_time >= KEEPALIVE_INTERVAL * G_USEC_PER_SEC)
+    {
+      applet->send_timers();
+    }
+  return TRUE;
+}
+
+
+//! Returns whether an embedded applet did not subscribe.
+bool
+GenericDBusApplet::needs_keepalive() const
+{
+  for (std::set<std::string>::const_iterator i = active_bus_names.begin(); i != active_bus_names.end(); i++)
+    {
+      if (subscriptions.find(*i) == subscriptions.end())
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+
+//! Starts the keep-alive timeout if an embedded applet needs it.
+/*!
+ *  The timeout stops itself once all embedded applets subscribed.
+ */
+void
+GenericDBusApplet::start_keepalive()
+{
+  if (keepalive_id == 0 && needs_keepalive())
+    {
+      keepalive_id = g_timeout_add(KEEPALIVE_CHECK_INTERVAL, static_keepalive, this);
+    }
+}
+
+
 void
 GenericDBusApplet::init_applet()
 {
@@ -153,10 +303,7 @@ GenericDBusApplet::deactivate_applet()
   data[1].slot = BREAK_ID_NONE;
   data[2].slot = BREAK_ID_NONE;
 
-  org_workrave_AppletInterface *iface = org_workrave_AppletInterface::instance(dbus);
-  assert(iface != NULL);
-  iface->TimersUpdated(WORKRAVE_INDICATOR_SERVICE_OBJ,
-                       data[BREAK_ID_MICRO_BREAK], data[BREAK_ID_REST_BREAK], data[BREAK_ID_DAILY_LIMIT]);
+  send_timers();
   TRACE_EXIT();
 }
 
@@ -171,12 +318,40 @@ GenericDBusApplet::applet_embed(bool enable, const std::string &sender)
       dbus->unwatch(*i);
     }
   active_bus_names.clear();
-  
+
+  if (keepalive_id != 0)
+    {
+      // Restarted when the applet is seen on the bus.
+      g_source_remove(keepalive_id);
+      keepalive_id = 0;
+    }
+
   if (sender != "")
     {
       dbus->watch(sender, this);
     }
   // else... FIXME:
+
+  // Make sure the new applet receives the current state.
+  sent_data_valid = false;
+  TRACE_EXIT();
+}
+
+
+//! Sets the granularity (in seconds) of the timer updates for an applet.
+/*!
+ *  An applet that renders minutes only subscribes with a granularity of
+ *  60 seconds. Subscribed applets only receive the timer data when it
+ *  changes, without keep-alive updates.
+ */
+void
+GenericDBusApplet::applet_subscribe(const std::string &sender, int granularity)
+{
+  TRACE_ENTER_MSG("GenericDBusApplet::applet_subscribe", sender << " " << granularity);
+
+  subscriptions[sender] = granularity > 0 ? granularity : 1;
+  sent_data_valid = false;
+
   TRACE_EXIT();
 }
 
@@ -274,6 +449,7 @@ GenericDBusApplet::bus_name_presence(const std::string &name, bool present)
   if (present)
     {
       active_bus_names.insert(name);
+      start_keepalive();
       if (!visible)
         {
           TRACE_MSG("Enabling: " << enabled);
@@ -284,9 +460,15 @@ GenericDBusApplet::bus_name_presence(const std::string &name, bool present)
   else
     {
       active_bus_names.erase(name);
+      subscriptions.erase(name);
       if (active_bus_names.size() == 0)
         {
           TRACE_MSG("Disabling");
+          if (keepalive_id != 0)
+            {
+              g_source_remove(keepalive_id);
+              keepalive_id = 0;
+            }
           state_changed_signal.emit(AppletWindow::APPLET_STATE_DISABLED);
           visible = false;
         }
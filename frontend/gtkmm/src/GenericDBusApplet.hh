@@ -24,6 +24,7 @@
 
 #include <string>
 #include <set>
+#include <map>
 
 #include "IConfiguratorListener.hh"
 
@@ -67,6 +68,7 @@ public:
   virtual void get_tray_icon_enabled(bool &enabled) const;
   virtual void applet_command(int command);
   virtual void applet_embed(bool enable, const std::string &sender);
+  virtual void applet_subscribe(const std::string &sender, int granularity);
   virtual void button_clicked(int button);
   
 private:
@@ -97,11 +99,35 @@ private:
   void add_menu_item(const char *text, int command, int flags);
 
   void send_tray_icon_enabled();
-  
+  void send_timers();
+  int get_granularity() const;
+  bool needs_keepalive() const;
+  void start_keepalive();
+
+  static gboolean static_keepalive(gpointer data);
+
+  static bool is_changed(const TimerData &a, const TimerData &b, int granularity);
+
 private:
   bool enabled;
   bool visible;
   TimerData data[BREAK_ID_SIZEOF];
+
+  //! Timer data last sent to the applets.
+  TimerData sent_data[BREAK_ID_SIZEOF];
+
+  //! Whether sent_data is valid.
+  bool sent_data_valid;
+
+  //! Monotonic time at which the timer data was last sent.
+  gint64 last_sent_time;
+
+  //! Timeout that sends keep-alive updates.
+  guint keepalive_id;
+
+  //! Update granularity (in seconds) requested by each subscribed applet.
+  std::map<std::string, int> subscriptions;
+
   MenuItems items;
   std::set<std::string> active_bus_names;
   workrave::dbus::IDBus::Ptr dbus;
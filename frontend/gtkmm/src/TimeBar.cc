@@ -55,12 +55,17 @@ Gdk::Color TimeBar::bar_colors[TimeBar::COLOR_ID_SIZEOF] =
 
 //! Constructor
 TimeBar::TimeBar() :
+  bar_color(COLOR_ID_INACTIVE),
+  secondary_bar_color(COLOR_ID_INACTIVE),
   bar_value(0),
   bar_max_value(0),
   secondary_bar_value(0),
   secondary_bar_max_value(0),
   bar_text_align(0),
-  rotation(0)
+  rotation(0),
+  dirty(true),
+  drawn_bar_width(-1),
+  drawn_sbar_width(-1)
 {
   add_events(Gdk::EXPOSURE_MASK);
   add_events(Gdk::BUTTON_PRESS_MASK);
@@ -110,7 +115,11 @@ TimeBar::set_secondary_progress(int value, int max_value)
 void
 TimeBar::set_text(string text)
 {
-  bar_text = text;
+  if (bar_text != text)
+    {
+      bar_text = text;
+      dirty = true;
+    }
 }
 
 
@@ -118,7 +127,11 @@ TimeBar::set_text(string text)
 void
 TimeBar::set_text_alignment(int align)
 {
-  bar_text_align = align;
+  if (bar_text_align != align)
+    {
+      bar_text_align = align;
+      dirty = true;
+    }
 }
 
 
@@ -126,7 +139,11 @@ TimeBar::set_text_alignment(int align)
 void
 TimeBar::set_bar_color(ColorId color)
 {
-  bar_color = color;
+  if (bar_color != color)
+    {
+      bar_color = color;
+      dirty = true;
+    }
 }
 
 
@@ -134,7 +151,11 @@ TimeBar::set_bar_color(ColorId color)
 void
 TimeBar::set_secondary_bar_color(ColorId color)
 {
-  secondary_bar_color = color;
+  if (secondary_bar_color != color)
+    {
+      secondary_bar_color = color;
+      dirty = true;
+    }
 }
 
 
@@ -143,6 +164,7 @@ void
 TimeBar::set_text_color(Gdk::Color color)
 {
   bar_text_color = color;
+  dirty = true;
 }
 
 
@@ -155,9 +177,62 @@ TimeBar::set_rotation(int r)
 
 
 //! Updates the screen.
+/*!
+ *  The bar is only redrawn if its text or colors changed, or if the
+ *  progress changed by at least one pixel.
+ */
 void TimeBar::update()
 {
-  queue_draw();
+  int bar_width, sbar_width;
+  get_bar_widths(get_bar_length(), bar_width, sbar_width);
+
+  if (dirty || bar_width != drawn_bar_width || sbar_width != drawn_sbar_width)
+    {
+      queue_draw();
+    }
+}
+
+
+//! Returns the length in pixels of a full bar.
+int
+TimeBar::get_bar_length() const
+{
+  Gtk::Allocation allocation = get_allocation();
+
+#ifdef HAVE_GTK3
+  const int border_size = 1;
+  int win_w = allocation.get_width() - 2; // FIXME:
+#else
+  const int border_size = 2;
+  int win_w = allocation.get_width();
+#endif
+  int win_h = allocation.get_height();
+
+  int win_lw = (rotation == 0 || rotation == 180) ? win_w : win_h;
+
+#ifdef HAVE_GTK3
+  return win_lw - 2 * border_size - 1;
+#else
+  return win_lw - 2 * border_size;
+#endif
+}
+
+
+//! Computes the width in pixels of the primary and secondary bar.
+void
+TimeBar::get_bar_widths(int bar_length, int &bar_width, int &sbar_width) const
+{
+  bar_width = 0;
+  if (bar_max_value > 0)
+    {
+      bar_width = (bar_value * bar_length) / bar_max_value;
+    }
+
+  sbar_width = 0;
+  if (secondary_bar_max_value > 0)
+    {
+      sbar_width = (secondary_bar_value * bar_length) / secondary_bar_max_value;
+    }
 }
 
 
@@ -311,19 +386,13 @@ TimeBar::on_expose_event(GdkEventExpose *e)
                          e->area.width -2*border_size,
                          e->area.height -2*border_size);
 
-  // Bar
-  int bar_width = 0;
-  if (bar_max_value > 0)
-    {
-      bar_width = (bar_value * (win_lw - 2 * border_size)) / bar_max_value;
-    }
+  // Bar and secondary bar
+  int bar_width, sbar_width;
+  get_bar_widths(win_lw - 2 * border_size, bar_width, sbar_width);
 
-  // Secondary bar
-  int sbar_width = 0;
-  if (secondary_bar_max_value >  0)
-    {
-      sbar_width = (secondary_bar_value * (win_lw - 2 * border_size)) / secondary_bar_max_value;
-    }
+  dirty = false;
+  drawn_bar_width = bar_width;
+  drawn_sbar_width = sbar_width;
 
   int bar_height = win_lh - 2 * border_size;
 
@@ -610,19 +679,13 @@ TimeBar::on_draw(const Cairo::RefPtr<Cairo::Context> &cr)
   // cr->rectangle(border_size, border_size, win_w - 2*border_size, win_h - 2*border_size);
   // cr->fill();
 
-  // Bar
-  int bar_width = 0;
-  if (bar_max_value > 0)
-    {
-      bar_width = (bar_value * (win_lw - 2 * border_size - 1)) / bar_max_value;
-    }
+  // Bar and secondary bar
+  int bar_width, sbar_width;
+  get_bar_widths(win_lw - 2 * border_size - 1, bar_width, sbar_width);
 
-  // Secondary bar
-  int sbar_width = 0;
-  if (secondary_bar_max_value >  0)
-    {
-      sbar_width = (secondary_bar_value * (win_lw - 2 * border_size - 1)) / secondary_bar_max_value;
-    }
+  dirty = false;
+  drawn_bar_width = bar_width;
+  drawn_sbar_width = sbar_width;
 
   int bar_height = win_lh - 2 * border_size - 1;
 
@@ -63,6 +63,8 @@ private:
                 int winw, int winh);
 #endif
   void set_text_color(Gdk::Color color);
+  int get_bar_length() const;
+  void get_bar_widths(int bar_length, int &bar_width, int &sbar_width) const;
 
 protected:
 #ifdef HAVE_GTK3
@@ -117,6 +119,15 @@ private:
 
   //! Bar rotation (clockwise degrees)
   int rotation;
+
+  //! Whether the text, colors or alignment changed since the last draw.
+  bool dirty;
+
+  //! Width in pixels of the bar at the last draw.
+  int drawn_bar_width;
+
+  //! Width in pixels of the secondary bar at the last draw.
+  int drawn_sbar_width;
 };
 
 
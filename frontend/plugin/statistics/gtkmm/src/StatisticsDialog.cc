@@ -519,33 +519,27 @@ StatisticsDialog::display_week_statistics()
   std::tm const *time_loc = std::localtime(&t);
 
   int offset = (time_loc->tm_wday - Locale::get_week_start() + 7) % 7;
-  int64_t total_week = 0;
-  for (int i = 0; i < 7; i++)
-    {
-      std::memset(&timeinfo, 0, sizeof(timeinfo));
-      timeinfo.tm_mday = d - offset + i;
-      timeinfo.tm_mon = m;
-      timeinfo.tm_year = y - 1900;
-      t = std::mktime(&timeinfo);
-      time_loc = std::localtime(&t);
-
-      int idx, next, prev;
-      statistics->get_day_index_by_date(time_loc->tm_year + 1900,
-                                        time_loc->tm_mon + 1,
-                                        time_loc->tm_mday, idx, next, prev);
-
-      if (idx >= 0)
-        {
-          IStatistics::DailyStats *stats = statistics->get_day(idx);
-          if (stats != NULL)
-            {
-              total_week += stats->misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME];
-            }
-
-          update_usage_real_time |= (idx == 0);
-        }
-    }
 
+  std::memset(&timeinfo, 0, sizeof(timeinfo));
+  timeinfo.tm_mday = d - offset;
+  timeinfo.tm_mon = m;
+  timeinfo.tm_year = y - 1900;
+  t = std::mktime(&timeinfo);
+  std::tm first = *std::localtime(&t);
+
+  timeinfo.tm_mday += 6;
+  timeinfo.tm_isdst = -1;
+  t = std::mktime(&timeinfo);
+  std::tm last = *std::localtime(&t);
+
+  IStatistics::DailyStats totals;
+  bool today = false;
+  statistics->get_stats_by_date_range(first.tm_year + 1900, first.tm_mon + 1, first.tm_mday,
+                                      last.tm_year + 1900, last.tm_mon + 1, last.tm_mday,
+                                      totals, today);
+  update_usage_real_time |= today;
+
+  int64_t total_week = totals.misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME];
   weekly_usage_time_label->set_text(total_week > 0 ? Text::time_to_string(total_week) : "");
 }
 
@@ -576,23 +570,12 @@ StatisticsDialog::display_month_statistics() {
       max_mday = 31;
     }
 
-  int64_t total_month = 0;
-  for (guint i = 1; i <= max_mday; i++)
-    {
-      int idx, next, prev;
-      statistics->get_day_index_by_date(y, m + 1, i, idx, next, prev);
-      if (idx >= 0)
-        {
-          IStatistics::DailyStats *stats = statistics->get_day(idx);
-          if (stats != NULL)
-            {
-              total_month += stats->misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME];
-            }
-
-          update_usage_real_time |= (idx == 0);
-        }
-    }
+  IStatistics::DailyStats totals;
+  bool today = false;
+  statistics->get_stats_by_date_range(y, m + 1, 1, y, m + 1, max_mday, totals, today);
+  update_usage_real_time |= today;
 
+  int64_t total_month = totals.misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME];
   monthly_usage_time_label->set_text(total_month > 0 ? Text::time_to_string(total_month) : "");
 }
 
@@ -76,7 +76,8 @@ GUI::GUI(int argc, char **argv)  :
   response(NULL),
   break_window_destroy(false),
   prelude_window_destroy(false),
-  active_break_id(BREAK_ID_NONE)
+  active_break_id(BREAK_ID_NONE),
+  timer_id(0)
 {
   TRACE_ENTER("GUI:GUI");
 
@@ -116,8 +117,9 @@ gboolean
 GUI::static_on_timer(gpointer data)
 {
   GUI *gui = (GUI*) data;
+  gui->timer_id = 0;
   gui->on_timer();
-  return true;
+  return false;
 }
 
 
@@ -153,7 +155,7 @@ GUI::main()
   const char *env = getenv("WORKRAVE_TEST");
   if (env == NULL)
     {
-      g_timeout_add(1000, static_on_timer, this);
+      schedule_timer();
     }
 
   g_main_loop_run(main_loop);
@@ -204,9 +206,29 @@ GUI::on_timer()
 
   collect_garbage();
 
+  schedule_timer();
   return true;
 }
 
+
+//! Schedules the next heartbeat.
+void
+GUI::schedule_timer()
+{
+  int delay = core->get_heartbeat_delay();
+
+  if (delay > 1000 && !core->are_timers_settled())
+    {
+      delay = 1000;
+    }
+
+  if (timer_id != 0)
+    {
+      g_source_remove(timer_id);
+    }
+  timer_id = g_timeout_add(delay, static_on_timer, this);
+}
+
 #ifdef NDEBUG
 static void my_log_handler(const gchar *log_domain, GLogLevelFlags log_level,
                            const gchar *message, gpointer user_data)
@@ -300,6 +322,16 @@ GUI::core_event_operation_mode_changed(const OperationMode m)
   (void) m;
 }
 
+
+void
+GUI::core_event_wakeup()
+{
+  if (timer_id != 0)
+    {
+      on_timer();
+    }
+}
+
 //! Returns a break window for the specified break.
 IBreakWindow *
 GUI::new_break_window(BreakId break_id, bool user_initiated)
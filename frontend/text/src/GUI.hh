@@ -69,6 +69,7 @@ public:
   //
   void core_event_notify(CoreEvent event);
   void core_event_operation_mode_changed(const OperationMode m);
+  void core_event_wakeup();
 
   SoundPlayer *get_sound_player() const;
 
@@ -78,6 +79,7 @@ public:
 
 private:
   bool on_timer();
+  void schedule_timer();
   void init_gui();
   void init_debug();
   void init_nls();
@@ -128,6 +130,9 @@ private:
   //! Current active break.
   BreakId active_break_id;
 
+  //! Source ID of the heartbeat timer.
+  guint timer_id;
+
   //! The number of command line arguments.
   int argc;
 
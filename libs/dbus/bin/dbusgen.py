@@ -251,6 +251,17 @@ class InterfaceNode(NodeBase):
     def symbol(self):
         return self.csymbol
 
+    def methods_by_length(self):
+        """Returns (length, methods) pairs of the methods grouped by name length.
+
+        The generated stubs switch on the length of the method name, so that
+        at most a few names are compared per call.
+        """
+        groups = {}
+        for m in self.methods:
+            groups.setdefault(len(m.name), []).append(m)
+        return sorted(groups.items())
+
 class MethodNode(NodeBase):
     def __init__(self, interface_node):
         NodeBase.__init__(self)
@@ -47,7 +47,7 @@ namespace workrave
       virtual ~DBusBindingGio();
 
       virtual const char *get_interface_introspect() = 0;
-      virtual void call(const std::string &method, void *object, GDBusMethodInvocation *invocation, const std::string &sender, GVariant *inargs) = 0;
+      virtual void call(const char *method, void *object, GDBusMethodInvocation *invocation, const char *sender, GVariant *inargs) = 0;
 
     protected:
       IDBus::Ptr dbus;
@@ -134,6 +134,13 @@ DBusGio::update_object_registration(InterfaceData &data)
   if (data.registration_id != 0)
     {
       g_dbus_connection_unregister_object(connection, data.registration_id);
+      data.registration_id = 0;
+    }
+
+  if (data.introspection_data != nullptr)
+    {
+      g_dbus_node_info_unref(data.introspection_data);
+      data.introspection_data = nullptr;
     }
 
   string introspection_xml = get_introspect(data.object_path, data.interface_name);
@@ -152,7 +159,7 @@ DBusGio::update_object_registration(InterfaceData &data)
                                                            data.object_path.c_str(),
                                                            data.introspection_data->interfaces[0],
                                                            &interface_vtable,
-                                                           this, nullptr, nullptr);
+                                                           &data, nullptr, nullptr);
 
   TRACE_EXIT();
 }
@@ -186,6 +193,7 @@ DBusGio::connect(const std::string &object_path, const std::string &interface_na
   interface_data.object_path = object_path;
   interface_data.interface_name = interface_name;
   interface_data.object = object;
+  interface_data.binding = binding;
 
   if (object_data.registered)
     {
@@ -242,26 +250,6 @@ DBusGio::find_binding(const std::string &interface_name) const
 }
 
 
-void *
-DBusGio::find_object(const std::string &path, const std::string &interface_name) const
-{
-  void *object = nullptr;
-
-  ObjectCIter object_it = objects.find(path);
-  if (object_it != objects.end())
-    {
-      InterfaceCIter interface_it = object_it->second.interfaces.find(interface_name);
-
-      if (interface_it != object_it->second.interfaces.end())
-        {
-          object = interface_it->second.object;
-        }
-    }
-
-  return object;
-}
-
-
 bool
 DBusGio::is_running(const std::string &name) const
 {
@@ -423,10 +411,8 @@ DBusGio::on_method_call(GDBusConnection       *connection,
 
   try
     {
-      DBusGio *self = (DBusGio *) user_data;
-
-      void *object = self->find_object(object_path, interface_name);
-      if (object == nullptr)
+      InterfaceData *data = (InterfaceData *) user_data;
+      if (data->object == nullptr || data->binding == nullptr)
         {
           throw DBusRemoteException()
             << message_info("No such object")
@@ -435,17 +421,7 @@ DBusGio::on_method_call(GDBusConnection       *connection,
             << interface_info(interface_name);
         }
 
-      DBusBindingGio *binding = dynamic_cast<DBusBindingGio*>(self->find_binding(interface_name));
-      if (binding == nullptr)
-        {
-          throw DBusRemoteException()
-            << message_info("No such interface")
-            << error_code_info(DBUS_ERROR_FAILED)
-            << object_info(object_path)
-            << interface_info(interface_name);
-        }
-
-      binding->call(method_name, object, invocation, sender, parameters);
+      data->binding->call(method_name, data->object, invocation, sender, parameters);
     }
   catch (DBusRemoteException &e)
     {
@@ -72,15 +72,21 @@ namespace workrave
       typedef Services::iterator ServicesIter;
       typedef Services::const_iterator ServicesCIter;
 
+      //! Registration of an interface on an object path.
+      /*!
+       *  The registration is passed as user data to GDBus, so that incoming
+       *  calls are dispatched without looking up the object and binding.
+       */
       struct InterfaceData
       {
-        InterfaceData() : introspection_data(NULL), registration_id(0), object(NULL) {}
+        InterfaceData() : introspection_data(NULL), registration_id(0), object(NULL), binding(NULL) {}
 
         std::string object_path;
         std::string interface_name;
         GDBusNodeInfo *introspection_data;
         guint registration_id;
         void *object;
+        DBusBindingGio *binding;
       };
 
       typedef std::map<std::string, InterfaceData> Interfaces;
@@ -110,7 +116,6 @@ namespace workrave
       typedef Watched::iterator WatchIter;
       typedef Watched::const_iterator WatchCIter;
 
-      void *find_object(const std::string &path, const std::string &interface_name) const;
       void send() const;
 
       std::string get_introspect(const std::string &path, const std::string &interface_name);